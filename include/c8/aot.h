@@ -0,0 +1,60 @@
+#ifndef C8_AOT_H
+#define C8_AOT_H
+
+#include "c8/cpu.h"
+#include "c8/keyboard.h"
+
+#include <stdint.h>
+
+/*
+ * A ROM translated to C by c8-aot. `translated` is a bitmap over the 4 KiB
+ * address space with a bit set for every address `run` has a label for.
+ * `run` executes at most `count` instructions starting at the current PC and
+ * returns how many it executed; it returns early whenever control reaches
+ * an address without a translation.
+ */
+typedef struct c8_aot_program {
+    const char *name;
+    const uint8_t *rom;
+    uint16_t size;
+    const uint8_t *translated;
+    uint32_t (*run)(C8Cpu *cpu, uint32_t count);
+} C8AotProgram;
+
+/*
+ * Attaches a translated program. Fails unless the program's ROM image
+ * matches the memory the CPU runs. Select it with C8_CPU_ENGINE_AOT.
+ */
+int c8_cpu_set_aot_program(C8Cpu *cpu, const C8AotProgram *program);
+
+/* Runtime used by generated code */
+uint8_t *c8_aot_registers(C8Cpu *cpu);
+uint16_t *c8_aot_index(C8Cpu *cpu);
+uint16_t *c8_aot_pc(C8Cpu *cpu);
+uint16_t *c8_aot_instruction(C8Cpu *cpu);
+uint8_t *c8_aot_delay_timer(C8Cpu *cpu);
+uint8_t *c8_aot_sound_timer(C8Cpu *cpu);
+C8Keyboard *c8_aot_keyboard(C8Cpu *cpu);
+
+/*
+ * Instructions with side effects outside the registers. These expect the
+ * registers, PC and the current instruction to be stored back into the CPU
+ * and return a result for c8_aot_advance.
+ */
+int c8_aot_cls(C8Cpu *cpu);
+int c8_aot_ret(C8Cpu *cpu);
+int c8_aot_call(C8Cpu *cpu, uint16_t nnn);
+int c8_aot_rnd(C8Cpu *cpu, uint8_t x, uint8_t kk);
+int c8_aot_drw(C8Cpu *cpu, uint8_t x, uint8_t y, uint8_t n);
+int c8_aot_ld_reg_key(C8Cpu *cpu, uint8_t x);
+int c8_aot_ld_mem_bcd(C8Cpu *cpu, uint8_t x);
+int c8_aot_ld_mem_reg(C8Cpu *cpu, uint8_t x);
+int c8_aot_ld_reg_mem(C8Cpu *cpu, uint8_t x);
+void c8_aot_advance(C8Cpu *cpu, int ret);
+
+/* Generated code must return after a helper when either of these is true */
+bool c8_aot_stopped(C8Cpu *cpu);
+/* True once a write has hit translated code */
+bool c8_aot_code_modified(C8Cpu *cpu);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef C8_CALLGRAPH_H
+#define C8_CALLGRAPH_H
+
+#include "c8/cpu.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Instructions between samples, prime so that loops don't alias with it */
+#define C8_CALLGRAPH_DEFAULT_PERIOD 997
+
+typedef struct c8_callgraph C8CallGraph;
+
+/*
+ * A sampling profiler over subroutines. CALL records the entry address of
+ * each frame on a shadow of the CPU stack, and every `period` instructions
+ * the stack is sampled and charged with the instructions run since the
+ * last sample. c8_cpu_run splits its budget at the sample points, so any
+ * engine keeps running at full speed in between.
+ *
+ * Frames entered before the call graph was attached, or whose return
+ * address was replaced by a state load, show up as unknown.
+ */
+C8CallGraph *c8_callgraph_new(uint32_t period);
+C8CallGraph *c8_callgraph_free(C8CallGraph *callgraph);
+/* Attaches the call graph to the CPU, or detaches it with NULL */
+void c8_cpu_set_callgraph(C8Cpu *cpu, C8CallGraph *callgraph);
+
+uint64_t c8_callgraph_samples(C8CallGraph *callgraph);
+/*
+ * Writes one "main;sub_0x2a4;sub_0x31c count" line per distinct stack, the
+ * folded format flame graph tools read. Counts are instructions.
+ */
+int c8_callgraph_save_folded(C8CallGraph *callgraph, const char *path);
+/* Prints inclusive and exclusive instructions per subroutine */
+void c8_callgraph_print(C8CallGraph *callgraph, FILE *file);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef C8_COVERAGE_H
+#define C8_COVERAGE_H
+
+#include "c8/cpu.h"
+
+#include <stdint.h>
+
+#define C8_COVERAGE_SIZE (1 << 14)
+
+/*
+ * Edge coverage for fuzzing: every executed instruction increments the
+ * byte of `map`, C8_COVERAGE_SIZE bytes long, that its PC-to-next-PC
+ * transition hashes to, wrapping like AFL's counters. The caller owns the
+ * map and clears it between runs.
+ *
+ * While a map is attached, c8_cpu_run executes through a separate counting
+ * loop over the switch engine's handlers, whatever engine is selected;
+ * without one, no engine pays anything for it. An active debugger,
+ * profile or trace attached as well is fed by the same loop.
+ */
+void c8_cpu_set_coverage(C8Cpu *cpu, uint8_t *map);
+
+#endif
@@ -1,19 +1,130 @@
 #ifndef C8_CPU_H
 #define C8_CPU_H
 
+#include "c8/c8.h"
+
 #include <stdbool.h>
+#include <stdint.h>
 
 #define C8_CPU_HZ 500
+/* Instructions per timer frame */
+#define C8_CPU_FRAME_CYCLES (C8_CPU_HZ / C8_TIMERS_HZ)
 
 typedef struct c8_cpu C8Cpu;
 typedef struct c8_memory C8Memory;
 typedef struct c8_keyboard C8Keyboard;
 
+typedef enum c8_cpu_engine {
+    /* Fetch and decode every instruction through a switch */
+    C8_CPU_ENGINE_SWITCH = 0,
+    /* Dispatch predecoded instructions with threaded code */
+    C8_CPU_ENGINE_THREADED,
+    /* Translate basic blocks to native code, x86-64 hosts only */
+    C8_CPU_ENGINE_JIT,
+    /* Run a program translated ahead of time by c8-aot, see c8/aot.h */
+    C8_CPU_ENGINE_AOT
+} C8CpuEngine;
+
+/* Why c8_cpu_run returned */
+typedef enum c8_cpu_stop {
+    /* All requested cycles were executed */
+    C8_CPU_STOP_BUDGET = 0,
+    /* The last instruction changed the display */
+    C8_CPU_STOP_DRAW,
+    /*
+     * Fx0A is waiting for a key to be released, PC stays on it. Until one
+     * is, c8_cpu_run counts one cycle per call without entering the engine.
+     */
+    C8_CPU_STOP_KEY_WAIT,
+    /* Bad instruction, stack error or a fetch out of program memory */
+    C8_CPU_STOP_FAULT,
+    /* Paused by the debugger, see c8/debugger.h */
+    C8_CPU_STOP_BREAK,
+    /*
+     * PC is on a jump to itself. The cycles were counted without running
+     * it, which a debugger, profile, call graph, trace or coverage map
+     * prevents.
+     */
+    C8_CPU_STOP_HALT
+} C8CpuStop;
+
+/*
+ * Frontend hooks. The core never touches audio or video devices itself:
+ * `sound` is called on every sound timer tick while the timer is active and
+ * `display` after each instruction that changed the display.
+ */
+typedef struct c8_cpu_callbacks {
+    void (*sound)(void *userdata);
+    void (*display)(void *userdata);
+    void *userdata;
+} C8CpuCallbacks;
+
 C8Cpu *c8_cpu_new(C8Memory *memory, C8Keyboard *keyboard);
 C8Cpu *c8_cpu_free(C8Cpu *cpu);
+/*
+ * Returns an independent copy of the machine in O(registers): RAM and the
+ * display are shared copy-on-write (see c8_memory_fork), the keyboard state
+ * is copied into the fork and everything is allocated from a pool shared
+ * with the parent. The fork runs the switch engine and has no callbacks.
+ * A machine and its forks must stay on one thread.
+ */
+C8Cpu *c8_cpu_fork(C8Cpu *cpu);
+/* The memory and keyboard the CPU runs with, forks have their own */
+C8Memory *c8_cpu_memory(C8Cpu *cpu);
+C8Keyboard *c8_cpu_keyboard(C8Cpu *cpu);
+void c8_cpu_set_callbacks(C8Cpu *cpu, const C8CpuCallbacks *callbacks);
+int c8_cpu_set_engine(C8Cpu *cpu, C8CpuEngine engine);
+/*
+ * Reseeds the CPU's own random generator behind Cxkk. A new CPU is seeded
+ * with 0, so runs are reproducible unless the frontend picks a seed.
+ */
+void c8_cpu_seed(C8Cpu *cpu, uint64_t seed);
+/*
+ * Clears the registers, timers, instruction count and keyboard edges and
+ * puts PC at the program, as after c8_cpu_new. The memory, engine,
+ * attachments, random generator and held keys stay; see c8_memory_reset
+ * for the rest of a restart.
+ */
+void c8_cpu_reset(C8Cpu *cpu);
 void c8_cpu_execute_instruction(C8Cpu *cpu);
+/*
+ * Executes up to max_cycles instructions, one cycle each, stopping early
+ * after an instruction that needs the frontend's attention.
+ */
+C8CpuStop c8_cpu_run(C8Cpu *cpu, uint32_t max_cycles);
+/*
+ * Runs one timer frame: up to `cycles` instructions, continuing past draws
+ * but ending early on a key wait or fault, then ticks both timers and
+ * clears the keyboard's edges, which a debugger pause skips. Returns
+ * the stop that ended the frame. Frontends sharing it get identical frame
+ * timing, which movie replay relies on.
+ */
+C8CpuStop c8_cpu_run_frame(C8Cpu *cpu, uint32_t cycles);
+/*
+ * Whether the CPU is parked: waiting in Fx0A with both timers stopped and
+ * nothing watching it. Until a key is released, frames only add one to
+ * the instruction count, so a frontend may sleep until a key event rather
+ * than run them; a movie recorded meanwhile still replays exactly.
+ */
+bool c8_cpu_parked(C8Cpu *cpu);
+/*
+ * Fast-forwards through a wait: up to `frames` frames of `cycles`
+ * instructions, with the keyboard as it is, exactly as c8_cpu_run_frame
+ * would run them, as long as the CPU only jumps, skips, loads registers
+ * and reads DT. A jump to itself is left to c8_cpu_run to report as
+ * C8_CPU_STOP_HALT. Returns the frames run, 0 when the CPU isn't waiting.
+ *
+ * Once such a loop repeats, every frame until DT stops or reaches a value
+ * the loop compares against is skipped at once, so callers feeding input
+ * between frames pass the frames left until their next event. Does nothing
+ * with a debugger attached or anything else watching, as for
+ * C8_CPU_STOP_HALT.
+ */
+uint32_t c8_cpu_skip_idle(C8Cpu *cpu, uint32_t cycles, uint32_t frames);
+/* Instructions executed since the CPU was created */
+uint64_t c8_cpu_cycles(C8Cpu *cpu);
+uint16_t c8_cpu_pc(C8Cpu *cpu);
 
-bool c8_display_updated(C8Cpu *cpu);
 void c8_delay_timer_tick(C8Cpu *cpu);
 void c8_sound_timer_tick(C8Cpu *cpu);
 
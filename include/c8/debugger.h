@@ -0,0 +1,91 @@
+#ifndef C8_DEBUGGER_H
+#define C8_DEBUGGER_H
+
+#include "c8/cpu.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define C8_DEBUGGER_MAX_WATCHES 16
+
+/* Access kinds a memory watchpoint stops on */
+#define C8_DEBUGGER_READ 0x1
+#define C8_DEBUGGER_WRITE 0x2
+
+typedef struct c8_debugger C8Debugger;
+
+typedef enum c8_debugger_register {
+    /* V0 to VF are 0 to 15 */
+    C8_DEBUGGER_I = 16,
+    C8_DEBUGGER_DT,
+    C8_DEBUGGER_ST,
+    C8_DEBUGGER_SP,
+    C8_DEBUGGER_PC,
+    C8_DEBUGGER_REGISTER_NUM
+} C8DebuggerRegister;
+
+/* Why the debugger last paused */
+typedef enum c8_debugger_event {
+    C8_DEBUGGER_EVENT_NONE = 0,
+    /* c8_debugger_pause */
+    C8_DEBUGGER_EVENT_PAUSE,
+    /* PC reached a breakpoint, the instruction there hasn't run */
+    C8_DEBUGGER_EVENT_BREAKPOINT,
+    /* The last instruction accessed a watched address */
+    C8_DEBUGGER_EVENT_MEMORY,
+    /* The last instruction changed a watched register */
+    C8_DEBUGGER_EVENT_REGISTER,
+    /* The requested instructions or frames have run */
+    C8_DEBUGGER_EVENT_STEP,
+    C8_DEBUGGER_EVENT_FRAME
+} C8DebuggerEvent;
+
+/*
+ * Breakpoints, watchpoints and stepping. While paused, c8_cpu_run executes
+ * nothing and returns C8_CPU_STOP_BREAK, and c8_cpu_run_frame returns it
+ * without ticking the timers.
+ *
+ * Only while something is armed (a breakpoint, a watchpoint or a step) or
+ * the CPU is paused does c8_cpu_run execute through a separate checking
+ * loop over the switch engine's handlers; otherwise the selected engine
+ * runs untouched. A profile, trace or coverage map attached at the same
+ * time is fed by the same loop.
+ */
+C8Debugger *c8_debugger_new(void);
+C8Debugger *c8_debugger_free(C8Debugger *debugger);
+/* Attaches the debugger to the CPU, or detaches it with NULL */
+void c8_cpu_set_debugger(C8Cpu *cpu, C8Debugger *debugger);
+
+void c8_debugger_set_breakpoint(C8Debugger *debugger, uint16_t addr,
+                                bool enabled);
+bool c8_debugger_breakpoint(C8Debugger *debugger, uint16_t addr);
+/*
+ * Stops after an instruction that reads or writes, as `access` says, a byte
+ * of [addr, addr + len). Returns the watchpoint's id, or -1 when all
+ * C8_DEBUGGER_MAX_WATCHES are in use or it would watch nothing.
+ */
+int c8_debugger_watch_memory(C8Debugger *debugger, uint16_t addr,
+                             uint16_t len, unsigned access);
+void c8_debugger_unwatch_memory(C8Debugger *debugger, int id);
+/* Stops after an instruction that changes the register */
+void c8_debugger_watch_register(C8Debugger *debugger, C8DebuggerRegister reg,
+                                bool enabled);
+
+void c8_debugger_pause(C8Debugger *debugger);
+/* Resumes, running the instruction at a breakpoint it is paused on */
+void c8_debugger_continue(C8Debugger *debugger);
+/* Resumes for `count` instructions, stopping earlier on a breakpoint */
+void c8_debugger_step(C8Debugger *debugger, uint32_t count);
+/* Resumes until `count` more c8_cpu_run_frame frames have ended */
+void c8_debugger_run_frames(C8Debugger *debugger, uint32_t count);
+
+bool c8_debugger_paused(C8Debugger *debugger);
+/*
+ * The event behind the last pause, with the address or register it was
+ * about in `detail` when not NULL.
+ */
+C8DebuggerEvent c8_debugger_event(C8Debugger *debugger, uint16_t *detail);
+
+uint16_t c8_debugger_register(C8Cpu *cpu, C8DebuggerRegister reg);
+
+#endif
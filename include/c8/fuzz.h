@@ -0,0 +1,51 @@
+#ifndef C8_FUZZ_H
+#define C8_FUZZ_H
+
+#include "c8/coverage.h"
+#include "c8/cpu.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Timer frames one input runs for */
+#define C8_FUZZ_DEFAULT_FRAMES 60
+
+/* C8FuzzEvent.key bit for a release, a press otherwise */
+#define C8_FUZZ_RELEASE 0x80
+
+typedef struct c8_fuzz C8Fuzz;
+
+/*
+ * Fuzz inputs are a key schedule followed by the program:
+ *
+ *   byte 0         number of events n
+ *   2n bytes       events, C8FuzzEvent each
+ *   the rest       the program, cut at the end of RAM
+ *
+ * A truncated schedule takes as many events as there are bytes for, so
+ * every byte string is a valid input.
+ */
+typedef struct c8_fuzz_event {
+    /* Frames after the previous event */
+    uint8_t delay;
+    /* The key in the low nibble, C8_FUZZ_RELEASE for a release */
+    uint8_t key;
+} C8FuzzEvent;
+
+/*
+ * One machine reset and rerun for every input, without allocating. Edge
+ * coverage goes to `map`, C8_COVERAGE_SIZE bytes the caller clears between
+ * runs, or to a map of the harness's own when NULL.
+ */
+C8Fuzz *c8_fuzz_new(uint32_t frames, uint8_t *map);
+C8Fuzz *c8_fuzz_free(C8Fuzz *fuzz);
+uint8_t *c8_fuzz_coverage(C8Fuzz *fuzz);
+
+/*
+ * Runs the input from a fresh machine for the configured frames. Returns
+ * C8_CPU_STOP_FAULT when the program faulted, C8_CPU_STOP_KEY_WAIT when it
+ * waits for a key after the last event, C8_CPU_STOP_BUDGET otherwise.
+ */
+C8CpuStop c8_fuzz_run(C8Fuzz *fuzz, const uint8_t *data, size_t size);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef C8_IMAGE_H
+#define C8_IMAGE_H
+
+#include "c8/memory.h"
+
+#include <stdint.h>
+
+typedef struct c8_image C8Image;
+typedef struct c8_image_registry C8ImageRegistry;
+
+/*
+ * A program loaded once for any number of machines: the initial RAM pages
+ * and the threaded engine's decode table, both built up front and never
+ * written again. Memories created from an image reference its pages until
+ * they write to one, and a threaded engine on such a memory dispatches from
+ * the shared table until the program modifies itself. Images are reference
+ * counted and can be shared between threads.
+ */
+C8Image *c8_image_new(const void *program, uint16_t size);
+C8Image *c8_image_retain(C8Image *image);
+void c8_image_release(C8Image *image);
+
+const uint8_t *c8_image_program(C8Image *image, uint16_t *size);
+/* c8_memory_new for the image's program, without copying it */
+C8Memory *c8_image_memory_new(C8Image *image);
+
+/*
+ * Images keyed by program contents, so every machine running the same ROM
+ * ends up on one image however it was loaded. A registry is used from one
+ * thread; the images it hands out can go anywhere.
+ */
+C8ImageRegistry *c8_image_registry_new(void);
+C8ImageRegistry *c8_image_registry_free(C8ImageRegistry *registry);
+/*
+ * Returns the registry's image of the program, creating it the first time.
+ * The registry holds a reference until it is freed.
+ */
+C8Image *c8_image_registry_get(C8ImageRegistry *registry, const void *program,
+                               uint16_t size);
+/* Distinct programs in the registry */
+uint32_t c8_image_registry_count(C8ImageRegistry *registry);
+
+#endif
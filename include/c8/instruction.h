@@ -1,6 +1,7 @@
 #ifndef C8_INSTRUCTION_H
 #define C8_INSTRUCTION_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define C8_INSTRUCTION_SIZE 2
@@ -30,4 +31,11 @@ static inline uint16_t c8_instruction_get_nnn(uint16_t instruction)
     return instruction & 0xfff;
 }
 
+/*
+ * Writes the instruction in Cowgod's mnemonics, such as "DRW V1, V2, 5",
+ * or "DW 0x5121" for anything that doesn't decode. Returns the length the
+ * text has, like snprintf.
+ */
+int c8_instruction_disassemble(uint16_t instruction, char *text, size_t size);
+
 #endif
@@ -2,6 +2,7 @@
 #define C8_KEYBOARD_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef enum c8_key {
     C8_KEY_0 = 0,
@@ -29,6 +30,21 @@ C8Keyboard *c8_keyboard_new(void);
 void c8_keyboard_press_key(C8Keyboard *keyboard, C8Key key);
 void c8_keyboard_release_key(C8Keyboard *keyboard, C8Key key);
 bool c8_keyboard_is_key_pressed(C8Keyboard *keyboard, C8Key key);
+/* The lowest key held down, C8_KEY_NUM when there is none */
 C8Key c8_keyboard_wait_for_press(C8Keyboard *keyboard);
+/*
+ * The lowest key released since the edges were last cleared, C8_KEY_NUM
+ * when there is none. Fx0A completes with it: like on the COSMAC VIP, a
+ * key counts once it is let go. c8_cpu_run_frame clears the edges after
+ * each frame, so a release is seen by the frame right after it.
+ */
+C8Key c8_keyboard_wait_for_release(C8Keyboard *keyboard);
+/*
+ * The keys that went down and up since the edges were last cleared, bit n
+ * for key n, to tell a tap within one frame from no input at all.
+ */
+uint16_t c8_keyboard_pressed_edges(C8Keyboard *keyboard);
+uint16_t c8_keyboard_released_edges(C8Keyboard *keyboard);
+void c8_keyboard_clear_edges(C8Keyboard *keyboard);
 
 #endif
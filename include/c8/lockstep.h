@@ -0,0 +1,52 @@
+#ifndef C8_LOCKSTEP_H
+#define C8_LOCKSTEP_H
+
+#include "c8/cpu.h"
+#include "c8/keyboard.h"
+#include "c8/memory.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct c8_lockstep C8Lockstep;
+
+typedef struct c8_lockstep_stats {
+    /* Instructions executed, summed over the lanes */
+    uint64_t instructions;
+    /* Steps that ran every running lane at once, all on the same PC */
+    uint64_t converged;
+    /* Steps that ran the lanes one by one because their PCs differed */
+    uint64_t diverged;
+} C8LockstepStats;
+
+/*
+ * Many machines running the same program, stored as structure of arrays:
+ * each register, timer, stack slot, RAM byte and display row is an array
+ * with one element per lane. While every running lane sits on the same
+ * instruction, a step executes it for all lanes with loops over those
+ * arrays that the compiler turns into vector code. Once the PCs diverge,
+ * lanes are stepped one at a time until they meet again.
+ *
+ * Each lane behaves like a C8Cpu running the switch engine, except that
+ * there are no callbacks and protection mode isn't available.
+ */
+C8Lockstep *c8_lockstep_new(const void *program, uint16_t size,
+                            uint32_t lanes);
+C8Lockstep *c8_lockstep_free(C8Lockstep *lockstep);
+uint32_t c8_lockstep_lanes(C8Lockstep *lockstep);
+
+void c8_lockstep_set_display_edge(C8Lockstep *lockstep, C8DisplayEdge edge);
+void c8_lockstep_seed(C8Lockstep *lockstep, uint32_t lane, uint64_t seed);
+void c8_lockstep_set_key(C8Lockstep *lockstep, uint32_t lane, C8Key key,
+                         bool pressed);
+
+/* c8_cpu_run_frame for every lane */
+void c8_lockstep_run_frame(C8Lockstep *lockstep, uint32_t cycles);
+/* The stop that ended the lane's last frame */
+C8CpuStop c8_lockstep_stop(C8Lockstep *lockstep, uint32_t lane);
+uint64_t c8_lockstep_cycles(C8Lockstep *lockstep, uint32_t lane);
+void c8_lockstep_display_read(C8Lockstep *lockstep, uint32_t lane,
+                              uint8_t *buf);
+void c8_lockstep_stats(C8Lockstep *lockstep, C8LockstepStats *stats);
+
+#endif
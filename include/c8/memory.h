@@ -1,12 +1,62 @@
 #ifndef C8_MEMORY_H
 #define C8_MEMORY_H
 
+#include "c8/c8.h"
+
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
+/* Flat RAM; addresses are masked to 12 bits on every access */
+#define C8_MEMORY_SIZE 0x1000
+#define C8_MEMORY_ADDRESS_MASK (C8_MEMORY_SIZE - 1)
+
 typedef struct c8_memory C8Memory;
 
+/* What happens to sprite pixels drawn past the display edge */
+typedef enum c8_display_edge {
+    /* Wrap around to the opposite edge */
+    C8_DISPLAY_EDGE_WRAP = 0,
+    /* Drop them; the sprite origin itself still wraps */
+    C8_DISPLAY_EDGE_CLIP
+} C8DisplayEdge;
+
+/* Display regions changed since the dirty state was last consumed */
+typedef struct c8_display_dirty {
+    /* Bit y is set when row y changed */
+    uint32_t rows;
+    /* Bit n of columns[y] is set when byte n of row y changed */
+    uint8_t columns[C8_DISPLAY_HEIGHT];
+    /* Counts clears and writes that changed at least one pixel */
+    uint64_t generation;
+} C8DisplayDirty;
+
+/* Called after every successful c8_memory_write */
+typedef void (*C8MemoryWriteHook)(void *userdata, uint16_t addr,
+                                  uint16_t len);
+
 C8Memory *c8_memory_new(const void *program, uint16_t size);
+/*
+ * An independent copy that shares RAM and display pages with `memory` until
+ * either one writes to them. The copy has no write hook. Memories forked
+ * from one another allocate from a common pool and must stay on one thread.
+ */
+C8Memory *c8_memory_fork(C8Memory *memory);
+C8Memory *c8_memory_free(C8Memory *memory);
+/*
+ * Puts the memory back in the state c8_memory_new leaves it in with another
+ * program, copying only the bytes that differ. Settings and the write hook,
+ * which sees the changed range, stay.
+ */
+int c8_memory_reset(C8Memory *memory, const void *program, uint16_t size);
+/*
+ * Protection mode is a debugging aid: instead of wrapping, accesses past
+ * 0xfff, writes below the program area and fetches outside it fail with a
+ * diagnostic. Off by default.
+ */
+void c8_memory_set_protected(C8Memory *memory, bool protect);
+void c8_memory_set_write_hook(C8Memory *memory, C8MemoryWriteHook hook,
+                              void *userdata);
 
 int c8_memory_program_read(C8Memory *memory, uint16_t addr, uint16_t *value);
 uint16_t c8_memory_program_begin(void);
@@ -14,10 +64,23 @@ uint16_t c8_memory_program_begin(void);
 int c8_memory_stack_read(C8Memory *memory, uint8_t sp, uint16_t *value);
 int c8_memory_stack_write(C8Memory *memory, uint8_t sp, uint16_t value);
 
-void c8_memory_display_clear(C8Memory *memory);
+void c8_memory_set_display_edge(C8Memory *memory, C8DisplayEdge edge);
+
+/* Fails only when a shared display page can't be copied */
+int c8_memory_display_clear(C8Memory *memory);
 void c8_memory_display_read(C8Memory *memory, uint8_t *buf);
-uint8_t c8_memory_display_write(C8Memory *memory, uint8_t x, uint8_t y,
-                                uint8_t *buf, uint8_t n);
+/* Returns whether a lit pixel was turned off, -1 like clearing */
+int c8_memory_display_write(C8Memory *memory, uint8_t x, uint8_t y,
+                            uint8_t *buf, uint8_t n);
+/*
+ * Copies the dirty state accumulated by clears and writes since the previous
+ * call and resets it. The generation keeps counting; frames with an
+ * unchanged generation are identical. A new memory starts fully dirty.
+ */
+void c8_memory_display_consume_dirty(C8Memory *memory, C8DisplayDirty *dirty);
+uint64_t c8_memory_display_generation(C8Memory *memory);
+/* 64-bit FNV-1a of the bytes c8_memory_display_read returns */
+uint64_t c8_memory_display_hash(C8Memory *memory);
 
 int c8_memory_read(C8Memory *memory, uint16_t addr, void *buf, uint16_t len);
 int c8_memory_write(C8Memory *memory, uint16_t addr, void *buf, uint16_t len);
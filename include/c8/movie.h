@@ -0,0 +1,38 @@
+#ifndef C8_MOVIE_H
+#define C8_MOVIE_H
+
+#include "c8/keyboard.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct c8_movie C8Movie;
+
+/*
+ * A recorded session: the CPU seed, a hash of the ROM and every key press
+ * and release stamped with the instruction count at which it was applied.
+ * Frontends apply input only between c8_cpu_run_frame calls, so replaying
+ * the events at the same counts through the same frame loop reproduces the
+ * run exactly.
+ */
+C8Movie *c8_movie_new(uint64_t seed, const void *rom, size_t size);
+C8Movie *c8_movie_free(C8Movie *movie);
+
+int c8_movie_save(C8Movie *movie, const char *path);
+C8Movie *c8_movie_load(const char *path);
+
+uint64_t c8_movie_seed(C8Movie *movie);
+/* Whether the movie was recorded with this ROM */
+bool c8_movie_matches_rom(C8Movie *movie, const void *rom, size_t size);
+
+int c8_movie_record(C8Movie *movie, uint64_t cycles, C8Key key, bool pressed);
+/*
+ * Applies the events stamped at or before `cycles` that weren't applied
+ * yet. Returns false once every event has been applied.
+ */
+bool c8_movie_play(C8Movie *movie, C8Keyboard *keyboard, uint64_t cycles);
+/* The stamp of the next event to apply, UINT64_MAX after the last */
+uint64_t c8_movie_next(C8Movie *movie);
+
+#endif
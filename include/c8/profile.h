@@ -0,0 +1,40 @@
+#ifndef C8_PROFILE_H
+#define C8_PROFILE_H
+
+#include "c8/cpu.h"
+
+#include <stdint.h>
+
+typedef struct c8_profile C8Profile;
+
+typedef enum c8_profile_format {
+    C8_PROFILE_FORMAT_CSV = 0,
+    C8_PROFILE_FORMAT_JSON,
+    /* Text heat maps of PC, reads and writes plus the top opcodes */
+    C8_PROFILE_FORMAT_HEATMAP
+} C8ProfileFormat;
+
+/*
+ * Execution counters: instructions per opcode class and per PC, RAM bytes
+ * read and written by instructions per address and sprite rows drawn per
+ * display row.
+ *
+ * While a profile is attached, c8_cpu_run executes through a separate
+ * counting loop over the switch engine's handlers, whatever engine is
+ * selected; without one, no engine pays anything for it. An active
+ * debugger, trace or coverage map attached as well is fed by the same
+ * loop. Accesses are
+ * counted when the instruction is executed, including ones that fault.
+ */
+C8Profile *c8_profile_new(void);
+C8Profile *c8_profile_free(C8Profile *profile);
+/* Attaches the profile to the CPU, or detaches it with NULL */
+void c8_cpu_set_profile(C8Cpu *cpu, C8Profile *profile);
+
+uint64_t c8_profile_instructions(C8Profile *profile);
+/* Picks the format from the extension: .csv, .json, heat map otherwise */
+C8ProfileFormat c8_profile_format_for(const char *path);
+int c8_profile_save(C8Profile *profile, const char *path,
+                    C8ProfileFormat format);
+
+#endif
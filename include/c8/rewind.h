@@ -0,0 +1,37 @@
+#ifndef C8_REWIND_H
+#define C8_REWIND_H
+
+#include "c8/cpu.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define C8_REWIND_DEFAULT_BUDGET (8 * 1024 * 1024)
+#define C8_REWIND_DEFAULT_KEYFRAME_INTERVAL 60
+
+typedef struct c8_rewind C8Rewind;
+
+/*
+ * History of machine states, one per recorded frame, kept in a ring buffer
+ * of `budget` bytes. Every `keyframe_interval` frames a full state is
+ * stored; the frames in between only store the XOR against the previous
+ * frame, run-length encoded, which is usually a few dozen bytes. The oldest
+ * keyframe and its deltas are dropped when the buffer fills up.
+ */
+C8Rewind *c8_rewind_new(size_t budget, uint32_t keyframe_interval);
+C8Rewind *c8_rewind_free(C8Rewind *rewind);
+
+/* Records the current state as the newest frame, -1 if it can't fit. */
+int c8_rewind_record(C8Rewind *rewind, C8Cpu *cpu);
+/*
+ * Restores the state `frames` frames before the newest one and forgets
+ * everything recorded after it. Stops at the oldest frame still kept and
+ * returns how many frames it went back, or -1 on failure.
+ */
+long c8_rewind_step_back(C8Rewind *rewind, C8Cpu *cpu, uint32_t frames);
+
+/* Number of recorded frames and the bytes of the buffer they use */
+uint32_t c8_rewind_frames(C8Rewind *rewind);
+size_t c8_rewind_used(C8Rewind *rewind);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef C8_STATE_H
+#define C8_STATE_H
+
+#include "c8/cpu.h"
+
+#include <stddef.h>
+
+/* Bumped whenever the layout of a saved state changes */
+#define C8_STATE_VERSION 2
+
+/*
+ * A saved state is a fixed-size blob holding the registers, timers, random
+ * generator, stack, RAM and framebuffer in host byte order; states only
+ * load on hosts with the same endianness. Engine caches, callbacks and the
+ * keyboard are not part of it.
+ */
+size_t c8_state_size(void);
+
+/* Returns the number of bytes written to buf, or -1 if it is too small. */
+long c8_state_save(C8Cpu *cpu, void *buf, size_t size);
+/*
+ * Fails without touching the machine if the blob isn't a valid state.
+ * Clears the keyboard's edges, so a key let go before loading doesn't
+ * complete an Fx0A in the loaded state.
+ */
+int c8_state_load(C8Cpu *cpu, const void *buf, size_t size);
+
+int c8_state_save_file(C8Cpu *cpu, const char *path);
+int c8_state_load_file(C8Cpu *cpu, const char *path);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef C8_TRACE_H
+#define C8_TRACE_H
+
+#include "c8/cpu.h"
+
+#include <stdint.h>
+
+#define C8_TRACE_DEFAULT_CAPACITY (1 << 16)
+/* C8TraceRecord.reg when the instruction changed no V register */
+#define C8_TRACE_NO_REGISTER 0xff
+
+typedef struct c8_trace C8Trace;
+
+/* One executed instruction, written to trace files as is */
+typedef struct c8_trace_record {
+    /* Instructions the CPU had executed before this one */
+    uint64_t count;
+    uint16_t pc;
+    uint16_t instruction;
+    /* I after the instruction */
+    uint16_t i;
+    /* Lowest V register the instruction changed and its new value */
+    uint8_t reg;
+    uint8_t value;
+} C8TraceRecord;
+
+/*
+ * Trace files are this header followed by records in execution order, in
+ * the byte order of the host that wrote them.
+ */
+typedef struct c8_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} C8TraceHeader;
+
+#define C8_TRACE_MAGIC "C8TRACE"
+#define C8_TRACE_VERSION 1
+
+/*
+ * A ring of the last `capacity` records, rounded up to a power of two.
+ *
+ * While a trace is attached, c8_cpu_run executes through a separate
+ * recording loop over the switch engine's handlers, whatever engine is
+ * selected; without one, no engine pays anything for it. An active
+ * debugger, profile or coverage map attached as well is fed by the same
+ * loop.
+ */
+C8Trace *c8_trace_new(uint32_t capacity);
+/* Stops the writer, if any, after it has written every record */
+C8Trace *c8_trace_free(C8Trace *trace);
+/* Attaches the trace to the CPU, or detaches it with NULL */
+void c8_cpu_set_trace(C8Cpu *cpu, C8Trace *trace);
+
+/*
+ * Streams every record to the file from a writer thread. The ring is then
+ * a lock-free queue between the CPU and the writer, and the CPU waits for
+ * room instead of overwriting records the writer hasn't taken yet.
+ */
+int c8_trace_stream(C8Trace *trace, const char *path);
+/* Writes the records still in the ring, for traces that aren't streamed */
+int c8_trace_save(C8Trace *trace, const char *path);
+
+/* Records appended so far */
+uint64_t c8_trace_records(C8Trace *trace);
+
+#endif
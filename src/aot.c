@@ -0,0 +1,225 @@
+#include "c8/aot.h"
+
+#include "cpu_internal.h"
+
+#include "c8/memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define C8_AOT_ADDRESS_SPACE 0x1000
+
+struct c8_aot {
+    const C8AotProgram *program;
+
+    /* Translated addresses overwritten since the program was attached */
+    bool dirty[C8_AOT_ADDRESS_SPACE];
+    bool modified;
+};
+
+static bool c8_aot_is_translated(const C8AotProgram *program, uint16_t pc)
+{
+    return pc < C8_AOT_ADDRESS_SPACE &&
+           (program->translated[pc / 8] & (1 << (pc % 8))) != 0;
+}
+
+C8Aot *c8_aot_new(const C8AotProgram *program)
+{
+    C8Aot *aot = calloc(1, sizeof(C8Aot));
+
+    if (aot == NULL) {
+        fprintf(stderr, "aot: can't allocate aot\n");
+        return NULL;
+    }
+
+    aot->program = program;
+    return aot;
+}
+
+C8Aot *c8_aot_free(C8Aot *aot)
+{
+    free(aot);
+    return NULL;
+}
+
+void c8_aot_invalidate(C8Aot *aot, uint16_t addr, uint16_t len)
+{
+    /* An instruction starting one byte before addr overlaps the write too */
+    uint16_t begin = addr > 0 ? addr - 1 : 0;
+    uint32_t end = (uint32_t)addr + len;
+
+    for (uint32_t pc = begin; pc < end && pc < C8_AOT_ADDRESS_SPACE; pc++) {
+        if (c8_aot_is_translated(aot->program, pc)) {
+            aot->dirty[pc] = true;
+            aot->modified = true;
+        }
+    }
+}
+
+uint32_t c8_aot_run(C8Cpu *cpu, uint32_t count)
+{
+    C8Aot *aot = cpu->aot;
+    const C8AotProgram *program = aot->program;
+    uint32_t executed = 0;
+
+    while (executed < count) {
+        if (c8_aot_is_translated(program, cpu->pc) && !aot->dirty[cpu->pc]) {
+            /*
+             * Generated code jumps between translations directly, so once
+             * any of them was overwritten it only runs one instruction per
+             * entry and every PC goes through the dirty check above.
+             */
+            uint32_t budget = aot->modified ? 1 : count - executed;
+            uint32_t ran = program->run(cpu, budget);
+
+            if (ran > 0) {
+                executed += ran;
+                if (cpu->stop != C8_CPU_STOP_BUDGET) {
+                    break;
+                }
+                continue;
+            }
+        }
+
+        if (c8_cpu_step(cpu) < 0) {
+            break;
+        }
+        executed++;
+        if (cpu->stop != C8_CPU_STOP_BUDGET) {
+            break;
+        }
+    }
+
+    return executed;
+}
+
+int c8_cpu_set_aot_program(C8Cpu *cpu, const C8AotProgram *program)
+{
+    uint8_t *rom = malloc(program->size);
+
+    if (rom == NULL) {
+        fprintf(stderr, "aot: can't allocate rom\n");
+        return -1;
+    }
+
+    if (c8_memory_read(cpu->memory, c8_memory_program_begin(), rom,
+                       program->size) < 0 ||
+        memcmp(rom, program->rom, program->size) != 0) {
+        fprintf(stderr, "aot: %s doesn't match the loaded program\n",
+                program->name);
+        free(rom);
+        return -1;
+    }
+
+    free(rom);
+    cpu->aot_program = program;
+
+    /* Reattach a running engine to the new program */
+    if (cpu->engine == C8_CPU_ENGINE_AOT) {
+        C8Aot *aot = c8_aot_new(program);
+        if (aot == NULL) {
+            return -1;
+        }
+
+        c8_aot_free(cpu->aot);
+        cpu->aot = aot;
+    }
+
+    return 0;
+}
+
+uint8_t *c8_aot_registers(C8Cpu *cpu)
+{
+    return cpu->v;
+}
+
+uint16_t *c8_aot_index(C8Cpu *cpu)
+{
+    return &cpu->i;
+}
+
+uint16_t *c8_aot_pc(C8Cpu *cpu)
+{
+    return &cpu->pc;
+}
+
+uint16_t *c8_aot_instruction(C8Cpu *cpu)
+{
+    return &cpu->instruction;
+}
+
+uint8_t *c8_aot_delay_timer(C8Cpu *cpu)
+{
+    return &cpu->dt;
+}
+
+uint8_t *c8_aot_sound_timer(C8Cpu *cpu)
+{
+    return &cpu->st;
+}
+
+C8Keyboard *c8_aot_keyboard(C8Cpu *cpu)
+{
+    return cpu->keyboard;
+}
+
+int c8_aot_cls(C8Cpu *cpu)
+{
+    return c8_cpu_op_cls(cpu);
+}
+
+int c8_aot_ret(C8Cpu *cpu)
+{
+    return c8_cpu_op_ret(cpu);
+}
+
+int c8_aot_call(C8Cpu *cpu, uint16_t nnn)
+{
+    return c8_cpu_op_call(cpu, nnn);
+}
+
+int c8_aot_rnd(C8Cpu *cpu, uint8_t x, uint8_t kk)
+{
+    return c8_cpu_op_rnd(cpu, x, kk);
+}
+
+int c8_aot_drw(C8Cpu *cpu, uint8_t x, uint8_t y, uint8_t n)
+{
+    return c8_cpu_op_drw(cpu, x, y, n);
+}
+
+int c8_aot_ld_reg_key(C8Cpu *cpu, uint8_t x)
+{
+    return c8_cpu_op_ld_reg_key(cpu, x);
+}
+
+int c8_aot_ld_mem_bcd(C8Cpu *cpu, uint8_t x)
+{
+    return c8_cpu_op_ld_mem_bcd(cpu, x);
+}
+
+int c8_aot_ld_mem_reg(C8Cpu *cpu, uint8_t x)
+{
+    return c8_cpu_op_ld_mem_reg(cpu, x);
+}
+
+int c8_aot_ld_reg_mem(C8Cpu *cpu, uint8_t x)
+{
+    return c8_cpu_op_ld_reg_mem(cpu, x);
+}
+
+void c8_aot_advance(C8Cpu *cpu, int ret)
+{
+    c8_cpu_advance(cpu, ret);
+}
+
+bool c8_aot_stopped(C8Cpu *cpu)
+{
+    return cpu->stop != C8_CPU_STOP_BUDGET;
+}
+
+bool c8_aot_code_modified(C8Cpu *cpu)
+{
+    return cpu->aot != NULL && cpu->aot->modified;
+}
@@ -0,0 +1,605 @@
+#include "c8/instruction.h"
+#include "c8/memory.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define C8_AOT_ADDRESS_SPACE 0x1000
+#define C8_AOT_NAME_SIZE 64
+
+typedef struct c8_aot_compiler {
+    const uint8_t *rom;
+    uint16_t size;
+    uint16_t begin;
+    bool reachable[C8_AOT_ADDRESS_SPACE];
+    FILE *out;
+} C8AotCompiler;
+
+static bool c8_aot_in_rom(C8AotCompiler *compiler, uint32_t pc)
+{
+    return pc >= compiler->begin &&
+           pc + 1 < (uint32_t)compiler->begin + compiler->size;
+}
+
+static uint16_t c8_aot_fetch(C8AotCompiler *compiler, uint16_t pc)
+{
+    const uint8_t *p = compiler->rom + pc - compiler->begin;
+    return (p[0] << 8) | p[1];
+}
+
+static void c8_aot_push(C8AotCompiler *compiler, uint16_t *worklist,
+                        size_t *n, uint32_t pc)
+{
+    pc &= C8_MEMORY_ADDRESS_MASK;
+
+    if (c8_aot_in_rom(compiler, pc) && !compiler->reachable[pc]) {
+        compiler->reachable[pc] = true;
+        worklist[(*n)++] = pc;
+    }
+}
+
+/*
+ * Marks every address control can reach from the entry point. 00EE targets
+ * are return addresses of reachable calls and Bnnn may land anywhere in
+ * nnn..nnn+255, so both are covered without knowing register values.
+ */
+static void c8_aot_analyze(C8AotCompiler *compiler)
+{
+    static uint16_t worklist[C8_AOT_ADDRESS_SPACE];
+    size_t n = 0;
+
+    c8_aot_push(compiler, worklist, &n, compiler->begin);
+
+    while (n > 0) {
+        uint16_t pc = worklist[--n];
+        uint16_t instruction = c8_aot_fetch(compiler, pc);
+        uint16_t nnn = c8_instruction_get_nnn(instruction);
+        uint16_t next = pc + C8_INSTRUCTION_SIZE;
+
+        switch (instruction >> 12) {
+        case 0x0:
+            if (instruction != 0x00ee) {
+                c8_aot_push(compiler, worklist, &n, next);
+            }
+            break;
+
+        case 0x1:
+            c8_aot_push(compiler, worklist, &n, nnn);
+            break;
+
+        case 0x2:
+            c8_aot_push(compiler, worklist, &n, nnn);
+            c8_aot_push(compiler, worklist, &n, next);
+            break;
+
+        case 0x3:
+        case 0x4:
+        case 0x5:
+        case 0x9:
+        case 0xe:
+            c8_aot_push(compiler, worklist, &n, next);
+            c8_aot_push(compiler, worklist, &n, next + C8_INSTRUCTION_SIZE);
+            break;
+
+        case 0xb:
+            for (uint16_t v0 = 0; v0 <= UINT8_MAX; v0++) {
+                c8_aot_push(compiler, worklist, &n, nnn + v0);
+            }
+            break;
+
+        default:
+            c8_aot_push(compiler, worklist, &n, next);
+            break;
+        }
+    }
+}
+
+static void c8_aot_emit_jump(C8AotCompiler *compiler, uint32_t pc)
+{
+    pc &= C8_MEMORY_ADDRESS_MASK;
+
+    if (compiler->reachable[pc]) {
+        fprintf(compiler->out, "    goto L_%03x;\n", pc);
+    } else {
+        fprintf(compiler->out, "    C8_AOT_EXIT(0x%03x);\n", pc);
+    }
+}
+
+static void c8_aot_emit_skip(C8AotCompiler *compiler, uint16_t pc,
+                             const char *condition)
+{
+    fprintf(compiler->out, "    if (%s) {\n    ", condition);
+    c8_aot_emit_jump(compiler, pc + 2 * C8_INSTRUCTION_SIZE);
+    fprintf(compiler->out, "    }\n");
+    c8_aot_emit_jump(compiler, pc + C8_INSTRUCTION_SIZE);
+}
+
+static void c8_aot_emit_helper(C8AotCompiler *compiler, uint16_t pc,
+                               uint16_t instruction, const char *call)
+{
+    fprintf(compiler->out, "    C8_AOT_HELPER(0x%03x, 0x%04x, %s);\n",
+            pc, instruction, call);
+}
+
+static void c8_aot_emit_bad(C8AotCompiler *compiler, uint16_t pc,
+                            uint16_t instruction)
+{
+    c8_aot_emit_helper(compiler, pc, instruction, "-1");
+}
+
+static void c8_aot_emit_alu(C8AotCompiler *compiler, uint16_t pc,
+                            uint16_t instruction)
+{
+    FILE *out = compiler->out;
+    uint8_t x = c8_instruction_get_x(instruction);
+    uint8_t y = c8_instruction_get_y(instruction);
+
+    switch (instruction & 0x00f) {
+    case 0x0:
+        fprintf(out, "    v[0x%x] = v[0x%x];\n", x, y);
+        break;
+
+    case 0x1:
+        fprintf(out, "    v[0x%x] |= v[0x%x];\n", x, y);
+        break;
+
+    case 0x2:
+        fprintf(out, "    v[0x%x] &= v[0x%x];\n", x, y);
+        break;
+
+    case 0x3:
+        fprintf(out, "    v[0x%x] ^= v[0x%x];\n", x, y);
+        break;
+
+    case 0x4:
+        fprintf(out, "    v[0xf] = v[0x%x] > (UINT8_MAX - v[0x%x]);\n", x, y);
+        fprintf(out, "    v[0x%x] += v[0x%x];\n", x, y);
+        break;
+
+    case 0x5:
+        fprintf(out, "    v[0xf] = v[0x%x] > v[0x%x];\n", x, y);
+        fprintf(out, "    v[0x%x] -= v[0x%x];\n", x, y);
+        break;
+
+    case 0x6:
+        fprintf(out, "    v[0xf] = v[0x%x] & 0x01;\n", x);
+        fprintf(out, "    v[0x%x] >>= 1;\n", x);
+        break;
+
+    case 0x7:
+        fprintf(out, "    v[0xf] = v[0x%x] > v[0x%x];\n", y, x);
+        fprintf(out, "    v[0x%x] -= v[0x%x];\n", y, x);
+        break;
+
+    case 0xe:
+        fprintf(out, "    v[0xf] = v[0x%x] & 0x80;\n", x);
+        fprintf(out, "    v[0x%x] <<= 1;\n", x);
+        break;
+
+    default:
+        c8_aot_emit_bad(compiler, pc, instruction);
+        return;
+    }
+
+    c8_aot_emit_jump(compiler, pc + C8_INSTRUCTION_SIZE);
+}
+
+static void c8_aot_emit_misc(C8AotCompiler *compiler, uint16_t pc,
+                             uint16_t instruction)
+{
+    FILE *out = compiler->out;
+    uint8_t x = c8_instruction_get_x(instruction);
+    char call[64];
+
+    switch (instruction & 0x0ff) {
+    case 0x07:
+        fprintf(out, "    v[0x%x] = *cpu_dt;\n", x);
+        break;
+
+    case 0x0a:
+        snprintf(call, sizeof(call), "c8_aot_ld_reg_key(cpu, 0x%x)", x);
+        c8_aot_emit_helper(compiler, pc, instruction, call);
+        return;
+
+    case 0x15:
+        fprintf(out, "    *cpu_dt = v[0x%x];\n", x);
+        break;
+
+    case 0x18:
+        fprintf(out, "    *cpu_st = v[0x%x];\n", x);
+        break;
+
+    case 0x1e:
+        fprintf(out, "    i += v[0x%x];\n", x);
+        break;
+
+    case 0x29:
+        fprintf(out, "    i = 5 * v[0x%x];\n", x);
+        break;
+
+    case 0x33:
+        snprintf(call, sizeof(call), "c8_aot_ld_mem_bcd(cpu, 0x%x)", x);
+        fprintf(out, "    C8_AOT_HELPER_WRITE(0x%03x, 0x%04x, %s);\n",
+                pc, instruction, call);
+        return;
+
+    case 0x55:
+        snprintf(call, sizeof(call), "c8_aot_ld_mem_reg(cpu, 0x%x)", x);
+        fprintf(out, "    C8_AOT_HELPER_WRITE(0x%03x, 0x%04x, %s);\n",
+                pc, instruction, call);
+        return;
+
+    case 0x65:
+        snprintf(call, sizeof(call), "c8_aot_ld_reg_mem(cpu, 0x%x)", x);
+        c8_aot_emit_helper(compiler, pc, instruction, call);
+        return;
+
+    default:
+        c8_aot_emit_bad(compiler, pc, instruction);
+        return;
+    }
+
+    c8_aot_emit_jump(compiler, pc + C8_INSTRUCTION_SIZE);
+}
+
+/* Mirrors c8_cpu_execute_instruction_internal in cpu.c */
+static void c8_aot_emit_instruction(C8AotCompiler *compiler, uint16_t pc)
+{
+    FILE *out = compiler->out;
+    uint16_t instruction = c8_aot_fetch(compiler, pc);
+    uint8_t x = c8_instruction_get_x(instruction);
+    uint8_t y = c8_instruction_get_y(instruction);
+    uint8_t kk = c8_instruction_get_kk(instruction);
+    uint16_t nnn = c8_instruction_get_nnn(instruction);
+    uint16_t next = pc + C8_INSTRUCTION_SIZE;
+    char buf[96];
+
+    fprintf(out, "L_%03x: /* %04x */\n", pc, instruction);
+    fprintf(out, "    C8_AOT_BEGIN(0x%03x);\n", pc);
+
+    switch (instruction >> 12) {
+    case 0x0:
+        if ((instruction >> 8) != 0) {
+            /* Ignore SYS instruction */
+            c8_aot_emit_jump(compiler, pc);
+        } else if (instruction == 0x00e0) {
+            c8_aot_emit_helper(compiler, pc, instruction, "c8_aot_cls(cpu)");
+        } else if (instruction == 0x00ee) {
+            c8_aot_emit_helper(compiler, pc, instruction, "c8_aot_ret(cpu)");
+        } else {
+            c8_aot_emit_bad(compiler, pc, instruction);
+        }
+        break;
+
+    case 0x1:
+        c8_aot_emit_jump(compiler, nnn);
+        break;
+
+    case 0x2:
+        snprintf(buf, sizeof(buf), "c8_aot_call(cpu, 0x%03x)", nnn);
+        c8_aot_emit_helper(compiler, pc, instruction, buf);
+        break;
+
+    case 0x3:
+        snprintf(buf, sizeof(buf), "v[0x%x] == 0x%02x", x, kk);
+        c8_aot_emit_skip(compiler, pc, buf);
+        break;
+
+    case 0x4:
+        snprintf(buf, sizeof(buf), "v[0x%x] != 0x%02x", x, kk);
+        c8_aot_emit_skip(compiler, pc, buf);
+        break;
+
+    case 0x5:
+        if ((instruction & 0x00f) != 0) {
+            c8_aot_emit_bad(compiler, pc, instruction);
+            break;
+        }
+        snprintf(buf, sizeof(buf), "v[0x%x] == v[0x%x]", x, y);
+        c8_aot_emit_skip(compiler, pc, buf);
+        break;
+
+    case 0x6:
+        fprintf(out, "    v[0x%x] = 0x%02x;\n", x, kk);
+        c8_aot_emit_jump(compiler, next);
+        break;
+
+    case 0x7:
+        fprintf(out, "    v[0x%x] += 0x%02x;\n", x, kk);
+        c8_aot_emit_jump(compiler, next);
+        break;
+
+    case 0x8:
+        c8_aot_emit_alu(compiler, pc, instruction);
+        break;
+
+    case 0x9:
+        snprintf(buf, sizeof(buf), "v[0x%x] != v[0x%x]", x, y);
+        c8_aot_emit_skip(compiler, pc, buf);
+        break;
+
+    case 0xa:
+        fprintf(out, "    i = 0x%03x;\n", nnn);
+        c8_aot_emit_jump(compiler, next);
+        break;
+
+    case 0xb:
+        fprintf(out, "    pc = (v[0x0] + 0x%03x) & 0xfff;\n", nnn);
+        fprintf(out, "    goto dispatch;\n");
+        break;
+
+    case 0xc:
+        snprintf(buf, sizeof(buf), "c8_aot_rnd(cpu, 0x%x, 0x%02x)", x, kk);
+        c8_aot_emit_helper(compiler, pc, instruction, buf);
+        break;
+
+    case 0xd:
+        snprintf(buf, sizeof(buf), "c8_aot_drw(cpu, 0x%x, 0x%x, 0x%x)",
+                 x, y, c8_instruction_get_n(instruction));
+        c8_aot_emit_helper(compiler, pc, instruction, buf);
+        break;
+
+    case 0xe:
+        if (kk == 0x9e) {
+            snprintf(buf, sizeof(buf),
+                     "c8_keyboard_is_key_pressed(keyboard, v[0x%x])", x);
+            c8_aot_emit_skip(compiler, pc, buf);
+        } else if (kk == 0xa1) {
+            snprintf(buf, sizeof(buf),
+                     "!c8_keyboard_is_key_pressed(keyboard, v[0x%x])", x);
+            c8_aot_emit_skip(compiler, pc, buf);
+        } else {
+            c8_aot_emit_bad(compiler, pc, instruction);
+        }
+        break;
+
+    case 0xf:
+        c8_aot_emit_misc(compiler, pc, instruction);
+        break;
+    }
+
+    fprintf(out, "\n");
+}
+
+static void c8_aot_emit_bytes(FILE *out, const uint8_t *bytes, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        fprintf(out, "%s0x%02x,%s", i % 12 == 0 ? "    " : "", bytes[i],
+                (i % 12 == 11 || i + 1 == size) ? "\n" : " ");
+    }
+}
+
+static void c8_aot_emit(C8AotCompiler *compiler, const char *name,
+                        const char *source)
+{
+    FILE *out = compiler->out;
+    uint8_t translated[C8_AOT_ADDRESS_SPACE / 8] = {0};
+
+    for (uint16_t pc = 0; pc < C8_AOT_ADDRESS_SPACE; pc++) {
+        if (compiler->reachable[pc]) {
+            translated[pc / 8] |= 1 << (pc % 8);
+        }
+    }
+
+    fprintf(out,
+        "/* Generated by c8-aot from %s, do not edit */\n"
+        "\n"
+        "#include \"c8/aot.h\"\n"
+        "\n"
+        "#include <stdint.h>\n"
+        "#include <string.h>\n"
+        "\n", source);
+
+    fprintf(out, "static const uint8_t c8_aot_%s_rom[] = {\n", name);
+    c8_aot_emit_bytes(out, compiler->rom, compiler->size);
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const uint8_t c8_aot_%s_translated[] = {\n", name);
+    c8_aot_emit_bytes(out, translated, sizeof(translated));
+    fprintf(out, "};\n\n");
+
+    fprintf(out,
+        "/*\n"
+        " * Registers live in locals so the compiler can keep them in host\n"
+        " * registers; they are synced with the CPU around runtime calls.\n"
+        " */\n"
+        "#define C8_AOT_SYNC() \\\n"
+        "    (memcpy(cpu_v, v, sizeof(v)), *cpu_i = i)\n"
+        "#define C8_AOT_LOAD() \\\n"
+        "    (memcpy(v, cpu_v, sizeof(v)), i = *cpu_i)\n"
+        "#define C8_AOT_EXIT(addr) \\\n"
+        "    do { C8_AOT_SYNC(); *cpu_pc = (addr); return executed; } "
+        "while (0)\n"
+        "#define C8_AOT_BEGIN(addr) \\\n"
+        "    do { if (executed == count) C8_AOT_EXIT(addr); executed++; } "
+        "while (0)\n"
+        "#define C8_AOT_CALL(addr, instruction, call) \\\n"
+        "    do { \\\n"
+        "        C8_AOT_SYNC(); \\\n"
+        "        *cpu_pc = (addr); \\\n"
+        "        *cpu_instruction = (instruction); \\\n"
+        "        c8_aot_advance(cpu, (call)); \\\n"
+        "        C8_AOT_LOAD(); \\\n"
+        "        pc = *cpu_pc; \\\n"
+        "    } while (0)\n"
+        "#define C8_AOT_HELPER(addr, instruction, call) \\\n"
+        "    do { \\\n"
+        "        C8_AOT_CALL(addr, instruction, call); \\\n"
+        "        if (c8_aot_stopped(cpu)) { \\\n"
+        "            return executed; \\\n"
+        "        } \\\n"
+        "        goto dispatch; \\\n"
+        "    } while (0)\n"
+        "#define C8_AOT_HELPER_WRITE(addr, instruction, call) \\\n"
+        "    do { \\\n"
+        "        C8_AOT_CALL(addr, instruction, call); \\\n"
+        "        if (c8_aot_stopped(cpu) || c8_aot_code_modified(cpu)) { \\\n"
+        "            return executed; \\\n"
+        "        } \\\n"
+        "        goto dispatch; \\\n"
+        "    } while (0)\n"
+        "\n");
+
+    fprintf(out,
+        "static uint32_t c8_aot_%s_run(C8Cpu *cpu, uint32_t count)\n"
+        "{\n"
+        "    uint8_t *cpu_v = c8_aot_registers(cpu);\n"
+        "    uint16_t *cpu_i = c8_aot_index(cpu);\n"
+        "    uint16_t *cpu_pc = c8_aot_pc(cpu);\n"
+        "    uint16_t *cpu_instruction = c8_aot_instruction(cpu);\n"
+        "    uint8_t *cpu_dt = c8_aot_delay_timer(cpu);\n"
+        "    uint8_t *cpu_st = c8_aot_sound_timer(cpu);\n"
+        "    C8Keyboard *keyboard = c8_aot_keyboard(cpu);\n"
+        "    uint32_t executed = 0;\n"
+        "    uint8_t v[16];\n"
+        "    uint16_t i;\n"
+        "    uint16_t pc = *cpu_pc;\n"
+        "\n"
+        "    (void)cpu_instruction;\n"
+        "    (void)cpu_dt;\n"
+        "    (void)cpu_st;\n"
+        "    (void)keyboard;\n"
+        "\n"
+        "    C8_AOT_LOAD();\n"
+        "\n"
+        "dispatch:\n"
+        "    switch (pc) {\n", name);
+
+    for (uint16_t pc = 0; pc < C8_AOT_ADDRESS_SPACE; pc++) {
+        if (compiler->reachable[pc]) {
+            fprintf(out, "    case 0x%03x: goto L_%03x;\n", pc, pc);
+        }
+    }
+
+    fprintf(out,
+        "    default: C8_AOT_EXIT(pc);\n"
+        "    }\n"
+        "\n");
+
+    for (uint16_t pc = 0; pc < C8_AOT_ADDRESS_SPACE; pc++) {
+        if (compiler->reachable[pc]) {
+            c8_aot_emit_instruction(compiler, pc);
+        }
+    }
+
+    fprintf(out, "}\n\n");
+
+    fprintf(out,
+        "const C8AotProgram c8_aot_%s = {\n"
+        "    .name = \"%s\",\n"
+        "    .rom = c8_aot_%s_rom,\n"
+        "    .size = sizeof(c8_aot_%s_rom),\n"
+        "    .translated = c8_aot_%s_translated,\n"
+        "    .run = c8_aot_%s_run\n"
+        "};\n", name, name, name, name, name, name);
+}
+
+static void c8_aot_default_name(const char *path, char *name)
+{
+    const char *base = strrchr(path, '/');
+    base = base != NULL ? base + 1 : path;
+
+    size_t n = 0;
+    if (isdigit((unsigned char)*base)) {
+        name[n++] = '_';
+    }
+
+    for (; *base != '\0' && *base != '.' && n + 1 < C8_AOT_NAME_SIZE; base++) {
+        name[n++] = isalnum((unsigned char)*base) ? *base : '_';
+    }
+
+    if (n == 0) {
+        name[n++] = '_';
+    }
+    name[n] = '\0';
+}
+
+static bool c8_aot_valid_name(const char *name)
+{
+    if (*name == '\0' || isdigit((unsigned char)*name)) {
+        return false;
+    }
+
+    for (; *name != '\0'; name++) {
+        if (!isalnum((unsigned char)*name) && *name != '_') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *name = NULL;
+    const char *paths[2] = {NULL, NULL};
+    size_t npaths = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        } else if (npaths < 2) {
+            paths[npaths++] = argv[i];
+        } else {
+            npaths++;
+        }
+    }
+
+    if (npaths != 2) {
+        printf("usage: %s [-n name] [program] [output.c]\n", argv[0]);
+        return 1;
+    }
+
+    char default_name[C8_AOT_NAME_SIZE];
+    if (name == NULL) {
+        c8_aot_default_name(paths[0], default_name);
+        name = default_name;
+    }
+
+    if (!c8_aot_valid_name(name)) {
+        fprintf(stderr, "aot: %s is not a valid C identifier\n", name);
+        return 1;
+    }
+
+    size_t size = 0;
+    uint8_t *rom = c8_rom_new(paths[0], &size);
+    if (rom == NULL) {
+        return 1;
+    }
+
+    /* Reject the same ROMs c8_memory_new does */
+    C8Memory *memory = c8_memory_new(rom, size);
+    if (memory == NULL) {
+        free(rom);
+        return 1;
+    }
+    c8_memory_free(memory);
+
+    static C8AotCompiler compiler;
+    compiler.rom = rom;
+    compiler.size = size;
+    compiler.begin = c8_memory_program_begin();
+
+    compiler.out = fopen(paths[1], "w");
+    if (compiler.out == NULL) {
+        fprintf(stderr, "aot: can't open %s\n", paths[1]);
+        free(rom);
+        return 1;
+    }
+
+    c8_aot_analyze(&compiler);
+    c8_aot_emit(&compiler, name, paths[0]);
+
+    int ret = 0;
+    if (fclose(compiler.out) != 0) {
+        fprintf(stderr, "aot: can't write %s\n", paths[1]);
+        ret = 1;
+    }
+
+    free(rom);
+    return ret;
+}
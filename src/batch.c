@@ -0,0 +1,743 @@
+#include "c8/c8.h"
+#include "c8/cpu.h"
+#include "c8/image.h"
+#include "c8/keyboard.h"
+#include "c8/memory.h"
+#include "c8/movie.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define C8_BATCH_DEFAULT_FRAMES 600
+#define C8_BATCH_MAX_WORKERS 256
+#define C8_BATCH_LINE_SIZE 4096
+/* Most frames between attempts to skip a wait that isn't there */
+#define C8_BATCH_IDLE_BACKOFF 64
+
+typedef enum c8_batch_status {
+    C8_BATCH_PENDING = 0,
+    /* Reached its frame or instruction limit */
+    C8_BATCH_DONE,
+    /* Stuck on a jump to itself or a key wait no input will satisfy */
+    C8_BATCH_HANG,
+    C8_BATCH_FAULT,
+    /* The ROM or movie couldn't be loaded */
+    C8_BATCH_ERROR
+} C8BatchStatus;
+
+static const char *const c8_batch_status_names[] = {
+    [C8_BATCH_PENDING] = "pending",
+    [C8_BATCH_DONE] = "done",
+    [C8_BATCH_HANG] = "hang",
+    [C8_BATCH_FAULT] = "fault",
+    [C8_BATCH_ERROR] = "error"
+};
+
+typedef struct c8_batch_job {
+    char *program;
+    /* Owned by the registry, NULL if the ROM couldn't be loaded */
+    C8Image *image;
+    char *movie;
+    uint64_t seed;
+    uint64_t frames;
+    uint64_t instructions;
+
+    /* Results */
+    C8BatchStatus status;
+    uint64_t frames_run;
+    uint64_t executed;
+    uint64_t hash;
+    double elapsed;
+} C8BatchJob;
+
+typedef struct c8_batch_options {
+    const char *jobs;
+    const char *results;
+    uint64_t frames;
+    uint64_t instructions;
+    uint64_t seed;
+    uint64_t workers;
+    C8CpuEngine engine;
+    bool clip;
+    bool protect;
+    bool stats;
+} C8BatchOptions;
+
+/* Jobs [begin, end) that no worker has taken yet */
+typedef struct c8_batch_queue {
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+} C8BatchQueue;
+
+typedef struct c8_batch {
+    const C8BatchOptions *options;
+    C8BatchJob *jobs;
+    size_t count;
+    C8ImageRegistry *images;
+    C8BatchQueue queues[C8_BATCH_MAX_WORKERS];
+    size_t workers;
+} C8Batch;
+
+typedef struct c8_batch_worker {
+    C8Batch *batch;
+    size_t id;
+    pthread_t thread;
+} C8BatchWorker;
+
+static void c8_batch_usage(const char *name)
+{
+    printf("usage: %s [-f frames | -n instructions] [-e engine] [-j threads] "
+           "[-c] [-p] [-r seed] [-o results] [-s] jobs\n", name);
+    printf("engines: switch, threaded, jit\n");
+    printf("job lines: program [frames=N] [instructions=N] [seed=N] "
+           "[movie=path]\n");
+}
+
+static int c8_batch_parse_engine(const char *arg, C8CpuEngine *engine)
+{
+    if (arg == NULL) {
+        return -1;
+    }
+
+    if (strcmp(arg, "switch") == 0) {
+        *engine = C8_CPU_ENGINE_SWITCH;
+    } else if (strcmp(arg, "threaded") == 0) {
+        *engine = C8_CPU_ENGINE_THREADED;
+    } else if (strcmp(arg, "jit") == 0) {
+        *engine = C8_CPU_ENGINE_JIT;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int c8_batch_parse_count(const char *arg, uint64_t *value)
+{
+    char *end = NULL;
+
+    if (arg == NULL) {
+        return -1;
+    }
+
+    *value = strtoull(arg, &end, 10);
+    if (*end != '\0' || end == arg) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int c8_batch_parse_options(int argc, char *argv[],
+                                  C8BatchOptions *options)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0) {
+            if (c8_batch_parse_count(argv[++i], &options->frames) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-n") == 0) {
+            if (c8_batch_parse_count(argv[++i], &options->instructions) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-e") == 0) {
+            if (c8_batch_parse_engine(argv[++i], &options->engine) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-j") == 0) {
+            if (c8_batch_parse_count(argv[++i], &options->workers) < 0 ||
+                options->workers == 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-c") == 0) {
+            options->clip = true;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            options->protect = true;
+        } else if (strcmp(argv[i], "-r") == 0) {
+            if (c8_batch_parse_count(argv[++i], &options->seed) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-o") == 0) {
+            if ((options->results = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-s") == 0) {
+            options->stats = true;
+        } else if (argv[i][0] == '-' || options->jobs != NULL) {
+            return -1;
+        } else {
+            options->jobs = argv[i];
+        }
+    }
+
+    if (options->jobs == NULL) {
+        return -1;
+    }
+
+    if (options->frames == 0 && options->instructions == 0) {
+        options->frames = C8_BATCH_DEFAULT_FRAMES;
+    }
+
+    if (options->workers == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        options->workers = online > 0 ? online : 1;
+    }
+    if (options->workers > C8_BATCH_MAX_WORKERS) {
+        options->workers = C8_BATCH_MAX_WORKERS;
+    }
+
+    return 0;
+}
+
+static double c8_batch_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void c8_batch_free_jobs(C8BatchJob *jobs, size_t count)
+{
+    for (size_t k = 0; k < count; k++) {
+        free(jobs[k].program);
+        free(jobs[k].movie);
+    }
+
+    free(jobs);
+}
+
+static int c8_batch_parse_job(const C8BatchOptions *options, char *line,
+                              C8BatchJob *job)
+{
+    char *save = NULL;
+    char *token = strtok_r(line, " \t\r\n", &save);
+
+    job->seed = options->seed;
+    job->frames = options->frames;
+    job->instructions = options->instructions;
+
+    job->program = strdup(token);
+    if (job->program == NULL) {
+        return -1;
+    }
+
+    while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+        char *value = strchr(token, '=');
+        if (value == NULL) {
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (strcmp(token, "frames") == 0) {
+            if (c8_batch_parse_count(value, &job->frames) < 0) {
+                return -1;
+            }
+        } else if (strcmp(token, "instructions") == 0) {
+            if (c8_batch_parse_count(value, &job->instructions) < 0) {
+                return -1;
+            }
+        } else if (strcmp(token, "seed") == 0) {
+            if (c8_batch_parse_count(value, &job->seed) < 0) {
+                return -1;
+            }
+        } else if (strcmp(token, "movie") == 0) {
+            free(job->movie);
+            if ((job->movie = strdup(value)) == NULL) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+    }
+
+    if (job->frames == 0 && job->instructions == 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* One job per line, blank lines and lines starting with # are skipped */
+static C8BatchJob *c8_batch_load_jobs(const C8BatchOptions *options,
+                                      size_t *count)
+{
+    FILE *file = fopen(options->jobs, "r");
+    if (file == NULL) {
+        fprintf(stderr, "batch: can't open %s\n", options->jobs);
+        return NULL;
+    }
+
+    C8BatchJob *jobs = NULL;
+    size_t capacity = 0;
+    size_t line_number = 0;
+    char line[C8_BATCH_LINE_SIZE];
+
+    *count = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+
+        if (strchr(line, '\n') == NULL && !feof(file)) {
+            fprintf(stderr, "batch: %s:%zu: line too long\n", options->jobs,
+                    line_number);
+            goto fail;
+        }
+
+        size_t skip = strspn(line, " \t\r\n");
+        if (line[skip] == '\0' || line[skip] == '#') {
+            continue;
+        }
+
+        if (*count == capacity) {
+            size_t grown = capacity > 0 ? capacity * 2 : 64;
+            C8BatchJob *resized = realloc(jobs, grown * sizeof(C8BatchJob));
+            if (resized == NULL) {
+                fprintf(stderr, "batch: can't allocate jobs\n");
+                goto fail;
+            }
+
+            jobs = resized;
+            capacity = grown;
+        }
+
+        C8BatchJob *job = &jobs[(*count)++];
+        memset(job, 0, sizeof(C8BatchJob));
+        if (c8_batch_parse_job(options, line, job) < 0) {
+            fprintf(stderr, "batch: %s:%zu: bad job\n", options->jobs,
+                    line_number);
+            goto fail;
+        }
+    }
+
+    if (ferror(file)) {
+        fprintf(stderr, "batch: can't read from %s\n", options->jobs);
+        goto fail;
+    }
+    if (*count == 0) {
+        fprintf(stderr, "batch: no jobs in %s\n", options->jobs);
+        goto fail;
+    }
+
+    fclose(file);
+    return jobs;
+
+fail:
+    c8_batch_free_jobs(jobs, *count);
+    fclose(file);
+    return NULL;
+}
+
+/*
+ * CHIP-8 has no interrupts, so a jump to itself is never left, and once the
+ * input has run out a key wait is never satisfied.
+ */
+static bool c8_batch_hung(C8Cpu *cpu, C8Memory *memory, C8CpuStop stop,
+                          bool input)
+{
+    if (stop == C8_CPU_STOP_KEY_WAIT) {
+        return !input;
+    }
+
+    uint16_t pc = c8_cpu_pc(cpu);
+    uint16_t instruction = 0;
+    if (c8_memory_program_read(memory, pc, &instruction) < 0) {
+        return false;
+    }
+
+    return instruction == (0x1000 | pc);
+}
+
+/*
+ * Whole frames left before a limit or the movie's next event, which
+ * c8_cpu_skip_idle may run in one go.
+ */
+static uint32_t c8_batch_idle_frames(C8Cpu *cpu, C8Movie *movie,
+                                     const C8BatchJob *job)
+{
+    uint64_t cycles = c8_cpu_cycles(cpu);
+    uint64_t frames = UINT32_MAX;
+
+    if (job->frames > 0 && job->frames - job->frames_run < frames) {
+        frames = job->frames - job->frames_run;
+    }
+    if (job->instructions > 0 &&
+        (job->instructions - cycles) / C8_CPU_FRAME_CYCLES < frames) {
+        frames = (job->instructions - cycles) / C8_CPU_FRAME_CYCLES;
+    }
+
+    if (movie != NULL) {
+        /* The event is applied before the first frame starting at or past it */
+        uint64_t next = c8_movie_next(movie);
+        uint64_t before = next > cycles
+                              ? (next - cycles - 1) / C8_CPU_FRAME_CYCLES + 1
+                              : 0;
+        if (before < frames) {
+            frames = before;
+        }
+    }
+
+    return frames;
+}
+
+static C8BatchStatus c8_batch_loop(C8Cpu *cpu, C8Memory *memory,
+                                   C8Keyboard *keyboard, C8Movie *movie,
+                                   C8BatchJob *job)
+{
+    /* Frames until the next idle check, which backs off while it fails */
+    uint32_t idle_wait = 0;
+    uint32_t idle_backoff = 1;
+
+    for (;;) {
+        uint64_t cycles = c8_cpu_cycles(cpu);
+
+        if (job->frames > 0 && job->frames_run >= job->frames) {
+            return C8_BATCH_DONE;
+        }
+        if (job->instructions > 0 && cycles >= job->instructions) {
+            return C8_BATCH_DONE;
+        }
+
+        uint32_t slice = C8_CPU_FRAME_CYCLES;
+        if (job->instructions > 0 && job->instructions - cycles < slice) {
+            slice = job->instructions - cycles;
+        }
+
+        bool input = movie != NULL && c8_movie_play(movie, keyboard, cycles);
+
+        C8CpuStop stop = c8_cpu_run_frame(cpu, slice);
+        job->frames_run++;
+
+        if (stop == C8_CPU_STOP_FAULT) {
+            return C8_BATCH_FAULT;
+        }
+        if (c8_batch_hung(cpu, memory, stop, input)) {
+            return C8_BATCH_HANG;
+        }
+
+        if (idle_wait > 0) {
+            idle_wait--;
+            continue;
+        }
+
+        uint32_t idle = c8_cpu_skip_idle(
+            cpu, C8_CPU_FRAME_CYCLES, c8_batch_idle_frames(cpu, movie, job));
+        job->frames_run += idle;
+
+        if (idle > 0) {
+            idle_backoff = 1;
+        } else {
+            idle_wait = idle_backoff;
+            if (idle_backoff < C8_BATCH_IDLE_BACKOFF) {
+                idle_backoff *= 2;
+            }
+        }
+    }
+}
+
+/* The CPU owns the memory and keyboard it returns */
+static C8Cpu *c8_batch_new_cpu(const C8BatchOptions *options,
+                               const C8BatchJob *job, C8Memory **memory,
+                               C8Keyboard **keyboard, C8Movie **movie)
+{
+    if (job->image == NULL) {
+        return NULL;
+    }
+
+    if (job->movie != NULL) {
+        uint16_t size = 0;
+        const uint8_t *rom = c8_image_program(job->image, &size);
+
+        *movie = c8_movie_load(job->movie);
+        if (*movie == NULL) {
+            return NULL;
+        }
+        if (!c8_movie_matches_rom(*movie, rom, size)) {
+            fprintf(stderr, "batch: %s was recorded with another ROM\n",
+                    job->movie);
+            *movie = c8_movie_free(*movie);
+            return NULL;
+        }
+    }
+
+    *memory = c8_image_memory_new(job->image);
+    if (*memory == NULL) {
+        *movie = c8_movie_free(*movie);
+        return NULL;
+    }
+
+    c8_memory_set_protected(*memory, options->protect);
+    c8_memory_set_display_edge(*memory, options->clip ? C8_DISPLAY_EDGE_CLIP
+                                                      : C8_DISPLAY_EDGE_WRAP);
+
+    *keyboard = c8_keyboard_new();
+    if (*keyboard == NULL) {
+        *movie = c8_movie_free(*movie);
+        c8_memory_free(*memory);
+        return NULL;
+    }
+
+    C8Cpu *cpu = c8_cpu_new(*memory, *keyboard);
+    if (cpu == NULL) {
+        *movie = c8_movie_free(*movie);
+        free(*keyboard);
+        c8_memory_free(*memory);
+        return NULL;
+    }
+
+    c8_cpu_seed(cpu, *movie != NULL ? c8_movie_seed(*movie) : job->seed);
+
+    if (c8_cpu_set_engine(cpu, options->engine) < 0) {
+        fprintf(stderr, "batch: can't select engine\n");
+        *movie = c8_movie_free(*movie);
+        return c8_cpu_free(cpu);
+    }
+
+    return cpu;
+}
+
+static void c8_batch_run_job(const C8BatchOptions *options, C8BatchJob *job)
+{
+    C8Memory *memory = NULL;
+    C8Keyboard *keyboard = NULL;
+    C8Movie *movie = NULL;
+    double begin = c8_batch_now();
+
+    C8Cpu *cpu = c8_batch_new_cpu(options, job, &memory, &keyboard, &movie);
+    if (cpu == NULL) {
+        job->status = C8_BATCH_ERROR;
+        return;
+    }
+
+    job->status = c8_batch_loop(cpu, memory, keyboard, movie, job);
+    job->elapsed = c8_batch_now() - begin;
+    job->executed = c8_cpu_cycles(cpu);
+    job->hash = c8_memory_display_hash(memory);
+
+    c8_movie_free(movie);
+    c8_cpu_free(cpu);
+}
+
+/*
+ * Loads every job's ROM up front, once per distinct program: jobs running
+ * the same ROM share its pages and decode table instead of each loading and
+ * decoding a copy.
+ */
+static void c8_batch_load_images(C8ImageRegistry *registry, C8BatchJob *jobs,
+                                 size_t count)
+{
+    for (size_t k = 0; k < count; k++) {
+        size_t size = 0;
+        uint8_t *rom = c8_rom_new(jobs[k].program, &size);
+        if (rom == NULL) {
+            continue;
+        }
+
+        jobs[k].image = c8_image_registry_get(registry, rom, size);
+        free(rom);
+    }
+}
+
+static bool c8_batch_take(C8Batch *batch, size_t id, size_t *job)
+{
+    C8BatchQueue *own = &batch->queues[id];
+
+    pthread_mutex_lock(&own->lock);
+    if (own->begin < own->end) {
+        *job = own->begin++;
+        pthread_mutex_unlock(&own->lock);
+        return true;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    /* Steal the back half of the next worker's queue that has jobs left */
+    for (size_t k = 1; k < batch->workers; k++) {
+        C8BatchQueue *victim = &batch->queues[(id + k) % batch->workers];
+
+        pthread_mutex_lock(&victim->lock);
+        size_t left = victim->end - victim->begin;
+        if (left == 0) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+
+        size_t end = victim->end;
+        size_t split = end - (left + 1) / 2;
+        victim->end = split;
+        pthread_mutex_unlock(&victim->lock);
+
+        pthread_mutex_lock(&own->lock);
+        own->begin = split + 1;
+        own->end = end;
+        pthread_mutex_unlock(&own->lock);
+
+        *job = split;
+        return true;
+    }
+
+    return false;
+}
+
+static void *c8_batch_work(void *userdata)
+{
+    C8BatchWorker *worker = userdata;
+    C8Batch *batch = worker->batch;
+    size_t job = 0;
+
+    while (c8_batch_take(batch, worker->id, &job)) {
+        c8_batch_run_job(batch->options, &batch->jobs[job]);
+    }
+
+    return NULL;
+}
+
+/*
+ * Jobs start out split into one contiguous range per worker. A worker that
+ * runs out steals half of another's remaining range, so a few long jobs
+ * don't leave the other cores idle.
+ */
+static int c8_batch_run(C8Batch *batch)
+{
+    C8BatchWorker workers[C8_BATCH_MAX_WORKERS];
+    size_t started = 0;
+
+    for (size_t k = 0; k < batch->workers; k++) {
+        C8BatchQueue *queue = &batch->queues[k];
+
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->begin = batch->count * k / batch->workers;
+        queue->end = batch->count * (k + 1) / batch->workers;
+    }
+
+    /* The calling thread works too, as worker 0 */
+    for (size_t k = 1; k < batch->workers; k++) {
+        workers[k].batch = batch;
+        workers[k].id = k;
+        if (pthread_create(&workers[k].thread, NULL, c8_batch_work,
+                           &workers[k]) != 0) {
+            fprintf(stderr, "batch: can't start worker %zu\n", k);
+            break;
+        }
+        started = k;
+    }
+
+    workers[0].batch = batch;
+    workers[0].id = 0;
+    c8_batch_work(&workers[0]);
+
+    for (size_t k = 1; k <= started; k++) {
+        pthread_join(workers[k].thread, NULL);
+    }
+
+    for (size_t k = 0; k < batch->workers; k++) {
+        pthread_mutex_destroy(&batch->queues[k].lock);
+    }
+
+    return 0;
+}
+
+static int c8_batch_write_results(const C8BatchOptions *options,
+                                  const C8BatchJob *jobs, size_t count)
+{
+    FILE *file = stdout;
+
+    if (options->results != NULL) {
+        file = fopen(options->results, "w");
+        if (file == NULL) {
+            fprintf(stderr, "batch: can't open %s\n", options->results);
+            return -1;
+        }
+    }
+
+    fprintf(file, "# program\tstatus\tframes\tinstructions\thash\tseconds\n");
+    for (size_t k = 0; k < count; k++) {
+        const C8BatchJob *job = &jobs[k];
+
+        fprintf(file, "%s\t%s\t%llu\t%llu\t%016llx\t%.6f\n", job->program,
+                c8_batch_status_names[job->status],
+                (unsigned long long)job->frames_run,
+                (unsigned long long)job->executed,
+                (unsigned long long)job->hash, job->elapsed);
+    }
+
+    int failed = ferror(file);
+    if (file != stdout && fclose(file) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        fprintf(stderr, "batch: can't write results\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void c8_batch_print_stats(const C8Batch *batch, double elapsed)
+{
+    uint64_t statuses[C8_BATCH_ERROR + 1] = {};
+    uint64_t executed = 0;
+
+    for (size_t k = 0; k < batch->count; k++) {
+        statuses[batch->jobs[k].status]++;
+        executed += batch->jobs[k].executed;
+    }
+
+    fprintf(stderr, "jobs: %zu on %zu threads\n", batch->count,
+            batch->workers);
+    fprintf(stderr, "programs: %u\n", c8_image_registry_count(batch->images));
+    for (int status = C8_BATCH_DONE; status <= C8_BATCH_ERROR; status++) {
+        fprintf(stderr, "%s: %llu\n", c8_batch_status_names[status],
+                (unsigned long long)statuses[status]);
+    }
+    fprintf(stderr, "instructions: %llu\n", (unsigned long long)executed);
+    fprintf(stderr, "elapsed: %.6f s\n", elapsed);
+    fprintf(stderr, "mips: %.2f\n",
+            elapsed > 0 ? executed / elapsed / 1e6 : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+    C8BatchOptions options = {};
+
+    if (c8_batch_parse_options(argc, argv, &options) < 0) {
+        c8_batch_usage(argv[0]);
+        return 1;
+    }
+
+    static C8Batch batch;
+    batch.options = &options;
+    batch.jobs = c8_batch_load_jobs(&options, &batch.count);
+    if (batch.jobs == NULL) {
+        return 1;
+    }
+
+    batch.images = c8_image_registry_new();
+    if (batch.images == NULL) {
+        c8_batch_free_jobs(batch.jobs, batch.count);
+        return 1;
+    }
+    c8_batch_load_images(batch.images, batch.jobs, batch.count);
+
+    batch.workers = options.workers;
+    if (batch.workers > batch.count) {
+        batch.workers = batch.count > 0 ? batch.count : 1;
+    }
+
+    double begin = c8_batch_now();
+    c8_batch_run(&batch);
+    double elapsed = c8_batch_now() - begin;
+
+    if (options.stats) {
+        c8_batch_print_stats(&batch, elapsed);
+    }
+
+    int status = c8_batch_write_results(&options, batch.jobs, batch.count);
+    c8_batch_free_jobs(batch.jobs, batch.count);
+    c8_image_registry_free(batch.images);
+    return status < 0 ? 1 : 0;
+}
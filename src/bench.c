@@ -0,0 +1,948 @@
+#include "c8/c8.h"
+#include "c8/cpu.h"
+#include "c8/image.h"
+#include "c8/instruction.h"
+#include "c8/keyboard.h"
+#include "c8/lockstep.h"
+#include "c8/memory.h"
+#include "c8/state.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define C8_BENCH_DEFAULT_SAMPLES 20
+#define C8_BENCH_DEFAULT_SAMPLE_MS 10
+#define C8_BENCH_DEFAULT_THRESHOLD 10
+#define C8_BENCH_MAX_SAMPLES 1000
+#define C8_BENCH_NAME_SIZE 64
+#define C8_BENCH_LINE_SIZE 512
+/* Lanes in the lockstep benchmarks, enough to fill the vector loops */
+#define C8_BENCH_LANES 256
+
+/*
+ * Opcode benchmarks fill the program area with one instruction between a
+ * short prelude and a jump back, so nearly every cycle executes it:
+ *
+ *   0x200  6101  V1 = 1, so 5010 doesn't skip and E19E finds no key
+ *   0x202  6000  V0 = 0
+ *   0x204  AC00  I = the data area
+ *   ...    the instruction, repeated
+ *   0xbfc  1206  jump back to the first copy
+ *   0xbfe  00EE  the subroutine the CALL benchmark calls
+ *   0xc00  data, 0xaa up to the end of memory
+ */
+#define C8_BENCH_BODY_BEGIN 0x206
+#define C8_BENCH_BODY_END 0xbfc
+#define C8_BENCH_SUBROUTINE 0xbfe
+#define C8_BENCH_DATA 0xc00
+#define C8_BENCH_ROM_SIZE (C8_MEMORY_SIZE - 0x200)
+
+typedef struct c8_bench_options {
+    uint64_t samples;
+    uint64_t sample_ms;
+    uint64_t threshold;
+    const char *filter;
+    const char *baseline;
+    const char *output;
+    bool list;
+} C8BenchOptions;
+
+typedef struct c8_bench C8Bench;
+
+/*
+ * Performs at least `count` operations of the benchmark and returns how
+ * many it did, 0 on failure.
+ */
+typedef uint64_t (*C8BenchRun)(C8Bench *bench, uint64_t count);
+
+struct c8_bench {
+    char name[C8_BENCH_NAME_SIZE];
+    C8BenchRun run;
+    /* Whole-program benchmarks also report MIPS */
+    bool program;
+
+    C8Cpu *cpu;
+    C8Image *image;
+    /* Lockstep benchmarks count an instruction of one lane as one op */
+    C8Lockstep *lockstep;
+    uint8_t *state;
+    uint64_t sink;
+
+    /* Operations per sample */
+    uint64_t count;
+    /* Results, in nanoseconds per operation */
+    double samples[C8_BENCH_MAX_SAMPLES];
+    double mean;
+    double min;
+    double p50;
+    double p90;
+    double p99;
+};
+
+typedef struct c8_bench_opcode {
+    const char *name;
+    uint16_t instruction;
+} C8BenchOpcode;
+
+/* Every handler behind the switch engine, in cpu.c order */
+static const C8BenchOpcode c8_bench_opcodes[] = {
+    {"cls", 0x00e0},
+    {"call_ret", 0x2000 | C8_BENCH_SUBROUTINE},
+    {"sys", 0x0300},
+    {"jp", 0x1000},
+    {"se_i8", 0x3001},
+    {"sne_i8", 0x4000},
+    {"se_reg", 0x5010},
+    {"ld_i8", 0x6a55},
+    {"add_i8", 0x7a01},
+    {"ld_reg", 0x8ab0},
+    {"or", 0x8ab1},
+    {"and", 0x8ab2},
+    {"xor", 0x8ab3},
+    {"add_reg", 0x8ab4},
+    {"sub", 0x8ab5},
+    {"shr", 0x8ab6},
+    {"subn", 0x8ab7},
+    {"shl", 0x8abe},
+    {"sne_reg", 0x9000},
+    {"ld_i", 0xa000 | C8_BENCH_DATA},
+    {"jp_v0", 0xb000},
+    {"rnd", 0xcaff},
+    {"drw", 0xdab5},
+    {"skp", 0xe19e},
+    {"sknp", 0xe0a1},
+    {"ld_reg_dt", 0xfa07},
+    {"ld_reg_key", 0xfa0a},
+    {"ld_dt_reg", 0xfa15},
+    {"ld_st_reg", 0xfa18},
+    {"add_i", 0xfa1e},
+    {"ld_sprite", 0xfa29},
+    {"ld_bcd", 0xfa33},
+    {"ld_mem_reg", 0xff55},
+    {"ld_reg_mem", 0xff65},
+};
+
+typedef struct c8_bench_program {
+    const char *name;
+    const uint16_t *code;
+    uint16_t length;
+} C8BenchProgram;
+
+/* Arithmetic and a conditional branch */
+static const uint16_t c8_bench_alu[] = {
+    0x6000, 0x6105,
+    0x7001, 0x8214, 0x8325, 0x8436, 0x8543, 0x8651, 0x8762, 0x3000,
+    0x1204, 0x1204,
+};
+
+/* BCD conversion, register stores and loads and I arithmetic */
+static const uint16_t c8_bench_memory[] = {
+    0xa400, 0x7501, 0xf533, 0xf255, 0xf265, 0xf51e, 0x1200,
+};
+
+/* Font sprites across the screen, cleared once every 256 draws */
+static const uint16_t c8_bench_draw[] = {
+    0xa000, 0x7003, 0x7102, 0xd015, 0x3000, 0x1202, 0x00e0, 0x1202,
+};
+
+/* Nested subroutine calls */
+static const uint16_t c8_bench_calls[] = {
+    0x2206, 0x7001, 0x1200, 0x220c, 0x7101, 0x00ee, 0x7201, 0x00ee,
+};
+
+/* Rewrites an instruction ahead of it on every iteration */
+static const uint16_t c8_bench_smc[] = {
+    0xa20c, 0x7301, 0x6072, 0x8130, 0xf155, 0x6400, 0x0000, 0x1202,
+};
+
+static const C8BenchProgram c8_bench_programs[] = {
+    {"alu", c8_bench_alu, sizeof(c8_bench_alu) / sizeof(uint16_t)},
+    {"memory", c8_bench_memory, sizeof(c8_bench_memory) / sizeof(uint16_t)},
+    {"draw", c8_bench_draw, sizeof(c8_bench_draw) / sizeof(uint16_t)},
+    {"calls", c8_bench_calls, sizeof(c8_bench_calls) / sizeof(uint16_t)},
+    {"smc", c8_bench_smc, sizeof(c8_bench_smc) / sizeof(uint16_t)},
+};
+
+static const struct {
+    const char *name;
+    C8CpuEngine engine;
+} c8_bench_engines[] = {
+    {"switch", C8_CPU_ENGINE_SWITCH},
+    {"threaded", C8_CPU_ENGINE_THREADED},
+    {"jit", C8_CPU_ENGINE_JIT},
+};
+
+static void c8_bench_usage(const char *name)
+{
+    printf("usage: %s [-n samples] [-t ms] [-f filter] [-b baseline] "
+           "[-r percent] [-o results] [-l]\n", name);
+    printf("exits with 2 if a benchmark is slower than the baseline by more "
+           "than the percentage\n");
+}
+
+static int c8_bench_parse_count(const char *arg, uint64_t *value)
+{
+    char *end = NULL;
+
+    if (arg == NULL) {
+        return -1;
+    }
+
+    *value = strtoull(arg, &end, 10);
+    if (*end != '\0' || end == arg) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int c8_bench_parse_options(int argc, char *argv[],
+                                  C8BenchOptions *options)
+{
+    options->samples = C8_BENCH_DEFAULT_SAMPLES;
+    options->sample_ms = C8_BENCH_DEFAULT_SAMPLE_MS;
+    options->threshold = C8_BENCH_DEFAULT_THRESHOLD;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0) {
+            if (c8_bench_parse_count(argv[++i], &options->samples) < 0 ||
+                options->samples == 0 ||
+                options->samples > C8_BENCH_MAX_SAMPLES) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-t") == 0) {
+            if (c8_bench_parse_count(argv[++i], &options->sample_ms) < 0 ||
+                options->sample_ms == 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-f") == 0) {
+            if ((options->filter = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-b") == 0) {
+            if ((options->baseline = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-r") == 0) {
+            if (c8_bench_parse_count(argv[++i], &options->threshold) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-o") == 0) {
+            if ((options->output = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-l") == 0) {
+            options->list = true;
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static double c8_bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void c8_bench_put(uint8_t *rom, uint16_t addr, uint16_t instruction)
+{
+    rom[addr - 0x200] = instruction >> 8;
+    rom[addr - 0x200 + 1] = instruction & 0xff;
+}
+
+static void c8_bench_opcode_rom(uint16_t instruction, uint8_t *rom)
+{
+    memset(rom, 0xaa, C8_BENCH_ROM_SIZE);
+
+    c8_bench_put(rom, 0x200, 0x6101);
+    c8_bench_put(rom, 0x202, 0x6000);
+    c8_bench_put(rom, 0x204, 0xa000 | C8_BENCH_DATA);
+
+    for (uint16_t addr = C8_BENCH_BODY_BEGIN; addr < C8_BENCH_BODY_END;
+         addr += C8_INSTRUCTION_SIZE) {
+        uint16_t next = addr + C8_INSTRUCTION_SIZE;
+
+        /* Jumps go to the next copy, with V0 = 0 for Bnnn */
+        switch (instruction >> 12) {
+        case 0x1:
+        case 0xb:
+            c8_bench_put(rom, addr, (instruction & 0xf000) | next);
+            break;
+
+        default:
+            c8_bench_put(rom, addr, instruction);
+            break;
+        }
+    }
+
+    c8_bench_put(rom, C8_BENCH_BODY_END, 0x1000 | C8_BENCH_BODY_BEGIN);
+    c8_bench_put(rom, C8_BENCH_SUBROUTINE, 0x00ee);
+}
+
+static C8Cpu *c8_bench_new_cpu(C8Image *image, C8CpuEngine engine)
+{
+    C8Memory *memory = c8_image_memory_new(image);
+    if (memory == NULL) {
+        return NULL;
+    }
+
+    C8Keyboard *keyboard = c8_keyboard_new();
+    if (keyboard == NULL) {
+        c8_memory_free(memory);
+        return NULL;
+    }
+
+    C8Cpu *cpu = c8_cpu_new(memory, keyboard);
+    if (cpu == NULL) {
+        free(keyboard);
+        c8_memory_free(memory);
+        return NULL;
+    }
+
+    /*
+     * Key 0 is held for Ex9E and ExA1. Key 1 is tapped for Fx0A, which
+     * would wait forever otherwise: only c8_cpu_run_frame clears the
+     * release.
+     */
+    c8_keyboard_press_key(keyboard, C8_KEY_0);
+    c8_keyboard_press_key(keyboard, C8_KEY_1);
+    c8_keyboard_release_key(keyboard, C8_KEY_1);
+
+    if (c8_cpu_set_engine(cpu, engine) < 0) {
+        return c8_cpu_free(cpu);
+    }
+
+    return cpu;
+}
+
+/* Draws and clears return early, so run until the cycles add up */
+static uint64_t c8_bench_run_cpu(C8Bench *bench, uint64_t count)
+{
+    uint64_t begin = c8_cpu_cycles(bench->cpu);
+    uint64_t executed = 0;
+
+    while (executed < count) {
+        uint64_t left = count - executed;
+        C8CpuStop stop = c8_cpu_run(bench->cpu, left < UINT32_MAX ? left
+                                                                  : UINT32_MAX);
+
+        if (stop == C8_CPU_STOP_FAULT || stop == C8_CPU_STOP_KEY_WAIT) {
+            fprintf(stderr, "bench: %s stopped at 0x%03x\n", bench->name,
+                    c8_cpu_pc(bench->cpu));
+            return 0;
+        }
+
+        executed = c8_cpu_cycles(bench->cpu) - begin;
+    }
+
+    return executed;
+}
+
+static uint64_t c8_bench_run_lockstep(C8Bench *bench, uint64_t count)
+{
+    C8LockstepStats stats;
+    c8_lockstep_stats(bench->lockstep, &stats);
+
+    uint64_t begin = stats.instructions;
+    uint64_t executed = 0;
+
+    while (executed < count) {
+        uint64_t cycles = (count - executed) / C8_BENCH_LANES + 1;
+
+        c8_lockstep_run_frame(bench->lockstep, cycles < UINT32_MAX
+                                                   ? cycles
+                                                   : UINT32_MAX);
+        c8_lockstep_stats(bench->lockstep, &stats);
+
+        if (stats.instructions - begin == executed) {
+            fprintf(stderr, "bench: %s stopped\n", bench->name);
+            return 0;
+        }
+        executed = stats.instructions - begin;
+    }
+
+    return executed;
+}
+
+static uint64_t c8_bench_run_fetch(C8Bench *bench, uint64_t count)
+{
+    C8Memory *memory = c8_cpu_memory(bench->cpu);
+    uint16_t pc = C8_BENCH_BODY_BEGIN;
+
+    for (uint64_t k = 0; k < count; k++) {
+        uint16_t instruction = 0;
+
+        c8_memory_program_read(memory, pc, &instruction);
+        bench->sink += c8_instruction_get_x(instruction) +
+                       c8_instruction_get_y(instruction) +
+                       c8_instruction_get_kk(instruction) +
+                       c8_instruction_get_nnn(instruction);
+
+        pc += C8_INSTRUCTION_SIZE;
+        if (pc >= C8_BENCH_BODY_END) {
+            pc = C8_BENCH_BODY_BEGIN;
+        }
+    }
+
+    return count;
+}
+
+/* An 8x15 sprite moved across the screen so it wraps in both directions */
+static uint64_t c8_bench_run_blit(C8Bench *bench, uint64_t count)
+{
+    C8Memory *memory = c8_cpu_memory(bench->cpu);
+    uint8_t sprite[15];
+    uint8_t x = 0;
+    uint8_t y = 0;
+
+    memset(sprite, 0x5a, sizeof(sprite));
+
+    for (uint64_t k = 0; k < count; k++) {
+        int collision = c8_memory_display_write(memory, x, y, sprite,
+                                                sizeof(sprite));
+        if (collision < 0) {
+            return 0;
+        }
+
+        bench->sink += collision;
+        x += 7;
+        y += 3;
+    }
+
+    return count;
+}
+
+static uint64_t c8_bench_run_save(C8Bench *bench, uint64_t count)
+{
+    for (uint64_t k = 0; k < count; k++) {
+        if (c8_state_save(bench->cpu, bench->state, c8_state_size()) < 0) {
+            return 0;
+        }
+    }
+
+    return count;
+}
+
+/* Alternates between two states so every load has something to change */
+static uint64_t c8_bench_run_load(C8Bench *bench, uint64_t count)
+{
+    size_t size = c8_state_size();
+
+    for (uint64_t k = 0; k < count; k++) {
+        if (c8_state_load(bench->cpu, bench->state + (k & 1) * size,
+                          size) < 0) {
+            return 0;
+        }
+    }
+
+    return count;
+}
+
+static uint64_t c8_bench_run_fork(C8Bench *bench, uint64_t count)
+{
+    for (uint64_t k = 0; k < count; k++) {
+        C8Cpu *fork = c8_cpu_fork(bench->cpu);
+        if (fork == NULL) {
+            return 0;
+        }
+
+        c8_cpu_free(fork);
+    }
+
+    return count;
+}
+
+static uint64_t c8_bench_run_memory_new(C8Bench *bench, uint64_t count)
+{
+    for (uint64_t k = 0; k < count; k++) {
+        C8Memory *memory = c8_image_memory_new(bench->image);
+        if (memory == NULL) {
+            return 0;
+        }
+
+        c8_memory_free(memory);
+    }
+
+    return count;
+}
+
+static int c8_bench_add(C8Bench **benches, size_t *count, size_t *capacity,
+                        C8Bench *bench)
+{
+    if (*count == *capacity) {
+        size_t grown = *capacity > 0 ? *capacity * 2 : 64;
+        C8Bench *resized = realloc(*benches, grown * sizeof(C8Bench));
+
+        if (resized == NULL) {
+            fprintf(stderr, "bench: can't allocate benchmarks\n");
+            return -1;
+        }
+
+        *benches = resized;
+        *capacity = grown;
+    }
+
+    (*benches)[(*count)++] = *bench;
+    return 0;
+}
+
+static void c8_bench_free(C8Bench *benches, size_t count)
+{
+    for (size_t k = 0; k < count; k++) {
+        c8_cpu_free(benches[k].cpu);
+        c8_image_release(benches[k].image);
+        c8_lockstep_free(benches[k].lockstep);
+        free(benches[k].state);
+    }
+
+    free(benches);
+}
+
+static bool c8_bench_selected(const C8BenchOptions *options,
+                              const char *name)
+{
+    return options->filter == NULL || strstr(name, options->filter) != NULL;
+}
+
+/* Sets up a benchmark on a fresh machine running `rom` */
+static int c8_bench_setup(const C8BenchOptions *options, C8Bench **benches,
+                          size_t *count, size_t *capacity, const char *name,
+                          C8BenchRun run, const uint8_t *rom, uint16_t size,
+                          C8CpuEngine engine)
+{
+    if (!c8_bench_selected(options, name)) {
+        return 0;
+    }
+
+    C8Bench bench = {.run = run};
+    snprintf(bench.name, sizeof(bench.name), "%s", name);
+
+    if (options->list) {
+        return c8_bench_add(benches, count, capacity, &bench);
+    }
+
+    bench.image = c8_image_new(rom, size);
+    if (bench.image == NULL) {
+        return -1;
+    }
+
+    bench.cpu = c8_bench_new_cpu(bench.image, engine);
+    if (bench.cpu == NULL) {
+        /* Engines the host doesn't have are skipped */
+        c8_image_release(bench.image);
+        return engine == C8_CPU_ENGINE_SWITCH ? -1 : 0;
+    }
+
+    if (c8_bench_add(benches, count, capacity, &bench) < 0) {
+        c8_cpu_free(bench.cpu);
+        c8_image_release(bench.image);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Sets up a benchmark on C8_BENCH_LANES lanes running `rom` */
+static int c8_bench_setup_lockstep(const C8BenchOptions *options,
+                                   C8Bench **benches, size_t *count,
+                                   size_t *capacity, const char *name,
+                                   const uint8_t *rom, uint16_t size)
+{
+    if (!c8_bench_selected(options, name)) {
+        return 0;
+    }
+
+    C8Bench bench = {.run = c8_bench_run_lockstep, .program = true};
+    snprintf(bench.name, sizeof(bench.name), "%s", name);
+
+    if (options->list) {
+        return c8_bench_add(benches, count, capacity, &bench);
+    }
+
+    bench.lockstep = c8_lockstep_new(rom, size, C8_BENCH_LANES);
+    if (bench.lockstep == NULL) {
+        return -1;
+    }
+
+    for (uint32_t lane = 0; lane < C8_BENCH_LANES; lane++) {
+        c8_lockstep_seed(bench.lockstep, lane, lane);
+    }
+
+    if (c8_bench_add(benches, count, capacity, &bench) < 0) {
+        c8_lockstep_free(bench.lockstep);
+        return -1;
+    }
+
+    return 0;
+}
+
+static C8Bench *c8_bench_create(const C8BenchOptions *options, size_t *count)
+{
+    static uint8_t rom[C8_BENCH_ROM_SIZE];
+    C8Bench *benches = NULL;
+    size_t capacity = 0;
+    char name[C8_BENCH_NAME_SIZE];
+
+    *count = 0;
+
+    for (size_t k = 0;
+         k < sizeof(c8_bench_opcodes) / sizeof(c8_bench_opcodes[0]); k++) {
+        const C8BenchOpcode *opcode = &c8_bench_opcodes[k];
+
+        c8_bench_opcode_rom(opcode->instruction, rom);
+        snprintf(name, sizeof(name), "op/%s", opcode->name);
+        if (c8_bench_setup(options, &benches, count, &capacity, name,
+                           c8_bench_run_cpu, rom, sizeof(rom),
+                           C8_CPU_ENGINE_SWITCH) < 0) {
+            goto fail;
+        }
+    }
+
+    /* The rest run on the ld_i8 program, which has no side effects */
+    c8_bench_opcode_rom(0x6a55, rom);
+
+    static const struct {
+        const char *name;
+        C8BenchRun run;
+    } others[] = {
+        {"fetch_decode", c8_bench_run_fetch},
+        {"display_write", c8_bench_run_blit},
+        {"state/save", c8_bench_run_save},
+        {"state/load", c8_bench_run_load},
+        {"cpu/fork", c8_bench_run_fork},
+        {"image/memory_new", c8_bench_run_memory_new},
+    };
+
+    for (size_t k = 0; k < sizeof(others) / sizeof(others[0]); k++) {
+        if (c8_bench_setup(options, &benches, count, &capacity,
+                           others[k].name, others[k].run, rom, sizeof(rom),
+                           C8_CPU_ENGINE_SWITCH) < 0) {
+            goto fail;
+        }
+    }
+
+    for (size_t k = 0;
+         k < sizeof(c8_bench_programs) / sizeof(c8_bench_programs[0]); k++) {
+        const C8BenchProgram *program = &c8_bench_programs[k];
+
+        for (uint16_t i = 0; i < program->length; i++) {
+            rom[2 * i] = program->code[i] >> 8;
+            rom[2 * i + 1] = program->code[i] & 0xff;
+        }
+
+        for (size_t e = 0;
+             e < sizeof(c8_bench_engines) / sizeof(c8_bench_engines[0]);
+             e++) {
+            snprintf(name, sizeof(name), "rom/%s/%s", program->name,
+                     c8_bench_engines[e].name);
+            size_t before = *count;
+
+            if (c8_bench_setup(options, &benches, count, &capacity, name,
+                               c8_bench_run_cpu, rom,
+                               program->length * C8_INSTRUCTION_SIZE,
+                               c8_bench_engines[e].engine) < 0) {
+                goto fail;
+            }
+            if (*count > before) {
+                benches[*count - 1].program = true;
+            }
+        }
+
+        snprintf(name, sizeof(name), "lockstep/%s", program->name);
+        if (c8_bench_setup_lockstep(
+                options, &benches, count, &capacity, name, rom,
+                program->length * C8_INSTRUCTION_SIZE) < 0) {
+            goto fail;
+        }
+    }
+
+    if (*count == 0) {
+        fprintf(stderr, "bench: no benchmarks match\n");
+        goto fail;
+    }
+    if (options->list) {
+        return benches;
+    }
+
+    /* The state benchmarks need a buffer of one or two states */
+    for (size_t k = 0; k < *count; k++) {
+        C8Bench *bench = &benches[k];
+
+        if (bench->run != c8_bench_run_save &&
+            bench->run != c8_bench_run_load) {
+            continue;
+        }
+
+        size_t size = c8_state_size();
+        bench->state = malloc(2 * size);
+        if (bench->state == NULL) {
+            fprintf(stderr, "bench: can't allocate states\n");
+            goto fail;
+        }
+
+        c8_state_save(bench->cpu, bench->state, size);
+        c8_bench_run_cpu(bench, 1000);
+        c8_state_save(bench->cpu, bench->state + size, size);
+    }
+
+    return benches;
+
+fail:
+    c8_bench_free(benches, *count);
+    return NULL;
+}
+
+static int c8_bench_compare_samples(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted samples */
+static double c8_bench_percentile(const double *samples, uint64_t count,
+                                  uint32_t percent)
+{
+    uint64_t rank = (count * percent + 99) / 100;
+    return samples[rank > 0 ? rank - 1 : 0];
+}
+
+/*
+ * Grows the operation count until one run takes a tenth of a sample, then
+ * scales it to the sample length.
+ */
+static int c8_bench_calibrate(const C8BenchOptions *options, C8Bench *bench)
+{
+    double target = options->sample_ms / 1e3;
+    uint64_t count = 1;
+    double elapsed = 0;
+
+    for (;;) {
+        double begin = c8_bench_now();
+        if (bench->run(bench, count) == 0) {
+            return -1;
+        }
+        elapsed = c8_bench_now() - begin;
+
+        if (elapsed >= target / 10 || count >= UINT64_MAX / 2) {
+            break;
+        }
+        count *= 2;
+    }
+
+    if (elapsed > 0) {
+        count = count * (target / elapsed);
+    }
+
+    bench->count = count > 0 ? count : 1;
+    return 0;
+}
+
+static int c8_bench_sample(C8Bench *bench, uint64_t sample)
+{
+    double begin = c8_bench_now();
+    uint64_t done = bench->run(bench, bench->count);
+    double elapsed = c8_bench_now() - begin;
+
+    if (done == 0) {
+        return -1;
+    }
+
+    bench->samples[sample] = elapsed * 1e9 / done;
+    return 0;
+}
+
+static void c8_bench_summarize(const C8BenchOptions *options, C8Bench *bench)
+{
+    double sum = 0;
+
+    for (uint64_t k = 0; k < options->samples; k++) {
+        sum += bench->samples[k];
+    }
+
+    qsort(bench->samples, options->samples, sizeof(double),
+          c8_bench_compare_samples);
+
+    bench->mean = sum / options->samples;
+    bench->min = bench->samples[0];
+    bench->p50 = c8_bench_percentile(bench->samples, options->samples, 50);
+    bench->p90 = c8_bench_percentile(bench->samples, options->samples, 90);
+    bench->p99 = c8_bench_percentile(bench->samples, options->samples, 99);
+}
+
+/*
+ * Samples are taken round-robin across the benchmarks, so a stretch where
+ * the host is busy or clocked down spreads over all of them instead of
+ * skewing the few that happened to run during it.
+ */
+static int c8_bench_measure(const C8BenchOptions *options, C8Bench *benches,
+                            size_t count)
+{
+    for (size_t k = 0; k < count; k++) {
+        if (c8_bench_calibrate(options, &benches[k]) < 0) {
+            return -1;
+        }
+    }
+
+    for (uint64_t sample = 0; sample < options->samples; sample++) {
+        for (size_t k = 0; k < count; k++) {
+            if (c8_bench_sample(&benches[k], sample) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    for (size_t k = 0; k < count; k++) {
+        c8_bench_summarize(options, &benches[k]);
+    }
+
+    return 0;
+}
+
+/* One benchmark per line, which is all the baseline reader relies on */
+static int c8_bench_write_results(const C8BenchOptions *options,
+                                  const C8Bench *benches, size_t count)
+{
+    FILE *file = stdout;
+
+    if (options->output != NULL) {
+        file = fopen(options->output, "w");
+        if (file == NULL) {
+            fprintf(stderr, "bench: can't open %s\n", options->output);
+            return -1;
+        }
+    }
+
+    fprintf(file, "{\n  \"unit\": \"ns/op\",\n  \"samples\": %llu,\n"
+            "  \"benchmarks\": [\n", (unsigned long long)options->samples);
+    for (size_t k = 0; k < count; k++) {
+        const C8Bench *bench = &benches[k];
+
+        fprintf(file, "    {\"name\": \"%s\", \"mean\": %.3f, \"min\": %.3f, "
+                "\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f", bench->name,
+                bench->mean, bench->min, bench->p50, bench->p90, bench->p99);
+        if (bench->program) {
+            fprintf(file, ", \"mips\": %.2f", 1e3 / bench->mean);
+        }
+        fprintf(file, "}%s\n", k + 1 < count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    int failed = ferror(file);
+    if (file != stdout && fclose(file) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        fprintf(stderr, "bench: can't write results\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Finds the median of `name` in a file written by c8_bench_write_results */
+static bool c8_bench_baseline_p50(FILE *file, const char *name, double *p50)
+{
+    char line[C8_BENCH_LINE_SIZE];
+    char key[C8_BENCH_NAME_SIZE + 16];
+
+    snprintf(key, sizeof(key), "\"name\": \"%s\",", name);
+    rewind(file);
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strstr(line, key) == NULL) {
+            continue;
+        }
+
+        const char *value = strstr(line, "\"p50\": ");
+        return value != NULL && sscanf(value, "\"p50\": %lf", p50) == 1;
+    }
+
+    return false;
+}
+
+/*
+ * Compares medians, which a few preempted samples don't move, against the
+ * baseline's. Returns 1 if any benchmark got slower by more than the
+ * threshold, -1 on failure.
+ */
+static int c8_bench_compare(const C8BenchOptions *options,
+                            const C8Bench *benches, size_t count)
+{
+    FILE *file = fopen(options->baseline, "r");
+    if (file == NULL) {
+        fprintf(stderr, "bench: can't open %s\n", options->baseline);
+        return -1;
+    }
+
+    int regressed = 0;
+
+    fprintf(stderr, "%-28s %12s %12s %9s\n", "benchmark", "baseline",
+            "current", "change");
+    for (size_t k = 0; k < count; k++) {
+        const C8Bench *bench = &benches[k];
+        double baseline = 0;
+
+        if (!c8_bench_baseline_p50(file, bench->name, &baseline) ||
+            baseline <= 0) {
+            fprintf(stderr, "%-28s %12s %9.3f ns\n", bench->name, "-",
+                    bench->p50);
+            continue;
+        }
+
+        double change = (bench->p50 / baseline - 1) * 100;
+        bool slower = change > (double)options->threshold;
+
+        fprintf(stderr, "%-28s %9.3f ns %9.3f ns %+8.1f%%%s\n", bench->name,
+                baseline, bench->p50, change, slower ? "  slower" : "");
+        regressed |= slower;
+    }
+
+    fclose(file);
+    return regressed;
+}
+
+int main(int argc, char *argv[])
+{
+    C8BenchOptions options = {};
+
+    if (c8_bench_parse_options(argc, argv, &options) < 0) {
+        c8_bench_usage(argv[0]);
+        return 1;
+    }
+
+    size_t count = 0;
+    C8Bench *benches = c8_bench_create(&options, &count);
+    if (benches == NULL) {
+        return 1;
+    }
+
+    if (options.list) {
+        for (size_t k = 0; k < count; k++) {
+            printf("%s\n", benches[k].name);
+        }
+        c8_bench_free(benches, count);
+        return 0;
+    }
+
+    if (c8_bench_measure(&options, benches, count) < 0) {
+        c8_bench_free(benches, count);
+        return 1;
+    }
+
+    int status = c8_bench_write_results(&options, benches, count);
+    if (status == 0 && options.baseline != NULL) {
+        status = c8_bench_compare(&options, benches, count);
+    }
+
+    c8_bench_free(benches, count);
+    return status < 0 ? 1 : status > 0 ? 2 : 0;
+}
@@ -0,0 +1,343 @@
+#include "c8/callgraph.h"
+
+#include "cpu_internal.h"
+#include "memory_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define C8_CALLGRAPH_MIN_STACKS 256
+
+/* Slots past the address space for frames that have no entry address */
+#define C8_CALLGRAPH_UNKNOWN C8_MEMORY_SIZE
+#define C8_CALLGRAPH_MAIN (C8_MEMORY_SIZE + 1)
+#define C8_CALLGRAPH_SLOTS (C8_MEMORY_SIZE + 2)
+
+/* A distinct sampled stack, frames[0] is always main */
+typedef struct c8_callgraph_stack {
+    uint64_t count;
+    uint8_t depth;
+    uint16_t frames[C8_MEMORY_STACK_SIZE];
+} C8CallGraphStack;
+
+struct c8_callgraph {
+    uint32_t period;
+    /* Instructions left before the next sample */
+    uint32_t until_sample;
+    /* Instructions since the last sample, charged to it */
+    uint64_t pending;
+    uint64_t samples;
+    uint64_t instructions;
+    /* Samples left out of the folded stacks, the table couldn't grow */
+    uint64_t dropped;
+
+    /* Shadow of the CPU stack: entry address and call site per level */
+    uint16_t entries[C8_MEMORY_STACK_SIZE];
+    uint16_t sites[C8_MEMORY_STACK_SIZE];
+
+    /* Open addressing table of sampled stacks */
+    C8CallGraphStack *stacks;
+    uint32_t stack_capacity;
+    uint32_t stack_count;
+
+    uint64_t inclusive[C8_CALLGRAPH_SLOTS];
+    uint64_t exclusive[C8_CALLGRAPH_SLOTS];
+};
+
+C8CallGraph *c8_callgraph_new(uint32_t period)
+{
+    C8CallGraph *callgraph = calloc(1, sizeof(C8CallGraph));
+
+    if (callgraph == NULL) {
+        fprintf(stderr, "callgraph: can't allocate call graph\n");
+        return NULL;
+    }
+
+    callgraph->stacks = calloc(C8_CALLGRAPH_MIN_STACKS,
+                               sizeof(C8CallGraphStack));
+    if (callgraph->stacks == NULL) {
+        fprintf(stderr, "callgraph: can't allocate call graph\n");
+        free(callgraph);
+        return NULL;
+    }
+
+    callgraph->stack_capacity = C8_CALLGRAPH_MIN_STACKS;
+    callgraph->period = period > 0 ? period : C8_CALLGRAPH_DEFAULT_PERIOD;
+    callgraph->until_sample = callgraph->period;
+
+    for (int k = 0; k < C8_MEMORY_STACK_SIZE; k++) {
+        callgraph->entries[k] = C8_CALLGRAPH_UNKNOWN;
+    }
+
+    return callgraph;
+}
+
+C8CallGraph *c8_callgraph_free(C8CallGraph *callgraph)
+{
+    if (callgraph != NULL) {
+        free(callgraph->stacks);
+        free(callgraph);
+    }
+
+    return NULL;
+}
+
+void c8_cpu_set_callgraph(C8Cpu *cpu, C8CallGraph *callgraph)
+{
+    cpu->callgraph = callgraph;
+}
+
+uint64_t c8_callgraph_samples(C8CallGraph *callgraph)
+{
+    return callgraph->samples;
+}
+
+void c8_callgraph_enter(C8CallGraph *callgraph, uint8_t sp, uint16_t site,
+                        uint16_t entry)
+{
+    if (sp < C8_MEMORY_STACK_SIZE) {
+        callgraph->entries[sp] = entry;
+        callgraph->sites[sp] = site;
+    }
+}
+
+static uint32_t c8_callgraph_hash(const C8CallGraphStack *stack)
+{
+    uint32_t hash = 0x811c9dc5;
+
+    for (uint8_t k = 0; k < stack->depth; k++) {
+        hash = (hash ^ stack->frames[k]) * 0x01000193;
+    }
+
+    return hash;
+}
+
+static C8CallGraphStack *c8_callgraph_find(C8CallGraphStack *stacks,
+                                           uint32_t capacity,
+                                           const C8CallGraphStack *stack)
+{
+    uint32_t k = c8_callgraph_hash(stack) & (capacity - 1);
+
+    while (stacks[k].depth != 0 &&
+           (stacks[k].depth != stack->depth ||
+            memcmp(stacks[k].frames, stack->frames,
+                   stack->depth * sizeof(uint16_t)) != 0)) {
+        k = (k + 1) & (capacity - 1);
+    }
+
+    return &stacks[k];
+}
+
+/* Doubles the table, keeping it at most half full */
+static int c8_callgraph_grow(C8CallGraph *callgraph)
+{
+    uint32_t capacity = callgraph->stack_capacity * 2;
+    C8CallGraphStack *stacks = calloc(capacity, sizeof(C8CallGraphStack));
+
+    if (stacks == NULL) {
+        return -1;
+    }
+
+    for (uint32_t k = 0; k < callgraph->stack_capacity; k++) {
+        if (callgraph->stacks[k].depth != 0) {
+            *c8_callgraph_find(stacks, capacity, &callgraph->stacks[k]) =
+                callgraph->stacks[k];
+        }
+    }
+
+    free(callgraph->stacks);
+    callgraph->stacks = stacks;
+    callgraph->stack_capacity = capacity;
+    return 0;
+}
+
+static void c8_callgraph_sample(C8CallGraph *callgraph, C8Cpu *cpu)
+{
+    C8CallGraphStack stack = {.count = callgraph->pending, .depth = 1};
+    uint64_t weight = callgraph->pending;
+    uint8_t sp = cpu->sp < C8_MEMORY_STACK_SIZE ? cpu->sp
+                                                 : C8_MEMORY_STACK_SIZE - 1;
+
+    stack.frames[0] = C8_CALLGRAPH_MAIN;
+
+    /* A level whose return address isn't the recorded call site is unknown */
+    for (uint8_t k = 1; k <= sp; k++) {
+        bool known = callgraph->entries[k] != C8_CALLGRAPH_UNKNOWN &&
+                     callgraph->sites[k] == cpu->memory->stack[k];
+
+        stack.frames[stack.depth++] =
+            known ? callgraph->entries[k] : C8_CALLGRAPH_UNKNOWN;
+    }
+
+    callgraph->pending = 0;
+    callgraph->samples++;
+    callgraph->instructions += weight;
+    callgraph->exclusive[stack.frames[stack.depth - 1]] += weight;
+
+    /* Recursive subroutines count once per sample */
+    for (uint8_t k = 0; k < stack.depth; k++) {
+        bool seen = false;
+
+        for (uint8_t j = 0; j < k && !seen; j++) {
+            seen = stack.frames[j] == stack.frames[k];
+        }
+        if (!seen) {
+            callgraph->inclusive[stack.frames[k]] += weight;
+        }
+    }
+
+    if (2 * (callgraph->stack_count + 1) > callgraph->stack_capacity &&
+        c8_callgraph_grow(callgraph) < 0) {
+        callgraph->dropped++;
+        return;
+    }
+
+    C8CallGraphStack *slot = c8_callgraph_find(
+        callgraph->stacks, callgraph->stack_capacity, &stack);
+    if (slot->depth == 0) {
+        *slot = stack;
+        callgraph->stack_count++;
+    } else {
+        slot->count += weight;
+    }
+}
+
+/*
+ * Runs the engine in slices that end at the sample points. The engines
+ * never overrun a budget, so samples land exactly every `period`
+ * instructions whichever one is selected. Each slice is counted into
+ * cpu->cycles as it ends, which the trace numbers its records from.
+ */
+uint32_t c8_callgraph_run(C8Cpu *cpu, uint32_t count)
+{
+    C8CallGraph *callgraph = cpu->callgraph;
+    uint32_t executed = 0;
+
+    while (executed < count && cpu->stop == C8_CPU_STOP_BUDGET) {
+        uint32_t slice = count - executed;
+        if (slice > callgraph->until_sample) {
+            slice = callgraph->until_sample;
+        }
+
+        uint32_t n = c8_cpu_engine_run(cpu, slice);
+        executed += n;
+        cpu->cycles += n;
+        callgraph->pending += n;
+        callgraph->until_sample -= n;
+
+        if (callgraph->until_sample == 0) {
+            c8_callgraph_sample(callgraph, cpu);
+            callgraph->until_sample = callgraph->period;
+        }
+
+        if (n < slice) {
+            break;
+        }
+    }
+
+    return executed;
+}
+
+static const char *c8_callgraph_name(uint16_t slot, char *name, size_t size)
+{
+    if (slot == C8_CALLGRAPH_MAIN) {
+        return "main";
+    }
+    if (slot == C8_CALLGRAPH_UNKNOWN) {
+        return "unknown";
+    }
+
+    snprintf(name, size, "sub_0x%03x", slot);
+    return name;
+}
+
+int c8_callgraph_save_folded(C8CallGraph *callgraph, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "callgraph: can't open %s\n", path);
+        return -1;
+    }
+
+    for (uint32_t k = 0; k < callgraph->stack_capacity; k++) {
+        const C8CallGraphStack *stack = &callgraph->stacks[k];
+
+        if (stack->depth == 0) {
+            continue;
+        }
+
+        for (uint8_t j = 0; j < stack->depth; j++) {
+            char name[16];
+            fprintf(file, "%s%s", j > 0 ? ";" : "",
+                    c8_callgraph_name(stack->frames[j], name, sizeof(name)));
+        }
+        fprintf(file, " %llu\n", (unsigned long long)stack->count);
+    }
+
+    int failed = ferror(file);
+    if (fclose(file) != 0 || failed) {
+        fprintf(stderr, "callgraph: can't write %s\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+typedef struct c8_callgraph_row {
+    uint16_t slot;
+    uint64_t inclusive;
+    uint64_t exclusive;
+} C8CallGraphRow;
+
+static int c8_callgraph_compare_rows(const void *a, const void *b)
+{
+    const C8CallGraphRow *x = a;
+    const C8CallGraphRow *y = b;
+
+    if (x->inclusive != y->inclusive) {
+        return x->inclusive < y->inclusive ? 1 : -1;
+    }
+    return (x->slot > y->slot) - (x->slot < y->slot);
+}
+
+void c8_callgraph_print(C8CallGraph *callgraph, FILE *file)
+{
+    C8CallGraphRow *rows = malloc(C8_CALLGRAPH_SLOTS * sizeof(C8CallGraphRow));
+    uint32_t count = 0;
+    double total = callgraph->instructions > 0 ? callgraph->instructions : 1;
+
+    if (rows == NULL) {
+        fprintf(stderr, "callgraph: can't allocate report\n");
+        return;
+    }
+
+    for (uint16_t slot = 0; slot < C8_CALLGRAPH_SLOTS; slot++) {
+        if (callgraph->inclusive[slot] != 0) {
+            rows[count++] = (C8CallGraphRow){slot, callgraph->inclusive[slot],
+                                             callgraph->exclusive[slot]};
+        }
+    }
+    qsort(rows, count, sizeof(C8CallGraphRow), c8_callgraph_compare_rows);
+
+    fprintf(file, "samples: %llu every %u instructions",
+            (unsigned long long)callgraph->samples, callgraph->period);
+    if (callgraph->dropped > 0) {
+        fprintf(file, ", %llu dropped",
+                (unsigned long long)callgraph->dropped);
+    }
+    fprintf(file, "\n%-12s %14s %7s %14s %7s\n", "subroutine", "inclusive",
+            "", "exclusive", "");
+
+    for (uint32_t k = 0; k < count; k++) {
+        char name[16];
+        fprintf(file, "%-12s %14llu %6.2f%% %14llu %6.2f%%\n",
+                c8_callgraph_name(rows[k].slot, name, sizeof(name)),
+                (unsigned long long)rows[k].inclusive,
+                100.0 * rows[k].inclusive / total,
+                (unsigned long long)rows[k].exclusive,
+                100.0 * rows[k].exclusive / total);
+    }
+
+    free(rows);
+}
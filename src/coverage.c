@@ -0,0 +1,19 @@
+#include "c8/coverage.h"
+
+#include "cpu_internal.h"
+
+void c8_cpu_set_coverage(C8Cpu *cpu, uint8_t *map)
+{
+    cpu->coverage = map;
+}
+
+/* Both ends of the edge matter, so a jump and its reverse differ */
+static inline uint32_t c8_coverage_edge(uint16_t from, uint16_t to)
+{
+    return ((from * 0x9e3779b1u) >> 16 ^ to) & (C8_COVERAGE_SIZE - 1);
+}
+
+void c8_coverage_observe(C8Cpu *cpu, uint16_t from)
+{
+    cpu->coverage[c8_coverage_edge(from, cpu->pc)]++;
+}
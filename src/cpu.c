@@ -1,42 +1,34 @@
 #include "c8/cpu.h"
 
-#include "c8/audio.h"
+#include "cpu_internal.h"
+
 #include "c8/instruction.h"
 #include "c8/keyboard.h"
 #include "c8/memory.h"
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
-
-struct c8_cpu {
-    uint8_t v[16];
-    uint16_t i;
-    uint8_t dt;
-    uint8_t st;
-    uint16_t pc;
-    uint8_t sp;
-
-    C8Memory *memory;
-    C8Keyboard *keyboard;
-    C8Audio *audio;
-
-    uint16_t instruction;
-};
+#include <string.h>
 
 C8Cpu *c8_cpu_new(C8Memory *memory, C8Keyboard *keyboard)
 {
-    C8Cpu *cpu = calloc(1, sizeof(C8Cpu));
+    C8Pool *pool = c8_pool_new(sizeof(C8Cpu));
+    if (pool == NULL) {
+        return NULL;
+    }
 
+    C8Cpu *cpu = c8_pool_alloc(pool);
     if (cpu == NULL) {
         fprintf(stderr, "cpu: can't allocate cpu\n");
+        c8_pool_release(pool);
         return NULL;
     }
 
+    memset(cpu, 0, sizeof(C8Cpu));
+    cpu->pool = pool;
     cpu->memory = memory;
     cpu->keyboard = keyboard;
-    cpu->audio = c8_audio_new();
-    srand(time(0));
+    c8_cpu_seed(cpu, 0);
 
     cpu->pc = c8_memory_program_begin();
     return cpu;
@@ -45,26 +37,177 @@ C8Cpu *c8_cpu_new(C8Memory *memory, C8Keyboard *keyboard)
 C8Cpu *c8_cpu_free(C8Cpu *cpu)
 {
     if (cpu != NULL) {
-        if (cpu->audio) {
-            c8_audio_free(cpu->audio);
+        c8_threaded_free(cpu->threaded);
+        c8_jit_free(cpu->jit);
+        c8_aot_free(cpu->aot);
+        c8_memory_free(cpu->memory);
+        if (cpu->keyboard != &cpu->fork_keyboard) {
+            free(cpu->keyboard);
+        }
+
+        C8Pool *pool = cpu->pool;
+        c8_pool_free(pool, cpu);
+        c8_pool_release(pool);
+    }
+
+    return NULL;
+}
+
+C8Cpu *c8_cpu_fork(C8Cpu *cpu)
+{
+    C8Cpu *child = c8_pool_alloc(cpu->pool);
+    if (child == NULL) {
+        fprintf(stderr, "cpu: can't allocate cpu\n");
+        return NULL;
+    }
+
+    *child = *cpu;
+    child->memory = c8_memory_fork(cpu->memory);
+    if (child->memory == NULL) {
+        c8_pool_free(cpu->pool, child);
+        return NULL;
+    }
+
+    c8_pool_retain(child->pool);
+    child->fork_keyboard = *cpu->keyboard;
+    child->keyboard = &child->fork_keyboard;
+    child->callbacks = (C8CpuCallbacks){};
+    child->engine = C8_CPU_ENGINE_SWITCH;
+    child->threaded = NULL;
+    child->jit = NULL;
+    child->aot = NULL;
+    child->profile = NULL;
+    child->callgraph = NULL;
+    child->trace = NULL;
+    child->debugger = NULL;
+    child->coverage = NULL;
+
+    return child;
+}
+
+C8Memory *c8_cpu_memory(C8Cpu *cpu)
+{
+    return cpu->memory;
+}
+
+C8Keyboard *c8_cpu_keyboard(C8Cpu *cpu)
+{
+    return cpu->keyboard;
+}
+
+void c8_cpu_set_callbacks(C8Cpu *cpu, const C8CpuCallbacks *callbacks)
+{
+    cpu->callbacks = *callbacks;
+}
+
+static void c8_cpu_code_written(void *userdata, uint16_t addr, uint16_t len)
+{
+    C8Cpu *cpu = userdata;
+
+    if (cpu->threaded != NULL &&
+        c8_threaded_invalidate(cpu->threaded, addr, len) < 0) {
+        cpu->stop = C8_CPU_STOP_FAULT;
+    }
+    if (cpu->jit != NULL) {
+        c8_jit_invalidate(cpu->jit, addr, len);
+    }
+    if (cpu->aot != NULL) {
+        c8_aot_invalidate(cpu->aot, addr, len);
+    }
+}
+
+static void c8_cpu_free_engines(C8Cpu *cpu)
+{
+    cpu->threaded = c8_threaded_free(cpu->threaded);
+    cpu->jit = c8_jit_free(cpu->jit);
+    cpu->aot = c8_aot_free(cpu->aot);
+}
+
+int c8_cpu_set_engine(C8Cpu *cpu, C8CpuEngine engine)
+{
+    if (engine == cpu->engine) {
+        return 0;
+    }
+
+    switch (engine) {
+    case C8_CPU_ENGINE_SWITCH:
+        c8_cpu_free_engines(cpu);
+        c8_memory_set_write_hook(cpu->memory, NULL, NULL);
+        break;
+
+    case C8_CPU_ENGINE_THREADED: {
+        C8Threaded *threaded = c8_threaded_new(c8_image_decoded(cpu->memory));
+        if (threaded == NULL) {
+            return -1;
         }
-        if (cpu->memory != NULL) {
-            free(cpu->memory);
+
+        c8_cpu_free_engines(cpu);
+        cpu->threaded = threaded;
+        c8_memory_set_write_hook(cpu->memory, c8_cpu_code_written, cpu);
+        break;
+    }
+
+    case C8_CPU_ENGINE_JIT: {
+        C8Jit *jit = c8_jit_new();
+        if (jit == NULL) {
+            return -1;
         }
-        if (cpu->keyboard != NULL) {
-            free(cpu->keyboard);
+
+        c8_cpu_free_engines(cpu);
+        cpu->jit = jit;
+        c8_memory_set_write_hook(cpu->memory, c8_cpu_code_written, cpu);
+        break;
+    }
+
+    case C8_CPU_ENGINE_AOT: {
+        if (cpu->aot_program == NULL) {
+            fprintf(stderr, "cpu: no translated program attached\n");
+            return -1;
         }
-        free(cpu);
+
+        C8Aot *aot = c8_aot_new(cpu->aot_program);
+        if (aot == NULL) {
+            return -1;
+        }
+
+        c8_cpu_free_engines(cpu);
+        cpu->aot = aot;
+        c8_memory_set_write_hook(cpu->memory, c8_cpu_code_written, cpu);
+        break;
+    }
+
+    default:
+        return -1;
     }
+
+    cpu->engine = engine;
+    return 0;
 }
 
-static int c8_cpu_cls(C8Cpu *cpu)
+static void c8_cpu_display_changed(C8Cpu *cpu)
+{
+    if (cpu->callbacks.display != NULL) {
+        cpu->callbacks.display(cpu->callbacks.userdata);
+    }
+}
+
+int c8_cpu_op_cls(C8Cpu *cpu)
 {
-    c8_memory_display_clear(cpu->memory);
+    if (c8_memory_display_clear(cpu->memory) < 0) {
+        return -1;
+    }
+
+    c8_cpu_display_changed(cpu);
+    cpu->stop = C8_CPU_STOP_DRAW;
     return 1;
 }
 
-static int c8_cpu_ret(C8Cpu *cpu)
+static int c8_cpu_cls(C8Cpu *cpu)
+{
+    return c8_cpu_op_cls(cpu);
+}
+
+int c8_cpu_op_ret(C8Cpu *cpu)
 {
     uint16_t addr = 0;
 
@@ -78,6 +221,11 @@ static int c8_cpu_ret(C8Cpu *cpu)
     return 1;
 }
 
+static int c8_cpu_ret(C8Cpu *cpu)
+{
+    return c8_cpu_op_ret(cpu);
+}
+
 static int c8_cpu_jp_i12(C8Cpu *cpu)
 {
     cpu->pc = c8_instruction_get_nnn(cpu->instruction);
@@ -86,22 +234,31 @@ static int c8_cpu_jp_i12(C8Cpu *cpu)
 
 static int c8_cpu_jp_reg_i12(C8Cpu *cpu)
 {
-    cpu->pc = cpu->v[0] + c8_instruction_get_nnn(cpu->instruction);
+    cpu->pc = (cpu->v[0] + c8_instruction_get_nnn(cpu->instruction)) &
+              C8_MEMORY_ADDRESS_MASK;
     return 0;
 }
 
-static int c8_cpu_call(C8Cpu *cpu)
+int c8_cpu_op_call(C8Cpu *cpu, uint16_t nnn)
 {
     if (c8_memory_stack_write(cpu->memory, cpu->sp + 1, cpu->pc) < 0) {
         return -1;
     }
 
     cpu->sp++;
-    cpu->pc = c8_instruction_get_nnn(cpu->instruction);
+    if (cpu->callgraph != NULL) {
+        c8_callgraph_enter(cpu->callgraph, cpu->sp, cpu->pc, nnn);
+    }
+    cpu->pc = nnn;
 
     return 0;
 }
 
+static int c8_cpu_call(C8Cpu *cpu)
+{
+    return c8_cpu_op_call(cpu, c8_instruction_get_nnn(cpu->instruction));
+}
+
 static int c8_cpu_se_i8(C8Cpu *cpu)
 {
     uint8_t x = c8_instruction_get_x(cpu->instruction);
@@ -172,12 +329,12 @@ static int c8_cpu_ld_st_reg(C8Cpu *cpu)
     return 1;
 }
 
-static int c8_cpu_ld_reg_key(C8Cpu *cpu)
+int c8_cpu_op_ld_reg_key(C8Cpu *cpu, uint8_t x)
 {
-    uint8_t x = c8_instruction_get_x(cpu->instruction);
-    C8Key key = c8_keyboard_wait_for_press(cpu->keyboard);
+    C8Key key = c8_keyboard_wait_for_release(cpu->keyboard);
 
     if (key == C8_KEY_NUM) {
+        cpu->stop = C8_CPU_STOP_KEY_WAIT;
         return 0;
     }
 
@@ -185,6 +342,11 @@ static int c8_cpu_ld_reg_key(C8Cpu *cpu)
     return 1;
 }
 
+static int c8_cpu_ld_reg_key(C8Cpu *cpu)
+{
+    return c8_cpu_op_ld_reg_key(cpu, c8_instruction_get_x(cpu->instruction));
+}
+
 static int c8_cpu_ld_reg_sprite(C8Cpu *cpu)
 {
     const uint8_t sprite_size = 5;
@@ -193,9 +355,8 @@ static int c8_cpu_ld_reg_sprite(C8Cpu *cpu)
     return 1;
 }
 
-static int c8_cpu_ld_mem_bcd(C8Cpu *cpu)
+int c8_cpu_op_ld_mem_bcd(C8Cpu *cpu, uint8_t x)
 {
-    uint8_t x = c8_instruction_get_x(cpu->instruction);
     uint8_t value = cpu->v[x];
 
     if (c8_memory_write_i8(cpu->memory, cpu->i, value / 100) < 0) {
@@ -215,10 +376,13 @@ static int c8_cpu_ld_mem_bcd(C8Cpu *cpu)
     return 1;
 }
 
-static int c8_cpu_ld_mem_reg(C8Cpu *cpu)
+static int c8_cpu_ld_mem_bcd(C8Cpu *cpu)
 {
-    uint8_t x = c8_instruction_get_x(cpu->instruction);
+    return c8_cpu_op_ld_mem_bcd(cpu, c8_instruction_get_x(cpu->instruction));
+}
 
+int c8_cpu_op_ld_mem_reg(C8Cpu *cpu, uint8_t x)
+{
     if (c8_memory_write(cpu->memory, cpu->i, cpu->v, x + 1) < 0) {
         return -1;
     }
@@ -226,10 +390,13 @@ static int c8_cpu_ld_mem_reg(C8Cpu *cpu)
     return 1;
 }
 
-static int c8_cpu_ld_reg_mem(C8Cpu *cpu)
+static int c8_cpu_ld_mem_reg(C8Cpu *cpu)
 {
-    uint8_t x = c8_instruction_get_x(cpu->instruction);
+    return c8_cpu_op_ld_mem_reg(cpu, c8_instruction_get_x(cpu->instruction));
+}
 
+int c8_cpu_op_ld_reg_mem(C8Cpu *cpu, uint8_t x)
+{
     if (c8_memory_read(cpu->memory, cpu->i, cpu->v, x + 1) < 0) {
         return -1;
     }
@@ -237,6 +404,11 @@ static int c8_cpu_ld_reg_mem(C8Cpu *cpu)
     return 1;
 }
 
+static int c8_cpu_ld_reg_mem(C8Cpu *cpu)
+{
+    return c8_cpu_op_ld_reg_mem(cpu, c8_instruction_get_x(cpu->instruction));
+}
+
 static int c8_cpu_add_i8(C8Cpu *cpu)
 {
     uint8_t x = c8_instruction_get_x(cpu->instruction);
@@ -331,29 +503,65 @@ static int c8_cpu_shl(C8Cpu *cpu)
     return 1;
 }
 
-static int c8_cpu_rnd(C8Cpu *cpu)
+void c8_cpu_seed(C8Cpu *cpu, uint64_t seed)
 {
-    uint8_t x = c8_instruction_get_x(cpu->instruction);
-    cpu->v[x] <<= rand() & c8_instruction_get_kk(cpu->instruction);
+    cpu->rng = c8_cpu_rng_seed(seed);
+}
+
+void c8_cpu_reset(C8Cpu *cpu)
+{
+    memset(cpu->v, 0, sizeof(cpu->v));
+    cpu->i = 0;
+    cpu->dt = 0;
+    cpu->st = 0;
+    cpu->sp = 0;
+    cpu->pc = c8_memory_program_begin();
+    cpu->instruction = 0;
+    cpu->cycles = 0;
+    cpu->stop = C8_CPU_STOP_BUDGET;
+    c8_keyboard_clear_edges(cpu->keyboard);
+}
+
+int c8_cpu_op_rnd(C8Cpu *cpu, uint8_t x, uint8_t kk)
+{
+    cpu->v[x] = c8_cpu_rng_next(&cpu->rng) & kk;
     return 1;
 }
 
-static int c8_cpu_drw(C8Cpu *cpu)
+static int c8_cpu_rnd(C8Cpu *cpu)
 {
-    uint8_t x = c8_instruction_get_x(cpu->instruction);
-    uint8_t y = c8_instruction_get_y(cpu->instruction);
-    uint8_t n = c8_instruction_get_n(cpu->instruction);
-    uint8_t buf[n];
+    return c8_cpu_op_rnd(cpu, c8_instruction_get_x(cpu->instruction),
+                         c8_instruction_get_kk(cpu->instruction));
+}
+
+int c8_cpu_op_drw(C8Cpu *cpu, uint8_t x, uint8_t y, uint8_t n)
+{
+    /* n is a nibble; a fixed buffer also covers n == 0 */
+    uint8_t buf[15];
 
     if (c8_memory_read(cpu->memory, cpu->i, buf, n) < 0) {
         return -1;
     }
 
-    cpu->v[0xf] = c8_memory_display_write(
-        cpu->memory, cpu->v[x], cpu->v[y], buf, n);
+    int collision = c8_memory_display_write(cpu->memory, cpu->v[x],
+                                            cpu->v[y], buf, n);
+    if (collision < 0) {
+        return -1;
+    }
+
+    cpu->v[0xf] = collision;
+    c8_cpu_display_changed(cpu);
+    cpu->stop = C8_CPU_STOP_DRAW;
     return 1;
 }
 
+static int c8_cpu_drw(C8Cpu *cpu)
+{
+    return c8_cpu_op_drw(cpu, c8_instruction_get_x(cpu->instruction),
+                         c8_instruction_get_y(cpu->instruction),
+                         c8_instruction_get_n(cpu->instruction));
+}
+
 static int c8_cpu_skp(C8Cpu *cpu)
 {
     uint8_t x = c8_instruction_get_x(cpu->instruction);
@@ -505,24 +713,233 @@ static int c8_cpu_execute_instruction_internal(C8Cpu *cpu)
     }
 }
 
-void c8_cpu_execute_instruction(C8Cpu *cpu)
+void c8_cpu_advance(C8Cpu *cpu, int ret)
+{
+    if (ret < 0) {
+        fprintf(stderr, "cpu: bad instruction: 0x%04x\n", cpu->instruction);
+        cpu->pc = (cpu->pc + C8_INSTRUCTION_SIZE) & C8_MEMORY_ADDRESS_MASK;
+        cpu->stop = C8_CPU_STOP_FAULT;
+    } else {
+        cpu->pc = (cpu->pc + C8_INSTRUCTION_SIZE * ret) &
+                  C8_MEMORY_ADDRESS_MASK;
+    }
+}
+
+int c8_cpu_step(C8Cpu *cpu)
 {
     if (c8_memory_program_read(cpu->memory, cpu->pc, &cpu->instruction) < 0) {
-        return;
+        cpu->stop = C8_CPU_STOP_FAULT;
+        return -1;
     }
 
-    int ret = c8_cpu_execute_instruction_internal(cpu);
-    if (ret < 0) {
-        fprintf(stderr, "cpu: bad instruction: 0x%04x\n", cpu->instruction);
-        cpu->pc += C8_INSTRUCTION_SIZE;
+    c8_cpu_advance(cpu, c8_cpu_execute_instruction_internal(cpu));
+    return 0;
+}
+
+static uint32_t c8_cpu_switch_run(C8Cpu *cpu, uint32_t count)
+{
+    uint32_t executed = 0;
+
+    while (executed < count && cpu->stop == C8_CPU_STOP_BUDGET &&
+           c8_cpu_step(cpu) == 0) {
+        executed++;
+    }
+
+    return executed;
+}
+
+void c8_cpu_execute_instruction(C8Cpu *cpu)
+{
+    c8_cpu_run(cpu, 1);
+}
+
+static bool c8_cpu_debugging(C8Cpu *cpu)
+{
+    return cpu->debugger != NULL && c8_debugger_active(cpu->debugger);
+}
+
+/*
+ * The switch engine's loop with every attached observer fed around each
+ * instruction. It is kept apart from the engines so that unobserved runs
+ * don't test for observers on every instruction.
+ */
+static uint32_t c8_cpu_observed_run(C8Cpu *cpu, uint32_t count)
+{
+    bool debugging = c8_cpu_debugging(cpu);
+    uint32_t executed = 0;
+
+    while (executed < count && cpu->stop == C8_CPU_STOP_BUDGET) {
+        uint16_t pc = cpu->pc;
+        uint8_t v[16];
+
+        if (debugging && !c8_debugger_check(cpu)) {
+            break;
+        }
+        if (cpu->profile != NULL) {
+            c8_profile_observe(cpu);
+        }
+        if (cpu->trace != NULL) {
+            memcpy(v, cpu->v, sizeof(v));
+        }
+
+        if (c8_cpu_step(cpu) < 0) {
+            break;
+        }
+
+        if (cpu->trace != NULL) {
+            c8_trace_observe(cpu, pc, v, cpu->cycles + executed);
+        }
+        if (cpu->coverage != NULL) {
+            c8_coverage_observe(cpu, pc);
+        }
+        if (debugging) {
+            c8_debugger_observe(cpu);
+        }
+        executed++;
+    }
+
+    if (cpu->trace != NULL) {
+        c8_trace_publish(cpu->trace);
+    }
+    if (debugging) {
+        c8_debugger_settle(cpu);
+    }
+
+    return executed;
+}
+
+uint32_t c8_cpu_engine_run(C8Cpu *cpu, uint32_t count)
+{
+    if (c8_cpu_debugging(cpu) || cpu->profile != NULL ||
+        cpu->trace != NULL || cpu->coverage != NULL) {
+        return c8_cpu_observed_run(cpu, count);
+    }
+
+    switch (cpu->engine) {
+    case C8_CPU_ENGINE_THREADED:
+        return c8_threaded_run(cpu, count);
+
+    case C8_CPU_ENGINE_JIT:
+        return c8_jit_run(cpu, count);
+
+    case C8_CPU_ENGINE_AOT:
+        return c8_aot_run(cpu, count);
+
+    default:
+        return c8_cpu_switch_run(cpu, count);
+    }
+}
+
+bool c8_cpu_plain(C8Cpu *cpu)
+{
+    return !c8_cpu_debugging(cpu) && cpu->profile == NULL &&
+           cpu->callgraph == NULL && cpu->trace == NULL &&
+           cpu->coverage == NULL;
+}
+
+/*
+ * C8_CPU_STOP_HALT for a jump to itself, which nothing gets the CPU out of,
+ * C8_CPU_STOP_KEY_WAIT for Fx0A with no key released to complete it, and
+ * C8_CPU_STOP_BUDGET when the instruction at PC would do anything.
+ */
+static C8CpuStop c8_cpu_blocked(C8Cpu *cpu, uint16_t *instruction)
+{
+    /* A PC outside the program is the engine's fault to report */
+    if (cpu->pc < c8_memory_program_begin() ||
+        cpu->pc > C8_MEMORY_SIZE - C8_INSTRUCTION_SIZE ||
+        c8_memory_program_read(cpu->memory, cpu->pc, instruction) < 0) {
+        return C8_CPU_STOP_BUDGET;
+    }
+
+    if (*instruction == (0x1000 | cpu->pc)) {
+        return C8_CPU_STOP_HALT;
+    }
+    if ((*instruction & 0xf0ff) == 0xf00a &&
+        c8_keyboard_wait_for_release(cpu->keyboard) == C8_KEY_NUM) {
+        return C8_CPU_STOP_KEY_WAIT;
+    }
+
+    return C8_CPU_STOP_BUDGET;
+}
+
+bool c8_cpu_parked(C8Cpu *cpu)
+{
+    uint16_t instruction = 0;
+
+    return cpu->dt == 0 && cpu->st == 0 && c8_cpu_plain(cpu) &&
+           c8_cpu_blocked(cpu, &instruction) == C8_CPU_STOP_KEY_WAIT;
+}
+
+C8CpuStop c8_cpu_run(C8Cpu *cpu, uint32_t max_cycles)
+{
+    cpu->stop = C8_CPU_STOP_BUDGET;
+
+    /*
+     * A blocked CPU doesn't enter the engine. Unless someone is watching,
+     * only the count shows: the whole budget spins on a halt, and a
+     * waiting Fx0A runs once per call.
+     */
+    if (max_cycles > 0 && c8_cpu_plain(cpu)) {
+        uint16_t instruction = 0;
+        C8CpuStop blocked = c8_cpu_blocked(cpu, &instruction);
+
+        if (blocked != C8_CPU_STOP_BUDGET) {
+            cpu->instruction = instruction;
+            cpu->cycles += blocked == C8_CPU_STOP_HALT ? max_cycles : 1;
+            cpu->stop = blocked;
+            return cpu->stop;
+        }
+    }
+
+    if (cpu->callgraph != NULL) {
+        c8_callgraph_run(cpu, max_cycles);
     } else {
-        cpu->pc += C8_INSTRUCTION_SIZE * ret;
+        cpu->cycles += c8_cpu_engine_run(cpu, max_cycles);
+    }
+
+    return cpu->stop;
+}
+
+C8CpuStop c8_cpu_run_frame(C8Cpu *cpu, uint32_t cycles)
+{
+    C8CpuStop stop = C8_CPU_STOP_BUDGET;
+
+    while (cycles > 0) {
+        uint64_t begin = cpu->cycles;
+
+        stop = c8_cpu_run(cpu, cycles);
+        cycles -= cpu->cycles - begin;
+
+        if (stop == C8_CPU_STOP_BREAK) {
+            /* Time stands still while the debugger has the machine */
+            return stop;
+        }
+        if (stop != C8_CPU_STOP_BUDGET && stop != C8_CPU_STOP_DRAW) {
+            /* Waiting for a key or faulted, retry on the next frame */
+            break;
+        }
+        stop = C8_CPU_STOP_BUDGET;
     }
+
+    c8_delay_timer_tick(cpu);
+    c8_sound_timer_tick(cpu);
+    /* Releases are for the frame that follows them */
+    c8_keyboard_clear_edges(cpu->keyboard);
+
+    if (cpu->debugger != NULL) {
+        c8_debugger_frame(cpu->debugger);
+    }
+    return stop;
 }
 
-bool c8_display_updated(C8Cpu *cpu)
+uint64_t c8_cpu_cycles(C8Cpu *cpu)
 {
-    return (cpu->instruction >> 12) == 0xd;
+    return cpu->cycles;
+}
+
+uint16_t c8_cpu_pc(C8Cpu *cpu)
+{
+    return cpu->pc;
 }
 
 void c8_delay_timer_tick(C8Cpu *cpu)
@@ -535,7 +952,9 @@ void c8_delay_timer_tick(C8Cpu *cpu)
 void c8_sound_timer_tick(C8Cpu *cpu)
 {
     if (cpu->st > 0) {
-        c8_audio_play(cpu->audio);
+        if (cpu->callbacks.sound != NULL) {
+            cpu->callbacks.sound(cpu->callbacks.userdata);
+        }
         cpu->st--;
     }
 }
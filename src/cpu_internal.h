@@ -0,0 +1,182 @@
+#ifndef C8_CPU_INTERNAL_H
+#define C8_CPU_INTERNAL_H
+
+#include "c8/cpu.h"
+
+#include "keyboard_internal.h"
+#include "pool.h"
+
+#include <stdint.h>
+
+typedef struct c8_threaded C8Threaded;
+typedef struct c8_jit C8Jit;
+typedef struct c8_aot C8Aot;
+typedef struct c8_aot_program C8AotProgram;
+typedef struct c8_profile C8Profile;
+typedef struct c8_callgraph C8CallGraph;
+typedef struct c8_trace C8Trace;
+typedef struct c8_debugger C8Debugger;
+
+struct c8_cpu {
+    uint8_t v[16];
+    uint16_t i;
+    uint8_t dt;
+    uint8_t st;
+    uint16_t pc;
+    uint8_t sp;
+
+    C8Memory *memory;
+    C8Keyboard *keyboard;
+    C8CpuCallbacks callbacks;
+
+    uint16_t instruction;
+    uint64_t cycles;
+    /* xorshift64* state, never zero */
+    uint64_t rng;
+    /* Set by instructions that end a c8_cpu_run call early */
+    C8CpuStop stop;
+
+    /* Execution engine */
+    C8CpuEngine engine;
+    C8Threaded *threaded;
+    C8Jit *jit;
+    C8Aot *aot;
+    const C8AotProgram *aot_program;
+
+    /* CPUs forked from one c8_cpu_new, which are allocated from `pool` */
+    C8Pool *pool;
+    /* A fork's own keyboard, `keyboard` points here */
+    C8Keyboard fork_keyboard;
+
+    /* Counters c8_cpu_run executes through when set, see c8/profile.h */
+    C8Profile *profile;
+    /* Sampled at the points c8_cpu_run splits its budget, see c8/callgraph.h */
+    C8CallGraph *callgraph;
+    /* Records what c8_cpu_run executes when set, see c8/trace.h */
+    C8Trace *trace;
+    /* Checked by c8_cpu_run when set, see c8/debugger.h */
+    C8Debugger *debugger;
+    /* Edge counters c8_cpu_run fills when set, see c8/coverage.h */
+    uint8_t *coverage;
+};
+
+/*
+ * Instruction semantics shared by the execution engines. Each returns the
+ * number of instructions to advance PC by, or -1 on a bad instruction, the
+ * same way the handlers behind c8_cpu_execute_instruction do. They set
+ * cpu->stop when the engine has to return after the instruction.
+ *
+ * Engine run functions execute at most `count` instructions and return how
+ * many they executed, stopping right after one that set cpu->stop.
+ */
+int c8_cpu_op_cls(C8Cpu *cpu);
+int c8_cpu_op_ret(C8Cpu *cpu);
+int c8_cpu_op_call(C8Cpu *cpu, uint16_t nnn);
+int c8_cpu_op_rnd(C8Cpu *cpu, uint8_t x, uint8_t kk);
+int c8_cpu_op_drw(C8Cpu *cpu, uint8_t x, uint8_t y, uint8_t n);
+int c8_cpu_op_ld_reg_key(C8Cpu *cpu, uint8_t x);
+int c8_cpu_op_ld_mem_bcd(C8Cpu *cpu, uint8_t x);
+int c8_cpu_op_ld_mem_reg(C8Cpu *cpu, uint8_t x);
+int c8_cpu_op_ld_reg_mem(C8Cpu *cpu, uint8_t x);
+
+/*
+ * The xorshift64* generator behind Cxkk. splitmix64 spreads any seed,
+ * including 0, over the whole state, which must never be zero.
+ */
+static inline uint64_t c8_cpu_rng_seed(uint64_t seed)
+{
+    uint64_t z = seed + 0x9e3779b97f4a7c15;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    z ^= z >> 31;
+
+    return z != 0 ? z : 1;
+}
+
+static inline uint8_t c8_cpu_rng_next(uint64_t *rng)
+{
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+    return (*rng * 0x2545f4914f6cdd1d) >> 56;
+}
+
+/* Advances PC by a handler result, reporting bad instructions. */
+void c8_cpu_advance(C8Cpu *cpu, int ret);
+/*
+ * Fetches and executes one instruction through the switch. Returns -1 and
+ * stops with C8_CPU_STOP_FAULT if PC is outside program memory.
+ */
+int c8_cpu_step(C8Cpu *cpu);
+/*
+ * Whether nothing is watching the CPU execute: no active debugger, profile,
+ * call graph, trace or coverage map. Only then may it skip instructions.
+ */
+bool c8_cpu_plain(C8Cpu *cpu);
+/*
+ * Runs the selected engine, or c8_cpu_step's loop feeding an active
+ * debugger and every attached profile, trace and coverage map.
+ */
+uint32_t c8_cpu_engine_run(C8Cpu *cpu, uint32_t count);
+/* Counts the instruction at PC into cpu->profile, before it executes */
+void c8_profile_observe(C8Cpu *cpu);
+/*
+ * Appends the instruction just executed from `pc` to cpu->trace, `v` being
+ * the registers before it and `count` its number
+ */
+void c8_trace_observe(C8Cpu *cpu, uint16_t pc, const uint8_t *v,
+                      uint64_t count);
+/* Makes the records appended since the last call visible to readers */
+void c8_trace_publish(C8Trace *trace);
+/* Counts the edge from `from` to PC into cpu->coverage */
+void c8_coverage_observe(C8Cpu *cpu, uint16_t from);
+/* Whether the debugger has anything armed or is paused */
+bool c8_debugger_active(C8Debugger *debugger);
+/*
+ * Whether the instruction at PC may execute: false when cpu->debugger is
+ * paused or stops at a breakpoint there
+ */
+bool c8_debugger_check(C8Cpu *cpu);
+/* Checks watchpoints and steps against the instruction just executed */
+void c8_debugger_observe(C8Cpu *cpu);
+/* Turns the stop of a run the debugger paused into C8_CPU_STOP_BREAK */
+void c8_debugger_settle(C8Cpu *cpu);
+/* Counts a frame ended by c8_cpu_run_frame towards c8_debugger_run_frames */
+void c8_debugger_frame(C8Debugger *debugger);
+/*
+ * c8_cpu_engine_run in slices ending at cpu->callgraph's sample points,
+ * adding each slice to cpu->cycles itself
+ */
+uint32_t c8_callgraph_run(C8Cpu *cpu, uint32_t count);
+/* Records a CALL to `entry` from `site` that pushed stack level `sp` */
+void c8_callgraph_enter(C8CallGraph *callgraph, uint8_t sp, uint16_t site,
+                        uint16_t entry);
+
+/*
+ * A threaded engine created from a shared decode table dispatches from it
+ * until the first invalidation or decode, which switch it to a private
+ * copy. Invalidation fails only when that copy can't be allocated.
+ */
+C8Threaded *c8_threaded_new(const C8Threaded *shared);
+C8Threaded *c8_threaded_free(C8Threaded *threaded);
+int c8_threaded_invalidate(C8Threaded *threaded, uint16_t addr, uint16_t len);
+void c8_threaded_predecode(C8Threaded *threaded, C8Memory *memory);
+uint32_t c8_threaded_run(C8Cpu *cpu, uint32_t count);
+/*
+ * The decode table of the image the memory was created from, NULL when
+ * there is none or the memory no longer matches it.
+ */
+const C8Threaded *c8_image_decoded(C8Memory *memory);
+
+/* c8_jit_new returns NULL when the host has no JIT backend. */
+C8Jit *c8_jit_new(void);
+C8Jit *c8_jit_free(C8Jit *jit);
+void c8_jit_invalidate(C8Jit *jit, uint16_t addr, uint16_t len);
+uint32_t c8_jit_run(C8Cpu *cpu, uint32_t count);
+
+C8Aot *c8_aot_new(const C8AotProgram *program);
+C8Aot *c8_aot_free(C8Aot *aot);
+void c8_aot_invalidate(C8Aot *aot, uint16_t addr, uint16_t len);
+uint32_t c8_aot_run(C8Cpu *cpu, uint32_t count);
+
+#endif
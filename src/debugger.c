@@ -0,0 +1,337 @@
+#include "c8/debugger.h"
+
+#include "cpu_internal.h"
+
+#include "c8/instruction.h"
+#include "c8/memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct c8_debugger_watch {
+    uint16_t addr;
+    uint16_t len;
+    /* C8_DEBUGGER_READ and C8_DEBUGGER_WRITE, 0 for a free slot */
+    unsigned access;
+} C8DebuggerWatch;
+
+struct c8_debugger {
+    /* One bit per address */
+    uint64_t breakpoints[C8_MEMORY_SIZE / 64];
+    uint32_t breakpoint_count;
+
+    C8DebuggerWatch watches[C8_DEBUGGER_MAX_WATCHES];
+    uint32_t watch_count;
+    /* One bit per C8DebuggerRegister */
+    uint32_t registers;
+
+    bool paused;
+    /* Run the next instruction even if it is on a breakpoint */
+    bool resuming;
+    /* Instructions and frames left before pausing, 0 for no limit */
+    uint32_t steps;
+    uint32_t frames;
+
+    C8DebuggerEvent event;
+    uint16_t detail;
+
+    /* What c8_debugger_check saw before the instruction now executing */
+    int access;
+    uint16_t before[C8_DEBUGGER_REGISTER_NUM];
+};
+
+C8Debugger *c8_debugger_new(void)
+{
+    C8Debugger *debugger = calloc(1, sizeof(C8Debugger));
+
+    if (debugger == NULL) {
+        fprintf(stderr, "debugger: can't allocate debugger\n");
+        return NULL;
+    }
+
+    return debugger;
+}
+
+C8Debugger *c8_debugger_free(C8Debugger *debugger)
+{
+    free(debugger);
+    return NULL;
+}
+
+void c8_cpu_set_debugger(C8Cpu *cpu, C8Debugger *debugger)
+{
+    cpu->debugger = debugger;
+}
+
+void c8_debugger_set_breakpoint(C8Debugger *debugger, uint16_t addr,
+                                bool enabled)
+{
+    addr &= C8_MEMORY_ADDRESS_MASK;
+    if (c8_debugger_breakpoint(debugger, addr) == enabled) {
+        return;
+    }
+
+    debugger->breakpoints[addr / 64] ^= (uint64_t)1 << (addr % 64);
+    if (enabled) {
+        debugger->breakpoint_count++;
+    } else {
+        debugger->breakpoint_count--;
+    }
+}
+
+bool c8_debugger_breakpoint(C8Debugger *debugger, uint16_t addr)
+{
+    addr &= C8_MEMORY_ADDRESS_MASK;
+    return (debugger->breakpoints[addr / 64] >> (addr % 64)) & 1;
+}
+
+int c8_debugger_watch_memory(C8Debugger *debugger, uint16_t addr,
+                             uint16_t len, unsigned access)
+{
+    access &= C8_DEBUGGER_READ | C8_DEBUGGER_WRITE;
+    /* An empty watch would look like a free slot */
+    if (access == 0 || len == 0) {
+        return -1;
+    }
+
+    for (int id = 0; id < C8_DEBUGGER_MAX_WATCHES; id++) {
+        if (debugger->watches[id].access == 0) {
+            debugger->watches[id] = (C8DebuggerWatch){
+                addr & C8_MEMORY_ADDRESS_MASK, len, access};
+            debugger->watch_count++;
+            return id;
+        }
+    }
+
+    return -1;
+}
+
+void c8_debugger_unwatch_memory(C8Debugger *debugger, int id)
+{
+    if (id >= 0 && id < C8_DEBUGGER_MAX_WATCHES &&
+        debugger->watches[id].access != 0) {
+        debugger->watches[id].access = 0;
+        debugger->watch_count--;
+    }
+}
+
+void c8_debugger_watch_register(C8Debugger *debugger, C8DebuggerRegister reg,
+                                bool enabled)
+{
+    if (enabled) {
+        debugger->registers |= 1u << reg;
+    } else {
+        debugger->registers &= ~(1u << reg);
+    }
+}
+
+static void c8_debugger_stop(C8Debugger *debugger, C8DebuggerEvent event,
+                             uint16_t detail)
+{
+    debugger->paused = true;
+    debugger->steps = 0;
+    debugger->frames = 0;
+    debugger->event = event;
+    debugger->detail = detail;
+}
+
+void c8_debugger_pause(C8Debugger *debugger)
+{
+    c8_debugger_stop(debugger, C8_DEBUGGER_EVENT_PAUSE, 0);
+}
+
+void c8_debugger_continue(C8Debugger *debugger)
+{
+    debugger->paused = false;
+    debugger->resuming = true;
+    debugger->steps = 0;
+    debugger->frames = 0;
+}
+
+void c8_debugger_step(C8Debugger *debugger, uint32_t count)
+{
+    c8_debugger_continue(debugger);
+    debugger->steps = count;
+}
+
+void c8_debugger_run_frames(C8Debugger *debugger, uint32_t count)
+{
+    c8_debugger_continue(debugger);
+    debugger->frames = count;
+}
+
+bool c8_debugger_paused(C8Debugger *debugger)
+{
+    return debugger->paused;
+}
+
+C8DebuggerEvent c8_debugger_event(C8Debugger *debugger, uint16_t *detail)
+{
+    if (detail != NULL) {
+        *detail = debugger->detail;
+    }
+
+    return debugger->event;
+}
+
+uint16_t c8_debugger_register(C8Cpu *cpu, C8DebuggerRegister reg)
+{
+    switch (reg) {
+    case C8_DEBUGGER_I:
+        return cpu->i;
+
+    case C8_DEBUGGER_DT:
+        return cpu->dt;
+
+    case C8_DEBUGGER_ST:
+        return cpu->st;
+
+    case C8_DEBUGGER_SP:
+        return cpu->sp;
+
+    case C8_DEBUGGER_PC:
+        return cpu->pc;
+
+    default:
+        return reg < 16 ? cpu->v[reg] : 0;
+    }
+}
+
+bool c8_debugger_active(C8Debugger *debugger)
+{
+    return debugger->paused || debugger->steps > 0 ||
+           debugger->breakpoint_count > 0 || debugger->watch_count > 0 ||
+           debugger->registers != 0;
+}
+
+void c8_debugger_frame(C8Debugger *debugger)
+{
+    if (debugger->frames > 0 && --debugger->frames == 0) {
+        c8_debugger_stop(debugger, C8_DEBUGGER_EVENT_FRAME, 0);
+    }
+}
+
+/*
+ * The first watched address the instruction about to run reads or writes,
+ * or -1. Only these instructions touch RAM outside of fetching.
+ */
+static int c8_debugger_watched_access(C8Debugger *debugger, C8Cpu *cpu)
+{
+    uint16_t instruction = 0;
+    uint16_t len = 0;
+    unsigned access = 0;
+
+    if (c8_memory_program_read(cpu->memory, cpu->pc, &instruction) < 0) {
+        return -1;
+    }
+
+    if ((instruction >> 12) == 0xd) {
+        len = c8_instruction_get_n(instruction);
+        access = C8_DEBUGGER_READ;
+    } else if ((instruction >> 12) == 0xf) {
+        uint8_t x = c8_instruction_get_x(instruction);
+
+        switch (c8_instruction_get_kk(instruction)) {
+        case 0x33:
+            len = 3;
+            access = C8_DEBUGGER_WRITE;
+            break;
+
+        case 0x55:
+            len = x + 1;
+            access = C8_DEBUGGER_WRITE;
+            break;
+
+        case 0x65:
+            len = x + 1;
+            access = C8_DEBUGGER_READ;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    for (uint16_t k = 0; k < len; k++) {
+        uint16_t addr = (cpu->i + k) & C8_MEMORY_ADDRESS_MASK;
+
+        for (int id = 0; id < C8_DEBUGGER_MAX_WATCHES; id++) {
+            const C8DebuggerWatch *watch = &debugger->watches[id];
+
+            if ((watch->access & access) != 0 && addr >= watch->addr &&
+                addr - watch->addr < watch->len) {
+                return addr;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/* The first watched register whose value differs from `before` */
+static int c8_debugger_changed_register(C8Debugger *debugger, C8Cpu *cpu,
+                                        const uint16_t *before)
+{
+    for (int reg = 0; reg < C8_DEBUGGER_REGISTER_NUM; reg++) {
+        if ((debugger->registers >> reg) & 1 &&
+            c8_debugger_register(cpu, reg) != before[reg]) {
+            return reg;
+        }
+    }
+
+    return -1;
+}
+
+bool c8_debugger_check(C8Cpu *cpu)
+{
+    C8Debugger *debugger = cpu->debugger;
+
+    if (debugger->paused) {
+        return false;
+    }
+    if (!debugger->resuming && c8_debugger_breakpoint(debugger, cpu->pc)) {
+        c8_debugger_stop(debugger, C8_DEBUGGER_EVENT_BREAKPOINT, cpu->pc);
+        return false;
+    }
+    debugger->resuming = false;
+
+    debugger->access = debugger->watch_count > 0
+                           ? c8_debugger_watched_access(debugger, cpu)
+                           : -1;
+    if (debugger->registers != 0) {
+        for (int reg = 0; reg < C8_DEBUGGER_REGISTER_NUM; reg++) {
+            debugger->before[reg] = c8_debugger_register(cpu, reg);
+        }
+    }
+
+    return true;
+}
+
+void c8_debugger_observe(C8Cpu *cpu)
+{
+    C8Debugger *debugger = cpu->debugger;
+    int reg = debugger->registers != 0
+                  ? c8_debugger_changed_register(debugger, cpu,
+                                                 debugger->before)
+                  : -1;
+
+    if (debugger->access >= 0) {
+        c8_debugger_stop(debugger, C8_DEBUGGER_EVENT_MEMORY,
+                         debugger->access);
+    } else if (reg >= 0) {
+        c8_debugger_stop(debugger, C8_DEBUGGER_EVENT_REGISTER, reg);
+    } else if (debugger->steps > 0 && --debugger->steps == 0) {
+        c8_debugger_stop(debugger, C8_DEBUGGER_EVENT_STEP, cpu->pc);
+    }
+}
+
+void c8_debugger_settle(C8Cpu *cpu)
+{
+    C8Debugger *debugger = cpu->debugger;
+
+    /* A fault or key wait is still worth reporting over the pause */
+    if (debugger->paused && (cpu->stop == C8_CPU_STOP_BUDGET ||
+                             cpu->stop == C8_CPU_STOP_DRAW)) {
+        cpu->stop = C8_CPU_STOP_BREAK;
+    }
+}
@@ -0,0 +1,128 @@
+#include "c8/fuzz.h"
+
+#include "c8/keyboard.h"
+#include "c8/memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct c8_fuzz {
+    C8Cpu *cpu;
+    C8Memory *memory;
+    C8Keyboard *keyboard;
+    uint32_t frames;
+
+    uint8_t *map;
+    bool own_map;
+};
+
+C8Fuzz *c8_fuzz_new(uint32_t frames, uint8_t *map)
+{
+    C8Fuzz *fuzz = calloc(1, sizeof(C8Fuzz));
+
+    if (fuzz == NULL) {
+        fprintf(stderr, "fuzz: can't allocate harness\n");
+        return NULL;
+    }
+
+    fuzz->frames = frames;
+    fuzz->map = map;
+    if (fuzz->map == NULL) {
+        fuzz->map = calloc(C8_COVERAGE_SIZE, 1);
+        fuzz->own_map = true;
+    }
+
+    fuzz->memory = c8_memory_new(NULL, 0);
+    fuzz->keyboard = c8_keyboard_new();
+    if (fuzz->map == NULL || fuzz->memory == NULL || fuzz->keyboard == NULL) {
+        fprintf(stderr, "fuzz: can't allocate harness\n");
+        c8_memory_free(fuzz->memory);
+        free(fuzz->keyboard);
+        return c8_fuzz_free(fuzz);
+    }
+
+    fuzz->cpu = c8_cpu_new(fuzz->memory, fuzz->keyboard);
+    if (fuzz->cpu == NULL) {
+        c8_memory_free(fuzz->memory);
+        free(fuzz->keyboard);
+        return c8_fuzz_free(fuzz);
+    }
+
+    c8_cpu_set_coverage(fuzz->cpu, fuzz->map);
+    return fuzz;
+}
+
+C8Fuzz *c8_fuzz_free(C8Fuzz *fuzz)
+{
+    if (fuzz != NULL) {
+        /* The CPU owns the keyboard and memory */
+        c8_cpu_free(fuzz->cpu);
+        if (fuzz->own_map) {
+            free(fuzz->map);
+        }
+        free(fuzz);
+    }
+
+    return NULL;
+}
+
+uint8_t *c8_fuzz_coverage(C8Fuzz *fuzz)
+{
+    return fuzz->map;
+}
+
+C8CpuStop c8_fuzz_run(C8Fuzz *fuzz, const uint8_t *data, size_t size)
+{
+    size_t count = size > 0 ? data[0] : 0;
+    const C8FuzzEvent *events = (const C8FuzzEvent *)(data + 1);
+
+    if (count > (size - (size > 0)) / sizeof(C8FuzzEvent)) {
+        count = (size - (size > 0)) / sizeof(C8FuzzEvent);
+    }
+
+    size_t offset = size > 0 ? 1 + count * sizeof(C8FuzzEvent) : 0;
+    size_t program_size = size - offset;
+    size_t program_limit = C8_MEMORY_SIZE - c8_memory_program_begin();
+    if (program_size > program_limit) {
+        program_size = program_limit;
+    }
+
+    if (c8_memory_reset(fuzz->memory, data + offset, program_size) < 0) {
+        return C8_CPU_STOP_FAULT;
+    }
+    c8_cpu_reset(fuzz->cpu);
+    c8_cpu_seed(fuzz->cpu, 0);
+    for (int key = 0; key < C8_KEY_NUM; key++) {
+        c8_keyboard_release_key(fuzz->keyboard, key);
+    }
+    /* Or a key the last input left held completes the first Fx0A */
+    c8_keyboard_clear_edges(fuzz->keyboard);
+
+    size_t next = 0;
+    uint32_t due = count > 0 ? events[0].delay : 0;
+
+    for (uint32_t frame = 0; frame < fuzz->frames; frame++) {
+        while (next < count && due == frame) {
+            C8Key key = events[next].key & 0xf;
+
+            if (events[next].key & C8_FUZZ_RELEASE) {
+                c8_keyboard_release_key(fuzz->keyboard, key);
+            } else {
+                c8_keyboard_press_key(fuzz->keyboard, key);
+            }
+            if (++next < count) {
+                due += events[next].delay;
+            }
+        }
+
+        C8CpuStop stop = c8_cpu_run_frame(fuzz->cpu, C8_CPU_FRAME_CYCLES);
+        if (stop == C8_CPU_STOP_FAULT) {
+            return stop;
+        }
+        if (stop == C8_CPU_STOP_KEY_WAIT && next == count) {
+            return stop;
+        }
+    }
+
+    return C8_CPU_STOP_BUDGET;
+}
@@ -0,0 +1,571 @@
+#include "c8/c8.h"
+#include "c8/fuzz.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Inputs never grow past a full schedule and a full program */
+#define C8_FUZZ_MAX_INPUT (1 + 255 * 2 + 0xe00)
+#define C8_FUZZ_MAX_CORPUS 65536
+/* Mutations stacked on one input */
+#define C8_FUZZ_MAX_STACK 8
+
+typedef struct c8_fuzz_input {
+    size_t size;
+    uint8_t data[C8_FUZZ_MAX_INPUT];
+} C8FuzzInput;
+
+typedef struct c8_fuzz_options {
+    uint64_t runs;
+    uint64_t seconds;
+    uint32_t frames;
+    uint64_t seed;
+    const char *out;
+    const char *replay;
+    bool verbose;
+    const char **seeds;
+    int seed_count;
+} C8FuzzOptions;
+
+typedef struct c8_fuzz_driver {
+    C8Fuzz *fuzz;
+    uint64_t rng;
+
+    C8FuzzInput **corpus;
+    uint32_t corpus_count;
+
+    /* Hit count buckets seen so far per edge, AFL style */
+    uint8_t seen[C8_COVERAGE_SIZE];
+    uint32_t edges;
+
+    uint64_t faults;
+    uint64_t key_waits;
+} C8FuzzDriver;
+
+/* What the signal handlers need: the input running and where to put it */
+static const C8FuzzInput *volatile c8_fuzz_current;
+static volatile uint64_t c8_fuzz_runs;
+static uint64_t c8_fuzz_watchdog_runs;
+static char c8_fuzz_crash_path[4096];
+
+static uint64_t c8_fuzz_random(C8FuzzDriver *driver)
+{
+    driver->rng ^= driver->rng >> 12;
+    driver->rng ^= driver->rng << 25;
+    driver->rng ^= driver->rng >> 27;
+    return driver->rng * 0x2545f4914f6cdd1d;
+}
+
+static uint32_t c8_fuzz_below(C8FuzzDriver *driver, uint32_t bound)
+{
+    return bound > 0 ? c8_fuzz_random(driver) % bound : 0;
+}
+
+/* Writes the running input next to the corpus, from a signal handler */
+static void c8_fuzz_save_current(const char *suffix)
+{
+    const C8FuzzInput *input = c8_fuzz_current;
+    char path[sizeof(c8_fuzz_crash_path) + 16];
+
+    if (input == NULL) {
+        return;
+    }
+
+    size_t len = strlen(c8_fuzz_crash_path);
+    memcpy(path, c8_fuzz_crash_path, len);
+    memcpy(path + len, suffix, strlen(suffix) + 1);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        ssize_t written = write(fd, input->data, input->size);
+        (void)written;
+        close(fd);
+    }
+}
+
+static void c8_fuzz_on_crash(int sig)
+{
+    c8_fuzz_save_current("crash");
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/* A run that takes a whole watchdog period is a hang in the emulator */
+static void c8_fuzz_on_alarm(int sig)
+{
+    (void)sig;
+
+    if (c8_fuzz_current != NULL && c8_fuzz_runs == c8_fuzz_watchdog_runs) {
+        c8_fuzz_save_current("hang");
+        signal(SIGABRT, SIG_DFL);
+        abort();
+    }
+    c8_fuzz_watchdog_runs = c8_fuzz_runs;
+}
+
+static void c8_fuzz_install_handlers(const char *out)
+{
+    static const int signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+    const struct itimerval watchdog = {{1, 0}, {1, 0}};
+
+    snprintf(c8_fuzz_crash_path, sizeof(c8_fuzz_crash_path), "%s/",
+             out != NULL ? out : ".");
+
+    for (size_t k = 0; k < sizeof(signals) / sizeof(signals[0]); k++) {
+        signal(signals[k], c8_fuzz_on_crash);
+    }
+
+    signal(SIGALRM, c8_fuzz_on_alarm);
+    setitimer(ITIMER_REAL, &watchdog, NULL);
+}
+
+static int c8_fuzz_parse_count(const char *arg, uint64_t *value)
+{
+    char *end = NULL;
+
+    if (arg == NULL) {
+        return -1;
+    }
+
+    *value = strtoull(arg, &end, 10);
+    return *end != '\0' || end == arg ? -1 : 0;
+}
+
+static int c8_fuzz_parse_options(int argc, char *argv[],
+                                 C8FuzzOptions *options)
+{
+    uint64_t frames = C8_FUZZ_DEFAULT_FRAMES;
+
+    options->seeds = calloc(argc, sizeof(char *));
+    if (options->seeds == NULL) {
+        return -1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0) {
+            if (c8_fuzz_parse_count(argv[++i], &options->runs) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-t") == 0) {
+            if (c8_fuzz_parse_count(argv[++i], &options->seconds) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-f") == 0) {
+            if (c8_fuzz_parse_count(argv[++i], &frames) < 0 || frames == 0 ||
+                frames > UINT32_MAX) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-s") == 0) {
+            if (c8_fuzz_parse_count(argv[++i], &options->seed) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-o") == 0) {
+            if ((options->out = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-r") == 0) {
+            if ((options->replay = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-v") == 0) {
+            options->verbose = true;
+        } else if (argv[i][0] == '-') {
+            return -1;
+        } else {
+            options->seeds[options->seed_count++] = argv[i];
+        }
+    }
+
+    options->frames = frames;
+    return 0;
+}
+
+static int c8_fuzz_read(const char *path, C8FuzzInput *input)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "fuzz: can't open %s\n", path);
+        return -1;
+    }
+
+    input->size = fread(input->data, 1, sizeof(input->data), file);
+    fclose(file);
+    return 0;
+}
+
+static void c8_fuzz_write(const char *out, uint32_t id,
+                          const C8FuzzInput *input)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/id-%06u", out, id);
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return;
+    }
+
+    fwrite(input->data, 1, input->size, file);
+    fclose(file);
+}
+
+/* AFL's hit count buckets: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+ */
+static uint8_t c8_fuzz_bucket(uint8_t count)
+{
+    if (count < 4) {
+        return count == 3 ? 4 : count;
+    }
+    if (count < 8) {
+        return 8;
+    }
+    if (count < 16) {
+        return 16;
+    }
+    if (count < 32) {
+        return 32;
+    }
+    return count < 128 ? 64 : 128;
+}
+
+/*
+ * Folds the run's counters into what has been seen, clearing them for the
+ * next run. Returns whether any edge reached a new bucket.
+ */
+static bool c8_fuzz_collect(C8FuzzDriver *driver)
+{
+    uint8_t *map = c8_fuzz_coverage(driver->fuzz);
+    bool novel = false;
+
+    for (uint32_t k = 0; k < C8_COVERAGE_SIZE; k += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, map + k, sizeof(word));
+        if (word == 0) {
+            continue;
+        }
+
+        for (uint32_t j = k; j < k + sizeof(uint64_t); j++) {
+            uint8_t bucket = c8_fuzz_bucket(map[j]);
+
+            if ((bucket & ~driver->seen[j]) != 0) {
+                driver->edges += driver->seen[j] == 0;
+                driver->seen[j] |= bucket;
+                novel = true;
+            }
+        }
+        memset(map + k, 0, sizeof(uint64_t));
+    }
+
+    return novel;
+}
+
+static C8CpuStop c8_fuzz_execute(C8FuzzDriver *driver,
+                                 const C8FuzzInput *input)
+{
+    c8_fuzz_current = input;
+    C8CpuStop stop = c8_fuzz_run(driver->fuzz, input->data, input->size);
+    c8_fuzz_runs++;
+
+    driver->faults += stop == C8_CPU_STOP_FAULT;
+    driver->key_waits += stop == C8_CPU_STOP_KEY_WAIT;
+    return stop;
+}
+
+static int c8_fuzz_add(C8FuzzDriver *driver, const C8FuzzInput *input,
+                       const char *out)
+{
+    if (driver->corpus_count == C8_FUZZ_MAX_CORPUS) {
+        return -1;
+    }
+
+    C8FuzzInput *copy = malloc(sizeof(C8FuzzInput));
+    if (copy == NULL) {
+        fprintf(stderr, "fuzz: can't allocate input\n");
+        return -1;
+    }
+
+    *copy = *input;
+    driver->corpus[driver->corpus_count] = copy;
+    if (out != NULL) {
+        c8_fuzz_write(out, driver->corpus_count, copy);
+    }
+    driver->corpus_count++;
+    return 0;
+}
+
+static size_t c8_fuzz_events(const C8FuzzInput *input)
+{
+    size_t count = input->size > 0 ? input->data[0] : 0;
+    size_t room = input->size > 0 ? (input->size - 1) / 2 : 0;
+
+    return count < room ? count : room;
+}
+
+static void c8_fuzz_insert(C8FuzzInput *input, size_t at, const uint8_t *bytes,
+                           size_t len)
+{
+    if (input->size + len > sizeof(input->data)) {
+        return;
+    }
+
+    memmove(input->data + at + len, input->data + at, input->size - at);
+    memcpy(input->data + at, bytes, len);
+    input->size += len;
+}
+
+static void c8_fuzz_erase(C8FuzzInput *input, size_t at, size_t len)
+{
+    memmove(input->data + at, input->data + at + len,
+            input->size - at - len);
+    input->size -= len;
+}
+
+/* One random edit to the program or the key schedule */
+static void c8_fuzz_mutate(C8FuzzDriver *driver, C8FuzzInput *input)
+{
+    if (input->size == 0) {
+        input->data[input->size++] = 0;
+    }
+
+    size_t events = c8_fuzz_events(input);
+    size_t program = 1 + events * 2;
+    size_t program_size = input->size - program;
+
+    /* Schedules, with the count byte brought in line with the events */
+    input->data[0] = events;
+
+    switch (c8_fuzz_below(driver, program_size > 0 ? 8 : 3)) {
+    case 0: {
+        uint8_t event[2] = {c8_fuzz_below(driver, 16),
+                            c8_fuzz_random(driver) & (C8_FUZZ_RELEASE | 0xf)};
+        if (events < 255) {
+            c8_fuzz_insert(input, 1 + c8_fuzz_below(driver, events + 1) * 2,
+                           event, 2);
+            input->data[0]++;
+        }
+        break;
+    }
+
+    case 1:
+        if (events > 0) {
+            c8_fuzz_erase(input, 1 + c8_fuzz_below(driver, events) * 2, 2);
+            input->data[0]--;
+        }
+        break;
+
+    case 2: {
+        /* A new instruction at the end of the program */
+        uint8_t word[2] = {c8_fuzz_random(driver), c8_fuzz_random(driver)};
+        c8_fuzz_insert(input, input->size, word, 2);
+        break;
+    }
+
+    case 3:
+        input->data[program + c8_fuzz_below(driver, program_size)] ^=
+            1 << c8_fuzz_below(driver, 8);
+        break;
+
+    case 4:
+        input->data[program + c8_fuzz_below(driver, program_size)] =
+            c8_fuzz_random(driver);
+        break;
+
+    case 5: {
+        /* Replaces an instruction's operands, keeping the opcode */
+        size_t at = program + (c8_fuzz_below(driver, program_size) & ~1u);
+        input->data[at] = (input->data[at] & 0xf0) |
+                          (c8_fuzz_random(driver) & 0x0f);
+        if (at + 1 < input->size) {
+            input->data[at + 1] = c8_fuzz_random(driver);
+        }
+        break;
+    }
+
+    case 6: {
+        size_t at = program + c8_fuzz_below(driver, program_size);
+        size_t len = 1 + c8_fuzz_below(driver, input->size - at);
+        c8_fuzz_erase(input, at, len > 4 ? 4 : len);
+        break;
+    }
+
+    default: {
+        /* Splices in bytes of another program */
+        const C8FuzzInput *other =
+            driver->corpus[c8_fuzz_below(driver, driver->corpus_count)];
+        size_t at = program + c8_fuzz_below(driver, program_size);
+        size_t from = c8_fuzz_below(driver, other->size);
+        size_t len = 1 + c8_fuzz_below(driver, 32);
+
+        if (len > other->size - from) {
+            len = other->size - from;
+        }
+        if (len > input->size - at) {
+            len = input->size - at;
+        }
+        memcpy(input->data + at, other->data + from, len);
+        break;
+    }
+    }
+}
+
+static double c8_fuzz_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void c8_fuzz_report(C8FuzzDriver *driver, double elapsed)
+{
+    printf("runs: %llu, %.0f/s, corpus: %u, edges: %u, faults: %llu, "
+           "key waits: %llu\n",
+           (unsigned long long)c8_fuzz_runs,
+           elapsed > 0 ? c8_fuzz_runs / elapsed : 0.0, driver->corpus_count,
+           driver->edges, (unsigned long long)driver->faults,
+           (unsigned long long)driver->key_waits);
+    fflush(stdout);
+}
+
+static int c8_fuzz_replay(C8FuzzDriver *driver, const char *path)
+{
+    static C8FuzzInput input;
+    static const char *const stops[] = {
+        [C8_CPU_STOP_BUDGET] = "ran every frame",
+        [C8_CPU_STOP_DRAW] = "drew",
+        [C8_CPU_STOP_KEY_WAIT] = "waits for a key",
+        [C8_CPU_STOP_FAULT] = "faulted",
+        [C8_CPU_STOP_BREAK] = "stopped in the debugger",
+        [C8_CPU_STOP_HALT] = "halted",
+    };
+
+    if (c8_fuzz_read(path, &input) < 0) {
+        return 1;
+    }
+
+    printf("%s\n", stops[c8_fuzz_execute(driver, &input)]);
+    return 0;
+}
+
+static int c8_fuzz_loop(C8FuzzDriver *driver, const C8FuzzOptions *options)
+{
+    static C8FuzzInput input;
+    double begin = c8_fuzz_now();
+    double report = begin + 1;
+
+    for (int k = 0; k < options->seed_count; k++) {
+        if (c8_fuzz_read(options->seeds[k], &input) < 0) {
+            return 1;
+        }
+        /* Seeds are plain ROMs, run without any keys */
+        c8_fuzz_insert(&input, 0, (const uint8_t[]){0}, 1);
+        c8_fuzz_execute(driver, &input);
+        if (c8_fuzz_collect(driver) && c8_fuzz_add(driver, &input, NULL) < 0) {
+            return 1;
+        }
+    }
+
+    if (driver->corpus_count == 0) {
+        input.size = 1;
+        input.data[0] = 0;
+        c8_fuzz_execute(driver, &input);
+        c8_fuzz_collect(driver);
+        if (c8_fuzz_add(driver, &input, NULL) < 0) {
+            return 1;
+        }
+    }
+
+    while (options->runs == 0 || c8_fuzz_runs < options->runs) {
+        const C8FuzzInput *parent =
+            driver->corpus[c8_fuzz_below(driver, driver->corpus_count)];
+        uint32_t stack = 1 + c8_fuzz_below(driver, C8_FUZZ_MAX_STACK);
+
+        input = *parent;
+        for (uint32_t k = 0; k < stack; k++) {
+            c8_fuzz_mutate(driver, &input);
+        }
+
+        c8_fuzz_execute(driver, &input);
+        if (c8_fuzz_collect(driver)) {
+            c8_fuzz_add(driver, &input, options->out);
+        }
+
+        /* The clock is only read every so often, it costs a system call */
+        if ((c8_fuzz_runs & 0x3ff) == 0) {
+            double now = c8_fuzz_now();
+
+            if (options->seconds > 0 && now - begin >= options->seconds) {
+                break;
+            }
+            if (now >= report) {
+                c8_fuzz_report(driver, now - begin);
+                report = now + 1;
+            }
+        }
+    }
+
+    c8_fuzz_report(driver, c8_fuzz_now() - begin);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    C8FuzzOptions options = {};
+    if (c8_fuzz_parse_options(argc, argv, &options) < 0) {
+        printf("usage: %s [-n runs] [-t seconds] [-f frames] [-s seed] "
+               "[-o corpus dir] [-r input] [-v] [seed ROMs]\n", argv[0]);
+        free(options.seeds);
+        return 1;
+    }
+
+    C8FuzzDriver *driver = calloc(1, sizeof(C8FuzzDriver));
+    if (driver == NULL) {
+        fprintf(stderr, "fuzz: can't allocate driver\n");
+        free(options.seeds);
+        return 1;
+    }
+
+    driver->rng = options.seed * 0x9e3779b97f4a7c15 + 1;
+    driver->corpus = calloc(C8_FUZZ_MAX_CORPUS, sizeof(C8FuzzInput *));
+    driver->fuzz = c8_fuzz_new(options.frames, NULL);
+    if (driver->corpus == NULL || driver->fuzz == NULL) {
+        fprintf(stderr, "fuzz: can't allocate driver\n");
+        c8_fuzz_free(driver->fuzz);
+        free(driver->corpus);
+        free(driver);
+        free(options.seeds);
+        return 1;
+    }
+
+    int status = 0;
+    if (options.replay != NULL) {
+        status = c8_fuzz_replay(driver, options.replay);
+    } else {
+        /*
+         * Faulting programs are the common case and the core reports each
+         * fault on stderr; -v keeps them. Sanitizers write to the file
+         * descriptor and are not affected.
+         */
+        if (!options.verbose && freopen("/dev/null", "w", stderr) == NULL) {
+            status = 1;
+        }
+        c8_fuzz_install_handlers(options.out);
+        if (status == 0) {
+            status = c8_fuzz_loop(driver, &options);
+        }
+    }
+
+    for (uint32_t k = 0; k < driver->corpus_count; k++) {
+        free(driver->corpus[k]);
+    }
+    c8_fuzz_free(driver->fuzz);
+    free(driver->corpus);
+    free(driver);
+    free(options.seeds);
+    return status;
+}
@@ -0,0 +1,26 @@
+#include "c8/fuzz.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * libFuzzer reads extra counters from this section after every input, so
+ * the CHIP-8 program's edges guide it like the emulator's own do.
+ */
+__attribute__((section("__libfuzzer_extra_counters")))
+static uint8_t c8_fuzz_counters[C8_COVERAGE_SIZE];
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static C8Fuzz *fuzz;
+
+    if (fuzz == NULL) {
+        fuzz = c8_fuzz_new(C8_FUZZ_DEFAULT_FRAMES, c8_fuzz_counters);
+        if (fuzz == NULL) {
+            return -1;
+        }
+    }
+
+    c8_fuzz_run(fuzz, data, size);
+    return 0;
+}
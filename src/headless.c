@@ -0,0 +1,497 @@
+#include "c8/aot.h"
+#include "c8/c8.h"
+#include "c8/callgraph.h"
+#include "c8/cpu.h"
+#include "c8/keyboard.h"
+#include "c8/lockstep.h"
+#include "c8/memory.h"
+#include "c8/movie.h"
+#include "c8/profile.h"
+#include "c8/state.h"
+#include "c8/trace.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define C8_HEADLESS_DEFAULT_FRAMES 600
+
+#ifdef C8_AOT_PROGRAM
+extern const C8AotProgram C8_AOT_PROGRAM;
+#endif
+
+typedef struct c8_headless_options {
+    const char *program;
+    uint64_t frames;
+    uint64_t instructions;
+    C8CpuEngine engine;
+    bool quiet;
+    bool stats;
+    bool clip;
+    bool protect;
+    const char *load_state;
+    const char *save_state;
+    const char *movie;
+    const char *profile;
+    const char *callgraph;
+    uint64_t period;
+    const char *trace;
+    uint64_t seed;
+    uint64_t lanes;
+} C8HeadlessOptions;
+
+static void c8_headless_usage(const char *name)
+{
+    printf("usage: %s [-f frames | -n instructions] [-e engine] [-c] [-p] "
+           "[-L state] [-S state] [-m movie] [-P profile] [-G folded stacks] "
+           "[-g period] [-T trace] [-r seed] [-l lanes] [-q] [-s] "
+           "[program]\n", name);
+#ifdef C8_AOT_PROGRAM
+    printf("engines: switch, threaded, jit, aot\n");
+#else
+    printf("engines: switch, threaded, jit\n");
+#endif
+}
+
+static int c8_headless_parse_engine(const char *arg, C8CpuEngine *engine)
+{
+    if (arg == NULL) {
+        return -1;
+    }
+
+    if (strcmp(arg, "switch") == 0) {
+        *engine = C8_CPU_ENGINE_SWITCH;
+    } else if (strcmp(arg, "threaded") == 0) {
+        *engine = C8_CPU_ENGINE_THREADED;
+    } else if (strcmp(arg, "jit") == 0) {
+        *engine = C8_CPU_ENGINE_JIT;
+#ifdef C8_AOT_PROGRAM
+    } else if (strcmp(arg, "aot") == 0) {
+        *engine = C8_CPU_ENGINE_AOT;
+#endif
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int c8_headless_parse_count(const char *arg, uint64_t *value)
+{
+    char *end = NULL;
+
+    if (arg == NULL) {
+        return -1;
+    }
+
+    *value = strtoull(arg, &end, 10);
+    if (*end != '\0' || end == arg) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int c8_headless_parse_options(int argc, char *argv[],
+                                     C8HeadlessOptions *options)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0) {
+            if (c8_headless_parse_count(argv[++i], &options->frames) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-n") == 0) {
+            if (c8_headless_parse_count(argv[++i],
+                                        &options->instructions) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-e") == 0) {
+            if (c8_headless_parse_engine(argv[++i], &options->engine) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-c") == 0) {
+            options->clip = true;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            options->protect = true;
+        } else if (strcmp(argv[i], "-L") == 0) {
+            if ((options->load_state = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-S") == 0) {
+            if ((options->save_state = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-m") == 0) {
+            if ((options->movie = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-P") == 0) {
+            if ((options->profile = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-G") == 0) {
+            if ((options->callgraph = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-g") == 0) {
+            if (c8_headless_parse_count(argv[++i], &options->period) < 0 ||
+                options->period == 0 || options->period > UINT32_MAX) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-T") == 0) {
+            if ((options->trace = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-r") == 0) {
+            if (c8_headless_parse_count(argv[++i], &options->seed) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-l") == 0) {
+            if (c8_headless_parse_count(argv[++i], &options->lanes) < 0 ||
+                options->lanes == 0 || options->lanes > UINT32_MAX) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-q") == 0) {
+            options->quiet = true;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            options->stats = true;
+        } else if (argv[i][0] == '-' || options->program != NULL) {
+            return -1;
+        } else {
+            options->program = argv[i];
+        }
+    }
+
+    if (options->program == NULL) {
+        return -1;
+    }
+
+    /* Lockstep lanes run the switch semantics without any input */
+    if (options->lanes > 0 &&
+        (options->engine != C8_CPU_ENGINE_SWITCH || options->protect ||
+         options->load_state != NULL || options->save_state != NULL ||
+         options->movie != NULL || options->profile != NULL ||
+         options->callgraph != NULL || options->trace != NULL)) {
+        return -1;
+    }
+
+    if (options->frames == 0 && options->instructions == 0) {
+        options->frames = C8_HEADLESS_DEFAULT_FRAMES;
+    }
+
+    return 0;
+}
+
+static double c8_headless_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Replays the movie's input, if any, at the frame boundaries it was seen */
+static uint64_t c8_headless_run(C8Cpu *cpu, C8Keyboard *keyboard,
+                                C8Movie *movie,
+                                const C8HeadlessOptions *options)
+{
+    const uint64_t instructions_per_frame = C8_CPU_FRAME_CYCLES;
+    uint64_t requested = 0;
+    uint64_t executed = 0;
+    uint64_t frames = 0;
+
+    for (;;) {
+        if (options->frames > 0 && frames >= options->frames) {
+            break;
+        }
+        if (options->instructions > 0 && requested >= options->instructions) {
+            break;
+        }
+
+        uint64_t slice = instructions_per_frame;
+        if (options->instructions > 0 &&
+            options->instructions - requested < slice) {
+            slice = options->instructions - requested;
+        }
+
+        uint64_t cycles = c8_cpu_cycles(cpu);
+
+        if (movie != NULL) {
+            c8_movie_play(movie, keyboard, cycles);
+        }
+
+        c8_cpu_run_frame(cpu, slice);
+        executed += c8_cpu_cycles(cpu) - cycles;
+        requested += slice;
+        frames++;
+    }
+
+    return executed;
+}
+
+static void c8_headless_print_display(
+    const uint8_t display[C8_DISPLAY_HEIGHT][C8_DISPLAY_WIDTH / 8])
+{
+
+    for (int y = 0; y < C8_DISPLAY_HEIGHT; y++) {
+        char line[C8_DISPLAY_WIDTH + 1];
+
+        for (int x = 0; x < C8_DISPLAY_WIDTH; x++) {
+            bool on = display[y][x / 8] & (0x80 >> (x % 8));
+            line[x] = on ? '#' : '.';
+        }
+
+        line[C8_DISPLAY_WIDTH] = '\0';
+        puts(line);
+    }
+}
+
+/* Runs the lanes through the same frames, lane k seeded with seed + k */
+static int c8_headless_lockstep(const uint8_t *rom, size_t size,
+                                const C8HeadlessOptions *options)
+{
+    C8Lockstep *lockstep = c8_lockstep_new(rom, size, options->lanes);
+    if (lockstep == NULL) {
+        return 1;
+    }
+
+    if (options->clip) {
+        c8_lockstep_set_display_edge(lockstep, C8_DISPLAY_EDGE_CLIP);
+    }
+    for (uint32_t lane = 0; lane < options->lanes; lane++) {
+        c8_lockstep_seed(lockstep, lane, options->seed + lane);
+    }
+
+    uint64_t requested = 0;
+    uint64_t frames = 0;
+    double begin = c8_headless_now();
+
+    for (;;) {
+        if (options->frames > 0 && frames >= options->frames) {
+            break;
+        }
+        if (options->instructions > 0 && requested >= options->instructions) {
+            break;
+        }
+
+        uint64_t slice = C8_CPU_FRAME_CYCLES;
+        if (options->instructions > 0 &&
+            options->instructions - requested < slice) {
+            slice = options->instructions - requested;
+        }
+
+        c8_lockstep_run_frame(lockstep, slice);
+        requested += slice;
+        frames++;
+    }
+
+    double elapsed = c8_headless_now() - begin;
+
+    if (options->stats) {
+        C8LockstepStats stats;
+        c8_lockstep_stats(lockstep, &stats);
+
+        uint64_t steps = stats.converged + stats.diverged;
+        fprintf(stderr, "lanes: %llu\n", (unsigned long long)options->lanes);
+        fprintf(stderr, "instructions: %llu\n",
+                (unsigned long long)stats.instructions);
+        fprintf(stderr, "converged: %.2f%%\n",
+                steps > 0 ? 100.0 * stats.converged / steps : 0.0);
+        fprintf(stderr, "elapsed: %.6f s\n", elapsed);
+        fprintf(stderr, "lane frames/s: %.0f\n",
+                elapsed > 0 ? frames * options->lanes / elapsed : 0.0);
+        fprintf(stderr, "mips: %.2f\n",
+                elapsed > 0 ? stats.instructions / elapsed / 1e6 : 0.0);
+    }
+
+    if (!options->quiet) {
+        uint8_t display[C8_DISPLAY_HEIGHT][C8_DISPLAY_WIDTH / 8];
+        c8_lockstep_display_read(lockstep, 0, &display[0][0]);
+        c8_headless_print_display(display);
+    }
+
+    c8_lockstep_free(lockstep);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    C8HeadlessOptions options = {};
+    if (c8_headless_parse_options(argc, argv, &options) < 0) {
+        c8_headless_usage(argv[0]);
+        return 1;
+    }
+
+    size_t size = 0;
+    uint8_t *rom = c8_rom_new(options.program, &size);
+    if (rom == NULL) {
+        return 1;
+    }
+
+    if (options.lanes > 0) {
+        int status = c8_headless_lockstep(rom, size, &options);
+        free(rom);
+        return status;
+    }
+
+    C8Movie *movie = NULL;
+    if (options.movie != NULL) {
+        movie = c8_movie_load(options.movie);
+        if (movie == NULL) {
+            free(rom);
+            return 1;
+        }
+        if (!c8_movie_matches_rom(movie, rom, size)) {
+            fprintf(stderr, "headless: movie was recorded with another ROM\n");
+            c8_movie_free(movie);
+            free(rom);
+            return 1;
+        }
+    }
+
+    C8Memory *memory = c8_memory_new(rom, size);
+    free(rom);
+    if (memory == NULL) {
+        c8_movie_free(movie);
+        return 1;
+    }
+
+    if (options.clip) {
+        c8_memory_set_display_edge(memory, C8_DISPLAY_EDGE_CLIP);
+    }
+    c8_memory_set_protected(memory, options.protect);
+
+    C8Keyboard *keyboard = c8_keyboard_new();
+    if (keyboard == NULL) {
+        c8_movie_free(movie);
+        c8_memory_free(memory);
+        return 1;
+    }
+
+    C8Cpu *cpu = c8_cpu_new(memory, keyboard);
+    if (cpu == NULL) {
+        c8_movie_free(movie);
+        free(keyboard);
+        c8_memory_free(memory);
+        return 1;
+    }
+
+    c8_cpu_seed(cpu, movie != NULL ? c8_movie_seed(movie) : options.seed);
+
+#ifdef C8_AOT_PROGRAM
+    if (options.engine == C8_CPU_ENGINE_AOT &&
+        c8_cpu_set_aot_program(cpu, &C8_AOT_PROGRAM) < 0) {
+        c8_movie_free(movie);
+        c8_cpu_free(cpu);
+        return 1;
+    }
+#endif
+
+    if (c8_cpu_set_engine(cpu, options.engine) < 0) {
+        fprintf(stderr, "headless: can't select engine\n");
+        c8_movie_free(movie);
+        c8_cpu_free(cpu);
+        return 1;
+    }
+
+    if (options.load_state != NULL &&
+        c8_state_load_file(cpu, options.load_state) < 0) {
+        c8_movie_free(movie);
+        c8_cpu_free(cpu);
+        return 1;
+    }
+
+    C8Profile *profile = NULL;
+    if (options.profile != NULL) {
+        profile = c8_profile_new();
+        if (profile == NULL) {
+            c8_movie_free(movie);
+            c8_cpu_free(cpu);
+            return 1;
+        }
+        c8_cpu_set_profile(cpu, profile);
+    }
+
+    C8CallGraph *callgraph = NULL;
+    if (options.callgraph != NULL) {
+        callgraph = c8_callgraph_new(options.period);
+        if (callgraph == NULL) {
+            c8_profile_free(profile);
+            c8_movie_free(movie);
+            c8_cpu_free(cpu);
+            return 1;
+        }
+        c8_cpu_set_callgraph(cpu, callgraph);
+    }
+
+    C8Trace *trace = NULL;
+    if (options.trace != NULL) {
+        trace = c8_trace_new(C8_TRACE_DEFAULT_CAPACITY);
+        if (trace == NULL || c8_trace_stream(trace, options.trace) < 0) {
+            c8_trace_free(trace);
+            c8_callgraph_free(callgraph);
+            c8_profile_free(profile);
+            c8_movie_free(movie);
+            c8_cpu_free(cpu);
+            return 1;
+        }
+        c8_cpu_set_trace(cpu, trace);
+    }
+
+    double begin = c8_headless_now();
+    uint64_t executed = c8_headless_run(cpu, keyboard, movie, &options);
+    double elapsed = c8_headless_now() - begin;
+
+    /* Waits for the writer to finish the file */
+    c8_trace_free(trace);
+
+    if (options.stats) {
+        fprintf(stderr, "instructions: %llu\n", (unsigned long long)executed);
+        fprintf(stderr, "elapsed: %.6f s\n", elapsed);
+        fprintf(stderr, "mips: %.2f\n",
+                elapsed > 0 ? executed / elapsed / 1e6 : 0.0);
+    }
+
+    if (!options.quiet) {
+        uint8_t display[C8_DISPLAY_HEIGHT][C8_DISPLAY_WIDTH / 8];
+        c8_memory_display_read(memory, &display[0][0]);
+        c8_headless_print_display(display);
+    }
+
+    if (callgraph != NULL && options.stats) {
+        c8_callgraph_print(callgraph, stderr);
+    }
+
+    if (callgraph != NULL &&
+        c8_callgraph_save_folded(callgraph, options.callgraph) < 0) {
+        c8_callgraph_free(callgraph);
+        c8_profile_free(profile);
+        c8_movie_free(movie);
+        c8_cpu_free(cpu);
+        return 1;
+    }
+    c8_callgraph_free(callgraph);
+
+    if (profile != NULL &&
+        c8_profile_save(profile, options.profile,
+                        c8_profile_format_for(options.profile)) < 0) {
+        c8_profile_free(profile);
+        c8_movie_free(movie);
+        c8_cpu_free(cpu);
+        return 1;
+    }
+    c8_profile_free(profile);
+
+    if (options.save_state != NULL &&
+        c8_state_save_file(cpu, options.save_state) < 0) {
+        c8_movie_free(movie);
+        c8_cpu_free(cpu);
+        return 1;
+    }
+
+    c8_movie_free(movie);
+    c8_cpu_free(cpu);
+    return 0;
+}
@@ -0,0 +1,274 @@
+#include "cpu_internal.h"
+
+#include "c8/instruction.h"
+#include "c8/keyboard.h"
+#include "c8/memory.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Frames simulated while looking for the loop to repeat */
+#define C8_IDLE_WINDOW 16
+
+/*
+ * A frame boundary in the simulation. Registers last loaded from DT, by
+ * Fx07 or copied with 8xy0, are tagged: their values move with DT, so
+ * frames are compared by their offset from it instead.
+ */
+typedef struct c8_idle_state {
+    uint16_t pc;
+    uint16_t i;
+    uint8_t v[16];
+    uint16_t tagged;
+    uint8_t dt;
+} C8IdleState;
+
+typedef struct c8_idle_frame {
+    /* The state the frame started in */
+    C8IdleState begin;
+    uint16_t instruction;
+    /*
+     * Frames after this one until DT reaches a value one of its comparisons
+     * of a tagged register would decide differently, UINT32_MAX for none
+     */
+    uint32_t safe;
+} C8IdleFrame;
+
+static bool c8_idle_same(const C8IdleState *a, const C8IdleState *b)
+{
+    if (a->pc != b->pc || a->i != b->i || a->tagged != b->tagged) {
+        return false;
+    }
+
+    for (int x = 0; x < 16; x++) {
+        bool tagged = (a->tagged >> x) & 1;
+
+        if (tagged ? (uint8_t)(a->v[x] - a->dt) != (uint8_t)(b->v[x] - b->dt)
+                   : a->v[x] != b->v[x]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Notes a comparison of register x with `value`. With x tagged it holds
+ * DT + offset, so it equals `value` once DT comes down to value - offset.
+ */
+static void c8_idle_compare(const C8IdleState *state, C8IdleFrame *frame,
+                            uint8_t x, int value)
+{
+    if (((state->tagged >> x) & 1) == 0) {
+        return;
+    }
+
+    int offset = (uint8_t)(state->v[x] - state->dt);
+    int critical = value - offset;
+
+    if (critical >= 0 && critical <= state->dt &&
+        (uint32_t)(state->dt - critical) < frame->safe) {
+        frame->safe = state->dt - critical;
+    }
+}
+
+/*
+ * Runs one frame of instructions that can only change registers, the way
+ * the switch engine would, into `state`. Returns -1 at the first
+ * instruction that can do more, leaving `state` partly advanced.
+ */
+static int c8_idle_frame(C8Cpu *cpu, C8IdleState *state, C8IdleFrame *frame,
+                         uint32_t cycles)
+{
+    frame->begin = *state;
+    frame->safe = UINT32_MAX;
+
+    for (uint32_t k = 0; k < cycles; k++) {
+        uint16_t instruction = 0;
+
+        /* Outside of it the switch engine would report the fault */
+        if (state->pc < c8_memory_program_begin() ||
+            state->pc > C8_MEMORY_SIZE - C8_INSTRUCTION_SIZE ||
+            c8_memory_program_read(cpu->memory, state->pc, &instruction) < 0) {
+            return -1;
+        }
+
+        uint8_t x = c8_instruction_get_x(instruction);
+        uint8_t y = c8_instruction_get_y(instruction);
+        uint8_t kk = c8_instruction_get_kk(instruction);
+        bool skip = false;
+
+        /* c8_cpu_run stops on it, callers may be looking for that */
+        if (instruction == (0x1000 | state->pc)) {
+            return -1;
+        }
+
+        switch (instruction >> 12) {
+        case 0x1:
+            state->pc = c8_instruction_get_nnn(instruction);
+            frame->instruction = instruction;
+            continue;
+
+        case 0x3:
+        case 0x4:
+            c8_idle_compare(state, frame, x, kk);
+            skip = (state->v[x] == kk) == ((instruction >> 12) == 0x3);
+            break;
+
+        case 0x5:
+        case 0x9:
+            if (c8_instruction_get_n(instruction) != 0) {
+                return -1;
+            }
+            /* Two tagged registers move together and compare the same */
+            if (((state->tagged >> x) & 1) != ((state->tagged >> y) & 1)) {
+                c8_idle_compare(state, frame, x, state->v[y]);
+                c8_idle_compare(state, frame, y, state->v[x]);
+            }
+            skip = (state->v[x] == state->v[y]) == ((instruction >> 12) == 0x5);
+            break;
+
+        case 0x6:
+            state->v[x] = kk;
+            state->tagged &= ~(1u << x);
+            break;
+
+        case 0x8:
+            if (c8_instruction_get_n(instruction) != 0) {
+                return -1;
+            }
+            state->v[x] = state->v[y];
+            state->tagged = (state->tagged & ~(1u << x)) |
+                            (((state->tagged >> y) & 1) << x);
+            break;
+
+        case 0xa:
+            state->i = c8_instruction_get_nnn(instruction);
+            break;
+
+        case 0xe:
+            /* Which key is read must not depend on DT */
+            if ((state->tagged >> x) & 1 || (kk != 0x9e && kk != 0xa1)) {
+                return -1;
+            }
+            skip = c8_keyboard_is_key_pressed(cpu->keyboard, state->v[x]) ==
+                   (kk == 0x9e);
+            break;
+
+        case 0xf:
+            if (kk != 0x07) {
+                return -1;
+            }
+            state->v[x] = state->dt;
+            state->tagged |= 1u << x;
+            break;
+
+        default:
+            return -1;
+        }
+
+        state->pc = (state->pc + C8_INSTRUCTION_SIZE * (skip ? 2 : 1)) &
+                    C8_MEMORY_ADDRESS_MASK;
+        frame->instruction = instruction;
+    }
+
+    if (state->dt > 0) {
+        state->dt--;
+    }
+    return 0;
+}
+
+/* Makes the CPU look as if it had run `frames` frames ending in `state` */
+static void c8_idle_commit(C8Cpu *cpu, const C8IdleState *state,
+                           uint16_t instruction, uint32_t cycles,
+                           uint32_t frames)
+{
+    cpu->pc = state->pc;
+    cpu->i = state->i;
+    cpu->instruction = instruction;
+    cpu->cycles += (uint64_t)cycles * frames;
+
+    /* The timers reach zero within 255 frames, ticking stops mattering */
+    for (uint32_t k = 0; k < frames && (cpu->dt > 0 || cpu->st > 0); k++) {
+        c8_delay_timer_tick(cpu);
+        c8_sound_timer_tick(cpu);
+    }
+    c8_keyboard_clear_edges(cpu->keyboard);
+
+    for (int x = 0; x < 16; x++) {
+        cpu->v[x] = (state->tagged >> x) & 1
+                        ? (uint8_t)(state->v[x] - state->dt + cpu->dt)
+                        : state->v[x];
+    }
+}
+
+uint32_t c8_cpu_skip_idle(C8Cpu *cpu, uint32_t cycles, uint32_t frames)
+{
+    C8IdleFrame window[C8_IDLE_WINDOW];
+
+    /* A debugger counts frames even when it isn't checking instructions */
+    if (cycles == 0 || frames == 0 || cpu->debugger != NULL ||
+        !c8_cpu_plain(cpu)) {
+        return 0;
+    }
+
+    C8IdleState state = {.pc = cpu->pc, .i = cpu->i, .dt = cpu->dt};
+    memcpy(state.v, cpu->v, sizeof(state.v));
+
+    uint32_t run = 0;
+    uint32_t limit = frames < C8_IDLE_WINDOW ? frames : C8_IDLE_WINDOW;
+
+    while (run < limit) {
+        C8IdleState next = state;
+
+        if (c8_idle_frame(cpu, &next, &window[run], cycles) < 0) {
+            break;
+        }
+        state = next;
+        run++;
+
+        for (uint32_t first = 0; first < run; first++) {
+            if (!c8_idle_same(&window[first].begin, &state)) {
+                continue;
+            }
+
+            /*
+             * Frames [first, run) repeat from here on, until DT reaches
+             * zero, which stops it moving, or a value one of them compares
+             * against. With DT already at zero nothing changes any more.
+             */
+            uint32_t period = run - first;
+            uint64_t end = UINT64_MAX;
+
+            if (window[first].begin.dt > 0) {
+                end = first + window[first].begin.dt;
+                for (uint32_t k = first; k < run; k++) {
+                    if (window[k].safe != UINT32_MAX &&
+                        k + window[k].safe < end) {
+                        end = k + window[k].safe;
+                    }
+                }
+            }
+            if (end > frames) {
+                end = frames;
+            }
+            if (end <= run) {
+                c8_idle_commit(cpu, &state, window[run - 1].instruction,
+                               cycles, run);
+                return run;
+            }
+
+            const C8IdleFrame *last =
+                &window[first + (end - 1 - first) % period];
+            state = window[first + (end - first) % period].begin;
+            c8_idle_commit(cpu, &state, last->instruction, cycles, end);
+            return end;
+        }
+    }
+
+    if (run > 0) {
+        c8_idle_commit(cpu, &state, window[run - 1].instruction, cycles, run);
+    }
+    return run;
+}
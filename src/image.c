@@ -0,0 +1,237 @@
+#include "c8/image.h"
+
+#include "cpu_internal.h"
+#include "memory_internal.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define C8_IMAGE_REGISTRY_MIN_BUCKETS 64
+
+struct c8_image {
+    atomic_uint refs;
+    uint64_t hash;
+    uint8_t *program;
+    uint16_t size;
+
+    /* Its pages are what every memory created from the image starts on */
+    C8Memory *memory;
+    C8Threaded *decoded;
+
+    /* Next image in the registry bucket */
+    C8Image *next;
+};
+
+struct c8_image_registry {
+    C8Image **buckets;
+    uint32_t bucket_count;
+    uint32_t count;
+};
+
+/* 64-bit FNV-1a, the same hash movies use to identify ROMs */
+static uint64_t c8_image_hash(const uint8_t *program, uint16_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for (uint16_t k = 0; k < size; k++) {
+        hash = (hash ^ program[k]) * 0x100000001b3;
+    }
+
+    return hash;
+}
+
+C8Image *c8_image_new(const void *program, uint16_t size)
+{
+    C8Image *image = calloc(1, sizeof(C8Image));
+
+    if (image == NULL) {
+        fprintf(stderr, "image: can't allocate image\n");
+        return NULL;
+    }
+
+    atomic_init(&image->refs, 1);
+    image->hash = c8_image_hash(program, size);
+    image->size = size;
+
+    image->program = malloc(size > 0 ? size : 1);
+    if (image->program == NULL) {
+        fprintf(stderr, "image: can't allocate image\n");
+        free(image);
+        return NULL;
+    }
+    memcpy(image->program, program, size);
+
+    image->memory = c8_memory_new(program, size);
+    if (image->memory == NULL) {
+        free(image->program);
+        free(image);
+        return NULL;
+    }
+
+    image->decoded = c8_threaded_new(NULL);
+    if (image->decoded == NULL) {
+        c8_memory_free(image->memory);
+        free(image->program);
+        free(image);
+        return NULL;
+    }
+
+    c8_threaded_predecode(image->decoded, image->memory);
+    c8_memory_share(image->memory);
+
+    return image;
+}
+
+C8Image *c8_image_retain(C8Image *image)
+{
+    atomic_fetch_add_explicit(&image->refs, 1, memory_order_relaxed);
+    return image;
+}
+
+void c8_image_release(C8Image *image)
+{
+    if (image == NULL ||
+        atomic_fetch_sub_explicit(&image->refs, 1, memory_order_acq_rel) > 1) {
+        return;
+    }
+
+    c8_threaded_free(image->decoded);
+    c8_memory_free(image->memory);
+    free(image->program);
+    free(image);
+}
+
+const uint8_t *c8_image_program(C8Image *image, uint16_t *size)
+{
+    *size = image->size;
+    return image->program;
+}
+
+C8Memory *c8_image_memory_new(C8Image *image)
+{
+    return c8_memory_new_shared(image->memory, image);
+}
+
+const C8Threaded *c8_image_decoded(C8Memory *memory)
+{
+    C8Image *image = memory->image;
+
+    if (image == NULL) {
+        return NULL;
+    }
+
+    /* Any page written since is no longer the one the table was built from */
+    for (int k = 0; k < C8_MEMORY_PAGES; k++) {
+        if (memory->ram[k] != image->memory->ram[k]) {
+            return NULL;
+        }
+    }
+
+    return image->decoded;
+}
+
+C8ImageRegistry *c8_image_registry_new(void)
+{
+    C8ImageRegistry *registry = calloc(1, sizeof(C8ImageRegistry));
+
+    if (registry == NULL) {
+        fprintf(stderr, "image: can't allocate registry\n");
+        return NULL;
+    }
+
+    registry->buckets = calloc(C8_IMAGE_REGISTRY_MIN_BUCKETS,
+                               sizeof(C8Image *));
+    if (registry->buckets == NULL) {
+        fprintf(stderr, "image: can't allocate registry\n");
+        free(registry);
+        return NULL;
+    }
+
+    registry->bucket_count = C8_IMAGE_REGISTRY_MIN_BUCKETS;
+    return registry;
+}
+
+C8ImageRegistry *c8_image_registry_free(C8ImageRegistry *registry)
+{
+    if (registry != NULL) {
+        for (uint32_t k = 0; k < registry->bucket_count; k++) {
+            C8Image *image = registry->buckets[k];
+
+            while (image != NULL) {
+                C8Image *next = image->next;
+                c8_image_release(image);
+                image = next;
+            }
+        }
+
+        free(registry->buckets);
+        free(registry);
+    }
+
+    return NULL;
+}
+
+/* Doubles the buckets once there are more images than buckets */
+static void c8_image_registry_grow(C8ImageRegistry *registry)
+{
+    uint32_t bucket_count = registry->bucket_count * 2;
+    C8Image **buckets = calloc(bucket_count, sizeof(C8Image *));
+
+    /* A full table only makes lookups slower */
+    if (buckets == NULL) {
+        return;
+    }
+
+    for (uint32_t k = 0; k < registry->bucket_count; k++) {
+        C8Image *image = registry->buckets[k];
+
+        while (image != NULL) {
+            C8Image *next = image->next;
+            C8Image **bucket = &buckets[image->hash & (bucket_count - 1)];
+
+            image->next = *bucket;
+            *bucket = image;
+            image = next;
+        }
+    }
+
+    free(registry->buckets);
+    registry->buckets = buckets;
+    registry->bucket_count = bucket_count;
+}
+
+C8Image *c8_image_registry_get(C8ImageRegistry *registry, const void *program,
+                               uint16_t size)
+{
+    uint64_t hash = c8_image_hash(program, size);
+    C8Image **bucket =
+        &registry->buckets[hash & (registry->bucket_count - 1)];
+
+    for (C8Image *image = *bucket; image != NULL; image = image->next) {
+        if (image->hash == hash && image->size == size &&
+            memcmp(image->program, program, size) == 0) {
+            return image;
+        }
+    }
+
+    C8Image *image = c8_image_new(program, size);
+    if (image == NULL) {
+        return NULL;
+    }
+
+    image->next = *bucket;
+    *bucket = image;
+
+    if (++registry->count > registry->bucket_count) {
+        c8_image_registry_grow(registry);
+    }
+
+    return image;
+}
+
+uint32_t c8_image_registry_count(C8ImageRegistry *registry)
+{
+    return registry->count;
+}
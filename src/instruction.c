@@ -0,0 +1,126 @@
+#include "c8/instruction.h"
+
+#include <stdio.h>
+
+int c8_instruction_disassemble(uint16_t instruction, char *text, size_t size)
+{
+    static const char *const alu[16] = {
+        [0x0] = "LD", [0x1] = "OR",  [0x2] = "AND",  [0x3] = "XOR",
+        [0x4] = "ADD", [0x5] = "SUB", [0x6] = "SHR", [0x7] = "SUBN",
+        [0xe] = "SHL",
+    };
+
+    uint8_t x = c8_instruction_get_x(instruction);
+    uint8_t y = c8_instruction_get_y(instruction);
+    uint8_t kk = c8_instruction_get_kk(instruction);
+    uint16_t nnn = c8_instruction_get_nnn(instruction);
+
+    switch (instruction >> 12) {
+    case 0x0:
+        if (instruction == 0x00e0) {
+            return snprintf(text, size, "CLS");
+        }
+        if (instruction == 0x00ee) {
+            return snprintf(text, size, "RET");
+        }
+        if ((instruction >> 8) != 0) {
+            return snprintf(text, size, "SYS 0x%03x", nnn);
+        }
+        break;
+
+    case 0x1:
+        return snprintf(text, size, "JP 0x%03x", nnn);
+
+    case 0x2:
+        return snprintf(text, size, "CALL 0x%03x", nnn);
+
+    case 0x3:
+        return snprintf(text, size, "SE V%X, 0x%02x", x, kk);
+
+    case 0x4:
+        return snprintf(text, size, "SNE V%X, 0x%02x", x, kk);
+
+    case 0x5:
+        if ((instruction & 0x00f) == 0) {
+            return snprintf(text, size, "SE V%X, V%X", x, y);
+        }
+        break;
+
+    case 0x6:
+        return snprintf(text, size, "LD V%X, 0x%02x", x, kk);
+
+    case 0x7:
+        return snprintf(text, size, "ADD V%X, 0x%02x", x, kk);
+
+    case 0x8:
+        if (alu[instruction & 0x00f] != NULL) {
+            return snprintf(text, size, "%s V%X, V%X",
+                            alu[instruction & 0x00f], x, y);
+        }
+        break;
+
+    case 0x9:
+        if ((instruction & 0x00f) == 0) {
+            return snprintf(text, size, "SNE V%X, V%X", x, y);
+        }
+        break;
+
+    case 0xa:
+        return snprintf(text, size, "LD I, 0x%03x", nnn);
+
+    case 0xb:
+        return snprintf(text, size, "JP V0, 0x%03x", nnn);
+
+    case 0xc:
+        return snprintf(text, size, "RND V%X, 0x%02x", x, kk);
+
+    case 0xd:
+        return snprintf(text, size, "DRW V%X, V%X, %u", x, y,
+                        c8_instruction_get_n(instruction));
+
+    case 0xe:
+        if (kk == 0x9e) {
+            return snprintf(text, size, "SKP V%X", x);
+        }
+        if (kk == 0xa1) {
+            return snprintf(text, size, "SKNP V%X", x);
+        }
+        break;
+
+    default:
+        switch (kk) {
+        case 0x07:
+            return snprintf(text, size, "LD V%X, DT", x);
+
+        case 0x0a:
+            return snprintf(text, size, "LD V%X, K", x);
+
+        case 0x15:
+            return snprintf(text, size, "LD DT, V%X", x);
+
+        case 0x18:
+            return snprintf(text, size, "LD ST, V%X", x);
+
+        case 0x1e:
+            return snprintf(text, size, "ADD I, V%X", x);
+
+        case 0x29:
+            return snprintf(text, size, "LD F, V%X", x);
+
+        case 0x33:
+            return snprintf(text, size, "LD B, V%X", x);
+
+        case 0x55:
+            return snprintf(text, size, "LD [I], V%X", x);
+
+        case 0x65:
+            return snprintf(text, size, "LD V%X, [I]", x);
+
+        default:
+            break;
+        }
+        break;
+    }
+
+    return snprintf(text, size, "DW 0x%04x", instruction);
+}
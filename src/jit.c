@@ -0,0 +1,514 @@
+#include "cpu_internal.h"
+
+#include <stddef.h>
+
+#if defined(C8_JIT) && defined(__x86_64__) && defined(__unix__)
+
+#include "c8/instruction.h"
+#include "c8/memory.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define C8_JIT_ADDRESS_SPACE 0x1000
+#define C8_JIT_CACHE_SIZE (1 << 20)
+#define C8_JIT_MAX_BLOCK 64
+/* Longest sequence emitted for a single instruction plus block epilogue */
+#define C8_JIT_MAX_OP_SIZE 64
+
+typedef enum c8_jit_block_state {
+    C8_JIT_BLOCK_NONE = 0,
+    /* First instruction has no native translation */
+    C8_JIT_BLOCK_INTERPRET,
+    C8_JIT_BLOCK_NATIVE
+} C8JitBlockState;
+
+typedef void (*C8JitCode)(C8Cpu *cpu);
+
+typedef struct c8_jit_block {
+    C8JitCode code;
+    uint8_t state;
+    uint8_t length;
+} C8JitBlock;
+
+struct c8_jit {
+    uint8_t *cache;
+    size_t used;
+
+    C8JitBlock blocks[C8_JIT_ADDRESS_SPACE];
+    /* Bytes of guest memory translated into some block */
+    bool covered[C8_JIT_ADDRESS_SPACE];
+};
+
+typedef struct c8_jit_emitter {
+    uint8_t *code;
+    size_t size;
+} C8JitEmitter;
+
+/*
+ * Register usage: rdi holds the C8Cpu pointer for the whole block and every
+ * guest field is addressed as [rdi + disp32]. Only rax and rcx are used as
+ * scratch, so blocks need neither a frame nor saved registers.
+ */
+enum {
+    C8_JIT_AL = 0,
+    C8_JIT_CL = 1
+};
+
+#define C8_JIT_V(x) ((int32_t)(offsetof(struct c8_cpu, v) + (x)))
+#define C8_JIT_I ((int32_t)offsetof(struct c8_cpu, i))
+#define C8_JIT_DT ((int32_t)offsetof(struct c8_cpu, dt))
+#define C8_JIT_ST ((int32_t)offsetof(struct c8_cpu, st))
+#define C8_JIT_PC ((int32_t)offsetof(struct c8_cpu, pc))
+#define C8_JIT_INSTRUCTION ((int32_t)offsetof(struct c8_cpu, instruction))
+
+static void c8_jit_emit8(C8JitEmitter *e, uint8_t byte)
+{
+    e->code[e->size++] = byte;
+}
+
+static void c8_jit_emit16(C8JitEmitter *e, uint16_t value)
+{
+    c8_jit_emit8(e, value & 0xff);
+    c8_jit_emit8(e, value >> 8);
+}
+
+static void c8_jit_emit32(C8JitEmitter *e, int32_t value)
+{
+    c8_jit_emit16(e, (uint32_t)value & 0xffff);
+    c8_jit_emit16(e, (uint32_t)value >> 16);
+}
+
+/* ModRM for [rdi + disp32] with the given reg field, then the disp32 */
+static void c8_jit_emit_mem(C8JitEmitter *e, uint8_t reg, int32_t disp)
+{
+    c8_jit_emit8(e, 0x80 | (reg << 3) | 0x07);
+    c8_jit_emit32(e, disp);
+}
+
+/* <opcode> r8, [rdi + disp] or <opcode> [rdi + disp], r8 */
+static void c8_jit_emit_op_mem(C8JitEmitter *e, uint8_t opcode, uint8_t reg,
+                               int32_t disp)
+{
+    c8_jit_emit8(e, opcode);
+    c8_jit_emit_mem(e, reg, disp);
+}
+
+/* mov byte [rdi + disp], imm8 */
+static void c8_jit_emit_store_i8(C8JitEmitter *e, int32_t disp, uint8_t imm)
+{
+    c8_jit_emit8(e, 0xc6);
+    c8_jit_emit_mem(e, 0, disp);
+    c8_jit_emit8(e, imm);
+}
+
+/* mov word [rdi + disp], imm16 */
+static void c8_jit_emit_store_i16(C8JitEmitter *e, int32_t disp,
+                                  uint16_t imm)
+{
+    c8_jit_emit8(e, 0x66);
+    c8_jit_emit8(e, 0xc7);
+    c8_jit_emit_mem(e, 0, disp);
+    c8_jit_emit16(e, imm);
+}
+
+/* movzx eax, byte [rdi + disp] */
+static void c8_jit_emit_load_zx(C8JitEmitter *e, int32_t disp)
+{
+    c8_jit_emit8(e, 0x0f);
+    c8_jit_emit8(e, 0xb6);
+    c8_jit_emit_mem(e, C8_JIT_AL, disp);
+}
+
+/* mov byte [rdi + dst], byte [rdi + src] through al */
+static void c8_jit_emit_move8(C8JitEmitter *e, int32_t dst, int32_t src)
+{
+    c8_jit_emit_op_mem(e, 0x8a, C8_JIT_AL, src);
+    c8_jit_emit_op_mem(e, 0x88, C8_JIT_AL, dst);
+}
+
+/* setcc cl; mov [VF], cl */
+static void c8_jit_emit_set_vf(C8JitEmitter *e, uint8_t setcc)
+{
+    c8_jit_emit8(e, 0x0f);
+    c8_jit_emit8(e, setcc);
+    c8_jit_emit8(e, 0xc1);
+    c8_jit_emit_op_mem(e, 0x88, C8_JIT_CL, C8_JIT_V(0xf));
+}
+
+/*
+ * VF is written before the result, exactly like the interpreter, and the
+ * operands are reloaded afterwards so x or y being F behaves the same.
+ */
+static void c8_jit_emit_arith(C8JitEmitter *e, uint8_t opcode, uint8_t setcc,
+                              uint8_t dst, uint8_t src)
+{
+    if (opcode == 0x02) {
+        /* add al, [src]; setc */
+        c8_jit_emit_op_mem(e, 0x8a, C8_JIT_AL, C8_JIT_V(dst));
+        c8_jit_emit_op_mem(e, 0x02, C8_JIT_AL, C8_JIT_V(src));
+    } else {
+        /* cmp al, [src]; seta */
+        c8_jit_emit_op_mem(e, 0x8a, C8_JIT_AL, C8_JIT_V(dst));
+        c8_jit_emit_op_mem(e, 0x3a, C8_JIT_AL, C8_JIT_V(src));
+    }
+    c8_jit_emit_set_vf(e, setcc);
+
+    c8_jit_emit_op_mem(e, 0x8a, C8_JIT_AL, C8_JIT_V(dst));
+    c8_jit_emit_op_mem(e, opcode, C8_JIT_AL, C8_JIT_V(src));
+    c8_jit_emit_op_mem(e, 0x88, C8_JIT_AL, C8_JIT_V(dst));
+}
+
+/* VF = Vx & mask; shift Vx by one with the given ModRM reg extension */
+static void c8_jit_emit_shift(C8JitEmitter *e, uint8_t x, uint8_t mask,
+                              uint8_t ext)
+{
+    c8_jit_emit_op_mem(e, 0x8a, C8_JIT_AL, C8_JIT_V(x));
+    c8_jit_emit8(e, 0x24);
+    c8_jit_emit8(e, mask);
+    c8_jit_emit_op_mem(e, 0x88, C8_JIT_AL, C8_JIT_V(0xf));
+    c8_jit_emit8(e, 0xd0);
+    c8_jit_emit_mem(e, ext, C8_JIT_V(x));
+}
+
+/*
+ * Emits a straight-line instruction. Returns false if the instruction has
+ * no native translation or transfers control, ending the block before it.
+ */
+static bool c8_jit_emit_simple(C8JitEmitter *e, uint16_t instruction)
+{
+    uint8_t x = c8_instruction_get_x(instruction);
+    uint8_t y = c8_instruction_get_y(instruction);
+    uint8_t kk = c8_instruction_get_kk(instruction);
+
+    switch (instruction >> 12) {
+    case 0x6:
+        c8_jit_emit_store_i8(e, C8_JIT_V(x), kk);
+        return true;
+
+    case 0x7:
+        /* add byte [Vx], imm8 */
+        c8_jit_emit8(e, 0x80);
+        c8_jit_emit_mem(e, 0, C8_JIT_V(x));
+        c8_jit_emit8(e, kk);
+        return true;
+
+    case 0x8:
+        switch (instruction & 0x00f) {
+        case 0x0:
+            c8_jit_emit_move8(e, C8_JIT_V(x), C8_JIT_V(y));
+            return true;
+
+        case 0x1:
+        case 0x2:
+        case 0x3: {
+            static const uint8_t opcodes[] = {0x08, 0x20, 0x30};
+            c8_jit_emit_op_mem(e, 0x8a, C8_JIT_AL, C8_JIT_V(y));
+            c8_jit_emit_op_mem(e, opcodes[(instruction & 0x00f) - 1],
+                               C8_JIT_AL, C8_JIT_V(x));
+            return true;
+        }
+
+        case 0x4:
+            c8_jit_emit_arith(e, 0x02, 0x92, x, y);
+            return true;
+
+        case 0x5:
+            c8_jit_emit_arith(e, 0x2a, 0x97, x, y);
+            return true;
+
+        case 0x6:
+            c8_jit_emit_shift(e, x, 0x01, 5);
+            return true;
+
+        case 0x7:
+            c8_jit_emit_arith(e, 0x2a, 0x97, y, x);
+            return true;
+
+        case 0xe:
+            c8_jit_emit_shift(e, x, 0x80, 4);
+            return true;
+
+        default:
+            return false;
+        }
+
+    case 0xa:
+        c8_jit_emit_store_i16(e, C8_JIT_I,
+                              c8_instruction_get_nnn(instruction));
+        return true;
+
+    case 0xf:
+        switch (kk) {
+        case 0x07:
+            c8_jit_emit_move8(e, C8_JIT_V(x), C8_JIT_DT);
+            return true;
+
+        case 0x15:
+            c8_jit_emit_move8(e, C8_JIT_DT, C8_JIT_V(x));
+            return true;
+
+        case 0x18:
+            c8_jit_emit_move8(e, C8_JIT_ST, C8_JIT_V(x));
+            return true;
+
+        case 0x1e:
+            /* add word [I], ax */
+            c8_jit_emit_load_zx(e, C8_JIT_V(x));
+            c8_jit_emit8(e, 0x66);
+            c8_jit_emit_op_mem(e, 0x01, C8_JIT_AL, C8_JIT_I);
+            return true;
+
+        case 0x29:
+            /* lea eax, [rax + rax * 4]; mov word [I], ax */
+            c8_jit_emit_load_zx(e, C8_JIT_V(x));
+            c8_jit_emit8(e, 0x8d);
+            c8_jit_emit8(e, 0x04);
+            c8_jit_emit8(e, 0x80);
+            c8_jit_emit8(e, 0x66);
+            c8_jit_emit_op_mem(e, 0x89, C8_JIT_AL, C8_JIT_I);
+            return true;
+
+        default:
+            return false;
+        }
+
+    default:
+        return false;
+    }
+}
+
+/*
+ * Emits a block terminator that sets PC itself: jumps and skips. Returns
+ * false for anything left to the interpreter.
+ */
+static bool c8_jit_emit_branch(C8JitEmitter *e, uint16_t instruction,
+                               uint16_t pc)
+{
+    uint8_t x = c8_instruction_get_x(instruction);
+    uint8_t y = c8_instruction_get_y(instruction);
+    uint8_t jcc = 0;
+
+    switch (instruction >> 12) {
+    case 0x1:
+        c8_jit_emit_store_i16(e, C8_JIT_PC,
+                              c8_instruction_get_nnn(instruction));
+        return true;
+
+    case 0x3:
+    case 0x4:
+        /* cmp byte [Vx], imm8 */
+        c8_jit_emit8(e, 0x80);
+        c8_jit_emit_mem(e, 7, C8_JIT_V(x));
+        c8_jit_emit8(e, c8_instruction_get_kk(instruction));
+        jcc = (instruction >> 12) == 0x3 ? 0x75 : 0x74;
+        break;
+
+    case 0x5:
+        if ((instruction & 0x00f) != 0) {
+            return false;
+        }
+        /* fall through */
+    case 0x9:
+        c8_jit_emit_op_mem(e, 0x8a, C8_JIT_AL, C8_JIT_V(x));
+        c8_jit_emit_op_mem(e, 0x3a, C8_JIT_AL, C8_JIT_V(y));
+        jcc = (instruction >> 12) == 0x5 ? 0x75 : 0x74;
+        break;
+
+    default:
+        return false;
+    }
+
+    /*
+     * PC = next; j<not taken> over; PC = next + 2. mov doesn't touch the
+     * flags, so the compare can come first.
+     */
+    c8_jit_emit_store_i16(e, C8_JIT_PC,
+                          (pc + C8_INSTRUCTION_SIZE) & C8_MEMORY_ADDRESS_MASK);
+    c8_jit_emit8(e, jcc);
+    c8_jit_emit8(e, 9);
+    c8_jit_emit_store_i16(e, C8_JIT_PC, (pc + 2 * C8_INSTRUCTION_SIZE) &
+                                            C8_MEMORY_ADDRESS_MASK);
+    return true;
+}
+
+static void c8_jit_flush(C8Jit *jit)
+{
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->covered, 0, sizeof(jit->covered));
+    jit->used = 0;
+}
+
+static void c8_jit_compile(C8Jit *jit, C8Memory *memory, uint16_t begin)
+{
+    C8JitBlock *block = &jit->blocks[begin];
+
+    if (jit->used + C8_JIT_MAX_BLOCK * C8_JIT_MAX_OP_SIZE >
+        C8_JIT_CACHE_SIZE) {
+        c8_jit_flush(jit);
+    }
+
+    if (mprotect(jit->cache, C8_JIT_CACHE_SIZE, PROT_READ | PROT_WRITE) < 0) {
+        block->state = C8_JIT_BLOCK_INTERPRET;
+        return;
+    }
+
+    C8JitEmitter e = {
+        .code = jit->cache + jit->used,
+        .size = 0
+    };
+    uint16_t pc = begin;
+    uint16_t instruction = 0;
+    uint16_t last = 0;
+    uint8_t length = 0;
+    bool branched = false;
+
+    while (length < C8_JIT_MAX_BLOCK && pc + 1 < C8_JIT_ADDRESS_SPACE &&
+           c8_memory_program_read(memory, pc, &instruction) == 0) {
+        if (c8_jit_emit_simple(&e, instruction)) {
+            pc += C8_INSTRUCTION_SIZE;
+        } else if (c8_jit_emit_branch(&e, instruction, pc)) {
+            branched = true;
+            pc += C8_INSTRUCTION_SIZE;
+        } else {
+            break;
+        }
+
+        last = instruction;
+        length++;
+        if (branched) {
+            break;
+        }
+    }
+
+    if (length == 0) {
+        block->state = C8_JIT_BLOCK_INTERPRET;
+    } else {
+        if (!branched) {
+            c8_jit_emit_store_i16(&e, C8_JIT_PC, pc & C8_MEMORY_ADDRESS_MASK);
+        }
+        c8_jit_emit_store_i16(&e, C8_JIT_INSTRUCTION, last);
+        c8_jit_emit8(&e, 0xc3);
+
+        block->code = (C8JitCode)(void *)e.code;
+        block->state = C8_JIT_BLOCK_NATIVE;
+        block->length = length;
+        memset(&jit->covered[begin], true, pc - begin);
+
+        jit->used += (e.size + 15) & ~(size_t)15;
+    }
+
+    mprotect(jit->cache, C8_JIT_CACHE_SIZE, PROT_READ | PROT_EXEC);
+}
+
+C8Jit *c8_jit_new(void)
+{
+    C8Jit *jit = calloc(1, sizeof(C8Jit));
+
+    if (jit == NULL) {
+        fprintf(stderr, "jit: can't allocate jit\n");
+        return NULL;
+    }
+
+    jit->cache = mmap(NULL, C8_JIT_CACHE_SIZE, PROT_READ | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->cache == MAP_FAILED) {
+        fprintf(stderr, "jit: can't map code cache\n");
+        free(jit);
+        return NULL;
+    }
+
+    return jit;
+}
+
+C8Jit *c8_jit_free(C8Jit *jit)
+{
+    if (jit != NULL) {
+        munmap(jit->cache, C8_JIT_CACHE_SIZE);
+        free(jit);
+    }
+
+    return NULL;
+}
+
+void c8_jit_invalidate(C8Jit *jit, uint16_t addr, uint16_t len)
+{
+    uint32_t end = (uint32_t)addr + len;
+
+    if (end > C8_JIT_ADDRESS_SPACE) {
+        end = C8_JIT_ADDRESS_SPACE;
+    }
+
+    /* Self-modifying code is rare, dropping everything keeps this simple */
+    for (uint32_t a = addr; a < end; a++) {
+        if (jit->covered[a]) {
+            c8_jit_flush(jit);
+            return;
+        }
+    }
+}
+
+uint32_t c8_jit_run(C8Cpu *cpu, uint32_t count)
+{
+    C8Jit *jit = cpu->jit;
+    uint32_t executed = 0;
+
+    while (executed < count) {
+        C8JitBlock *block = NULL;
+
+        if (cpu->pc < C8_JIT_ADDRESS_SPACE) {
+            block = &jit->blocks[cpu->pc];
+            if (block->state == C8_JIT_BLOCK_NONE) {
+                c8_jit_compile(jit, cpu->memory, cpu->pc);
+            }
+        }
+
+        /* Never overrun the budget, the tail runs one by one instead */
+        if (block != NULL && block->state == C8_JIT_BLOCK_NATIVE &&
+            block->length <= count - executed) {
+            block->code(cpu);
+            executed += block->length;
+        } else if (c8_cpu_step(cpu) == 0) {
+            executed++;
+            if (cpu->stop != C8_CPU_STOP_BUDGET) {
+                break;
+            }
+        } else {
+            break;
+        }
+    }
+
+    return executed;
+}
+
+#else
+
+C8Jit *c8_jit_new(void)
+{
+    return NULL;
+}
+
+C8Jit *c8_jit_free(C8Jit *jit)
+{
+    (void)jit;
+    return NULL;
+}
+
+void c8_jit_invalidate(C8Jit *jit, uint16_t addr, uint16_t len)
+{
+    (void)jit;
+    (void)addr;
+    (void)len;
+}
+
+uint32_t c8_jit_run(C8Cpu *cpu, uint32_t count)
+{
+    (void)cpu;
+    (void)count;
+    return 0;
+}
+
+#endif
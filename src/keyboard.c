@@ -1,12 +1,10 @@
 #include "c8/keyboard.h"
 
+#include "keyboard_internal.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 
-struct c8_keyboard {
-    bool keys[C8_KEY_NUM];
-};
-
 C8Keyboard *c8_keyboard_new(void)
 {
     C8Keyboard *keyboard = calloc(sizeof(C8Keyboard), 1);
@@ -19,18 +17,29 @@ C8Keyboard *c8_keyboard_new(void)
     return keyboard;
 }
 
-void c8_keyboard_press_key(C8Keyboard *keyboard, C8Key key)
+/* Presses and releases that don't change the key are no events */
+static void c8_keyboard_set_key(C8Keyboard *keyboard, C8Key key, bool pressed)
 {
-    if (key < C8_KEY_NUM) {
-        keyboard->keys[key] = true;
+    if (key >= C8_KEY_NUM || keyboard->keys[key] == pressed) {
+        return;
     }
+
+    keyboard->keys[key] = pressed;
+    if (pressed) {
+        keyboard->pressed |= 1u << key;
+    } else {
+        keyboard->released |= 1u << key;
+    }
+}
+
+void c8_keyboard_press_key(C8Keyboard *keyboard, C8Key key)
+{
+    c8_keyboard_set_key(keyboard, key, true);
 }
 
 void c8_keyboard_release_key(C8Keyboard *keyboard, C8Key key)
 {
-    if (key < C8_KEY_NUM) {
-        keyboard->keys[key] = false;
-    }
+    c8_keyboard_set_key(keyboard, key, false);
 }
 
 bool c8_keyboard_is_key_pressed(C8Keyboard *keyboard, C8Key key)
@@ -38,6 +47,8 @@ bool c8_keyboard_is_key_pressed(C8Keyboard *keyboard, C8Key key)
     if (key < C8_KEY_NUM) {
         return keyboard->keys[key];
     }
+
+    return false;
 }
 
 C8Key c8_keyboard_wait_for_press(C8Keyboard *keyboard)
@@ -50,3 +61,30 @@ C8Key c8_keyboard_wait_for_press(C8Keyboard *keyboard)
 
     return C8_KEY_NUM;
 }
+
+C8Key c8_keyboard_wait_for_release(C8Keyboard *keyboard)
+{
+    for (C8Key key = 0; key < C8_KEY_NUM; key++) {
+        if ((keyboard->released >> key) & 1) {
+            return key;
+        }
+    }
+
+    return C8_KEY_NUM;
+}
+
+uint16_t c8_keyboard_pressed_edges(C8Keyboard *keyboard)
+{
+    return keyboard->pressed;
+}
+
+uint16_t c8_keyboard_released_edges(C8Keyboard *keyboard)
+{
+    return keyboard->released;
+}
+
+void c8_keyboard_clear_edges(C8Keyboard *keyboard)
+{
+    keyboard->pressed = 0;
+    keyboard->released = 0;
+}
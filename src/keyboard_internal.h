@@ -0,0 +1,16 @@
+#ifndef C8_KEYBOARD_INTERNAL_H
+#define C8_KEYBOARD_INTERNAL_H
+
+#include "c8/keyboard.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct c8_keyboard {
+    bool keys[C8_KEY_NUM];
+    /* Bit n is set when key n went down or up since the edges were cleared */
+    uint16_t pressed;
+    uint16_t released;
+};
+
+#endif
@@ -0,0 +1,816 @@
+#include "c8/lockstep.h"
+
+#include "cpu_internal.h"
+
+#include "c8/c8.h"
+#include "c8/instruction.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Lane arrays are padded to a multiple of this with lanes that never run */
+#define C8_LOCKSTEP_LANE_BLOCK 32
+
+#define C8_LOCKSTEP_STACK_SIZE 16
+
+/*
+ * Element `lane` of an array with one row per register, stack slot, address
+ * or display row lives at [row * stride + lane], so a row is contiguous
+ * across lanes and the kernels below walk it with unit stride.
+ */
+struct c8_lockstep {
+    uint32_t lanes;
+    uint32_t stride;
+    C8DisplayEdge edge;
+
+    uint8_t *v;
+    uint16_t *i;
+    uint16_t *pc;
+    uint8_t *dt;
+    uint8_t *st;
+    uint8_t *sp;
+    uint16_t *stack;
+    uint64_t *rng;
+    uint64_t *cycles;
+    /* Bit k is set while key k is held */
+    uint16_t *keys;
+    /* Bit k is set when key k was released since the last frame */
+    uint16_t *released;
+    uint8_t *ram;
+    uint64_t *display;
+
+    /* 0xff for the lanes taking part in the current step, 0 otherwise */
+    uint8_t *mask;
+    uint8_t *stop;
+    /* Per-lane condition of the skip instruction being executed */
+    uint8_t *skip;
+    /* Set when a lane stopped during the current step */
+    bool stopped;
+
+    C8LockstepStats stats;
+};
+
+static uint8_t c8_lockstep_select8(uint8_t mask, uint8_t value, uint8_t old)
+{
+    return (value & mask) | (old & ~mask);
+}
+
+static uint16_t c8_lockstep_select16(uint8_t mask, uint16_t value,
+                                     uint16_t old)
+{
+    uint16_t wide = (uint16_t)(int8_t)mask;
+    return (value & wide) | (old & ~wide);
+}
+
+static uint8_t *c8_lockstep_byte(C8Lockstep *lockstep, uint32_t addr,
+                                 uint32_t lane)
+{
+    return &lockstep->ram[(addr & C8_MEMORY_ADDRESS_MASK) * lockstep->stride +
+                          lane];
+}
+
+C8Lockstep *c8_lockstep_new(const void *program, uint16_t size,
+                            uint32_t lanes)
+{
+    if (lanes == 0) {
+        fprintf(stderr, "lockstep: need at least one lane\n");
+        return NULL;
+    }
+
+    /* Lay out RAM exactly like a fresh C8Memory */
+    C8Memory *image = c8_memory_new(program, size);
+    if (image == NULL) {
+        return NULL;
+    }
+
+    C8Lockstep *lockstep = calloc(1, sizeof(C8Lockstep));
+    if (lockstep == NULL) {
+        fprintf(stderr, "lockstep: can't allocate lockstep\n");
+        c8_memory_free(image);
+        return NULL;
+    }
+
+    size_t stride = (lanes + C8_LOCKSTEP_LANE_BLOCK - 1) /
+                    C8_LOCKSTEP_LANE_BLOCK * C8_LOCKSTEP_LANE_BLOCK;
+
+    lockstep->lanes = lanes;
+    lockstep->stride = stride;
+    lockstep->v = calloc(16 * stride, sizeof(uint8_t));
+    lockstep->i = calloc(stride, sizeof(uint16_t));
+    lockstep->pc = calloc(stride, sizeof(uint16_t));
+    lockstep->dt = calloc(stride, sizeof(uint8_t));
+    lockstep->st = calloc(stride, sizeof(uint8_t));
+    lockstep->sp = calloc(stride, sizeof(uint8_t));
+    lockstep->stack = calloc(C8_LOCKSTEP_STACK_SIZE * stride,
+                             sizeof(uint16_t));
+    lockstep->rng = calloc(stride, sizeof(uint64_t));
+    lockstep->cycles = calloc(stride, sizeof(uint64_t));
+    lockstep->keys = calloc(stride, sizeof(uint16_t));
+    lockstep->released = calloc(stride, sizeof(uint16_t));
+    lockstep->ram = malloc(C8_MEMORY_SIZE * stride);
+    lockstep->display = calloc(C8_DISPLAY_HEIGHT * stride, sizeof(uint64_t));
+    lockstep->mask = calloc(stride, sizeof(uint8_t));
+    lockstep->stop = calloc(stride, sizeof(uint8_t));
+    lockstep->skip = calloc(stride, sizeof(uint8_t));
+
+    if (lockstep->v == NULL || lockstep->i == NULL || lockstep->pc == NULL ||
+        lockstep->dt == NULL || lockstep->st == NULL || lockstep->sp == NULL ||
+        lockstep->stack == NULL || lockstep->rng == NULL ||
+        lockstep->cycles == NULL || lockstep->keys == NULL ||
+        lockstep->released == NULL || lockstep->ram == NULL ||
+        lockstep->display == NULL || lockstep->mask == NULL ||
+        lockstep->stop == NULL || lockstep->skip == NULL) {
+        fprintf(stderr, "lockstep: can't allocate lockstep\n");
+        c8_memory_free(image);
+        return c8_lockstep_free(lockstep);
+    }
+
+    uint8_t byte = 0;
+    for (uint32_t addr = 0; addr < C8_MEMORY_SIZE; addr++) {
+        c8_memory_read(image, addr, &byte, 1);
+        memset(lockstep->ram + addr * stride, byte, stride);
+    }
+    c8_memory_free(image);
+
+    for (uint32_t lane = 0; lane < stride; lane++) {
+        lockstep->pc[lane] = c8_memory_program_begin();
+        lockstep->rng[lane] = c8_cpu_rng_seed(0);
+    }
+
+    return lockstep;
+}
+
+C8Lockstep *c8_lockstep_free(C8Lockstep *lockstep)
+{
+    if (lockstep != NULL) {
+        free(lockstep->v);
+        free(lockstep->i);
+        free(lockstep->pc);
+        free(lockstep->dt);
+        free(lockstep->st);
+        free(lockstep->sp);
+        free(lockstep->stack);
+        free(lockstep->rng);
+        free(lockstep->cycles);
+        free(lockstep->keys);
+        free(lockstep->released);
+        free(lockstep->ram);
+        free(lockstep->display);
+        free(lockstep->mask);
+        free(lockstep->stop);
+        free(lockstep->skip);
+        free(lockstep);
+    }
+
+    return NULL;
+}
+
+uint32_t c8_lockstep_lanes(C8Lockstep *lockstep)
+{
+    return lockstep->lanes;
+}
+
+void c8_lockstep_set_display_edge(C8Lockstep *lockstep, C8DisplayEdge edge)
+{
+    lockstep->edge = edge;
+}
+
+void c8_lockstep_seed(C8Lockstep *lockstep, uint32_t lane, uint64_t seed)
+{
+    lockstep->rng[lane] = c8_cpu_rng_seed(seed);
+}
+
+void c8_lockstep_set_key(C8Lockstep *lockstep, uint32_t lane, C8Key key,
+                         bool pressed)
+{
+    if (key < C8_KEY_NUM) {
+        if (!pressed && (lockstep->keys[lane] >> key) & 1) {
+            lockstep->released[lane] |= 1u << key;
+        }
+        lockstep->keys[lane] &= ~(1u << key);
+        lockstep->keys[lane] |= (uint16_t)pressed << key;
+    }
+}
+
+/* Bad instruction or stack error: skip it and end the lane's frame */
+static void c8_lockstep_fault(C8Lockstep *lockstep, uint32_t lane)
+{
+    lockstep->pc[lane] = (lockstep->pc[lane] + C8_INSTRUCTION_SIZE) &
+                         C8_MEMORY_ADDRESS_MASK;
+    lockstep->stop[lane] = C8_CPU_STOP_FAULT;
+    lockstep->stopped = true;
+}
+
+static void c8_lockstep_fault_all(C8Lockstep *lockstep, uint16_t instruction,
+                                  uint32_t begin, uint32_t end)
+{
+    fprintf(stderr, "cpu: bad instruction: 0x%04x\n", instruction);
+
+    for (uint32_t lane = begin; lane < end; lane++) {
+        if (lockstep->mask[lane] != 0) {
+            c8_lockstep_fault(lockstep, lane);
+        }
+    }
+}
+
+/* Advances PC by 1 + skip[lane] instructions, skip being 0 or 1 */
+static void c8_lockstep_skip(C8Lockstep *lockstep, uint32_t begin,
+                             uint32_t end)
+{
+    const uint8_t *mask = lockstep->mask;
+    const uint8_t *skip = lockstep->skip;
+    uint16_t *pc = lockstep->pc;
+
+    for (uint32_t lane = begin; lane < end; lane++) {
+        uint16_t next = (pc[lane] + C8_INSTRUCTION_SIZE * (1 + skip[lane])) &
+                        C8_MEMORY_ADDRESS_MASK;
+        pc[lane] = c8_lockstep_select16(mask[lane], next, pc[lane]);
+    }
+}
+
+static void c8_lockstep_next(C8Lockstep *lockstep, uint32_t begin,
+                             uint32_t end)
+{
+    const uint8_t *mask = lockstep->mask;
+    uint16_t *pc = lockstep->pc;
+
+    for (uint32_t lane = begin; lane < end; lane++) {
+        uint16_t next = (pc[lane] + C8_INSTRUCTION_SIZE) &
+                        C8_MEMORY_ADDRESS_MASK;
+        pc[lane] = c8_lockstep_select16(mask[lane], next, pc[lane]);
+    }
+}
+
+static void c8_lockstep_cls(C8Lockstep *lockstep, uint32_t begin,
+                            uint32_t end)
+{
+    for (int y = 0; y < C8_DISPLAY_HEIGHT; y++) {
+        uint64_t *row = lockstep->display + y * lockstep->stride;
+
+        for (uint32_t lane = begin; lane < end; lane++) {
+            uint64_t keep = lockstep->mask[lane] != 0 ? 0 : UINT64_MAX;
+            row[lane] &= keep;
+        }
+    }
+}
+
+static void c8_lockstep_ret(C8Lockstep *lockstep, uint32_t begin,
+                            uint32_t end)
+{
+    for (uint32_t lane = begin; lane < end; lane++) {
+        uint8_t sp = lockstep->sp[lane];
+
+        if (lockstep->mask[lane] == 0) {
+            continue;
+        }
+        if (sp >= C8_LOCKSTEP_STACK_SIZE) {
+            fprintf(stderr, "memory: invalid stack pointer\n");
+            c8_lockstep_fault(lockstep, lane);
+            continue;
+        }
+
+        lockstep->pc[lane] =
+            (lockstep->stack[sp * lockstep->stride + lane] +
+             C8_INSTRUCTION_SIZE) & C8_MEMORY_ADDRESS_MASK;
+        lockstep->sp[lane] = sp - 1;
+    }
+}
+
+static void c8_lockstep_call(C8Lockstep *lockstep, uint16_t nnn,
+                             uint32_t begin, uint32_t end)
+{
+    for (uint32_t lane = begin; lane < end; lane++) {
+        uint8_t sp = lockstep->sp[lane] + 1;
+
+        if (lockstep->mask[lane] == 0) {
+            continue;
+        }
+        if (sp >= C8_LOCKSTEP_STACK_SIZE) {
+            fprintf(stderr,
+                    "memory: maximum level of nested subroutines is "
+                    "exceeded\n");
+            c8_lockstep_fault(lockstep, lane);
+            continue;
+        }
+
+        lockstep->stack[sp * lockstep->stride + lane] = lockstep->pc[lane];
+        lockstep->sp[lane] = sp;
+        lockstep->pc[lane] = nnn;
+    }
+}
+
+static void c8_lockstep_drw(C8Lockstep *lockstep, uint8_t x, uint8_t y,
+                            uint8_t n, uint32_t begin, uint32_t end)
+{
+    const uint32_t stride = lockstep->stride;
+    bool wrap = lockstep->edge == C8_DISPLAY_EDGE_WRAP;
+
+    for (uint32_t lane = begin; lane < end; lane++) {
+        uint8_t shift = lockstep->v[x * stride + lane] % C8_DISPLAY_WIDTH;
+        uint8_t top = lockstep->v[y * stride + lane] % C8_DISPLAY_HEIGHT;
+        uint8_t rows = n;
+        uint64_t collision = 0;
+
+        if (lockstep->mask[lane] == 0) {
+            continue;
+        }
+
+        if (!wrap && rows > C8_DISPLAY_HEIGHT - top) {
+            rows = C8_DISPLAY_HEIGHT - top;
+        }
+
+        for (uint8_t k = 0; k < rows; k++) {
+            uint8_t row_index = (top + k) % C8_DISPLAY_HEIGHT;
+            uint64_t *row = &lockstep->display[row_index * stride + lane];
+            uint64_t sprite =
+                (uint64_t)*c8_lockstep_byte(lockstep, lockstep->i[lane] + k,
+                                            lane) << (C8_DISPLAY_WIDTH - 8);
+
+            if (wrap) {
+                sprite = sprite >> shift |
+                         sprite << ((C8_DISPLAY_WIDTH - shift) %
+                                    C8_DISPLAY_WIDTH);
+            } else {
+                sprite >>= shift;
+            }
+
+            collision |= *row & sprite;
+            *row ^= sprite;
+        }
+
+        lockstep->v[0xf * stride + lane] = collision != 0;
+    }
+}
+
+static void c8_lockstep_ld_reg_key(C8Lockstep *lockstep, uint8_t x,
+                                   uint32_t begin, uint32_t end)
+{
+    for (uint32_t lane = begin; lane < end; lane++) {
+        uint16_t keys = lockstep->released[lane];
+
+        if (lockstep->mask[lane] == 0) {
+            continue;
+        }
+        if (keys == 0) {
+            /* PC stays on Fx0A */
+            lockstep->stop[lane] = C8_CPU_STOP_KEY_WAIT;
+            lockstep->stopped = true;
+            continue;
+        }
+
+        /* The lowest released key, like c8_keyboard_wait_for_release */
+        uint8_t key = 0;
+        while ((keys & 1) == 0) {
+            keys >>= 1;
+            key++;
+        }
+
+        lockstep->v[x * lockstep->stride + lane] = key;
+        lockstep->pc[lane] = (lockstep->pc[lane] + C8_INSTRUCTION_SIZE) &
+                             C8_MEMORY_ADDRESS_MASK;
+    }
+}
+
+/* Fx33, Fx55 and Fx65 */
+static void c8_lockstep_transfer(C8Lockstep *lockstep, uint8_t x,
+                                 uint8_t kind, uint32_t begin, uint32_t end)
+{
+    const uint32_t stride = lockstep->stride;
+
+    for (uint32_t lane = begin; lane < end; lane++) {
+        uint16_t i = lockstep->i[lane];
+
+        if (lockstep->mask[lane] == 0) {
+            continue;
+        }
+
+        if (kind == 0x33) {
+            uint8_t value = lockstep->v[x * stride + lane];
+
+            *c8_lockstep_byte(lockstep, i, lane) = value / 100;
+            *c8_lockstep_byte(lockstep, i + 1, lane) = value / 10 % 10;
+            *c8_lockstep_byte(lockstep, i + 2, lane) = value % 10;
+        } else if (kind == 0x55) {
+            for (uint8_t k = 0; k <= x; k++) {
+                *c8_lockstep_byte(lockstep, i + k, lane) =
+                    lockstep->v[k * stride + lane];
+            }
+        } else {
+            for (uint8_t k = 0; k <= x; k++) {
+                lockstep->v[k * stride + lane] =
+                    *c8_lockstep_byte(lockstep, i + k, lane);
+            }
+        }
+    }
+
+    c8_lockstep_next(lockstep, begin, end);
+}
+
+/*
+ * The ALU kernels. Each computes the new value for every lane in the range
+ * and keeps the old one where the mask is clear, so the loops have no
+ * branches. VF is written before Vx like c8_cpu_execute_instruction does,
+ * which matters when x is 0xf.
+ */
+static int c8_lockstep_alu(C8Lockstep *lockstep, uint16_t instruction,
+                           uint32_t begin, uint32_t end)
+{
+    const uint32_t stride = lockstep->stride;
+    const uint8_t *mask = lockstep->mask;
+    uint8_t *vx = lockstep->v + c8_instruction_get_x(instruction) * stride;
+    uint8_t *vy = lockstep->v + c8_instruction_get_y(instruction) * stride;
+    uint8_t *vf = lockstep->v + 0xf * stride;
+
+    switch (instruction & 0x00f) {
+    case 0x0:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            vx[lane] = c8_lockstep_select8(mask[lane], vy[lane], vx[lane]);
+        }
+        break;
+
+    case 0x1:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            vx[lane] |= vy[lane] & mask[lane];
+        }
+        break;
+
+    case 0x2:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            vx[lane] &= vy[lane] | ~mask[lane];
+        }
+        break;
+
+    case 0x3:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            vx[lane] ^= vy[lane] & mask[lane];
+        }
+        break;
+
+    case 0x4:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            uint8_t carry = vx[lane] > (UINT8_MAX - vy[lane]);
+            vf[lane] = c8_lockstep_select8(mask[lane], carry, vf[lane]);
+            vx[lane] = c8_lockstep_select8(mask[lane], vx[lane] + vy[lane],
+                                           vx[lane]);
+        }
+        break;
+
+    case 0x5:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            uint8_t borrow = vx[lane] > vy[lane];
+            vf[lane] = c8_lockstep_select8(mask[lane], borrow, vf[lane]);
+            vx[lane] = c8_lockstep_select8(mask[lane], vx[lane] - vy[lane],
+                                           vx[lane]);
+        }
+        break;
+
+    case 0x6:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            vf[lane] = c8_lockstep_select8(mask[lane], vx[lane] & 0x01,
+                                           vf[lane]);
+            vx[lane] = c8_lockstep_select8(mask[lane], vx[lane] >> 1,
+                                           vx[lane]);
+        }
+        break;
+
+    case 0x7:
+        /* Stores into Vy, matching the scalar 8xy7 */
+        for (uint32_t lane = begin; lane < end; lane++) {
+            uint8_t borrow = vy[lane] > vx[lane];
+            vf[lane] = c8_lockstep_select8(mask[lane], borrow, vf[lane]);
+            vy[lane] = c8_lockstep_select8(mask[lane], vy[lane] - vx[lane],
+                                           vy[lane]);
+        }
+        break;
+
+    case 0xe:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            vf[lane] = c8_lockstep_select8(mask[lane], vx[lane] & 0x80,
+                                           vf[lane]);
+            vx[lane] = c8_lockstep_select8(mask[lane], vx[lane] << 1,
+                                           vx[lane]);
+        }
+        break;
+
+    default:
+        return -1;
+    }
+
+    c8_lockstep_next(lockstep, begin, end);
+    return 0;
+}
+
+static int c8_lockstep_misc(C8Lockstep *lockstep, uint16_t instruction,
+                            uint32_t begin, uint32_t end)
+{
+    const uint32_t stride = lockstep->stride;
+    const uint8_t *mask = lockstep->mask;
+    uint8_t x = c8_instruction_get_x(instruction);
+    uint8_t *vx = lockstep->v + x * stride;
+    uint16_t *i = lockstep->i;
+
+    switch (instruction & 0x0ff) {
+    case 0x07:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            vx[lane] = c8_lockstep_select8(mask[lane], lockstep->dt[lane],
+                                           vx[lane]);
+        }
+        break;
+
+    case 0x0a:
+        c8_lockstep_ld_reg_key(lockstep, x, begin, end);
+        return 0;
+
+    case 0x15:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            lockstep->dt[lane] = c8_lockstep_select8(mask[lane], vx[lane],
+                                                     lockstep->dt[lane]);
+        }
+        break;
+
+    case 0x18:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            lockstep->st[lane] = c8_lockstep_select8(mask[lane], vx[lane],
+                                                     lockstep->st[lane]);
+        }
+        break;
+
+    case 0x1e:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            i[lane] = c8_lockstep_select16(mask[lane], i[lane] + vx[lane],
+                                           i[lane]);
+        }
+        break;
+
+    case 0x29:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            i[lane] = c8_lockstep_select16(mask[lane], 5 * vx[lane], i[lane]);
+        }
+        break;
+
+    case 0x33:
+    case 0x55:
+    case 0x65:
+        c8_lockstep_transfer(lockstep, x, instruction & 0x0ff, begin, end);
+        return 0;
+
+    default:
+        return -1;
+    }
+
+    c8_lockstep_next(lockstep, begin, end);
+    return 0;
+}
+
+/* Executes `instruction` on the lanes in [begin, end) whose mask is set */
+static void c8_lockstep_execute(C8Lockstep *lockstep, uint16_t instruction,
+                                uint32_t begin, uint32_t end)
+{
+    const uint32_t stride = lockstep->stride;
+    const uint8_t *mask = lockstep->mask;
+    uint8_t *vx = lockstep->v + c8_instruction_get_x(instruction) * stride;
+    uint8_t *vy = lockstep->v + c8_instruction_get_y(instruction) * stride;
+    uint8_t kk = c8_instruction_get_kk(instruction);
+    uint16_t nnn = c8_instruction_get_nnn(instruction);
+    uint8_t *skip = lockstep->skip;
+    int ret = 0;
+
+    switch (instruction >> 12) {
+    case 0x0:
+        if ((instruction >> 8) != 0) {
+            /* Ignore SYS instruction, PC stays */
+        } else if (kk == 0xe0) {
+            c8_lockstep_cls(lockstep, begin, end);
+            c8_lockstep_next(lockstep, begin, end);
+        } else if (kk == 0xee) {
+            c8_lockstep_ret(lockstep, begin, end);
+        } else {
+            ret = -1;
+        }
+        break;
+
+    case 0x1:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            lockstep->pc[lane] = c8_lockstep_select16(mask[lane], nnn,
+                                                      lockstep->pc[lane]);
+        }
+        break;
+
+    case 0x2:
+        c8_lockstep_call(lockstep, nnn, begin, end);
+        break;
+
+    case 0x3:
+    case 0x4:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            skip[lane] = (vx[lane] == kk) == (instruction >> 12 == 0x3);
+        }
+        c8_lockstep_skip(lockstep, begin, end);
+        break;
+
+    case 0x5:
+    case 0x9:
+        if ((instruction >> 12) == 0x5 && (instruction & 0x00f) != 0) {
+            ret = -1;
+            break;
+        }
+        for (uint32_t lane = begin; lane < end; lane++) {
+            skip[lane] =
+                (vx[lane] == vy[lane]) == (instruction >> 12 == 0x5);
+        }
+        c8_lockstep_skip(lockstep, begin, end);
+        break;
+
+    case 0x6:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            vx[lane] = c8_lockstep_select8(mask[lane], kk, vx[lane]);
+        }
+        c8_lockstep_next(lockstep, begin, end);
+        break;
+
+    case 0x7:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            vx[lane] += kk & mask[lane];
+        }
+        c8_lockstep_next(lockstep, begin, end);
+        break;
+
+    case 0x8:
+        ret = c8_lockstep_alu(lockstep, instruction, begin, end);
+        break;
+
+    case 0xa:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            lockstep->i[lane] = c8_lockstep_select16(mask[lane], nnn,
+                                                     lockstep->i[lane]);
+        }
+        c8_lockstep_next(lockstep, begin, end);
+        break;
+
+    case 0xb:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            uint16_t target = (lockstep->v[lane] + nnn) &
+                              C8_MEMORY_ADDRESS_MASK;
+            lockstep->pc[lane] = c8_lockstep_select16(mask[lane], target,
+                                                      lockstep->pc[lane]);
+        }
+        break;
+
+    case 0xc:
+        for (uint32_t lane = begin; lane < end; lane++) {
+            if (mask[lane] != 0) {
+                vx[lane] = c8_cpu_rng_next(&lockstep->rng[lane]) & kk;
+            }
+        }
+        c8_lockstep_next(lockstep, begin, end);
+        break;
+
+    case 0xd:
+        c8_lockstep_drw(lockstep, c8_instruction_get_x(instruction),
+                        c8_instruction_get_y(instruction),
+                        c8_instruction_get_n(instruction), begin, end);
+        c8_lockstep_next(lockstep, begin, end);
+        break;
+
+    case 0xe:
+        if (kk != 0x9e && kk != 0xa1) {
+            ret = -1;
+            break;
+        }
+        for (uint32_t lane = begin; lane < end; lane++) {
+            bool pressed = vx[lane] < C8_KEY_NUM &&
+                           (lockstep->keys[lane] >> vx[lane] & 1) != 0;
+            skip[lane] = pressed == (kk == 0x9e);
+        }
+        c8_lockstep_skip(lockstep, begin, end);
+        break;
+
+    case 0xf:
+        ret = c8_lockstep_misc(lockstep, instruction, begin, end);
+        break;
+    }
+
+    if (ret < 0) {
+        c8_lockstep_fault_all(lockstep, instruction, begin, end);
+    }
+}
+
+static uint16_t c8_lockstep_fetch(C8Lockstep *lockstep, uint32_t lane)
+{
+    uint16_t pc = lockstep->pc[lane];
+
+    return *c8_lockstep_byte(lockstep, pc, lane) << 8 |
+           *c8_lockstep_byte(lockstep, pc + 1, lane);
+}
+
+/*
+ * Whether every running lane is on `pc` with the same instruction there as
+ * `lead`. The RAM layout keeps the bytes at one address contiguous across
+ * lanes, so this is a single pass without gathers.
+ */
+static bool c8_lockstep_converged(C8Lockstep *lockstep, uint16_t pc,
+                                  uint32_t lead)
+{
+    const uint8_t *high = c8_lockstep_byte(lockstep, pc, 0);
+    const uint8_t *low = c8_lockstep_byte(lockstep, pc + 1, 0);
+    uint8_t differ = 0;
+
+    for (uint32_t lane = 0; lane < lockstep->stride; lane++) {
+        differ |= lockstep->mask[lane] &
+                  ((lockstep->pc[lane] != pc) | (high[lane] ^ high[lead]) |
+                   (low[lane] ^ low[lead]));
+    }
+
+    return differ == 0;
+}
+
+void c8_lockstep_run_frame(C8Lockstep *lockstep, uint32_t cycles)
+{
+    const uint32_t stride = lockstep->stride;
+    uint32_t running = lockstep->lanes;
+
+    for (uint32_t lane = 0; lane < stride; lane++) {
+        lockstep->stop[lane] = C8_CPU_STOP_BUDGET;
+        lockstep->mask[lane] = lane < lockstep->lanes ? UINT8_MAX : 0;
+    }
+
+    uint32_t step = 0;
+    for (; step < cycles && running > 0; step++) {
+        uint32_t lead = 0;
+        while (lockstep->mask[lead] == 0) {
+            lead++;
+        }
+
+        if (c8_lockstep_converged(lockstep, lockstep->pc[lead], lead)) {
+            c8_lockstep_execute(lockstep, c8_lockstep_fetch(lockstep, lead),
+                                0, stride);
+            lockstep->stats.converged++;
+        } else {
+            for (uint32_t lane = lead; lane < lockstep->lanes; lane++) {
+                if (lockstep->mask[lane] != 0) {
+                    c8_lockstep_execute(lockstep,
+                                        c8_lockstep_fetch(lockstep, lane),
+                                        lane, lane + 1);
+                }
+            }
+            lockstep->stats.diverged++;
+        }
+
+        lockstep->stats.instructions += running;
+        if (!lockstep->stopped) {
+            continue;
+        }
+
+        /* Key waits and faults end the frame for their lane */
+        lockstep->stopped = false;
+        for (uint32_t lane = 0; lane < stride; lane++) {
+            if (lockstep->mask[lane] != 0 &&
+                lockstep->stop[lane] != C8_CPU_STOP_BUDGET) {
+                lockstep->cycles[lane] += step + 1;
+                lockstep->mask[lane] = 0;
+                running--;
+            }
+        }
+    }
+
+    /* Lanes still running executed every step */
+    for (uint32_t lane = 0; lane < stride; lane++) {
+        if (lockstep->mask[lane] != 0) {
+            lockstep->cycles[lane] += step;
+        }
+    }
+
+    for (uint32_t lane = 0; lane < stride; lane++) {
+        lockstep->dt[lane] -= lockstep->dt[lane] > 0;
+        lockstep->st[lane] -= lockstep->st[lane] > 0;
+        lockstep->released[lane] = 0;
+    }
+}
+
+C8CpuStop c8_lockstep_stop(C8Lockstep *lockstep, uint32_t lane)
+{
+    return lockstep->stop[lane];
+}
+
+uint64_t c8_lockstep_cycles(C8Lockstep *lockstep, uint32_t lane)
+{
+    return lockstep->cycles[lane];
+}
+
+void c8_lockstep_display_read(C8Lockstep *lockstep, uint32_t lane,
+                              uint8_t *buf)
+{
+    for (int y = 0; y < C8_DISPLAY_HEIGHT; y++) {
+        uint64_t row = lockstep->display[y * lockstep->stride + lane];
+
+        for (int x = 0; x < C8_DISPLAY_WIDTH / 8; x++) {
+            *buf++ = row >> (56 - 8 * x);
+        }
+    }
+}
+
+void c8_lockstep_stats(C8Lockstep *lockstep, C8LockstepStats *stats)
+{
+    *stats = lockstep->stats;
+}
@@ -1,12 +1,30 @@
+#include "c8/audio.h"
 #include "c8/c8.h"
 #include "c8/cpu.h"
+#include "c8/debugger.h"
+#include "c8/instruction.h"
 #include "c8/keyboard.h"
 #include "c8/memory.h"
+#include "c8/movie.h"
+#include "c8/profile.h"
+#include "c8/rewind.h"
+#include "c8/state.h"
+#include "c8/trace.h"
 
 #include <SDL2/SDL.h>
 
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+/* ARGB8888 colors of unlit and lit pixels */
+#define C8_COLOR_OFF 0xff2e3037
+#define C8_COLOR_ON 0xffebe5ce
+
+/* Frames run back to back after a host stall before the pacer resyncs */
+#define C8_CATCHUP_FRAMES 4
 
 typedef enum c8_state {
     C8_STOPPED = 0,
@@ -20,18 +38,33 @@ typedef struct c8_emulator {
     C8Keyboard *keyboard;
     C8Cpu *cpu;
 
+    /* Audio */
+    C8Audio *audio;
+
     /* Render */
     SDL_Window *window;
     bool window_resized;
     SDL_Renderer *renderer;
-    SDL_Surface *surface;
+    SDL_Texture *texture;
 
     /* Timing */
-    uint64_t cpu_ticks;
-    uint64_t timers_ticks;
+    uint64_t frame_deadline;
+    uint32_t catchup_frames;
 
     /* State */
     C8State state;
+    /* Quick save slot, F5 saves and F9 loads */
+    char *state_path;
+    /* Frame history, played backwards while backspace is held */
+    C8Rewind *rewind;
+    bool rewinding;
+    /*
+     * Input recording. State loads, rewinding and breaking into the
+     * debugger are off while it runs.
+     */
+    C8Movie *movie;
+    /* Command console on stdin while paused, F10 pauses */
+    C8Debugger *debugger;
 } C8Emulator;
 
 static int c8_emulator_new_render(C8Emulator *emulator)
@@ -59,22 +92,11 @@ static int c8_emulator_new_render(C8Emulator *emulator)
     SDL_RenderSetLogicalSize(emulator->renderer,
         C8_DISPLAY_WIDTH, C8_DISPLAY_HEIGHT);
 
-    emulator->surface = SDL_CreateRGBSurfaceWithFormat(
-        0, C8_DISPLAY_WIDTH, C8_DISPLAY_HEIGHT, 1, SDL_PIXELFORMAT_INDEX1LSB);
-    if (emulator->surface == NULL) {
-        SDL_DestroyRenderer(emulator->renderer);
-        SDL_DestroyWindow(emulator->window);
-        SDL_Quit();
-        return -1;
-    }
-
-    SDL_Color colors[] = {
-        {46, 48, 55, 255},
-        {235, 229, 206, 255}
-    };
-    if (SDL_SetPaletteColors(emulator->surface->format->palette, colors,
-                              0, 2) < 0) {
-        SDL_FreeSurface(emulator->surface);
+    /* Lives as long as the window; frames only upload changed rows */
+    emulator->texture = SDL_CreateTexture(
+        emulator->renderer, SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING, C8_DISPLAY_WIDTH, C8_DISPLAY_HEIGHT);
+    if (emulator->texture == NULL) {
         SDL_DestroyRenderer(emulator->renderer);
         SDL_DestroyWindow(emulator->window);
         SDL_Quit();
@@ -82,12 +104,13 @@ static int c8_emulator_new_render(C8Emulator *emulator)
     }
 
     SDL_ShowCursor(SDL_DISABLE);
+    return 0;
 }
 
 static void c8_emulator_free_render(C8Emulator *emulator)
 {
-    if (emulator->surface != NULL) {
-        SDL_FreeSurface(emulator->surface);
+    if (emulator->texture != NULL) {
+        SDL_DestroyTexture(emulator->texture);
     }
     if (emulator->renderer != NULL) {
         SDL_DestroyRenderer(emulator->renderer);
@@ -99,6 +122,15 @@ static void c8_emulator_free_render(C8Emulator *emulator)
     SDL_Quit();
 }
 
+static void c8_emulator_sound(void *userdata)
+{
+    C8Emulator *emulator = userdata;
+
+    if (emulator->audio != NULL) {
+        c8_audio_play(emulator->audio);
+    }
+}
+
 static int c8_emulator_new_device(C8Emulator *emulator, const uint8_t *program,
                                   size_t size)
 {
@@ -109,31 +141,35 @@ static int c8_emulator_new_device(C8Emulator *emulator, const uint8_t *program,
 
     emulator->keyboard = c8_keyboard_new();
     if (emulator->keyboard == NULL) {
-        free(emulator->memory);
+        c8_memory_free(emulator->memory);
         return -1;
     }
 
     emulator->cpu = c8_cpu_new(emulator->memory, emulator->keyboard);
     if (emulator->cpu == NULL) {
         free(emulator->keyboard);
-        free(emulator->memory);
+        c8_memory_free(emulator->memory);
         return -1;
     }
 
+    emulator->audio = c8_audio_new();
+
+    C8CpuCallbacks callbacks = {
+        .sound = c8_emulator_sound,
+        .userdata = emulator
+    };
+    c8_cpu_set_callbacks(emulator->cpu, &callbacks);
+
     return 0;
 }
 
 static void c8_emulator_free_device(C8Emulator *emulator)
 {
-    if (emulator->cpu != NULL) {
-        free(emulator->cpu);
-    }
-    if (emulator->keyboard != NULL) {
-        free(emulator->keyboard);
-    }
-    if (emulator->memory != NULL) {
-        free(emulator->memory);
+    if (emulator->audio != NULL) {
+        c8_audio_free(emulator->audio);
     }
+    /* The CPU owns the keyboard and memory */
+    c8_cpu_free(emulator->cpu);
 }
 
 static C8Emulator *c8_emulator_new(const uint8_t *program, size_t size)
@@ -165,6 +201,10 @@ static void c8_emulator_free(C8Emulator *emulator)
     if (emulator != NULL) {
         c8_emulator_free_device(emulator);
         c8_emulator_free_render(emulator);
+        c8_movie_free(emulator->movie);
+        c8_rewind_free(emulator->rewind);
+        c8_debugger_free(emulator->debugger);
+        free(emulator->state_path);
         free(emulator);
     }
 }
@@ -226,6 +266,25 @@ static C8Key c8_key_from_sdl(SDL_Keycode key)
     }
 }
 
+static void c8_handle_key(C8Emulator *emulator, SDL_Keycode sym, bool pressed)
+{
+    C8Key key = c8_key_from_sdl(sym);
+    if (key == C8_KEY_NUM) {
+        return;
+    }
+
+    if (emulator->movie != NULL) {
+        c8_movie_record(emulator->movie, c8_cpu_cycles(emulator->cpu), key,
+                        pressed);
+    }
+
+    if (pressed) {
+        c8_keyboard_press_key(emulator->keyboard, key);
+    } else {
+        c8_keyboard_release_key(emulator->keyboard, key);
+    }
+}
+
 static void c8_handle_event(C8Emulator *emulator, SDL_Event *event)
 {
     switch (event->type){
@@ -234,13 +293,30 @@ static void c8_handle_event(C8Emulator *emulator, SDL_Event *event)
         break;
 
     case SDL_KEYDOWN:
-        c8_keyboard_press_key(emulator->keyboard,
-                              c8_key_from_sdl(event->key.keysym.sym));
+        if (event->key.keysym.sym == SDLK_F5) {
+            c8_state_save_file(emulator->cpu, emulator->state_path);
+        } else if (event->key.keysym.sym == SDLK_F9) {
+            if (emulator->movie == NULL) {
+                c8_state_load_file(emulator->cpu, emulator->state_path);
+            }
+        } else if (event->key.keysym.sym == SDLK_F10) {
+            /* A break ends the frame early, which replay can't reproduce */
+            if (emulator->debugger != NULL && emulator->movie == NULL) {
+                c8_debugger_pause(emulator->debugger);
+            }
+        } else if (event->key.keysym.sym == SDLK_BACKSPACE) {
+            emulator->rewinding = emulator->rewind != NULL &&
+                                  emulator->movie == NULL;
+        } else if (event->key.repeat == 0) {
+            c8_handle_key(emulator, event->key.keysym.sym, true);
+        }
         break;
 
     case SDL_KEYUP:
-        c8_keyboard_release_key(emulator->keyboard,
-                                c8_key_from_sdl(event->key.keysym.sym));
+        if (event->key.keysym.sym == SDLK_BACKSPACE) {
+            emulator->rewinding = false;
+        }
+        c8_handle_key(emulator, event->key.keysym.sym, false);
         break;
 
     case SDL_WINDOWEVENT:
@@ -267,80 +343,449 @@ static void c8_handle_events(C8Emulator *emulator)
     }
 }
 
-static int c8_handle_cpu(C8Emulator *emulator, uint64_t elapsed_ticks)
+/* Sleeps until an event arrives or `counts` performance counts pass */
+static void c8_wait_events(C8Emulator *emulator, uint64_t counts,
+                           uint64_t frequency)
 {
-    const uint64_t target = 1000 / C8_CPU_HZ;
-    emulator->cpu_ticks += elapsed_ticks;
+    SDL_Event event = {};
+    /* Round up so a sub-millisecond remainder doesn't turn into a spin */
+    int timeout = (counts * 1000 + frequency - 1) / frequency;
 
-    if (emulator->cpu_ticks >= target) {
-        emulator->cpu_ticks -= target;
-        c8_cpu_execute_instruction(emulator->cpu);
+    if (SDL_WaitEventTimeout(&event, timeout) > 0) {
+        c8_handle_event(emulator, &event);
+        c8_handle_events(emulator);
     }
+}
 
-    return 0;
+static const char *const c8_debug_register_names[] = {
+    "V0", "V1", "V2", "V3", "V4", "V5", "V6", "V7",
+    "V8", "V9", "VA", "VB", "VC", "VD", "VE", "VF",
+    "I", "DT", "ST", "SP", "PC"
+};
+
+static int c8_debug_parse_register(const char *name)
+{
+    for (int reg = 0; reg < C8_DEBUGGER_REGISTER_NUM; reg++) {
+        if (strcasecmp(name, c8_debug_register_names[reg]) == 0) {
+            return reg;
+        }
+    }
+
+    return -1;
 }
 
-static void c8_handle_timers(C8Emulator *emulator, uint64_t elapsed_ticks)
+static void c8_debug_print_registers(C8Cpu *cpu)
 {
-    const uint64_t target = 1000 / C8_TIMERS_HZ;
-    emulator->timers_ticks += elapsed_ticks;
+    for (int reg = 0; reg < C8_DEBUGGER_REGISTER_NUM; reg++) {
+        printf("%s=%0*x%s", c8_debug_register_names[reg], reg < 16 ? 2 : 3,
+               c8_debugger_register(cpu, reg),
+               reg % 8 == 7 || reg == C8_DEBUGGER_REGISTER_NUM - 1 ? "\n"
+                                                                  : " ");
+    }
+}
 
-    if (emulator->timers_ticks >= target) {
-        emulator->timers_ticks -= target;
-        c8_delay_timer_tick(emulator->cpu);
-        c8_sound_timer_tick(emulator->cpu);
+/* Disassembles `count` instructions from addr, marking PC and breakpoints */
+static void c8_debug_list(C8Emulator *emulator, uint16_t addr, int count)
+{
+    uint16_t pc = c8_cpu_pc(emulator->cpu);
+
+    for (int k = 0; k < count; k++) {
+        uint16_t instruction = 0;
+        char text[24];
+
+        if (c8_memory_program_read(emulator->memory, addr, &instruction) < 0) {
+            break;
+        }
+        c8_instruction_disassemble(instruction, text, sizeof(text));
+
+        printf("%s%c 0x%03x  %04x  %s\n", addr == pc ? "=>" : "  ",
+               c8_debugger_breakpoint(emulator->debugger, addr) ? '*' : ' ',
+               addr, instruction, text);
+        addr = (addr + C8_INSTRUCTION_SIZE) & C8_MEMORY_ADDRESS_MASK;
     }
 }
 
-static void c8_handle_render(C8Emulator *emulator)
+static void c8_debug_dump(C8Emulator *emulator, uint16_t addr, uint16_t len)
+{
+    for (uint16_t k = 0; k < len; k += 16) {
+        uint8_t bytes[16];
+        uint16_t n = len - k < 16 ? len - k : 16;
+
+        if (c8_memory_read(emulator->memory, addr + k, bytes, n) < 0) {
+            break;
+        }
+
+        printf("0x%03x ", addr + k);
+        for (uint16_t j = 0; j < n; j++) {
+            printf(" %02x", bytes[j]);
+        }
+        printf("\n");
+    }
+}
+
+static void c8_debug_report(C8Emulator *emulator)
+{
+    uint16_t detail = 0;
+
+    switch (c8_debugger_event(emulator->debugger, &detail)) {
+    case C8_DEBUGGER_EVENT_BREAKPOINT:
+        printf("breakpoint at 0x%03x\n", detail);
+        break;
+
+    case C8_DEBUGGER_EVENT_MEMORY:
+        printf("watched address 0x%03x accessed\n", detail);
+        break;
+
+    case C8_DEBUGGER_EVENT_REGISTER:
+        printf("%s changed\n", c8_debug_register_names[detail]);
+        break;
+
+    default:
+        break;
+    }
+
+    c8_debug_list(emulator, c8_cpu_pc(emulator->cpu), 1);
+}
+
+static void c8_debug_help(void)
+{
+    printf("c               continue\n"
+           "s [n]           step n instructions\n"
+           "f [n]           run n frames\n"
+           "b addr          set a breakpoint\n"
+           "d addr          delete a breakpoint\n"
+           "w addr [len]    watch writes to memory\n"
+           "a addr [len]    watch reads and writes of memory\n"
+           "u id            remove a memory watch\n"
+           "v reg [off]     watch a register, such as V3 or I\n"
+           "r               print registers\n"
+           "x addr [len]    dump memory\n"
+           "l [addr]        disassemble\n"
+           "q               quit\n"
+           "addresses are hex, counts decimal\n");
+}
+
+/*
+ * Reads commands from stdin until one resumes the machine. The window
+ * doesn't update while a command is being typed.
+ */
+static void c8_debug_console(C8Emulator *emulator)
 {
-    if (!c8_display_updated(emulator->cpu) && !emulator->window_resized) {
+    C8Debugger *debugger = emulator->debugger;
+    char line[128];
+
+    c8_debug_report(emulator);
+
+    while (c8_debugger_paused(debugger)) {
+        char cmd[16] = "";
+        char arg[32] = "";
+        char extra[32] = "";
+
+        printf("(c8) ");
+        fflush(stdout);
+
+        if (fgets(line, sizeof(line), stdin) == NULL) {
+            emulator->state = C8_STOPPED;
+            return;
+        }
+        if (sscanf(line, "%15s %31s %31s", cmd, arg, extra) < 1) {
+            continue;
+        }
+
+        uint16_t addr = strtoul(arg, NULL, 16) & C8_MEMORY_ADDRESS_MASK;
+        long count = arg[0] != '\0' ? strtol(arg, NULL, 10) : 1;
+        long len = extra[0] != '\0' ? strtol(extra, NULL, 10) : 1;
+
+        if (strcmp(cmd, "c") == 0) {
+            c8_debugger_continue(debugger);
+        } else if (strcmp(cmd, "s") == 0 && count > 0) {
+            c8_debugger_step(debugger, count);
+        } else if (strcmp(cmd, "f") == 0 && count > 0) {
+            c8_debugger_run_frames(debugger, count);
+        } else if ((strcmp(cmd, "b") == 0 || strcmp(cmd, "d") == 0) &&
+                   arg[0] != '\0') {
+            c8_debugger_set_breakpoint(debugger, addr, cmd[0] == 'b');
+        } else if ((strcmp(cmd, "w") == 0 || strcmp(cmd, "a") == 0) &&
+                   arg[0] != '\0' && len > 0) {
+            int id = c8_debugger_watch_memory(
+                debugger, addr, len,
+                cmd[0] == 'w' ? C8_DEBUGGER_WRITE
+                              : C8_DEBUGGER_READ | C8_DEBUGGER_WRITE);
+            if (id < 0) {
+                printf("no free watchpoints\n");
+            } else {
+                printf("watch %d\n", id);
+            }
+        } else if (strcmp(cmd, "u") == 0 && arg[0] != '\0') {
+            c8_debugger_unwatch_memory(debugger, count);
+        } else if (strcmp(cmd, "v") == 0 && c8_debug_parse_register(arg) >= 0) {
+            c8_debugger_watch_register(debugger, c8_debug_parse_register(arg),
+                                       strcmp(extra, "off") != 0);
+        } else if (strcmp(cmd, "r") == 0) {
+            c8_debug_print_registers(emulator->cpu);
+        } else if (strcmp(cmd, "x") == 0 && arg[0] != '\0' && len > 0) {
+            c8_debug_dump(emulator, addr, len);
+        } else if (strcmp(cmd, "l") == 0) {
+            c8_debug_list(emulator,
+                          arg[0] != '\0' ? addr : c8_cpu_pc(emulator->cpu), 8);
+        } else if (strcmp(cmd, "q") == 0) {
+            emulator->state = C8_STOPPED;
+            return;
+        } else {
+            c8_debug_help();
+        }
+    }
+}
+
+/* Runs one frame's worth of instructions, then ticks the timers */
+static void c8_handle_frame(C8Emulator *emulator)
+{
+    /* Rewinding plays the history back one frame per frame */
+    if (emulator->rewinding) {
+        c8_rewind_step_back(emulator->rewind, emulator->cpu, 1);
         return;
     }
 
-    c8_memory_display_read(emulator->memory, emulator->surface->pixels);
+    if (emulator->debugger != NULL && c8_debugger_paused(emulator->debugger)) {
+        c8_debug_console(emulator);
+        if (emulator->state != C8_RUNNING) {
+            return;
+        }
+    }
+
+    C8CpuStop stop = c8_cpu_run_frame(emulator->cpu, C8_CPU_FRAME_CYCLES);
 
-    SDL_Texture *texture = SDL_CreateTextureFromSurface(
-        emulator->renderer, emulator->surface);
-    if (texture == NULL) {
-        fprintf(stderr, "render: %s\n", SDL_GetError());
+    /* A frame cut short by the debugger is not a frame of history */
+    if (emulator->rewind != NULL && stop != C8_CPU_STOP_BREAK) {
+        c8_rewind_record(emulator->rewind, emulator->cpu);
+    }
+}
+
+/*
+ * Runs every frame whose deadline has passed. After a stall longer than the
+ * catch-up limit the missed frames are dropped and the schedule restarts
+ * from now, so the emulator doesn't fast-forward through them.
+ */
+static void c8_handle_frames(C8Emulator *emulator, uint64_t now,
+                             uint64_t period)
+{
+    uint64_t frames = (now - emulator->frame_deadline) / period + 1;
+
+    if (frames > emulator->catchup_frames) {
+        frames = emulator->catchup_frames;
+        emulator->frame_deadline = now;
+    } else {
+        emulator->frame_deadline += (frames - 1) * period;
+    }
+
+    for (uint64_t i = 0; i < frames && emulator->state == C8_RUNNING; i++) {
+        c8_handle_frame(emulator);
+    }
+
+    emulator->frame_deadline += period;
+}
+
+/*
+ * Expands display rows [begin, end) from 1bpp into the locked texture,
+ * limited to the span of byte columns set in `columns`.
+ */
+static int c8_upload_rows(C8Emulator *emulator,
+                          uint8_t display[][C8_DISPLAY_WIDTH / 8],
+                          int begin, int end, uint8_t columns)
+{
+    int first = 0;
+    int last = C8_DISPLAY_WIDTH / 8 - 1;
+
+    while ((columns & (1 << first)) == 0) {
+        first++;
+    }
+    while ((columns & (1 << last)) == 0) {
+        last--;
+    }
+
+    SDL_Rect rect = {
+        first * 8, begin, (last - first + 1) * 8, end - begin
+    };
+    void *pixels = NULL;
+    int pitch = 0;
+
+    if (SDL_LockTexture(emulator->texture, &rect, &pixels, &pitch) < 0) {
+        return -1;
+    }
+
+    for (int y = begin; y < end; y++) {
+        uint32_t *row = (uint32_t *)((uint8_t *)pixels + (y - begin) * pitch);
+
+        for (int x = rect.x; x < rect.x + rect.w; x++) {
+            bool on = display[y][x / 8] & (0x80 >> (x % 8));
+            row[x - rect.x] = on ? C8_COLOR_ON : C8_COLOR_OFF;
+        }
+    }
+
+    SDL_UnlockTexture(emulator->texture);
+    return 0;
+}
+
+static void c8_handle_render(C8Emulator *emulator)
+{
+    C8DisplayDirty dirty;
+    c8_memory_display_consume_dirty(emulator->memory, &dirty);
+
+    if (dirty.rows == 0 && !emulator->window_resized) {
         return;
     }
 
+    if (dirty.rows != 0) {
+        uint8_t display[C8_DISPLAY_HEIGHT][C8_DISPLAY_WIDTH / 8];
+        c8_memory_display_read(emulator->memory, &display[0][0]);
+
+        /* One lock per run of consecutive dirty rows */
+        for (int y = 0; y < C8_DISPLAY_HEIGHT; y++) {
+            if ((dirty.rows & (1u << y)) == 0) {
+                continue;
+            }
+
+            int begin = y;
+            uint8_t columns = 0;
+            while (y < C8_DISPLAY_HEIGHT && (dirty.rows & (1u << y)) != 0) {
+                columns |= dirty.columns[y];
+                y++;
+            }
+
+            if (c8_upload_rows(emulator, display, begin, y, columns) < 0) {
+                fprintf(stderr, "render: %s\n", SDL_GetError());
+                return;
+            }
+        }
+    }
+
     SDL_RenderClear(emulator->renderer);
-    SDL_RenderCopy(emulator->renderer, texture, NULL, NULL);
+    SDL_RenderCopy(emulator->renderer, emulator->texture, NULL, NULL);
     SDL_RenderPresent(emulator->renderer);
 
-    SDL_DestroyTexture(texture);
-
     emulator->window_resized = false;
 }
 
+/*
+ * Waiting in Fx0A with the timers stopped, frames change nothing until a
+ * key does. Rewinding and the debugger's console keep the loop running.
+ */
+static bool c8_parked(C8Emulator *emulator)
+{
+    if (emulator->rewinding || (emulator->debugger != NULL &&
+                                c8_debugger_paused(emulator->debugger))) {
+        return false;
+    }
+
+    return c8_cpu_parked(emulator->cpu);
+}
+
+/*
+ * Sleeps until a key goes down or up, handling the other events that wake
+ * it up meanwhile. Frames are not caught up on afterwards: parked, they
+ * would only have counted cycles.
+ */
+static void c8_wait_key(C8Emulator *emulator)
+{
+    uint16_t pressed = c8_keyboard_pressed_edges(emulator->keyboard);
+    uint16_t released = c8_keyboard_released_edges(emulator->keyboard);
+    SDL_Event event = {};
+
+    while (emulator->state == C8_RUNNING && c8_parked(emulator) &&
+           c8_keyboard_pressed_edges(emulator->keyboard) == pressed &&
+           c8_keyboard_released_edges(emulator->keyboard) == released &&
+           SDL_WaitEvent(&event) > 0) {
+        c8_handle_event(emulator, &event);
+        c8_handle_events(emulator);
+
+        if (emulator->window_resized) {
+            c8_handle_render(emulator);
+        }
+    }
+}
+
+/*
+ * Sleeps in SDL_WaitEventTimeout until the next frame deadline on the
+ * performance counter, so an idle ROM costs next to no host CPU. Events
+ * arriving in between are handled right away; frames and the present only
+ * happen on the deadline.
+ */
 static void c8_main_loop(C8Emulator *emulator)
 {
-    uint64_t prev_ticks = SDL_GetTicks64();
+    const uint64_t frequency = SDL_GetPerformanceFrequency();
+    const uint64_t period = frequency / C8_TIMERS_HZ;
+
+    emulator->frame_deadline = SDL_GetPerformanceCounter() + period;
 
     while (emulator->state == C8_RUNNING) {
-        uint64_t ticks = SDL_GetTicks64();
-        uint64_t elapsed_ticks = ticks - prev_ticks;
-        prev_ticks = ticks;
+        uint64_t now = SDL_GetPerformanceCounter();
+
+        if (now < emulator->frame_deadline) {
+            c8_wait_events(emulator, emulator->frame_deadline - now,
+                           frequency);
+            continue;
+        }
 
         c8_handle_events(emulator);
-        c8_handle_cpu(emulator, elapsed_ticks);
-        c8_handle_timers(emulator, elapsed_ticks);
+        c8_handle_frames(emulator, now, period);
         c8_handle_render(emulator);
+
+        if (c8_parked(emulator)) {
+            c8_wait_key(emulator);
+            /* The frame that sees the key runs right away */
+            emulator->frame_deadline = SDL_GetPerformanceCounter();
+        }
     }
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc < 2) {
-        printf("usage: %s [program]\n", argv[0]);
+    const char *program = NULL;
+    long catchup_frames = C8_CATCHUP_FRAMES;
+    long rewind_kib = C8_REWIND_DEFAULT_BUDGET / 1024;
+    long keyframe_interval = C8_REWIND_DEFAULT_KEYFRAME_INTERVAL;
+    uint64_t seed = (uint64_t)time(NULL);
+    const char *movie = NULL;
+    const char *profile_path = NULL;
+    const char *trace_path = NULL;
+    bool debug = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            catchup_frames = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rewind_kib = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            keyframe_interval = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            movie = argv[++i];
+        } else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+            profile_path = argv[++i];
+        } else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "-D") == 0) {
+            debug = true;
+        } else if (program == NULL) {
+            program = argv[i];
+        } else {
+            program = NULL;
+            break;
+        }
+    }
+
+    if (program == NULL || catchup_frames < 1 || rewind_kib < 0 ||
+        keyframe_interval < 1) {
+        printf("usage: %s [-c catch-up frames] [-r rewind KiB, 0 disables] "
+               "[-k keyframe interval] [-s seed] [-m record movie] "
+               "[-P profile] [-T trace of the last instructions] "
+               "[-D start in the debugger] [program]\n", argv[0]);
         return 1;
     }
 
     size_t size = 0;
-    uint8_t *rom = c8_rom_new(argv[1], &size);
+    uint8_t *rom = c8_rom_new(program, &size);
     if (rom == NULL) {
         return 1;
     }
@@ -351,8 +796,85 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    c8_cpu_seed(emulator->cpu, seed);
+    if (movie != NULL) {
+        emulator->movie = c8_movie_new(seed, rom, size);
+        if (emulator->movie == NULL) {
+            free(rom);
+            c8_emulator_free(emulator);
+            return 1;
+        }
+    }
+    free(rom);
+
+    emulator->catchup_frames = catchup_frames;
+
+    emulator->state_path = malloc(strlen(program) + sizeof(".state"));
+    if (emulator->state_path == NULL) {
+        fprintf(stderr, "emulator: can't allocate state path\n");
+        c8_emulator_free(emulator);
+        return 1;
+    }
+    strcpy(emulator->state_path, program);
+    strcat(emulator->state_path, ".state");
+
+    if (rewind_kib > 0) {
+        emulator->rewind = c8_rewind_new(rewind_kib * 1024,
+                                         keyframe_interval);
+    }
+
+    /* F10 breaks into the console whether or not it starts there */
+    emulator->debugger = c8_debugger_new();
+    if (emulator->debugger == NULL) {
+        c8_emulator_free(emulator);
+        return 1;
+    }
+    c8_cpu_set_debugger(emulator->cpu, emulator->debugger);
+    if (debug && emulator->movie != NULL) {
+        fprintf(stderr, "emulator: no debugger while recording a movie\n");
+    } else if (debug) {
+        c8_debugger_pause(emulator->debugger);
+    }
+
+    C8Profile *profile = NULL;
+    if (profile_path != NULL) {
+        profile = c8_profile_new();
+        if (profile == NULL) {
+            c8_emulator_free(emulator);
+            return 1;
+        }
+        c8_cpu_set_profile(emulator->cpu, profile);
+    }
+
+    C8Trace *trace = NULL;
+    if (trace_path != NULL) {
+        trace = c8_trace_new(C8_TRACE_DEFAULT_CAPACITY);
+        if (trace == NULL) {
+            c8_profile_free(profile);
+            c8_emulator_free(emulator);
+            return 1;
+        }
+        c8_cpu_set_trace(emulator->cpu, trace);
+    }
+
     c8_main_loop(emulator);
 
+    int status = 0;
+    if (emulator->movie != NULL &&
+        c8_movie_save(emulator->movie, movie) < 0) {
+        status = 1;
+    }
+    if (profile != NULL &&
+        c8_profile_save(profile, profile_path,
+                        c8_profile_format_for(profile_path)) < 0) {
+        status = 1;
+    }
+    c8_profile_free(profile);
+    if (trace != NULL && c8_trace_save(trace, trace_path) < 0) {
+        status = 1;
+    }
+    c8_trace_free(trace);
+
     c8_emulator_free(emulator);
-    return 0;
+    return status;
 }
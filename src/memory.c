@@ -1,21 +1,17 @@
 #include "c8/memory.h"
 
+#include "memory_internal.h"
+
 #include "c8/c8.h"
+#include "c8/instruction.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define C8_MEMORY_INTERPRETER_SIZE 0x200
-#define C8_MEMORY_PROGRAM_SIZE 0x4a0
-#define C8_MEMORY_STACK_SIZE 16
-
-#define C8_MEMORY_INTERPRETER_BEGIN 0x000
-#define C8_MEMORY_INTERPRETER_END \
-    (C8_MEMORY_INTERPRETER_BEGIN + C8_MEMORY_INTERPRETER_SIZE)
 #define C8_MEMORY_PROGRAM_BEGIN 0x200
-#define C8_MEMORY_PROGRAM_END \
-    (C8_MEMORY_PROGRAM_BEGIN + C8_MEMORY_PROGRAM_SIZE)
+#define C8_MEMORY_PROGRAM_SIZE (C8_MEMORY_SIZE - C8_MEMORY_PROGRAM_BEGIN)
 
 #define C8_DISPLAY_WIDTH_BYTES (C8_DISPLAY_WIDTH / 8)
 
@@ -38,12 +34,66 @@ static const uint8_t c8_font[] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80,
 };
 
-struct c8_memory {
-    uint8_t interpreter[C8_MEMORY_INTERPRETER_SIZE];
-    uint8_t program[C8_MEMORY_PROGRAM_SIZE];
-    uint16_t stack[C8_MEMORY_STACK_SIZE];
-    uint8_t display[C8_DISPLAY_HEIGHT][C8_DISPLAY_WIDTH_BYTES];
-};
+static C8MemoryPage *c8_memory_page_new(C8Pool *pool)
+{
+    C8MemoryPage *page = c8_pool_alloc(pool);
+
+    if (page == NULL) {
+        fprintf(stderr, "memory: can't allocate page\n");
+        return NULL;
+    }
+
+    page->refs = 1;
+    return page;
+}
+
+static void c8_memory_page_retain(C8MemoryPage *page)
+{
+    if (page->refs != C8_MEMORY_PAGE_SHARED) {
+        page->refs++;
+    }
+}
+
+static void c8_memory_page_release(C8Pool *pool, C8MemoryPage *page)
+{
+    if (page != NULL && page->refs != C8_MEMORY_PAGE_SHARED &&
+        --page->refs == 0) {
+        c8_pool_free(pool, page);
+    }
+}
+
+/* Gives the memory its own copy of a page it still shares */
+static C8MemoryPage *c8_memory_page_own(C8Memory *memory,
+                                        C8MemoryPage **page)
+{
+    if ((*page)->refs > 1) {
+        C8MemoryPage *copy = c8_memory_page_new(memory->pool);
+        if (copy == NULL) {
+            return NULL;
+        }
+
+        memcpy(copy->bytes, (*page)->bytes, sizeof(copy->bytes));
+        c8_memory_page_release(memory->pool, *page);
+        *page = copy;
+    }
+
+    return *page;
+}
+
+static uint8_t *c8_memory_byte(C8Memory *memory, uint16_t addr)
+{
+    addr &= C8_MEMORY_ADDRESS_MASK;
+    return &memory->ram[addr / C8_MEMORY_PAGE_SIZE]
+                ->bytes[addr % C8_MEMORY_PAGE_SIZE];
+}
+
+/* Pages and memories share one block size */
+static C8Pool *c8_memory_pool_new(void)
+{
+    return c8_pool_new(sizeof(C8MemoryPage) > sizeof(C8Memory)
+                           ? sizeof(C8MemoryPage)
+                           : sizeof(C8Memory));
+}
 
 C8Memory *c8_memory_new(const void *program, uint16_t size)
 {
@@ -52,29 +102,154 @@ C8Memory *c8_memory_new(const void *program, uint16_t size)
         return NULL;
     }
 
-    C8Memory *memory = calloc(1, sizeof(C8Memory));
+    C8Pool *pool = c8_memory_pool_new();
+    if (pool == NULL) {
+        return NULL;
+    }
 
+    C8Memory *memory = c8_pool_alloc(pool);
     if (memory == NULL) {
         fprintf(stderr, "memory: can't allocate memory\n");
+        c8_pool_release(pool);
         return NULL;
     }
 
-    memcpy(memory->interpreter, c8_font, sizeof(c8_font));
-    memcpy(memory->program, program, size);
+    memset(memory, 0, sizeof(C8Memory));
+    memory->pool = pool;
+
+    for (int k = 0; k < C8_MEMORY_PAGES; k++) {
+        if ((memory->ram[k] = c8_memory_page_new(pool)) == NULL) {
+            return c8_memory_free(memory);
+        }
+        memset(memory->ram[k]->bytes, 0, C8_MEMORY_PAGE_SIZE);
+    }
+    if ((memory->display = c8_memory_page_new(pool)) == NULL) {
+        return c8_memory_free(memory);
+    }
+    memset(memory->display->rows, 0, sizeof(memory->display->rows));
+
+    for (uint16_t k = 0; k < sizeof(c8_font); k++) {
+        *c8_memory_byte(memory, k) = c8_font[k];
+    }
+    for (uint16_t k = 0; k < size; k++) {
+        *c8_memory_byte(memory, C8_MEMORY_PROGRAM_BEGIN + k) =
+            ((const uint8_t *)program)[k];
+    }
+
+    /* Nothing has been presented yet */
+    memory->display_dirty.rows = UINT32_MAX;
+    memset(memory->display_dirty.columns, UINT8_MAX,
+           sizeof(memory->display_dirty.columns));
 
     return memory;
 }
 
-int c8_memory_program_read(C8Memory *memory, uint16_t pc, uint16_t *value)
+static C8Memory *c8_memory_copy(C8Memory *memory, C8Pool *pool)
 {
-    pc -= C8_MEMORY_PROGRAM_BEGIN;
+    C8Memory *copy = c8_pool_alloc(pool);
+
+    if (copy == NULL) {
+        fprintf(stderr, "memory: can't allocate memory\n");
+        return NULL;
+    }
 
-    if (pc + 1 >= C8_MEMORY_PROGRAM_SIZE) {
-        fprintf(stderr, "memory: trying to read from invalid address\n");
+    *copy = *memory;
+    copy->write_hook = NULL;
+    copy->write_hook_userdata = NULL;
+    copy->pool = c8_pool_retain(pool);
+    if (copy->image != NULL) {
+        c8_image_retain(copy->image);
+    }
+
+    for (int k = 0; k < C8_MEMORY_PAGES; k++) {
+        c8_memory_page_retain(copy->ram[k]);
+    }
+    c8_memory_page_retain(copy->display);
+
+    return copy;
+}
+
+C8Memory *c8_memory_fork(C8Memory *memory)
+{
+    return c8_memory_copy(memory, memory->pool);
+}
+
+void c8_memory_share(C8Memory *memory)
+{
+    for (int k = 0; k < C8_MEMORY_PAGES; k++) {
+        memory->ram[k]->refs = C8_MEMORY_PAGE_SHARED;
+    }
+    memory->display->refs = C8_MEMORY_PAGE_SHARED;
+}
+
+C8Memory *c8_memory_new_shared(C8Memory *memory, C8Image *image)
+{
+    C8Pool *pool = c8_memory_pool_new();
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    C8Memory *copy = c8_memory_copy(memory, pool);
+    if (copy != NULL) {
+        copy->image = c8_image_retain(image);
+    }
+
+    c8_pool_release(pool);
+    return copy;
+}
+
+C8Memory *c8_memory_free(C8Memory *memory)
+{
+    if (memory != NULL) {
+        C8Pool *pool = memory->pool;
+
+        for (int k = 0; k < C8_MEMORY_PAGES; k++) {
+            c8_memory_page_release(pool, memory->ram[k]);
+        }
+        c8_memory_page_release(pool, memory->display);
+
+        if (memory->image != NULL) {
+            c8_image_release(memory->image);
+        }
+
+        c8_pool_free(pool, memory);
+        c8_pool_release(pool);
+    }
+
+    return NULL;
+}
+
+void c8_memory_set_write_hook(C8Memory *memory, C8MemoryWriteHook hook,
+                              void *userdata)
+{
+    memory->write_hook = hook;
+    memory->write_hook_userdata = userdata;
+}
+
+void c8_memory_set_protected(C8Memory *memory, bool protect)
+{
+    memory->protect = protect;
+}
+
+/* Accesses the protection mode rejects */
+static bool c8_memory_violation(uint16_t addr, uint16_t len, bool write)
+{
+    return (uint32_t)addr + len > C8_MEMORY_SIZE ||
+           (write && addr < C8_MEMORY_PROGRAM_BEGIN);
+}
+
+int c8_memory_program_read(C8Memory *memory, uint16_t pc, uint16_t *value)
+{
+    if (memory->protect &&
+        (pc < C8_MEMORY_PROGRAM_BEGIN ||
+         c8_memory_violation(pc, C8_INSTRUCTION_SIZE, false))) {
+        fprintf(stderr, "memory: trying to execute invalid address 0x%04x\n",
+                pc);
         return -1;
     }
 
-    *value = (memory->program[pc] << 8) | memory->program[pc + 1];
+    *value = (*c8_memory_byte(memory, pc) << 8) |
+             *c8_memory_byte(memory, pc + 1);
     return 0;
 }
 
@@ -106,69 +281,197 @@ int c8_memory_stack_write(C8Memory *memory, uint8_t sp, uint16_t value)
     return 0;
 }
 
-void c8_memory_display_clear(C8Memory *memory)
+/*
+ * Bitmap of the non-zero bytes of a row, bit n for byte column n counted
+ * from the left. Folds every byte into its low bit, then one multiply
+ * gathers the eight low bits into the top byte in reverse order.
+ */
+static uint8_t c8_display_columns(uint64_t row)
+{
+    row |= row >> 4;
+    row |= row >> 2;
+    row |= row >> 1;
+    row &= 0x0101010101010101;
+    return (row * 0x8040201008040201) >> 56;
+}
+
+void c8_memory_set_display_edge(C8Memory *memory, C8DisplayEdge edge)
 {
-    memset(memory->display, 0, sizeof(memory->display));
+    memory->display_edge = edge;
+}
+
+int c8_memory_display_clear(C8Memory *memory)
+{
+    C8DisplayDirty *dirty = &memory->display_dirty;
+    uint64_t changed = 0;
+
+    for (int y = 0; y < C8_DISPLAY_HEIGHT; y++) {
+        changed |= memory->display->rows[y];
+    }
+
+    /* Only lit rows change, so clearing a blank screen isn't a new frame */
+    if (changed == 0) {
+        return 0;
+    }
+
+    C8MemoryPage *display = c8_memory_page_own(memory, &memory->display);
+    if (display == NULL) {
+        return -1;
+    }
+
+    for (int y = 0; y < C8_DISPLAY_HEIGHT; y++) {
+        uint64_t row = display->rows[y];
+
+        dirty->columns[y] |= c8_display_columns(row);
+        dirty->rows |= (uint32_t)(row != 0) << y;
+        display->rows[y] = 0;
+    }
+
+    dirty->generation++;
+    return 0;
 }
 
 void c8_memory_display_read(C8Memory *memory, uint8_t *buf)
 {
-    memcpy(buf, memory->display, sizeof(memory->display));
+    for (int y = 0; y < C8_DISPLAY_HEIGHT; y++) {
+        for (int x = 0; x < C8_DISPLAY_WIDTH_BYTES; x++) {
+            *buf++ = memory->display->rows[y] >> (56 - 8 * x);
+        }
+    }
+}
+
+uint64_t c8_memory_display_hash(C8Memory *memory)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for (int y = 0; y < C8_DISPLAY_HEIGHT; y++) {
+        for (int x = 0; x < C8_DISPLAY_WIDTH_BYTES; x++) {
+            uint8_t byte = memory->display->rows[y] >> (56 - 8 * x);
+            hash = (hash ^ byte) * 0x100000001b3;
+        }
+    }
+
+    return hash;
 }
 
-uint8_t c8_memory_display_write(C8Memory *memory, uint8_t x, uint8_t y,
-                                uint8_t *buf, uint8_t n)
+/*
+ * Each sprite row is placed with a single rotate (wrap) or shift (clip) and
+ * XORed into its row word. Collisions accumulate into one word that is
+ * tested once after the loop.
+ */
+int c8_memory_display_write(C8Memory *memory, uint8_t x, uint8_t y,
+                            uint8_t *buf, uint8_t n)
 {
-    uint8_t ret = 0;
-    uint8_t low_byte_offset = x / 8 % C8_DISPLAY_WIDTH_BYTES;
-    uint8_t high_byte_offset = (low_byte_offset + 1) % C8_DISPLAY_WIDTH_BYTES;
-    uint8_t in_byte_offset = x % 8;
+    C8MemoryPage *display = c8_memory_page_own(memory, &memory->display);
+    if (display == NULL) {
+        return -1;
+    }
+
+    C8DisplayDirty *dirty = &memory->display_dirty;
+    uint64_t collision = 0;
+    uint64_t changed = 0;
+    uint8_t shift = x % C8_DISPLAY_WIDTH;
+    uint8_t top = y % C8_DISPLAY_HEIGHT;
+    bool wrap = memory->display_edge == C8_DISPLAY_EDGE_WRAP;
+
+    if (!wrap && n > C8_DISPLAY_HEIGHT - top) {
+        n = C8_DISPLAY_HEIGHT - top;
+    }
 
     for (uint8_t i = 0; i < n; i++) {
-        uint8_t *row = memory->display[(y + i) % C8_DISPLAY_HEIGHT];
-        uint8_t low_part = buf[i] >> in_byte_offset;
-        uint8_t high_part = buf[i] << (8 - in_byte_offset);
-
-        if (ret == 0 &&
-            ((row[low_byte_offset] & low_part) > 0 ||
-             (row[high_byte_offset] & high_part) > 0)) {
-            ret = 1;
+        uint8_t row_index = (top + i) % C8_DISPLAY_HEIGHT;
+        uint64_t sprite = (uint64_t)buf[i] << (C8_DISPLAY_WIDTH - 8);
+
+        if (wrap) {
+            sprite = sprite >> shift |
+                     sprite << ((C8_DISPLAY_WIDTH - shift) % C8_DISPLAY_WIDTH);
+        } else {
+            sprite >>= shift;
         }
 
-        row[low_byte_offset] ^= low_part;
-        row[high_byte_offset] ^= high_part;
+        collision |= display->rows[row_index] & sprite;
+        display->rows[row_index] ^= sprite;
+
+        dirty->columns[row_index] |= c8_display_columns(sprite);
+        dirty->rows |= (uint32_t)(sprite != 0) << row_index;
+        changed |= sprite;
     }
 
-    return ret;
+    dirty->generation += changed != 0;
+
+    return collision != 0;
+}
+
+void c8_memory_display_consume_dirty(C8Memory *memory, C8DisplayDirty *dirty)
+{
+    *dirty = memory->display_dirty;
+    memory->display_dirty.rows = 0;
+    memset(memory->display_dirty.columns, 0,
+           sizeof(memory->display_dirty.columns));
+}
+
+uint64_t c8_memory_display_generation(C8Memory *memory)
+{
+    return memory->display_dirty.generation;
 }
 
+/*
+ * Addresses wrap at 4 KiB, so an access running past 0xfff continues at
+ * 0x000. `len` never exceeds the 16 registers.
+ */
 int c8_memory_read(C8Memory *memory, uint16_t addr, void *buf, uint16_t len)
 {
-    if (addr >= C8_MEMORY_INTERPRETER_BEGIN &&
-        addr + len <= C8_MEMORY_INTERPRETER_END) {
-        memcpy(buf, memory->interpreter + addr - C8_MEMORY_INTERPRETER_BEGIN,
-               len);
-        return 0;
-    } else if (addr >= C8_MEMORY_PROGRAM_BEGIN &&
-               addr + len <= C8_MEMORY_PROGRAM_END) {
-        memcpy(buf, memory->program + addr - C8_MEMORY_PROGRAM_BEGIN, len);
-        return 0;
-    } else {
-        fprintf(stderr, "memory: trying to read from invalid address\n");
+    uint8_t *dst = buf;
+
+    if (memory->protect && c8_memory_violation(addr, len, false)) {
+        fprintf(stderr, "memory: trying to read from invalid address 0x%04x\n",
+                addr);
         return -1;
     }
+
+    for (uint16_t k = 0; k < len; k++) {
+        dst[k] = *c8_memory_byte(memory, addr + k);
+    }
+
+    return 0;
 }
 
 int c8_memory_write(C8Memory *memory, uint16_t addr, void *buf, uint16_t len)
 {
-    if (addr >= C8_MEMORY_PROGRAM_BEGIN &&
-        addr + len <= C8_MEMORY_PROGRAM_END) {
-        memcpy(memory->program + addr - C8_MEMORY_PROGRAM_BEGIN, buf, len);
-        return 0;
-    } else {
-        fprintf(stderr, "memory: trying to write to invalid address\n");
+    const uint8_t *src = buf;
+
+    if (memory->protect && c8_memory_violation(addr, len, true)) {
+        fprintf(stderr, "memory: trying to write to invalid address 0x%04x\n",
+                addr);
         return -1;
     }
+
+    for (uint16_t k = 0; k < len; k++) {
+        uint16_t at = (addr + k) & C8_MEMORY_ADDRESS_MASK;
+
+        if ((k == 0 || at % C8_MEMORY_PAGE_SIZE == 0) &&
+            c8_memory_page_own(memory,
+                               &memory->ram[at / C8_MEMORY_PAGE_SIZE]) ==
+                NULL) {
+            return -1;
+        }
+
+        *c8_memory_byte(memory, at) = src[k];
+    }
+
+    if (memory->write_hook != NULL) {
+        /* Report a wrapped write as its two contiguous pieces */
+        uint16_t begin = addr & C8_MEMORY_ADDRESS_MASK;
+        uint16_t first = len < C8_MEMORY_SIZE - begin ? len
+                                                      : C8_MEMORY_SIZE - begin;
+
+        memory->write_hook(memory->write_hook_userdata, begin, first);
+        if (first < len) {
+            memory->write_hook(memory->write_hook_userdata, 0, len - first);
+        }
+    }
+
+    return 0;
 }
 
 int c8_memory_write_i8(C8Memory *memory, uint16_t addr, uint8_t value)
@@ -176,6 +479,102 @@ int c8_memory_write_i8(C8Memory *memory, uint16_t addr, uint8_t value)
     return c8_memory_write(memory, addr, &value, sizeof(value));
 }
 
+void c8_memory_export(C8Memory *memory, uint8_t *ram, uint64_t *display)
+{
+    for (int k = 0; k < C8_MEMORY_PAGES; k++) {
+        memcpy(ram + k * C8_MEMORY_PAGE_SIZE, memory->ram[k]->bytes,
+               C8_MEMORY_PAGE_SIZE);
+    }
+
+    memcpy(display, memory->display->rows, sizeof(memory->display->rows));
+}
+
+/*
+ * Only pages that differ are copied, so a fork loading a nearby state keeps
+ * sharing the rest. The write hook hears about the span that changed.
+ * Every such page is owned before anything is copied, so running out of
+ * pages leaves the contents as they were.
+ */
+int c8_memory_import(C8Memory *memory, const uint8_t *ram,
+                     const uint64_t *display)
+{
+    uint16_t begin = C8_MEMORY_SIZE;
+    uint16_t end = 0;
+
+    for (int k = 0; k < C8_MEMORY_PAGES; k++) {
+        if (memcmp(memory->ram[k]->bytes, ram + k * C8_MEMORY_PAGE_SIZE,
+                   C8_MEMORY_PAGE_SIZE) != 0 &&
+            c8_memory_page_own(memory, &memory->ram[k]) == NULL) {
+            return -1;
+        }
+    }
+    if (memcmp(memory->display->rows, display,
+               sizeof(memory->display->rows)) != 0 &&
+        c8_memory_page_own(memory, &memory->display) == NULL) {
+        return -1;
+    }
+
+    for (int k = 0; k < C8_MEMORY_PAGES; k++) {
+        const uint8_t *src = ram + k * C8_MEMORY_PAGE_SIZE;
+        uint16_t first = 0;
+        uint16_t last = C8_MEMORY_PAGE_SIZE;
+
+        while (first < last && memory->ram[k]->bytes[first] == src[first]) {
+            first++;
+        }
+        if (first == last) {
+            continue;
+        }
+        while (memory->ram[k]->bytes[last - 1] == src[last - 1]) {
+            last--;
+        }
+
+        memcpy(memory->ram[k]->bytes + first, src + first, last - first);
+        if (begin == C8_MEMORY_SIZE) {
+            begin = k * C8_MEMORY_PAGE_SIZE + first;
+        }
+        end = k * C8_MEMORY_PAGE_SIZE + last;
+    }
+
+    if (memcmp(memory->display->rows, display,
+               sizeof(memory->display->rows)) != 0) {
+        memcpy(memory->display->rows, display, sizeof(memory->display->rows));
+    }
+
+    if (begin < end && memory->write_hook != NULL) {
+        memory->write_hook(memory->write_hook_userdata, begin, end - begin);
+    }
+
+    return 0;
+}
+
+int c8_memory_reset(C8Memory *memory, const void *program, uint16_t size)
+{
+    static const uint64_t display[C8_DISPLAY_HEIGHT];
+    uint8_t ram[C8_MEMORY_SIZE] = {0};
+
+    if (size > C8_MEMORY_PROGRAM_SIZE) {
+        fprintf(stderr, "memory: program is too big\n");
+        return -1;
+    }
+
+    memcpy(ram, c8_font, sizeof(c8_font));
+    if (size > 0) {
+        memcpy(ram + C8_MEMORY_PROGRAM_BEGIN, program, size);
+    }
+
+    if (c8_memory_import(memory, ram, display) < 0) {
+        return -1;
+    }
+
+    memset(memory->stack, 0, sizeof(memory->stack));
+    memory->display_dirty.rows = UINT32_MAX;
+    memset(memory->display_dirty.columns, UINT8_MAX,
+           sizeof(memory->display_dirty.columns));
+    memory->display_dirty.generation++;
+    return 0;
+}
+
 static long c8_rom_get_size(FILE *file)
 {
     if (fseek(file, 0, SEEK_END) < 0) {
@@ -0,0 +1,68 @@
+#ifndef C8_MEMORY_INTERNAL_H
+#define C8_MEMORY_INTERNAL_H
+
+#include "c8/c8.h"
+#include "c8/image.h"
+#include "c8/memory.h"
+
+#include "pool.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define C8_MEMORY_STACK_SIZE 16
+
+#define C8_MEMORY_PAGE_SIZE 256
+#define C8_MEMORY_PAGES (C8_MEMORY_SIZE / C8_MEMORY_PAGE_SIZE)
+/* Page references of an image's pages, which are never written or freed */
+#define C8_MEMORY_PAGE_SHARED UINT32_MAX
+
+/*
+ * RAM and the display are kept in pages that forks share until one of
+ * them writes, at which point the writer gets its own copy.
+ */
+typedef struct c8_memory_page {
+    union {
+        uint8_t bytes[C8_MEMORY_PAGE_SIZE];
+        /* The display page, the leftmost pixel in the most significant bit */
+        uint64_t rows[C8_DISPLAY_HEIGHT];
+    };
+    /* Memories referencing the page */
+    uint32_t refs;
+} C8MemoryPage;
+
+_Static_assert(sizeof(uint64_t) * C8_DISPLAY_HEIGHT == C8_MEMORY_PAGE_SIZE,
+               "the display doesn't fill a page");
+
+struct c8_memory {
+    /* The font lives at 0x000, programs are loaded at 0x200 */
+    C8MemoryPage *ram[C8_MEMORY_PAGES];
+    C8MemoryPage *display;
+    uint16_t stack[C8_MEMORY_STACK_SIZE];
+    bool protect;
+    C8DisplayEdge display_edge;
+    C8DisplayDirty display_dirty;
+
+    C8MemoryWriteHook write_hook;
+    void *write_hook_userdata;
+
+    /* Pages and memories of everything forked from one c8_memory_new */
+    C8Pool *pool;
+    /* Where the shared pages came from, kept alive while they are used */
+    C8Image *image;
+};
+
+/*
+ * Makes every page of the memory read-only and shareable across threads,
+ * for the memory an image is built around. It must not be written after.
+ */
+void c8_memory_share(C8Memory *memory);
+/* A memory on its own pool that starts on the pages of a shared memory */
+C8Memory *c8_memory_new_shared(C8Memory *memory, C8Image *image);
+
+/* Save state access to the whole RAM and display */
+void c8_memory_export(C8Memory *memory, uint8_t *ram, uint64_t *display);
+int c8_memory_import(C8Memory *memory, const uint8_t *ram,
+                     const uint64_t *display);
+
+#endif
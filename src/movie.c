@@ -0,0 +1,194 @@
+#include "c8/movie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* "C8MV" read as a little-endian word */
+#define C8_MOVIE_MAGIC 0x564d3843
+#define C8_MOVIE_VERSION 1
+
+typedef struct c8_movie_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seed;
+    uint64_t rom_hash;
+    uint64_t count;
+} C8MovieHeader;
+
+typedef struct c8_movie_event {
+    uint64_t cycles;
+    uint8_t key;
+    uint8_t pressed;
+    uint8_t reserved[6];
+} C8MovieEvent;
+
+struct c8_movie {
+    C8MovieHeader header;
+    C8MovieEvent *events;
+    size_t capacity;
+    /* Next event to play */
+    size_t position;
+};
+
+/* 64-bit FNV-1a */
+static uint64_t c8_movie_hash(const void *buf, size_t size)
+{
+    const uint8_t *p = buf;
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for (size_t k = 0; k < size; k++) {
+        hash = (hash ^ p[k]) * 0x100000001b3;
+    }
+
+    return hash;
+}
+
+C8Movie *c8_movie_new(uint64_t seed, const void *rom, size_t size)
+{
+    C8Movie *movie = calloc(1, sizeof(C8Movie));
+
+    if (movie == NULL) {
+        fprintf(stderr, "movie: can't allocate movie\n");
+        return NULL;
+    }
+
+    movie->header.magic = C8_MOVIE_MAGIC;
+    movie->header.version = C8_MOVIE_VERSION;
+    movie->header.seed = seed;
+    movie->header.rom_hash = c8_movie_hash(rom, size);
+    return movie;
+}
+
+C8Movie *c8_movie_free(C8Movie *movie)
+{
+    if (movie != NULL) {
+        free(movie->events);
+        free(movie);
+    }
+
+    return NULL;
+}
+
+int c8_movie_save(C8Movie *movie, const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "movie: can't open %s\n", path);
+        return -1;
+    }
+
+    if (fwrite(&movie->header, sizeof(movie->header), 1, file) != 1 ||
+        fwrite(movie->events, sizeof(C8MovieEvent), movie->header.count,
+               file) != movie->header.count) {
+        fprintf(stderr, "movie: can't write to %s\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "movie: can't write to %s\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+C8Movie *c8_movie_load(const char *path)
+{
+    C8Movie *movie = calloc(1, sizeof(C8Movie));
+    if (movie == NULL) {
+        fprintf(stderr, "movie: can't allocate movie\n");
+        return NULL;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "movie: can't open %s\n", path);
+        return c8_movie_free(movie);
+    }
+
+    if (fread(&movie->header, sizeof(movie->header), 1, file) != 1 ||
+        movie->header.magic != C8_MOVIE_MAGIC) {
+        fprintf(stderr, "movie: %s is not a movie\n", path);
+        fclose(file);
+        return c8_movie_free(movie);
+    }
+    if (movie->header.version != C8_MOVIE_VERSION) {
+        fprintf(stderr, "movie: unsupported version %u\n",
+                movie->header.version);
+        fclose(file);
+        return c8_movie_free(movie);
+    }
+
+    movie->capacity = movie->header.count;
+    movie->events = malloc(movie->capacity * sizeof(C8MovieEvent));
+    if (movie->capacity > 0 &&
+        (movie->events == NULL ||
+         fread(movie->events, sizeof(C8MovieEvent), movie->capacity,
+               file) != movie->capacity)) {
+        fprintf(stderr, "movie: can't read events from %s\n", path);
+        fclose(file);
+        return c8_movie_free(movie);
+    }
+
+    fclose(file);
+    return movie;
+}
+
+uint64_t c8_movie_seed(C8Movie *movie)
+{
+    return movie->header.seed;
+}
+
+bool c8_movie_matches_rom(C8Movie *movie, const void *rom, size_t size)
+{
+    return movie->header.rom_hash == c8_movie_hash(rom, size);
+}
+
+int c8_movie_record(C8Movie *movie, uint64_t cycles, C8Key key, bool pressed)
+{
+    if (movie->header.count == movie->capacity) {
+        size_t capacity = movie->capacity > 0 ? 2 * movie->capacity : 256;
+        C8MovieEvent *events = realloc(movie->events,
+                                       capacity * sizeof(C8MovieEvent));
+
+        if (events == NULL) {
+            fprintf(stderr, "movie: can't allocate events\n");
+            return -1;
+        }
+
+        movie->events = events;
+        movie->capacity = capacity;
+    }
+
+    movie->events[movie->header.count++] = (C8MovieEvent){
+        .cycles = cycles,
+        .key = key,
+        .pressed = pressed
+    };
+    return 0;
+}
+
+bool c8_movie_play(C8Movie *movie, C8Keyboard *keyboard, uint64_t cycles)
+{
+    while (movie->position < movie->header.count &&
+           movie->events[movie->position].cycles <= cycles) {
+        const C8MovieEvent *event = &movie->events[movie->position++];
+
+        if (event->pressed) {
+            c8_keyboard_press_key(keyboard, event->key);
+        } else {
+            c8_keyboard_release_key(keyboard, event->key);
+        }
+    }
+
+    return movie->position < movie->header.count;
+}
+
+uint64_t c8_movie_next(C8Movie *movie)
+{
+    return movie->position < movie->header.count
+               ? movie->events[movie->position].cycles
+               : UINT64_MAX;
+}
@@ -0,0 +1,108 @@
+#include "pool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define C8_POOL_CHUNK_BLOCKS 64
+
+typedef struct c8_pool_chunk {
+    struct c8_pool_chunk *next;
+    max_align_t blocks[];
+} C8PoolChunk;
+
+struct c8_pool {
+    size_t block_size;
+    /* Blocks in the next chunk, doubling up to C8_POOL_CHUNK_BLOCKS */
+    size_t chunk_blocks;
+    uint32_t refs;
+    /* Free blocks, linked through their first word */
+    void *free;
+    C8PoolChunk *chunks;
+};
+
+C8Pool *c8_pool_new(size_t block_size)
+{
+    C8Pool *pool = calloc(1, sizeof(C8Pool));
+
+    if (pool == NULL) {
+        fprintf(stderr, "pool: can't allocate pool\n");
+        return NULL;
+    }
+
+    /* Every block stays aligned for any type and can hold the link */
+    if (block_size < sizeof(void *)) {
+        block_size = sizeof(void *);
+    }
+    pool->block_size = (block_size + sizeof(max_align_t) - 1) /
+                       sizeof(max_align_t) * sizeof(max_align_t);
+    pool->chunk_blocks = 1;
+    pool->refs = 1;
+
+    return pool;
+}
+
+C8Pool *c8_pool_retain(C8Pool *pool)
+{
+    pool->refs++;
+    return pool;
+}
+
+void c8_pool_release(C8Pool *pool)
+{
+    if (pool == NULL || --pool->refs > 0) {
+        return;
+    }
+
+    while (pool->chunks != NULL) {
+        C8PoolChunk *next = pool->chunks->next;
+        free(pool->chunks);
+        pool->chunks = next;
+    }
+
+    free(pool);
+}
+
+static int c8_pool_grow(C8Pool *pool)
+{
+    C8PoolChunk *chunk = malloc(sizeof(C8PoolChunk) +
+                                pool->chunk_blocks * pool->block_size);
+
+    if (chunk == NULL) {
+        fprintf(stderr, "pool: can't allocate chunk\n");
+        return -1;
+    }
+
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+
+    uint8_t *blocks = (uint8_t *)chunk->blocks;
+    for (size_t k = pool->chunk_blocks; k-- > 0;) {
+        c8_pool_free(pool, blocks + k * pool->block_size);
+    }
+
+    if (pool->chunk_blocks < C8_POOL_CHUNK_BLOCKS) {
+        pool->chunk_blocks *= 2;
+    }
+
+    return 0;
+}
+
+void *c8_pool_alloc(C8Pool *pool)
+{
+    if (pool->free == NULL && c8_pool_grow(pool) < 0) {
+        return NULL;
+    }
+
+    void *block = pool->free;
+    pool->free = *(void **)block;
+
+    return block;
+}
+
+void c8_pool_free(C8Pool *pool, void *block)
+{
+    *(void **)block = pool->free;
+    pool->free = block;
+}
@@ -0,0 +1,23 @@
+#ifndef C8_POOL_H
+#define C8_POOL_H
+
+#include <stddef.h>
+
+typedef struct c8_pool C8Pool;
+
+/*
+ * Fixed-size blocks carved from chunks that start at one block and double
+ * up to C8_POOL_CHUNK_BLOCKS, so a pool that only ever holds a few blocks
+ * stays small. Freed blocks go on a free list and chunks are only returned
+ * to the system when the last reference to the pool is dropped, so once
+ * warmed up, allocating and freeing never reaches malloc. Pools aren't
+ * thread-safe.
+ */
+C8Pool *c8_pool_new(size_t block_size);
+C8Pool *c8_pool_retain(C8Pool *pool);
+void c8_pool_release(C8Pool *pool);
+
+void *c8_pool_alloc(C8Pool *pool);
+void c8_pool_free(C8Pool *pool, void *block);
+
+#endif
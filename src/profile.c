@@ -0,0 +1,542 @@
+#include "c8/profile.h"
+
+#include "cpu_internal.h"
+#include "memory_internal.h"
+
+#include "c8/instruction.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Heat maps show 64 addresses per line */
+#define C8_PROFILE_HEATMAP_WIDTH 64
+#define C8_PROFILE_TOP_OPCODES 16
+
+typedef enum c8_profile_class {
+    C8_PROFILE_BAD = 0,
+    C8_PROFILE_SYS,
+    C8_PROFILE_CLS,
+    C8_PROFILE_RET,
+    C8_PROFILE_JP,
+    C8_PROFILE_CALL,
+    C8_PROFILE_SE_I8,
+    C8_PROFILE_SNE_I8,
+    C8_PROFILE_SE_REG,
+    C8_PROFILE_LD_I8,
+    C8_PROFILE_ADD_I8,
+    C8_PROFILE_LD_REG,
+    C8_PROFILE_OR,
+    C8_PROFILE_AND,
+    C8_PROFILE_XOR,
+    C8_PROFILE_ADD_REG,
+    C8_PROFILE_SUB,
+    C8_PROFILE_SHR,
+    C8_PROFILE_SUBN,
+    C8_PROFILE_SHL,
+    C8_PROFILE_SNE_REG,
+    C8_PROFILE_LD_I,
+    C8_PROFILE_JP_V0,
+    C8_PROFILE_RND,
+    C8_PROFILE_DRW,
+    C8_PROFILE_SKP,
+    C8_PROFILE_SKNP,
+    C8_PROFILE_LD_REG_DT,
+    C8_PROFILE_LD_REG_KEY,
+    C8_PROFILE_LD_DT_REG,
+    C8_PROFILE_LD_ST_REG,
+    C8_PROFILE_ADD_I,
+    C8_PROFILE_LD_SPRITE,
+    C8_PROFILE_LD_BCD,
+    C8_PROFILE_LD_MEM_REG,
+    C8_PROFILE_LD_REG_MEM,
+    C8_PROFILE_CLASS_NUM
+} C8ProfileClass;
+
+static const char *const c8_profile_class_names[] = {
+    [C8_PROFILE_BAD] = "bad",
+    [C8_PROFILE_SYS] = "sys",
+    [C8_PROFILE_CLS] = "cls",
+    [C8_PROFILE_RET] = "ret",
+    [C8_PROFILE_JP] = "jp",
+    [C8_PROFILE_CALL] = "call",
+    [C8_PROFILE_SE_I8] = "se_i8",
+    [C8_PROFILE_SNE_I8] = "sne_i8",
+    [C8_PROFILE_SE_REG] = "se_reg",
+    [C8_PROFILE_LD_I8] = "ld_i8",
+    [C8_PROFILE_ADD_I8] = "add_i8",
+    [C8_PROFILE_LD_REG] = "ld_reg",
+    [C8_PROFILE_OR] = "or",
+    [C8_PROFILE_AND] = "and",
+    [C8_PROFILE_XOR] = "xor",
+    [C8_PROFILE_ADD_REG] = "add_reg",
+    [C8_PROFILE_SUB] = "sub",
+    [C8_PROFILE_SHR] = "shr",
+    [C8_PROFILE_SUBN] = "subn",
+    [C8_PROFILE_SHL] = "shl",
+    [C8_PROFILE_SNE_REG] = "sne_reg",
+    [C8_PROFILE_LD_I] = "ld_i",
+    [C8_PROFILE_JP_V0] = "jp_v0",
+    [C8_PROFILE_RND] = "rnd",
+    [C8_PROFILE_DRW] = "drw",
+    [C8_PROFILE_SKP] = "skp",
+    [C8_PROFILE_SKNP] = "sknp",
+    [C8_PROFILE_LD_REG_DT] = "ld_reg_dt",
+    [C8_PROFILE_LD_REG_KEY] = "ld_reg_key",
+    [C8_PROFILE_LD_DT_REG] = "ld_dt_reg",
+    [C8_PROFILE_LD_ST_REG] = "ld_st_reg",
+    [C8_PROFILE_ADD_I] = "add_i",
+    [C8_PROFILE_LD_SPRITE] = "ld_sprite",
+    [C8_PROFILE_LD_BCD] = "ld_bcd",
+    [C8_PROFILE_LD_MEM_REG] = "ld_mem_reg",
+    [C8_PROFILE_LD_REG_MEM] = "ld_reg_mem",
+};
+
+struct c8_profile {
+    uint64_t instructions;
+    uint64_t classes[C8_PROFILE_CLASS_NUM];
+    uint64_t pcs[C8_MEMORY_SIZE];
+    uint64_t reads[C8_MEMORY_SIZE];
+    uint64_t writes[C8_MEMORY_SIZE];
+    uint64_t rows[C8_DISPLAY_HEIGHT];
+};
+
+C8Profile *c8_profile_new(void)
+{
+    C8Profile *profile = calloc(1, sizeof(C8Profile));
+
+    if (profile == NULL) {
+        fprintf(stderr, "profile: can't allocate profile\n");
+        return NULL;
+    }
+
+    return profile;
+}
+
+C8Profile *c8_profile_free(C8Profile *profile)
+{
+    free(profile);
+    return NULL;
+}
+
+void c8_cpu_set_profile(C8Cpu *cpu, C8Profile *profile)
+{
+    cpu->profile = profile;
+}
+
+uint64_t c8_profile_instructions(C8Profile *profile)
+{
+    return profile->instructions;
+}
+
+/* Follows the decoding in c8_cpu_execute_instruction_internal, cpu.c */
+static C8ProfileClass c8_profile_classify(uint16_t instruction)
+{
+    static const C8ProfileClass alu[16] = {
+        [0x0] = C8_PROFILE_LD_REG,
+        [0x1] = C8_PROFILE_OR,
+        [0x2] = C8_PROFILE_AND,
+        [0x3] = C8_PROFILE_XOR,
+        [0x4] = C8_PROFILE_ADD_REG,
+        [0x5] = C8_PROFILE_SUB,
+        [0x6] = C8_PROFILE_SHR,
+        [0x7] = C8_PROFILE_SUBN,
+        [0xe] = C8_PROFILE_SHL,
+    };
+
+    switch (instruction >> 12) {
+    case 0x0:
+        if ((instruction >> 8) != 0) {
+            return C8_PROFILE_SYS;
+        }
+        if ((instruction & 0x0ff) == 0xe0) {
+            return C8_PROFILE_CLS;
+        }
+        return (instruction & 0x0ff) == 0xee ? C8_PROFILE_RET
+                                             : C8_PROFILE_BAD;
+
+    case 0x1:
+        return C8_PROFILE_JP;
+
+    case 0x2:
+        return C8_PROFILE_CALL;
+
+    case 0x3:
+        return C8_PROFILE_SE_I8;
+
+    case 0x4:
+        return C8_PROFILE_SNE_I8;
+
+    case 0x5:
+        return (instruction & 0x00f) == 0 ? C8_PROFILE_SE_REG
+                                          : C8_PROFILE_BAD;
+
+    case 0x6:
+        return C8_PROFILE_LD_I8;
+
+    case 0x7:
+        return C8_PROFILE_ADD_I8;
+
+    case 0x8:
+        return alu[instruction & 0x00f];
+
+    case 0x9:
+        return (instruction & 0x00f) == 0 ? C8_PROFILE_SNE_REG
+                                          : C8_PROFILE_BAD;
+
+    case 0xa:
+        return C8_PROFILE_LD_I;
+
+    case 0xb:
+        return C8_PROFILE_JP_V0;
+
+    case 0xc:
+        return C8_PROFILE_RND;
+
+    case 0xd:
+        return C8_PROFILE_DRW;
+
+    case 0xe:
+        switch (instruction & 0x0ff) {
+        case 0x9e:
+            return C8_PROFILE_SKP;
+
+        case 0xa1:
+            return C8_PROFILE_SKNP;
+
+        default:
+            return C8_PROFILE_BAD;
+        }
+
+    default:
+        switch (instruction & 0x0ff) {
+        case 0x07:
+            return C8_PROFILE_LD_REG_DT;
+
+        case 0x0a:
+            return C8_PROFILE_LD_REG_KEY;
+
+        case 0x15:
+            return C8_PROFILE_LD_DT_REG;
+
+        case 0x18:
+            return C8_PROFILE_LD_ST_REG;
+
+        case 0x1e:
+            return C8_PROFILE_ADD_I;
+
+        case 0x29:
+            return C8_PROFILE_LD_SPRITE;
+
+        case 0x33:
+            return C8_PROFILE_LD_BCD;
+
+        case 0x55:
+            return C8_PROFILE_LD_MEM_REG;
+
+        case 0x65:
+            return C8_PROFILE_LD_REG_MEM;
+
+        default:
+            return C8_PROFILE_BAD;
+        }
+    }
+}
+
+static void c8_profile_count_span(uint64_t *counts, uint16_t addr,
+                                  uint16_t len)
+{
+    for (uint16_t k = 0; k < len; k++) {
+        counts[(addr + k) & C8_MEMORY_ADDRESS_MASK]++;
+    }
+}
+
+/* Counts an instruction about to execute, before it changes I or Vy */
+static void c8_profile_count(C8Profile *profile, C8Cpu *cpu,
+                             uint16_t instruction)
+{
+    C8ProfileClass class = c8_profile_classify(instruction);
+    uint8_t x = c8_instruction_get_x(instruction);
+
+    profile->instructions++;
+    profile->classes[class]++;
+    profile->pcs[cpu->pc]++;
+
+    switch (class) {
+    case C8_PROFILE_DRW: {
+        uint8_t n = c8_instruction_get_n(instruction);
+        uint8_t top = cpu->v[c8_instruction_get_y(instruction)] %
+                      C8_DISPLAY_HEIGHT;
+
+        if (cpu->memory->display_edge == C8_DISPLAY_EDGE_CLIP &&
+            n > C8_DISPLAY_HEIGHT - top) {
+            n = C8_DISPLAY_HEIGHT - top;
+        }
+
+        c8_profile_count_span(profile->reads, cpu->i, n);
+        for (uint8_t k = 0; k < n; k++) {
+            profile->rows[(top + k) % C8_DISPLAY_HEIGHT]++;
+        }
+        break;
+    }
+
+    case C8_PROFILE_LD_BCD:
+        c8_profile_count_span(profile->writes, cpu->i, 3);
+        break;
+
+    case C8_PROFILE_LD_MEM_REG:
+        c8_profile_count_span(profile->writes, cpu->i, x + 1);
+        break;
+
+    case C8_PROFILE_LD_REG_MEM:
+        c8_profile_count_span(profile->reads, cpu->i, x + 1);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void c8_profile_observe(C8Cpu *cpu)
+{
+    uint16_t instruction;
+
+    if (c8_memory_program_read(cpu->memory, cpu->pc, &instruction) == 0) {
+        c8_profile_count(cpu->profile, cpu, instruction);
+    }
+}
+
+C8ProfileFormat c8_profile_format_for(const char *path)
+{
+    const char *extension = strrchr(path, '.');
+
+    if (extension != NULL && strcmp(extension, ".csv") == 0) {
+        return C8_PROFILE_FORMAT_CSV;
+    }
+    if (extension != NULL && strcmp(extension, ".json") == 0) {
+        return C8_PROFILE_FORMAT_JSON;
+    }
+
+    return C8_PROFILE_FORMAT_HEATMAP;
+}
+
+/* One row per nonzero counter: kind, key, count */
+static void c8_profile_write_csv(C8Profile *profile, FILE *file)
+{
+    static const char *const kinds[] = {"pc", "read", "write"};
+    const uint64_t *counts[] = {profile->pcs, profile->reads, profile->writes};
+
+    fprintf(file, "kind,key,count\n");
+    fprintf(file, "total,instructions,%llu\n",
+            (unsigned long long)profile->instructions);
+
+    for (int k = 0; k < C8_PROFILE_CLASS_NUM; k++) {
+        if (profile->classes[k] != 0) {
+            fprintf(file, "opcode,%s,%llu\n", c8_profile_class_names[k],
+                    (unsigned long long)profile->classes[k]);
+        }
+    }
+
+    for (int kind = 0; kind < 3; kind++) {
+        for (int addr = 0; addr < C8_MEMORY_SIZE; addr++) {
+            if (counts[kind][addr] != 0) {
+                fprintf(file, "%s,0x%03x,%llu\n", kinds[kind], addr,
+                        (unsigned long long)counts[kind][addr]);
+            }
+        }
+    }
+
+    for (int y = 0; y < C8_DISPLAY_HEIGHT; y++) {
+        if (profile->rows[y] != 0) {
+            fprintf(file, "row,%d,%llu\n", y,
+                    (unsigned long long)profile->rows[y]);
+        }
+    }
+}
+
+static void c8_profile_write_json_counts(FILE *file, const char *name,
+                                         const uint64_t *counts, bool last)
+{
+    bool first = true;
+
+    fprintf(file, "  \"%s\": {", name);
+    for (int addr = 0; addr < C8_MEMORY_SIZE; addr++) {
+        if (counts[addr] != 0) {
+            fprintf(file, "%s\"0x%03x\": %llu", first ? "" : ", ", addr,
+                    (unsigned long long)counts[addr]);
+            first = false;
+        }
+    }
+    fprintf(file, "}%s\n", last ? "" : ",");
+}
+
+static void c8_profile_write_json(C8Profile *profile, FILE *file)
+{
+    bool first = true;
+
+    fprintf(file, "{\n  \"instructions\": %llu,\n  \"opcodes\": {",
+            (unsigned long long)profile->instructions);
+    for (int k = 0; k < C8_PROFILE_CLASS_NUM; k++) {
+        if (profile->classes[k] != 0) {
+            fprintf(file, "%s\"%s\": %llu", first ? "" : ", ",
+                    c8_profile_class_names[k],
+                    (unsigned long long)profile->classes[k]);
+            first = false;
+        }
+    }
+    fprintf(file, "},\n");
+
+    c8_profile_write_json_counts(file, "pc", profile->pcs, false);
+    c8_profile_write_json_counts(file, "reads", profile->reads, false);
+    c8_profile_write_json_counts(file, "writes", profile->writes, false);
+
+    fprintf(file, "  \"rows\": [");
+    for (int y = 0; y < C8_DISPLAY_HEIGHT; y++) {
+        fprintf(file, "%s%llu", y > 0 ? ", " : "",
+                (unsigned long long)profile->rows[y]);
+    }
+    fprintf(file, "]\n}\n");
+}
+
+static int c8_profile_log2(uint64_t count)
+{
+    int log = 0;
+
+    while (count >>= 1) {
+        log++;
+    }
+
+    return log;
+}
+
+/*
+ * Shades from ' ' for never to '@' for the hottest address, on a log scale
+ * so that loops executed thousands of times don't flatten everything else.
+ */
+static void c8_profile_write_heatmap_counts(FILE *file, const char *title,
+                                            const uint64_t *counts)
+{
+    static const char shades[] = " .:-=+*#%@";
+    const int levels = sizeof(shades) - 2;
+    uint64_t max = 0;
+
+    for (int addr = 0; addr < C8_MEMORY_SIZE; addr++) {
+        if (counts[addr] > max) {
+            max = counts[addr];
+        }
+    }
+
+    fprintf(file, "%s, hottest %llu\n", title, (unsigned long long)max);
+    if (max == 0) {
+        fprintf(file, "\n");
+        return;
+    }
+
+    int top = c8_profile_log2(max) > 0 ? c8_profile_log2(max) : 1;
+
+    for (int line = 0; line < C8_MEMORY_SIZE;
+         line += C8_PROFILE_HEATMAP_WIDTH) {
+        char text[C8_PROFILE_HEATMAP_WIDTH + 1];
+        bool any = false;
+
+        for (int k = 0; k < C8_PROFILE_HEATMAP_WIDTH; k++) {
+            uint64_t count = counts[line + k];
+            int level = 0;
+
+            if (count > 0) {
+                level = 1 + c8_profile_log2(count) * (levels - 1) / top;
+                any = true;
+            }
+            text[k] = shades[level];
+        }
+        text[C8_PROFILE_HEATMAP_WIDTH] = '\0';
+
+        /* Untouched stretches are left out */
+        if (any) {
+            fprintf(file, "0x%03x |%s|\n", line, text);
+        }
+    }
+
+    fprintf(file, "\n");
+}
+
+static int c8_profile_compare_classes(const void *a, const void *b,
+                                      const uint64_t *classes)
+{
+    uint64_t x = classes[*(const int *)a];
+    uint64_t y = classes[*(const int *)b];
+    return (x < y) - (x > y);
+}
+
+static void c8_profile_write_heatmap(C8Profile *profile, FILE *file)
+{
+    int order[C8_PROFILE_CLASS_NUM];
+
+    fprintf(file, "instructions: %llu\n\n",
+            (unsigned long long)profile->instructions);
+
+    /* Insertion sort, qsort has no context argument in C11 */
+    for (int k = 0; k < C8_PROFILE_CLASS_NUM; k++) {
+        int j = k;
+        while (j > 0 && c8_profile_compare_classes(&k, &order[j - 1],
+                                                   profile->classes) < 0) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = k;
+    }
+
+    fprintf(file, "top opcodes\n");
+    for (int k = 0; k < C8_PROFILE_TOP_OPCODES; k++) {
+        uint64_t count = profile->classes[order[k]];
+        if (count == 0) {
+            break;
+        }
+
+        fprintf(file, "  %-12s %12llu %6.2f%%\n",
+                c8_profile_class_names[order[k]], (unsigned long long)count,
+                100.0 * count / profile->instructions);
+    }
+    fprintf(file, "\n");
+
+    c8_profile_write_heatmap_counts(file, "pc", profile->pcs);
+    c8_profile_write_heatmap_counts(file, "reads", profile->reads);
+    c8_profile_write_heatmap_counts(file, "writes", profile->writes);
+
+    fprintf(file, "sprite rows drawn per display row\n");
+    for (int y = 0; y < C8_DISPLAY_HEIGHT; y++) {
+        fprintf(file, "  %2d %llu\n", y, (unsigned long long)profile->rows[y]);
+    }
+}
+
+int c8_profile_save(C8Profile *profile, const char *path,
+                    C8ProfileFormat format)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "profile: can't open %s\n", path);
+        return -1;
+    }
+
+    switch (format) {
+    case C8_PROFILE_FORMAT_CSV:
+        c8_profile_write_csv(profile, file);
+        break;
+
+    case C8_PROFILE_FORMAT_JSON:
+        c8_profile_write_json(profile, file);
+        break;
+
+    default:
+        c8_profile_write_heatmap(profile, file);
+        break;
+    }
+
+    int failed = ferror(file);
+    if (fclose(file) != 0 || failed) {
+        fprintf(stderr, "profile: can't write %s\n", path);
+        return -1;
+    }
+
+    return 0;
+}
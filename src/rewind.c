@@ -0,0 +1,330 @@
+#include "c8/rewind.h"
+
+#include "c8/state.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Entries are stored back to back in the ring as
+ *
+ *     meta, payload, meta
+ *
+ * where meta is a uint32_t holding the payload size shifted left by one and
+ * the keyframe flag in bit 0. The leading copy lets eviction walk forward
+ * from the oldest entry and the trailing one lets rewinding walk backward
+ * from the newest.
+ */
+#define C8_REWIND_META_SIZE sizeof(uint32_t)
+#define C8_REWIND_ENTRY_OVERHEAD (2 * C8_REWIND_META_SIZE)
+
+/* Zero runs shorter than this stay inside a literal */
+#define C8_REWIND_MIN_ZERO_RUN 4
+
+struct c8_rewind {
+    uint8_t *ring;
+    size_t capacity;
+    /* Offset of the oldest entry and bytes used from there on */
+    size_t head;
+    size_t used;
+
+    uint32_t frames;
+    uint32_t keyframe_interval;
+    /* Frames recorded since the newest keyframe, counting it */
+    uint32_t since_keyframe;
+
+    size_t state_size;
+    /* The newest recorded state, base of the next delta */
+    uint8_t *prev;
+    uint8_t *state;
+    uint8_t *scratch;
+};
+
+C8Rewind *c8_rewind_new(size_t budget, uint32_t keyframe_interval)
+{
+    C8Rewind *rewind = calloc(1, sizeof(C8Rewind));
+
+    if (rewind == NULL) {
+        fprintf(stderr, "rewind: can't allocate rewind\n");
+        return NULL;
+    }
+
+    rewind->capacity = budget;
+    rewind->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+    rewind->state_size = c8_state_size();
+    rewind->ring = malloc(budget);
+    rewind->prev = malloc(rewind->state_size);
+    rewind->state = malloc(rewind->state_size);
+    /* Every token covers at least MIN_ZERO_RUN bytes it doesn't store */
+    rewind->scratch = malloc(2 * rewind->state_size + 8);
+
+    if (rewind->ring == NULL || rewind->prev == NULL ||
+        rewind->state == NULL || rewind->scratch == NULL) {
+        fprintf(stderr, "rewind: can't allocate rewind\n");
+        return c8_rewind_free(rewind);
+    }
+
+    return rewind;
+}
+
+C8Rewind *c8_rewind_free(C8Rewind *rewind)
+{
+    if (rewind != NULL) {
+        free(rewind->ring);
+        free(rewind->prev);
+        free(rewind->state);
+        free(rewind->scratch);
+        free(rewind);
+    }
+
+    return NULL;
+}
+
+static size_t c8_rewind_offset(C8Rewind *rewind, size_t offset, long delta)
+{
+    return (offset + rewind->capacity + delta) % rewind->capacity;
+}
+
+static void c8_rewind_ring_write(C8Rewind *rewind, size_t offset,
+                                 const void *buf, size_t len)
+{
+    size_t first = rewind->capacity - offset;
+
+    if (first > len) {
+        first = len;
+    }
+
+    memcpy(rewind->ring + offset, buf, first);
+    memcpy(rewind->ring, (const uint8_t *)buf + first, len - first);
+}
+
+static void c8_rewind_ring_read(C8Rewind *rewind, size_t offset, void *buf,
+                                size_t len)
+{
+    size_t first = rewind->capacity - offset;
+
+    if (first > len) {
+        first = len;
+    }
+
+    memcpy(buf, rewind->ring + offset, first);
+    memcpy((uint8_t *)buf + first, rewind->ring, len - first);
+}
+
+static uint32_t c8_rewind_meta(C8Rewind *rewind, size_t offset)
+{
+    uint32_t meta = 0;
+    c8_rewind_ring_read(rewind, offset, &meta, sizeof(meta));
+    return meta;
+}
+
+/*
+ * Encodes state XOR base (base may be NULL for a keyframe) as a sequence of
+ * tokens: a uint16_t count of zero bytes to skip, a uint16_t literal length
+ * and the literal bytes.
+ */
+static size_t c8_rewind_encode(const uint8_t *state, const uint8_t *base,
+                               size_t size, uint8_t *out)
+{
+#define C8_REWIND_BYTE(k) (state[k] ^ (base != NULL ? base[k] : 0))
+    size_t len = 0;
+    size_t pos = 0;
+
+    while (pos < size) {
+        size_t begin = pos;
+        while (pos < size && C8_REWIND_BYTE(pos) == 0) {
+            pos++;
+        }
+        if (pos == size) {
+            break;
+        }
+
+        uint16_t zeros = pos - begin;
+        size_t end = pos;
+        while (end < size) {
+            size_t run = end;
+            while (run < size && C8_REWIND_BYTE(run) == 0 &&
+                   run - end < C8_REWIND_MIN_ZERO_RUN) {
+                run++;
+            }
+            if (run == end) {
+                end++;
+            } else if (run - end >= C8_REWIND_MIN_ZERO_RUN || run == size) {
+                break;
+            } else {
+                end = run;
+            }
+        }
+
+        uint16_t literal = end - pos;
+        memcpy(out + len, &zeros, sizeof(zeros));
+        memcpy(out + len + sizeof(zeros), &literal, sizeof(literal));
+        len += sizeof(zeros) + sizeof(literal);
+
+        for (size_t k = pos; k < end; k++) {
+            out[len++] = C8_REWIND_BYTE(k);
+        }
+        pos = end;
+    }
+
+    return len;
+#undef C8_REWIND_BYTE
+}
+
+/* XORs an encoded entry into state */
+static void c8_rewind_apply(const uint8_t *in, size_t len, uint8_t *state)
+{
+    size_t pos = 0;
+
+    for (size_t k = 0; k < len;) {
+        uint16_t zeros = 0;
+        uint16_t literal = 0;
+
+        memcpy(&zeros, in + k, sizeof(zeros));
+        memcpy(&literal, in + k + sizeof(zeros), sizeof(literal));
+        k += sizeof(zeros) + sizeof(literal);
+        pos += zeros;
+
+        for (uint16_t n = 0; n < literal; n++) {
+            state[pos++] ^= in[k++];
+        }
+    }
+}
+
+/* Drops the oldest keyframe and the deltas depending on it */
+static void c8_rewind_evict_group(C8Rewind *rewind)
+{
+    do {
+        uint32_t meta = c8_rewind_meta(rewind, rewind->head);
+        size_t total = (meta >> 1) + C8_REWIND_ENTRY_OVERHEAD;
+
+        rewind->head = c8_rewind_offset(rewind, rewind->head, total);
+        rewind->used -= total;
+        rewind->frames--;
+    } while (rewind->frames > 0 &&
+             (c8_rewind_meta(rewind, rewind->head) & 1) == 0);
+
+    if (rewind->frames == 0) {
+        rewind->head = 0;
+        rewind->used = 0;
+    }
+}
+
+int c8_rewind_record(C8Rewind *rewind, C8Cpu *cpu)
+{
+    bool keyframe = rewind->frames == 0 ||
+                    rewind->since_keyframe >= rewind->keyframe_interval;
+    size_t size = 0;
+
+    c8_state_save(cpu, rewind->state, rewind->state_size);
+    size = c8_rewind_encode(rewind->state, keyframe ? NULL : rewind->prev,
+                            rewind->state_size, rewind->scratch);
+
+    while (rewind->used + size + C8_REWIND_ENTRY_OVERHEAD >
+           rewind->capacity) {
+        if (rewind->frames == 0) {
+            fprintf(stderr, "rewind: frame doesn't fit in the budget\n");
+            return -1;
+        }
+
+        c8_rewind_evict_group(rewind);
+
+        /* The delta's base went with the evicted group */
+        if (rewind->frames == 0 && !keyframe) {
+            keyframe = true;
+            size = c8_rewind_encode(rewind->state, NULL, rewind->state_size,
+                                    rewind->scratch);
+        }
+    }
+
+    uint32_t meta = (uint32_t)size << 1 | keyframe;
+    size_t tail = c8_rewind_offset(rewind, rewind->head, rewind->used);
+
+    c8_rewind_ring_write(rewind, tail, &meta, sizeof(meta));
+    tail = c8_rewind_offset(rewind, tail, sizeof(meta));
+    c8_rewind_ring_write(rewind, tail, rewind->scratch, size);
+    tail = c8_rewind_offset(rewind, tail, size);
+    c8_rewind_ring_write(rewind, tail, &meta, sizeof(meta));
+
+    rewind->used += size + C8_REWIND_ENTRY_OVERHEAD;
+    rewind->frames++;
+    rewind->since_keyframe = keyframe ? 1 : rewind->since_keyframe + 1;
+
+    uint8_t *prev = rewind->prev;
+    rewind->prev = rewind->state;
+    rewind->state = prev;
+
+    return 0;
+}
+
+long c8_rewind_step_back(C8Rewind *rewind, C8Cpu *cpu, uint32_t frames)
+{
+    if (rewind->frames == 0) {
+        return 0;
+    }
+    if (frames > rewind->frames - 1) {
+        frames = rewind->frames - 1;
+    }
+
+    /* Walk back over the dropped frames to the end of the target */
+    size_t end = c8_rewind_offset(rewind, rewind->head, rewind->used);
+    for (uint32_t n = 0; n < frames; n++) {
+        uint32_t meta = c8_rewind_meta(rewind, c8_rewind_offset(
+            rewind, end, -(long)C8_REWIND_META_SIZE));
+        end = c8_rewind_offset(
+            rewind, end, -(long)((meta >> 1) + C8_REWIND_ENTRY_OVERHEAD));
+    }
+
+    /* Then on to the keyframe the target depends on */
+    size_t begin = end;
+    uint32_t depth = 0;
+    uint32_t meta = 0;
+    do {
+        meta = c8_rewind_meta(rewind, c8_rewind_offset(
+            rewind, begin, -(long)C8_REWIND_META_SIZE));
+        begin = c8_rewind_offset(
+            rewind, begin, -(long)((meta >> 1) + C8_REWIND_ENTRY_OVERHEAD));
+        depth++;
+    } while ((meta & 1) == 0);
+
+    /* Replay the keyframe and deltas up to the target */
+    memset(rewind->state, 0, rewind->state_size);
+    for (size_t offset = begin; offset != end;) {
+        size_t size = c8_rewind_meta(rewind, offset) >> 1;
+
+        c8_rewind_ring_read(rewind,
+                            c8_rewind_offset(rewind, offset,
+                                             C8_REWIND_META_SIZE),
+                            rewind->scratch, size);
+        c8_rewind_apply(rewind->scratch, size, rewind->state);
+        offset = c8_rewind_offset(rewind, offset,
+                                  size + C8_REWIND_ENTRY_OVERHEAD);
+    }
+
+    if (c8_state_load(cpu, rewind->state, rewind->state_size) < 0) {
+        return -1;
+    }
+
+    rewind->used = (end + rewind->capacity - rewind->head) % rewind->capacity;
+    if (rewind->used == 0) {
+        /* Only a completely full ring ends where it begins */
+        rewind->used = rewind->capacity;
+    }
+    rewind->frames -= frames;
+    rewind->since_keyframe = depth;
+    memcpy(rewind->prev, rewind->state, rewind->state_size);
+
+    return frames;
+}
+
+uint32_t c8_rewind_frames(C8Rewind *rewind)
+{
+    return rewind->frames;
+}
+
+size_t c8_rewind_used(C8Rewind *rewind)
+{
+    return rewind->used;
+}
@@ -0,0 +1,168 @@
+#include "c8/state.h"
+
+#include "cpu_internal.h"
+#include "memory_internal.h"
+
+#include "c8/keyboard.h"
+#include "c8/memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* "C8ST" read as a little-endian word */
+#define C8_STATE_MAGIC 0x54533843
+
+typedef struct c8_state_blob {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t cycles;
+    uint64_t rng;
+    uint64_t display[C8_DISPLAY_HEIGHT];
+    uint16_t stack[C8_MEMORY_STACK_SIZE];
+    uint16_t i;
+    uint16_t pc;
+    uint8_t v[16];
+    uint8_t dt;
+    uint8_t st;
+    uint8_t sp;
+    uint8_t reserved;
+    uint8_t ram[C8_MEMORY_SIZE];
+} C8StateBlob;
+
+/* No padding anywhere, so the layout is the same for every compiler */
+_Static_assert(sizeof(C8StateBlob) == 4432, "unexpected state layout");
+
+size_t c8_state_size(void)
+{
+    return sizeof(C8StateBlob);
+}
+
+static void c8_state_fill(C8Cpu *cpu, C8StateBlob *blob)
+{
+    C8Memory *memory = cpu->memory;
+
+    blob->magic = C8_STATE_MAGIC;
+    blob->version = C8_STATE_VERSION;
+    blob->cycles = cpu->cycles;
+    blob->rng = cpu->rng;
+    memcpy(blob->stack, memory->stack, sizeof(blob->stack));
+    blob->i = cpu->i;
+    blob->pc = cpu->pc;
+    memcpy(blob->v, cpu->v, sizeof(blob->v));
+    blob->dt = cpu->dt;
+    blob->st = cpu->st;
+    blob->sp = cpu->sp;
+    blob->reserved = 0;
+    c8_memory_export(memory, blob->ram, blob->display);
+}
+
+long c8_state_save(C8Cpu *cpu, void *buf, size_t size)
+{
+    C8StateBlob blob;
+
+    if (size < sizeof(C8StateBlob)) {
+        fprintf(stderr, "state: buffer is too small\n");
+        return -1;
+    }
+
+    /* Staged on the stack since buf needn't be aligned for the blob */
+    c8_state_fill(cpu, &blob);
+    memcpy(buf, &blob, sizeof(blob));
+
+    return sizeof(C8StateBlob);
+}
+
+int c8_state_load(C8Cpu *cpu, const void *buf, size_t size)
+{
+    C8Memory *memory = cpu->memory;
+    C8StateBlob copy;
+    const C8StateBlob *blob = &copy;
+
+    if (size != sizeof(C8StateBlob)) {
+        fprintf(stderr, "state: not a saved state\n");
+        return -1;
+    }
+
+    memcpy(&copy, buf, sizeof(copy));
+    if (blob->magic != C8_STATE_MAGIC) {
+        fprintf(stderr, "state: not a saved state\n");
+        return -1;
+    }
+    if (blob->version != C8_STATE_VERSION) {
+        fprintf(stderr, "state: unsupported version %u\n", blob->version);
+        return -1;
+    }
+
+    if (c8_memory_import(memory, blob->ram, blob->display) < 0) {
+        return -1;
+    }
+
+    cpu->cycles = blob->cycles;
+    cpu->rng = blob->rng;
+    cpu->i = blob->i;
+    cpu->pc = blob->pc & C8_MEMORY_ADDRESS_MASK;
+    memcpy(cpu->v, blob->v, sizeof(cpu->v));
+    cpu->dt = blob->dt;
+    cpu->st = blob->st;
+    cpu->sp = blob->sp;
+    cpu->stop = C8_CPU_STOP_BUDGET;
+
+    memcpy(memory->stack, blob->stack, sizeof(memory->stack));
+
+    /* Keys still count as held, but a release belongs to the old frame */
+    c8_keyboard_clear_edges(cpu->keyboard);
+
+    /* The whole frame may differ from what consumers last saw */
+    memory->display_dirty.rows = UINT32_MAX;
+    memset(memory->display_dirty.columns, UINT8_MAX,
+           sizeof(memory->display_dirty.columns));
+    memory->display_dirty.generation++;
+
+    return 0;
+}
+
+int c8_state_save_file(C8Cpu *cpu, const char *path)
+{
+    C8StateBlob blob;
+    c8_state_fill(cpu, &blob);
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "state: can't open %s\n", path);
+        return -1;
+    }
+
+    if (fwrite(&blob, sizeof(blob), 1, file) != 1) {
+        fprintf(stderr, "state: can't write to %s\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "state: can't write to %s\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+int c8_state_load_file(C8Cpu *cpu, const char *path)
+{
+    C8StateBlob blob;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "state: can't open %s\n", path);
+        return -1;
+    }
+
+    size_t size = fread(&blob, 1, sizeof(blob), file);
+    /* A longer file isn't a state either */
+    if (size == sizeof(blob) && fgetc(file) != EOF) {
+        size++;
+    }
+    fclose(file);
+
+    return c8_state_load(cpu, &blob, size);
+}
@@ -0,0 +1,615 @@
+#include "cpu_internal.h"
+
+#include "c8/instruction.h"
+#include "c8/keyboard.h"
+#include "c8/memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define C8_THREADED_SIZE C8_MEMORY_SIZE
+
+#if defined(__GNUC__)
+#define C8_THREADED_COMPUTED_GOTO 1
+#else
+#define C8_THREADED_COMPUTED_GOTO 0
+#endif
+
+/*
+ * Predecoded instruction kinds. C8_OP_DECODE is zero so that a freshly
+ * allocated or invalidated entry decodes itself on first dispatch.
+ */
+typedef enum c8_op_kind {
+    C8_OP_DECODE = 0,
+    C8_OP_BAD,
+    C8_OP_SYS,
+    C8_OP_CLS,
+    C8_OP_RET,
+    C8_OP_JP,
+    C8_OP_CALL,
+    C8_OP_SE_I8,
+    C8_OP_SNE_I8,
+    C8_OP_SE_REG,
+    C8_OP_LD_I8,
+    C8_OP_ADD_I8,
+    C8_OP_LD_REG,
+    C8_OP_OR,
+    C8_OP_AND,
+    C8_OP_XOR,
+    C8_OP_ADD_REG,
+    C8_OP_SUB,
+    C8_OP_SHR,
+    C8_OP_SUBN,
+    C8_OP_SHL,
+    C8_OP_SNE_REG,
+    C8_OP_LD_I,
+    C8_OP_JP_V0,
+    C8_OP_RND,
+    C8_OP_DRW,
+    C8_OP_SKP,
+    C8_OP_SKNP,
+    C8_OP_LD_REG_DT,
+    C8_OP_LD_REG_KEY,
+    C8_OP_LD_DT_REG,
+    C8_OP_LD_ST_REG,
+    C8_OP_ADD_I,
+    C8_OP_LD_SPRITE,
+    C8_OP_LD_BCD,
+    C8_OP_LD_MEM_REG,
+    C8_OP_LD_REG_MEM,
+    C8_OP_NUM
+} C8OpKind;
+
+typedef struct c8_op {
+    uint8_t kind;
+    uint8_t x;
+    uint8_t y;
+    uint8_t kk;
+    uint16_t nnn;
+    uint16_t instruction;
+} C8Op;
+
+struct c8_threaded {
+    /*
+     * The table dispatched from: `own`, or an image's shared table until
+     * the first entry has to change. NULL once a copy couldn't be made.
+     */
+    C8Op *ops;
+    C8Op *own;
+    const C8Op *shared;
+};
+
+C8Threaded *c8_threaded_new(const C8Threaded *shared)
+{
+    C8Threaded *threaded = calloc(1, sizeof(C8Threaded));
+
+    if (threaded == NULL) {
+        fprintf(stderr, "threaded: can't allocate decode cache\n");
+        return NULL;
+    }
+
+    if (shared != NULL) {
+        threaded->shared = shared->ops;
+        threaded->ops = (C8Op *)threaded->shared;
+        return threaded;
+    }
+
+    threaded->own = calloc(C8_THREADED_SIZE, sizeof(C8Op));
+    if (threaded->own == NULL) {
+        fprintf(stderr, "threaded: can't allocate decode cache\n");
+        free(threaded);
+        return NULL;
+    }
+
+    threaded->ops = threaded->own;
+    return threaded;
+}
+
+C8Threaded *c8_threaded_free(C8Threaded *threaded)
+{
+    if (threaded != NULL) {
+        free(threaded->own);
+        free(threaded);
+    }
+
+    return NULL;
+}
+
+/* Switches from the shared table to a private copy of it */
+static int c8_threaded_own(C8Threaded *threaded)
+{
+    if (threaded->own != NULL) {
+        return 0;
+    }
+
+    threaded->ops = NULL;
+    threaded->own = malloc(C8_THREADED_SIZE * sizeof(C8Op));
+    if (threaded->own == NULL) {
+        fprintf(stderr, "threaded: can't allocate decode cache\n");
+        return -1;
+    }
+
+    memcpy(threaded->own, threaded->shared, C8_THREADED_SIZE * sizeof(C8Op));
+    threaded->ops = threaded->own;
+    return 0;
+}
+
+int c8_threaded_invalidate(C8Threaded *threaded, uint16_t addr, uint16_t len)
+{
+    if (c8_threaded_own(threaded) < 0) {
+        return -1;
+    }
+
+    uint32_t end = (uint32_t)addr + len;
+
+    if (end > C8_THREADED_SIZE) {
+        end = C8_THREADED_SIZE;
+    }
+
+    for (uint32_t pc = addr; pc < end; pc++) {
+        threaded->ops[pc].kind = C8_OP_DECODE;
+    }
+
+    /*
+     * An instruction starting one byte before addr overlaps the write too,
+     * including the one at 0xfff that wraps around to 0x000.
+     */
+    threaded->ops[(addr - 1) & (C8_THREADED_SIZE - 1)].kind = C8_OP_DECODE;
+    return 0;
+}
+
+static C8OpKind c8_threaded_decode_kind(uint16_t instruction)
+{
+    switch (instruction >> 12) {
+    case 0x0:
+        if ((instruction >> 8) != 0) {
+            return C8_OP_SYS;
+        }
+
+        switch (instruction & 0x0ff) {
+        case 0xe0:
+            return C8_OP_CLS;
+
+        case 0xee:
+            return C8_OP_RET;
+
+        default:
+            return C8_OP_BAD;
+        }
+
+    case 0x1:
+        return C8_OP_JP;
+
+    case 0x2:
+        return C8_OP_CALL;
+
+    case 0x3:
+        return C8_OP_SE_I8;
+
+    case 0x4:
+        return C8_OP_SNE_I8;
+
+    case 0x5:
+        return (instruction & 0x00f) == 0 ? C8_OP_SE_REG : C8_OP_BAD;
+
+    case 0x6:
+        return C8_OP_LD_I8;
+
+    case 0x7:
+        return C8_OP_ADD_I8;
+
+    case 0x8:
+        switch (instruction & 0x00f) {
+        case 0x0:
+            return C8_OP_LD_REG;
+
+        case 0x1:
+            return C8_OP_OR;
+
+        case 0x2:
+            return C8_OP_AND;
+
+        case 0x3:
+            return C8_OP_XOR;
+
+        case 0x4:
+            return C8_OP_ADD_REG;
+
+        case 0x5:
+            return C8_OP_SUB;
+
+        case 0x6:
+            return C8_OP_SHR;
+
+        case 0x7:
+            return C8_OP_SUBN;
+
+        case 0xe:
+            return C8_OP_SHL;
+
+        default:
+            return C8_OP_BAD;
+        }
+
+    case 0x9:
+        return C8_OP_SNE_REG;
+
+    case 0xa:
+        return C8_OP_LD_I;
+
+    case 0xb:
+        return C8_OP_JP_V0;
+
+    case 0xc:
+        return C8_OP_RND;
+
+    case 0xd:
+        return C8_OP_DRW;
+
+    case 0xe:
+        switch (instruction & 0x0ff) {
+        case 0x9e:
+            return C8_OP_SKP;
+
+        case 0xa1:
+            return C8_OP_SKNP;
+
+        default:
+            return C8_OP_BAD;
+        }
+
+    case 0xf:
+        switch (instruction & 0x0ff) {
+        case 0x07:
+            return C8_OP_LD_REG_DT;
+
+        case 0x0a:
+            return C8_OP_LD_REG_KEY;
+
+        case 0x15:
+            return C8_OP_LD_DT_REG;
+
+        case 0x18:
+            return C8_OP_LD_ST_REG;
+
+        case 0x1e:
+            return C8_OP_ADD_I;
+
+        case 0x29:
+            return C8_OP_LD_SPRITE;
+
+        case 0x33:
+            return C8_OP_LD_BCD;
+
+        case 0x55:
+            return C8_OP_LD_MEM_REG;
+
+        case 0x65:
+            return C8_OP_LD_REG_MEM;
+
+        default:
+            return C8_OP_BAD;
+        }
+
+    default:
+        return C8_OP_BAD;
+    }
+}
+
+static int c8_threaded_decode(C8Memory *memory, uint16_t pc, C8Op *op)
+{
+    uint16_t instruction = 0;
+
+    if (c8_memory_program_read(memory, pc, &instruction) < 0) {
+        return -1;
+    }
+
+    op->kind = c8_threaded_decode_kind(instruction);
+    op->x = c8_instruction_get_x(instruction);
+    op->y = c8_instruction_get_y(instruction);
+    /* DRW is the only user of n, so it shares the kk slot */
+    op->kk = op->kind == C8_OP_DRW ? c8_instruction_get_n(instruction)
+                                   : c8_instruction_get_kk(instruction);
+    op->nnn = c8_instruction_get_nnn(instruction);
+    op->instruction = instruction;
+
+    return 0;
+}
+
+/*
+ * Fetches at 0x200-0xffe never fail, protection mode or not, so only they
+ * are decoded ahead of time; the rest decode on first dispatch as usual.
+ */
+void c8_threaded_predecode(C8Threaded *threaded, C8Memory *memory)
+{
+    for (uint16_t pc = c8_memory_program_begin();
+         pc <= C8_THREADED_SIZE - C8_INSTRUCTION_SIZE; pc++) {
+        c8_threaded_decode(memory, pc, &threaded->ops[pc]);
+    }
+}
+
+/*
+ * Every handler ends by advancing PC and dispatching the next entry
+ * directly, so there is no central loop and no re-decoding: with computed
+ * goto each handler gets its own indirect branch, which predicts far better
+ * than the single shared one of a switch.
+ */
+#if C8_THREADED_COMPUTED_GOTO
+#define C8_OP(kind) label_##kind
+#define C8_DISPATCH() goto *labels[op->kind]
+#else
+#define C8_OP(kind) case kind
+#define C8_DISPATCH() goto dispatch
+#endif
+
+/*
+ * PC lives in a local between handlers; it is written back to the CPU only
+ * around calls into the shared instruction semantics, which may read or
+ * modify it.
+ */
+#define C8_NEXT(n)                                      \
+    do {                                                \
+        pc = (pc + C8_INSTRUCTION_SIZE * (n)) &         \
+             (C8_THREADED_SIZE - 1);                    \
+        if (++executed == count) {                      \
+            goto out;                                   \
+        }                                               \
+        op = &ops[pc];                                  \
+        C8_DISPATCH();                                  \
+    } while (0)
+
+#define C8_COMPLETE(ret)                                \
+    do {                                                \
+        cpu->pc = pc;                                   \
+        cpu->instruction = op->instruction;             \
+        c8_cpu_advance(cpu, (ret));                     \
+        pc = cpu->pc;                                   \
+        ops = cpu->threaded->ops;                       \
+        if (cpu->stop != C8_CPU_STOP_BUDGET) {          \
+            executed++;                                 \
+            goto out;                                   \
+        }                                               \
+        C8_NEXT(0);                                     \
+    } while (0)
+
+uint32_t c8_threaded_run(C8Cpu *cpu, uint32_t count)
+{
+#if C8_THREADED_COMPUTED_GOTO
+    static const void *const labels[C8_OP_NUM] = {
+        [C8_OP_DECODE] = &&label_C8_OP_DECODE,
+        [C8_OP_BAD] = &&label_C8_OP_BAD,
+        [C8_OP_SYS] = &&label_C8_OP_SYS,
+        [C8_OP_CLS] = &&label_C8_OP_CLS,
+        [C8_OP_RET] = &&label_C8_OP_RET,
+        [C8_OP_JP] = &&label_C8_OP_JP,
+        [C8_OP_CALL] = &&label_C8_OP_CALL,
+        [C8_OP_SE_I8] = &&label_C8_OP_SE_I8,
+        [C8_OP_SNE_I8] = &&label_C8_OP_SNE_I8,
+        [C8_OP_SE_REG] = &&label_C8_OP_SE_REG,
+        [C8_OP_LD_I8] = &&label_C8_OP_LD_I8,
+        [C8_OP_ADD_I8] = &&label_C8_OP_ADD_I8,
+        [C8_OP_LD_REG] = &&label_C8_OP_LD_REG,
+        [C8_OP_OR] = &&label_C8_OP_OR,
+        [C8_OP_AND] = &&label_C8_OP_AND,
+        [C8_OP_XOR] = &&label_C8_OP_XOR,
+        [C8_OP_ADD_REG] = &&label_C8_OP_ADD_REG,
+        [C8_OP_SUB] = &&label_C8_OP_SUB,
+        [C8_OP_SHR] = &&label_C8_OP_SHR,
+        [C8_OP_SUBN] = &&label_C8_OP_SUBN,
+        [C8_OP_SHL] = &&label_C8_OP_SHL,
+        [C8_OP_SNE_REG] = &&label_C8_OP_SNE_REG,
+        [C8_OP_LD_I] = &&label_C8_OP_LD_I,
+        [C8_OP_JP_V0] = &&label_C8_OP_JP_V0,
+        [C8_OP_RND] = &&label_C8_OP_RND,
+        [C8_OP_DRW] = &&label_C8_OP_DRW,
+        [C8_OP_SKP] = &&label_C8_OP_SKP,
+        [C8_OP_SKNP] = &&label_C8_OP_SKNP,
+        [C8_OP_LD_REG_DT] = &&label_C8_OP_LD_REG_DT,
+        [C8_OP_LD_REG_KEY] = &&label_C8_OP_LD_REG_KEY,
+        [C8_OP_LD_DT_REG] = &&label_C8_OP_LD_DT_REG,
+        [C8_OP_LD_ST_REG] = &&label_C8_OP_LD_ST_REG,
+        [C8_OP_ADD_I] = &&label_C8_OP_ADD_I,
+        [C8_OP_LD_SPRITE] = &&label_C8_OP_LD_SPRITE,
+        [C8_OP_LD_BCD] = &&label_C8_OP_LD_BCD,
+        [C8_OP_LD_MEM_REG] = &&label_C8_OP_LD_MEM_REG,
+        [C8_OP_LD_REG_MEM] = &&label_C8_OP_LD_REG_MEM,
+    };
+#endif
+
+    C8Op *ops = cpu->threaded->ops;
+    uint8_t *v = cpu->v;
+    uint16_t pc = cpu->pc;
+    uint32_t executed = 0;
+    C8Op *op = NULL;
+
+    if (count == 0) {
+        return 0;
+    }
+    if (ops == NULL) {
+        cpu->stop = C8_CPU_STOP_FAULT;
+        return 0;
+    }
+
+    op = &ops[pc];
+
+#if C8_THREADED_COMPUTED_GOTO
+    C8_DISPATCH();
+#else
+dispatch:
+    switch (op->kind) {
+#endif
+
+    C8_OP(C8_OP_DECODE):
+        /* The shared table is never written */
+        if (cpu->threaded->own == NULL) {
+            if (c8_threaded_own(cpu->threaded) < 0) {
+                cpu->pc = pc;
+                cpu->stop = C8_CPU_STOP_FAULT;
+                return executed;
+            }
+            ops = cpu->threaded->ops;
+            op = &ops[pc];
+        }
+        if (c8_threaded_decode(cpu->memory, pc, op) < 0) {
+            cpu->pc = pc;
+            cpu->stop = C8_CPU_STOP_FAULT;
+            return executed;
+        }
+        C8_DISPATCH();
+
+    C8_OP(C8_OP_BAD):
+        C8_COMPLETE(-1);
+
+    C8_OP(C8_OP_SYS):
+        /* Ignore SYS instruction */
+        C8_NEXT(0);
+
+    C8_OP(C8_OP_CLS):
+        C8_COMPLETE(c8_cpu_op_cls(cpu));
+
+    C8_OP(C8_OP_RET):
+        C8_COMPLETE(c8_cpu_op_ret(cpu));
+
+    C8_OP(C8_OP_JP):
+        pc = op->nnn;
+        C8_NEXT(0);
+
+    C8_OP(C8_OP_CALL):
+        C8_COMPLETE(c8_cpu_op_call(cpu, op->nnn));
+
+    C8_OP(C8_OP_SE_I8):
+        C8_NEXT(v[op->x] == op->kk ? 2 : 1);
+
+    C8_OP(C8_OP_SNE_I8):
+        C8_NEXT(v[op->x] != op->kk ? 2 : 1);
+
+    C8_OP(C8_OP_SE_REG):
+        C8_NEXT(v[op->x] == v[op->y] ? 2 : 1);
+
+    C8_OP(C8_OP_LD_I8):
+        v[op->x] = op->kk;
+        C8_NEXT(1);
+
+    C8_OP(C8_OP_ADD_I8):
+        v[op->x] += op->kk;
+        C8_NEXT(1);
+
+    C8_OP(C8_OP_LD_REG):
+        v[op->x] = v[op->y];
+        C8_NEXT(1);
+
+    C8_OP(C8_OP_OR):
+        v[op->x] |= v[op->y];
+        C8_NEXT(1);
+
+    C8_OP(C8_OP_AND):
+        v[op->x] &= v[op->y];
+        C8_NEXT(1);
+
+    C8_OP(C8_OP_XOR):
+        v[op->x] ^= v[op->y];
+        C8_NEXT(1);
+
+    /* Operands are loaded up front: stores to v may alias op */
+    C8_OP(C8_OP_ADD_REG): {
+        uint8_t x = op->x, y = op->y;
+        v[0xf] = v[x] > (UINT8_MAX - v[y]);
+        v[x] += v[y];
+        C8_NEXT(1);
+    }
+
+    C8_OP(C8_OP_SUB): {
+        uint8_t x = op->x, y = op->y;
+        v[0xf] = v[x] > v[y];
+        v[x] -= v[y];
+        C8_NEXT(1);
+    }
+
+    C8_OP(C8_OP_SHR): {
+        uint8_t x = op->x;
+        v[0xf] = v[x] & 0x01;
+        v[x] >>= 1;
+        C8_NEXT(1);
+    }
+
+    C8_OP(C8_OP_SUBN): {
+        uint8_t x = op->x, y = op->y;
+        v[0xf] = v[y] > v[x];
+        v[y] -= v[x];
+        C8_NEXT(1);
+    }
+
+    C8_OP(C8_OP_SHL): {
+        uint8_t x = op->x;
+        v[0xf] = v[x] & 0x80;
+        v[x] <<= 1;
+        C8_NEXT(1);
+    }
+
+    C8_OP(C8_OP_SNE_REG):
+        C8_NEXT(v[op->x] != v[op->y] ? 2 : 1);
+
+    C8_OP(C8_OP_LD_I):
+        cpu->i = op->nnn;
+        C8_NEXT(1);
+
+    C8_OP(C8_OP_JP_V0):
+        pc = v[0] + op->nnn;
+        C8_NEXT(0);
+
+    C8_OP(C8_OP_RND):
+        C8_COMPLETE(c8_cpu_op_rnd(cpu, op->x, op->kk));
+
+    C8_OP(C8_OP_DRW):
+        C8_COMPLETE(c8_cpu_op_drw(cpu, op->x, op->y, op->kk));
+
+    C8_OP(C8_OP_SKP):
+        C8_NEXT(c8_keyboard_is_key_pressed(cpu->keyboard, v[op->x]) ? 2 : 1);
+
+    C8_OP(C8_OP_SKNP):
+        C8_NEXT(c8_keyboard_is_key_pressed(cpu->keyboard, v[op->x]) ? 1 : 2);
+
+    C8_OP(C8_OP_LD_REG_DT):
+        v[op->x] = cpu->dt;
+        C8_NEXT(1);
+
+    C8_OP(C8_OP_LD_REG_KEY):
+        C8_COMPLETE(c8_cpu_op_ld_reg_key(cpu, op->x));
+
+    C8_OP(C8_OP_LD_DT_REG):
+        cpu->dt = v[op->x];
+        C8_NEXT(1);
+
+    C8_OP(C8_OP_LD_ST_REG):
+        cpu->st = v[op->x];
+        C8_NEXT(1);
+
+    C8_OP(C8_OP_ADD_I):
+        cpu->i += v[op->x];
+        C8_NEXT(1);
+
+    C8_OP(C8_OP_LD_SPRITE):
+        cpu->i = 5 * v[op->x];
+        C8_NEXT(1);
+
+    C8_OP(C8_OP_LD_BCD):
+        C8_COMPLETE(c8_cpu_op_ld_mem_bcd(cpu, op->x));
+
+    C8_OP(C8_OP_LD_MEM_REG):
+        C8_COMPLETE(c8_cpu_op_ld_mem_reg(cpu, op->x));
+
+    C8_OP(C8_OP_LD_REG_MEM):
+        C8_COMPLETE(c8_cpu_op_ld_reg_mem(cpu, op->x));
+
+#if !C8_THREADED_COMPUTED_GOTO
+    default:
+        goto out;
+    }
+#endif
+
+out:
+    cpu->pc = pc;
+    cpu->instruction = op->instruction;
+    return executed;
+}
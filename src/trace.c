@@ -0,0 +1,280 @@
+#include "c8/trace.h"
+
+#include "cpu_internal.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+_Static_assert(sizeof(C8TraceRecord) == 16, "trace records must be 16 bytes");
+
+/* How long the writer sleeps when the ring is empty */
+#define C8_TRACE_WRITER_IDLE_NS 1000000
+
+struct c8_trace {
+    C8TraceRecord *ring;
+    uint64_t capacity;
+
+    /* Records appended, only the CPU moves it */
+    atomic_uint_fast64_t head;
+    /* Records appended but maybe not published yet, and where it must wait */
+    uint64_t next;
+    uint64_t limit;
+    /* Records written out, only the writer moves it */
+    atomic_uint_fast64_t tail;
+
+    /* The writer, while streaming */
+    bool streaming;
+    pthread_t writer;
+    atomic_bool closing;
+    FILE *file;
+    char *path;
+    bool failed;
+};
+
+C8Trace *c8_trace_new(uint32_t capacity)
+{
+    C8Trace *trace = calloc(1, sizeof(C8Trace));
+
+    if (trace == NULL) {
+        fprintf(stderr, "trace: can't allocate trace\n");
+        return NULL;
+    }
+
+    trace->capacity = 1;
+    while (trace->capacity < capacity) {
+        trace->capacity *= 2;
+    }
+
+    trace->ring = malloc(trace->capacity * sizeof(C8TraceRecord));
+    if (trace->ring == NULL) {
+        fprintf(stderr, "trace: can't allocate trace\n");
+        free(trace);
+        return NULL;
+    }
+
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->tail, 0);
+    atomic_init(&trace->closing, false);
+    trace->limit = UINT64_MAX;
+    return trace;
+}
+
+C8Trace *c8_trace_free(C8Trace *trace)
+{
+    if (trace != NULL) {
+        if (trace->streaming) {
+            atomic_store_explicit(&trace->closing, true, memory_order_release);
+            pthread_join(trace->writer, NULL);
+
+            if (fclose(trace->file) != 0 || trace->failed) {
+                fprintf(stderr, "trace: can't write %s\n", trace->path);
+            }
+            free(trace->path);
+        }
+
+        free(trace->ring);
+        free(trace);
+    }
+
+    return NULL;
+}
+
+void c8_cpu_set_trace(C8Cpu *cpu, C8Trace *trace)
+{
+    cpu->trace = trace;
+}
+
+uint64_t c8_trace_records(C8Trace *trace)
+{
+    return atomic_load_explicit(&trace->head, memory_order_relaxed);
+}
+
+static int c8_trace_write_header(FILE *file)
+{
+    C8TraceHeader header = {
+        .magic = C8_TRACE_MAGIC,
+        .version = C8_TRACE_VERSION,
+        .record_size = sizeof(C8TraceRecord),
+    };
+
+    return fwrite(&header, sizeof(header), 1, file) == 1 ? 0 : -1;
+}
+
+/*
+ * Takes whatever the CPU has published, in at most two runs since the ring
+ * wraps. A failed write still frees the records so the CPU never stalls.
+ */
+static void *c8_trace_writer(void *arg)
+{
+    C8Trace *trace = arg;
+    const struct timespec idle = {0, C8_TRACE_WRITER_IDLE_NS};
+
+    for (;;) {
+        bool closing =
+            atomic_load_explicit(&trace->closing, memory_order_acquire);
+        uint64_t head =
+            atomic_load_explicit(&trace->head, memory_order_acquire);
+        uint64_t tail =
+            atomic_load_explicit(&trace->tail, memory_order_relaxed);
+
+        if (head == tail) {
+            if (closing) {
+                break;
+            }
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        uint64_t begin = tail & (trace->capacity - 1);
+        uint64_t n = head - tail;
+        if (n > trace->capacity - begin) {
+            n = trace->capacity - begin;
+        }
+
+        if (!trace->failed &&
+            fwrite(&trace->ring[begin], sizeof(C8TraceRecord), n,
+                   trace->file) != n) {
+            trace->failed = true;
+        }
+
+        atomic_store_explicit(&trace->tail, tail + n, memory_order_release);
+    }
+
+    return NULL;
+}
+
+int c8_trace_stream(C8Trace *trace, const char *path)
+{
+    if (trace->streaming) {
+        fprintf(stderr, "trace: already streaming\n");
+        return -1;
+    }
+
+    trace->path = malloc(strlen(path) + 1);
+    if (trace->path == NULL) {
+        fprintf(stderr, "trace: can't allocate path\n");
+        return -1;
+    }
+    strcpy(trace->path, path);
+
+    trace->file = fopen(path, "wb");
+    if (trace->file == NULL) {
+        fprintf(stderr, "trace: can't open %s\n", path);
+        free(trace->path);
+        return -1;
+    }
+
+    if (c8_trace_write_header(trace->file) < 0) {
+        fprintf(stderr, "trace: can't write %s\n", path);
+        fclose(trace->file);
+        free(trace->path);
+        return -1;
+    }
+
+    /* Records already in the ring go out first */
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    uint64_t tail = head > trace->capacity ? head - trace->capacity : 0;
+    atomic_store_explicit(&trace->tail, tail, memory_order_relaxed);
+
+    if (pthread_create(&trace->writer, NULL, c8_trace_writer, trace) != 0) {
+        fprintf(stderr, "trace: can't start writer\n");
+        fclose(trace->file);
+        free(trace->path);
+        return -1;
+    }
+
+    trace->streaming = true;
+    trace->limit = tail + trace->capacity;
+    return 0;
+}
+
+int c8_trace_save(C8Trace *trace, const char *path)
+{
+    if (trace->streaming) {
+        fprintf(stderr, "trace: streamed traces are saved by the writer\n");
+        return -1;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "trace: can't open %s\n", path);
+        return -1;
+    }
+
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    uint64_t first = head > trace->capacity ? head - trace->capacity : 0;
+    int failed = c8_trace_write_header(file);
+
+    for (uint64_t k = first; k < head && failed == 0; k++) {
+        if (fwrite(&trace->ring[k & (trace->capacity - 1)],
+                   sizeof(C8TraceRecord), 1, file) != 1) {
+            failed = -1;
+        }
+    }
+
+    if (fclose(file) != 0 || failed < 0) {
+        fprintf(stderr, "trace: can't write %s\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Waits for the writer to make room, publishing what is there first */
+static uint64_t c8_trace_wait(C8Trace *trace, uint64_t head)
+{
+    atomic_store_explicit(&trace->head, head, memory_order_release);
+
+    for (;;) {
+        uint64_t tail =
+            atomic_load_explicit(&trace->tail, memory_order_acquire);
+        if (head - tail < trace->capacity) {
+            return tail + trace->capacity;
+        }
+        sched_yield();
+    }
+}
+
+/*
+ * Records are published by c8_trace_publish once per run, or here whenever
+ * a streamed ring fills up.
+ */
+void c8_trace_observe(C8Cpu *cpu, uint16_t pc, const uint8_t *v,
+                      uint64_t count)
+{
+    C8Trace *trace = cpu->trace;
+
+    if (trace->next == trace->limit) {
+        trace->limit = c8_trace_wait(trace, trace->next);
+    }
+
+    C8TraceRecord *record = &trace->ring[trace->next & (trace->capacity - 1)];
+    record->count = count;
+    record->pc = pc;
+    record->instruction = cpu->instruction;
+    record->i = cpu->i;
+    record->reg = C8_TRACE_NO_REGISTER;
+    record->value = 0;
+
+    if (memcmp(v, cpu->v, sizeof(cpu->v)) != 0) {
+        uint8_t x = 0;
+        while (v[x] == cpu->v[x]) {
+            x++;
+        }
+        record->reg = x;
+        record->value = cpu->v[x];
+    }
+
+    trace->next++;
+}
+
+void c8_trace_publish(C8Trace *trace)
+{
+    atomic_store_explicit(&trace->head, trace->next, memory_order_release);
+}
@@ -0,0 +1,185 @@
+#include "c8/instruction.h"
+#include "c8/trace.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* Records read from the file at a time */
+#define C8_TRACE_DECODER_CHUNK 4096
+
+typedef struct c8_trace_filter {
+    uint64_t pc_from;
+    uint64_t pc_to;
+    uint64_t count_from;
+    uint64_t count_to;
+    const char *mnemonic;
+    int reg;
+    uint64_t limit;
+} C8TraceFilter;
+
+/* Parses "a" or "a-b", in any base strtoull takes */
+static int c8_trace_parse_range(const char *arg, uint64_t *from,
+                                uint64_t *to)
+{
+    char *end = NULL;
+
+    if (arg == NULL) {
+        return -1;
+    }
+
+    *from = strtoull(arg, &end, 0);
+    if (end == arg) {
+        return -1;
+    }
+
+    *to = *from;
+    if (*end == '-') {
+        const char *begin = end + 1;
+        *to = strtoull(begin, &end, 0);
+        if (end == begin) {
+            return -1;
+        }
+    }
+
+    return *end == '\0' && *from <= *to ? 0 : -1;
+}
+
+static int c8_trace_parse_options(int argc, char *argv[],
+                                  C8TraceFilter *filter, const char **path)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-a") == 0) {
+            if (c8_trace_parse_range(argv[++i], &filter->pc_from,
+                                     &filter->pc_to) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-c") == 0) {
+            if (c8_trace_parse_range(argv[++i], &filter->count_from,
+                                     &filter->count_to) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-m") == 0) {
+            if ((filter->mnemonic = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-r") == 0) {
+            char *end = NULL;
+            if (argv[++i] == NULL) {
+                return -1;
+            }
+            filter->reg = strtol(argv[i], &end, 16);
+            if (*end != '\0' || end == argv[i] || filter->reg > 0xf) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-n") == 0) {
+            char *end = NULL;
+            if (argv[++i] == NULL) {
+                return -1;
+            }
+            filter->limit = strtoull(argv[i], &end, 10);
+            if (*end != '\0' || end == argv[i]) {
+                return -1;
+            }
+        } else if (argv[i][0] == '-' || *path != NULL) {
+            return -1;
+        } else {
+            *path = argv[i];
+        }
+    }
+
+    return *path != NULL ? 0 : -1;
+}
+
+static bool c8_trace_matches(const C8TraceFilter *filter,
+                             const C8TraceRecord *record, const char *text)
+{
+    if (record->pc < filter->pc_from || record->pc > filter->pc_to ||
+        record->count < filter->count_from ||
+        record->count > filter->count_to) {
+        return false;
+    }
+
+    if (filter->reg >= 0 && record->reg != filter->reg) {
+        return false;
+    }
+
+    return filter->mnemonic == NULL ||
+           strncasecmp(text, filter->mnemonic, strlen(filter->mnemonic)) == 0;
+}
+
+static void c8_trace_print(const C8TraceRecord *record, const char *text)
+{
+    printf("%12llu  0x%03x  %04x  %-16s I=0x%03x",
+           (unsigned long long)record->count, record->pc,
+           record->instruction, text, record->i);
+
+    if (record->reg != C8_TRACE_NO_REGISTER) {
+        printf("  V%X=0x%02x", record->reg, record->value);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    C8TraceFilter filter = {
+        .pc_to = UINT64_MAX,
+        .count_to = UINT64_MAX,
+        .reg = -1,
+        .limit = UINT64_MAX,
+    };
+    const char *path = NULL;
+
+    if (c8_trace_parse_options(argc, argv, &filter, &path) < 0) {
+        printf("usage: %s [-a pc[-pc]] [-c count[-count]] [-m mnemonic] "
+               "[-r register] [-n records] [trace]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "trace: can't open %s\n", path);
+        return 1;
+    }
+
+    C8TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, C8_TRACE_MAGIC, sizeof(C8_TRACE_MAGIC)) != 0 ||
+        header.version != C8_TRACE_VERSION ||
+        header.record_size != sizeof(C8TraceRecord)) {
+        fprintf(stderr, "trace: %s is not a trace this build can read\n",
+                path);
+        fclose(file);
+        return 1;
+    }
+
+    static C8TraceRecord records[C8_TRACE_DECODER_CHUNK];
+    uint64_t printed = 0;
+    size_t n = 0;
+
+    while (printed < filter.limit &&
+           (n = fread(records, sizeof(C8TraceRecord),
+                      C8_TRACE_DECODER_CHUNK, file)) > 0) {
+        for (size_t k = 0; k < n && printed < filter.limit; k++) {
+            char text[24];
+
+            c8_instruction_disassemble(records[k].instruction, text,
+                                       sizeof(text));
+            if (c8_trace_matches(&filter, &records[k], text)) {
+                c8_trace_print(&records[k], text);
+                printed++;
+            }
+        }
+    }
+
+    int status = ferror(file) ? 1 : 0;
+    if (status != 0) {
+        fprintf(stderr, "trace: can't read %s\n", path);
+    }
+
+    fclose(file);
+    return status;
+}
@@ -0,0 +1,26 @@
+# Runs ROM on the switch engine and on ENGINE through HEADLESS and fails
+# unless the printed displays and the saved end states are identical.
+set(args -f 600 -r 7)
+
+foreach(engine switch ${ENGINE})
+    execute_process(
+        COMMAND ${HEADLESS} -e ${engine} ${args} -S ${engine}.state ${ROM}
+        OUTPUT_VARIABLE display_${engine}
+        RESULT_VARIABLE result
+    )
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${engine} run failed: ${result}")
+    endif()
+endforeach()
+
+if(NOT display_switch STREQUAL display_${ENGINE})
+    message(FATAL_ERROR "${ENGINE} display differs from switch")
+endif()
+
+execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files switch.state ${ENGINE}.state
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${ENGINE} end state differs from switch")
+endif()
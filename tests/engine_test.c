@@ -0,0 +1,218 @@
+/*
+ * Differential test of the execution engines: random programs run on the
+ * switch engine and on each other engine this host has, and the saved
+ * states must match after every frame.
+ */
+#include "c8/cpu.h"
+#include "c8/keyboard.h"
+#include "c8/memory.h"
+#include "c8/state.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define C8_ENGINE_TEST_PROGRAMS 1000
+#define C8_ENGINE_TEST_FRAMES 300
+/* Instructions per program, all jump targets stay inside them */
+#define C8_ENGINE_TEST_LENGTH 128
+
+static uint64_t c8_engine_test_next(uint64_t *rng)
+{
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    return *rng;
+}
+
+/*
+ * A program made mostly of valid instructions, so it runs for a while
+ * instead of faulting on the first random word. I points past the code
+ * most of the time, and into it now and then to make it modify itself.
+ */
+static void c8_engine_test_program(uint64_t *rng, uint8_t *program)
+{
+    for (int k = 0; k < C8_ENGINE_TEST_LENGTH; k++) {
+        uint16_t r = c8_engine_test_next(rng);
+        uint16_t target =
+            0x200 + 2 * (c8_engine_test_next(rng) % C8_ENGINE_TEST_LENGTH);
+        uint16_t instruction = r;
+
+        switch ((r >> 12) & 0xf) {
+        /* Few calls and returns, or most programs soon leave the stack */
+        case 0x0:
+            instruction = (r & 7) == 0 ? 0x00ee : 0x00e0;
+            break;
+
+        case 0x2:
+            instruction =
+                (r & 3) == 0 ? 0x2000 | target : 0x7000 | (r & 0x0fff);
+            break;
+
+        case 0x1:
+        case 0xb:
+            instruction = (r & 0xf000) | target;
+            break;
+
+        case 0x5:
+        case 0x9:
+            instruction = r & 0xfff0;
+            break;
+
+        case 0x8: {
+            static const uint8_t n[] = {0x0, 0x1, 0x2, 0x3, 0x4,
+                                        0x5, 0x6, 0x7, 0xe};
+            instruction = (r & 0xfff0) | n[r % sizeof(n)];
+            break;
+        }
+
+        case 0xa:
+            instruction = (r & 7) == 0 ? 0xa000 | target
+                                       : 0xa000 | (0x400 + (r & 0x7ff));
+            break;
+
+        case 0xe:
+            instruction = (r & 0x0f00) | ((r & 1) ? 0xe09e : 0xe0a1);
+            break;
+
+        case 0xf: {
+            static const uint8_t kk[] = {0x07, 0x0a, 0x15, 0x18, 0x1e,
+                                         0x29, 0x33, 0x55, 0x65};
+            instruction = (r & 0x0f00) | 0xf000 | kk[r % sizeof(kk)];
+            break;
+        }
+
+        default:
+            break;
+        }
+
+        program[2 * k] = instruction >> 8;
+        program[2 * k + 1] = instruction & 0xff;
+    }
+
+    /* Start over rather than run off the end, even after a skip */
+    for (int k = C8_ENGINE_TEST_LENGTH - 2; k < C8_ENGINE_TEST_LENGTH; k++) {
+        program[2 * k] = 0x12;
+        program[2 * k + 1] = 0x00;
+    }
+}
+
+static C8Cpu *c8_engine_test_cpu(const uint8_t *program, uint64_t seed,
+                                 C8CpuEngine engine)
+{
+    C8Memory *memory = c8_memory_new(program, 2 * C8_ENGINE_TEST_LENGTH);
+    C8Keyboard *keyboard = c8_keyboard_new();
+
+    if (memory == NULL || keyboard == NULL) {
+        c8_memory_free(memory);
+        free(keyboard);
+        return NULL;
+    }
+
+    C8Cpu *cpu = c8_cpu_new(memory, keyboard);
+    if (cpu == NULL) {
+        c8_memory_free(memory);
+        free(keyboard);
+        return NULL;
+    }
+
+    c8_cpu_seed(cpu, seed);
+    if (c8_cpu_set_engine(cpu, engine) < 0) {
+        return c8_cpu_free(cpu);
+    }
+
+    return cpu;
+}
+
+static bool c8_engine_test_same(C8Cpu *a, C8Cpu *b)
+{
+    static uint8_t x[8192];
+    static uint8_t y[8192];
+
+    long size = c8_state_save(a, x, sizeof(x));
+    return size > 0 && c8_state_save(b, y, sizeof(y)) == size &&
+           memcmp(x, y, size) == 0;
+}
+
+/*
+ * Runs one program on the switch engine and `engine` side by side, with
+ * the same keys changing between frames. Returns the instructions run, 0
+ * when the host doesn't have the engine, or -1 when they came apart.
+ */
+static long c8_engine_test_run(const uint8_t *program, uint64_t seed,
+                               C8CpuEngine engine)
+{
+    C8Cpu *reference = c8_engine_test_cpu(program, seed, C8_CPU_ENGINE_SWITCH);
+    C8Cpu *cpu = c8_engine_test_cpu(program, seed, engine);
+    uint64_t keys = seed;
+    long executed = 0;
+
+    if (reference == NULL || cpu == NULL) {
+        c8_cpu_free(reference);
+        c8_cpu_free(cpu);
+        return 0;
+    }
+
+    for (uint32_t frame = 0; frame < C8_ENGINE_TEST_FRAMES; frame++) {
+        C8Key key = c8_engine_test_next(&keys) % C8_KEY_NUM;
+
+        if (keys & 0x100) {
+            c8_keyboard_press_key(c8_cpu_keyboard(reference), key);
+            c8_keyboard_press_key(c8_cpu_keyboard(cpu), key);
+        } else {
+            c8_keyboard_release_key(c8_cpu_keyboard(reference), key);
+            c8_keyboard_release_key(c8_cpu_keyboard(cpu), key);
+        }
+
+        C8CpuStop stop = c8_cpu_run_frame(reference, C8_CPU_FRAME_CYCLES);
+        if (c8_cpu_run_frame(cpu, C8_CPU_FRAME_CYCLES) != stop ||
+            !c8_engine_test_same(reference, cpu)) {
+            fprintf(stderr, "seed %llu: engine %d differs after frame %u\n",
+                    (unsigned long long)seed, engine, frame);
+            executed = -1;
+            break;
+        }
+        executed = c8_cpu_cycles(reference);
+
+        /* Nothing left to compare once the program has gone wrong */
+        if (stop == C8_CPU_STOP_FAULT) {
+            break;
+        }
+    }
+
+    c8_cpu_free(reference);
+    c8_cpu_free(cpu);
+    return executed;
+}
+
+int main(void)
+{
+    static const C8CpuEngine engines[] = {
+        C8_CPU_ENGINE_THREADED,
+        C8_CPU_ENGINE_JIT,
+    };
+    uint8_t program[2 * C8_ENGINE_TEST_LENGTH];
+    int failures = 0;
+
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+        long total = 0;
+
+        for (uint64_t seed = 1; seed <= C8_ENGINE_TEST_PROGRAMS; seed++) {
+            uint64_t rng = seed * 0x9e3779b97f4a7c15;
+            c8_engine_test_program(&rng, program);
+
+            long executed = c8_engine_test_run(program, seed, engines[e]);
+            if (executed < 0) {
+                failures++;
+            } else {
+                total += executed;
+            }
+        }
+
+        printf("engine %d: %ld instructions compared\n", engines[e], total);
+    }
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
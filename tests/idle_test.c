@@ -0,0 +1,373 @@
+/*
+ * Checks that c8_cpu_skip_idle is exact: one CPU runs every frame with
+ * c8_cpu_run_frame, another skips whatever it can, and their saved states
+ * must match whenever both have run the same frames. The polling ROMs below
+ * and a corpus of random programs each run on every engine with several
+ * input schedules.
+ */
+#include "c8/cpu.h"
+#include "c8/keyboard.h"
+#include "c8/memory.h"
+#include "c8/state.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define C8_IDLE_TEST_FRAMES 600
+/* Frames between forced comparisons, so a skip can't run to the end */
+#define C8_IDLE_TEST_CHECKPOINT 37
+
+#define C8_IDLE_TEST_PROGRAMS 3000
+#define C8_IDLE_TEST_PROGRAM_FRAMES 240
+/* Instructions per random program, all jump targets stay inside them */
+#define C8_IDLE_TEST_LENGTH 16
+
+typedef struct c8_idle_test_rom {
+    const char *name;
+    const uint8_t *program;
+    uint16_t size;
+} C8IdleTestRom;
+
+/* LD VA, 60; LD DT, VA; loop: LD V0, DT; SE V0, 0; JP loop; ADD V1, 1 */
+static const uint8_t c8_dt_poll[] = {
+    0x6a, 0x3c, 0xfa, 0x15, 0xf0, 0x07, 0x30, 0x00,
+    0x12, 0x04, 0x71, 0x01, 0x12, 0x00,
+};
+
+/* Waits for DT to pass 5 while copying it around, then reloads DT */
+static const uint8_t c8_dt_poll_offset[] = {
+    0x6a, 0xc8, 0xfa, 0x15, 0xf0, 0x07, 0x82, 0x00, 0xa3, 0x00,
+    0x63, 0x07, 0x32, 0x05, 0x12, 0x04, 0x71, 0x01, 0x6a, 0x0a,
+    0xfa, 0x15, 0xf5, 0x07, 0x45, 0x00, 0x12, 0x16, 0x12, 0x00,
+};
+
+/* LD V1, 5; wait: SKP V1; JP wait; ADD V2, 1; hold: SKNP V1; JP hold */
+static const uint8_t c8_key_poll[] = {
+    0x61, 0x05, 0xe1, 0x9e, 0x12, 0x02, 0x72, 0x01,
+    0xe1, 0xa1, 0x12, 0x08, 0x12, 0x00,
+};
+
+/* Polls DT down to 0, then jumps to itself */
+static const uint8_t c8_dt_halt[] = {
+    0x6a, 0x1e, 0xfa, 0x15, 0xf0, 0x07, 0x30, 0x00,
+    0x12, 0x04, 0x12, 0x0a,
+};
+
+static const C8IdleTestRom c8_idle_test_roms[] = {
+    {"dt poll", c8_dt_poll, sizeof(c8_dt_poll)},
+    {"dt poll offset", c8_dt_poll_offset, sizeof(c8_dt_poll_offset)},
+    {"key poll", c8_key_poll, sizeof(c8_key_poll)},
+    {"dt halt", c8_dt_halt, sizeof(c8_dt_halt)},
+};
+
+static uint64_t c8_idle_test_next(uint64_t *rng)
+{
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    return *rng;
+}
+
+/*
+ * A short program that starts DT and then mostly loads, compares, polls
+ * and jumps, the instructions c8_cpu_skip_idle simulates, with some it
+ * must give up on mixed in. Small constants make comparisons against DT
+ * come true while it runs down.
+ */
+static void c8_idle_test_program(uint64_t *rng, uint8_t *program)
+{
+    uint64_t r = c8_idle_test_next(rng);
+    uint16_t x = (r >> 8) & 0xf;
+
+    /* LD Vx, kk; LD DT, Vx */
+    program[0] = 0x60 | x;
+    program[1] = r & 0xff;
+    program[2] = 0xf0 | x;
+    program[3] = 0x15;
+
+    for (int k = 2; k < C8_IDLE_TEST_LENGTH - 2; k++) {
+        r = c8_idle_test_next(rng);
+        x = (r >> 8) & 0xf;
+
+        uint16_t y = (r >> 12) & 0xf;
+        uint16_t kk = (r >> 16) & 0x0f;
+        uint16_t target =
+            0x200 + 2 * ((r >> 24) % C8_IDLE_TEST_LENGTH);
+        uint16_t instruction;
+
+        switch (r % 16) {
+        case 0:
+            instruction = 0x6000 | x << 8 | kk;
+            break;
+        case 1:
+            instruction = 0x7000 | x << 8 | kk;
+            break;
+        case 2:
+        case 3:
+            instruction = 0xf007 | x << 8;
+            break;
+        case 4:
+            instruction = 0x3000 | x << 8 | kk;
+            break;
+        case 5:
+            instruction = 0x4000 | x << 8 | kk;
+            break;
+        case 6:
+            instruction = 0x5000 | x << 8 | y << 4;
+            break;
+        case 7:
+        case 8:
+            instruction = 0x1000 | target;
+            break;
+        case 9:
+            instruction = (r & 0x10000000 ? 0xe09e : 0xe0a1) | x << 8;
+            break;
+        case 10:
+            instruction = 0xa300 | ((r >> 16) & 0xff);
+            break;
+        case 11:
+            instruction = 0x8000 | x << 8 | y << 4;
+            break;
+        case 12:
+            instruction = 0x8000 | x << 8 | y << 4 | ((r >> 20) % 8);
+            break;
+        case 13:
+            instruction = 0xf015 | x << 8;
+            break;
+        case 14: {
+            /* DRW, LD B, LD [I], LD ST and RND end a simulation */
+            const uint16_t others[] = {
+                0xd005 | x << 8 | y << 4, 0xf033 | x << 8, 0xf055 | x << 8,
+                0xf018 | x << 8,          0xc00f | x << 8,
+            };
+            instruction = others[(r >> 20) % 5];
+            break;
+        }
+        default:
+            instruction = 0xf00a | x << 8;
+            break;
+        }
+
+        program[2 * k] = instruction >> 8;
+        program[2 * k + 1] = instruction & 0xff;
+    }
+
+    /* Start over rather than run off the end, even after a skip */
+    for (int k = C8_IDLE_TEST_LENGTH - 2; k < C8_IDLE_TEST_LENGTH; k++) {
+        program[2 * k] = 0x12;
+        program[2 * k + 1] = 0x00;
+    }
+}
+
+static C8Cpu *c8_idle_test_cpu(const C8IdleTestRom *rom, C8CpuEngine engine)
+{
+    C8Memory *memory = c8_memory_new(rom->program, rom->size);
+    C8Keyboard *keyboard = c8_keyboard_new();
+
+    if (memory == NULL || keyboard == NULL) {
+        c8_memory_free(memory);
+        free(keyboard);
+        return NULL;
+    }
+
+    C8Cpu *cpu = c8_cpu_new(memory, keyboard);
+    if (cpu == NULL) {
+        c8_memory_free(memory);
+        free(keyboard);
+        return NULL;
+    }
+
+    if (c8_cpu_set_engine(cpu, engine) < 0) {
+        return c8_cpu_free(cpu);
+    }
+
+    return cpu;
+}
+
+/* Toggles key 5 every `period` frames, nothing when it is 0 */
+static bool c8_idle_test_input(uint32_t period, uint32_t frame)
+{
+    return period > 0 && frame % period == 0;
+}
+
+static void c8_idle_test_feed(C8Cpu *cpu, uint32_t period, uint32_t frame)
+{
+    if (!c8_idle_test_input(period, frame)) {
+        return;
+    }
+
+    if ((frame / period) % 2 == 0) {
+        c8_keyboard_press_key(c8_cpu_keyboard(cpu), C8_KEY_5);
+    } else {
+        c8_keyboard_release_key(c8_cpu_keyboard(cpu), C8_KEY_5);
+    }
+}
+
+static bool c8_idle_test_same(C8Cpu *plain, C8Cpu *skipping)
+{
+    static uint8_t a[8192];
+    static uint8_t b[8192];
+
+    long size = c8_state_save(plain, a, sizeof(a));
+    return size > 0 && c8_state_save(skipping, b, sizeof(b)) == size &&
+           memcmp(a, b, size) == 0;
+}
+
+/* Returns the frames skipped, or -1 when the two CPUs came apart */
+static long c8_idle_test_run(const C8IdleTestRom *rom, C8CpuEngine engine,
+                             uint32_t period, uint32_t frames)
+{
+    C8Cpu *plain = c8_idle_test_cpu(rom, engine);
+    C8Cpu *skipping = c8_idle_test_cpu(rom, engine);
+    long skipped = 0;
+
+    if (plain == NULL || skipping == NULL) {
+        c8_cpu_free(plain);
+        c8_cpu_free(skipping);
+        /* An engine this host doesn't have */
+        return 0;
+    }
+
+    uint32_t frame = 0;
+    while (frame < frames) {
+        /* Both run the frame with input in it for real */
+        c8_idle_test_feed(plain, period, frame);
+        c8_idle_test_feed(skipping, period, frame);
+
+        C8CpuStop stop = c8_cpu_run_frame(plain, C8_CPU_FRAME_CYCLES);
+        if (c8_cpu_run_frame(skipping, C8_CPU_FRAME_CYCLES) != stop) {
+            fprintf(stderr, "frame %u stopped differently\n", frame);
+            skipped = -1;
+            break;
+        }
+        frame++;
+
+        /* Up to the next frame with input, checkpoint or the end */
+        uint32_t bound = 0;
+        for (uint32_t at = frame; at < frames; at++, bound++) {
+            if (c8_idle_test_input(period, at) ||
+                (at > frame && at % C8_IDLE_TEST_CHECKPOINT == 0)) {
+                break;
+            }
+        }
+
+        uint32_t n = c8_cpu_skip_idle(skipping, C8_CPU_FRAME_CYCLES, bound);
+        if (n > bound) {
+            fprintf(stderr, "skipped %u frames of %u at frame %u\n", n,
+                    bound, frame);
+            skipped = -1;
+            break;
+        }
+
+        for (uint32_t k = 0; k < n; k++) {
+            c8_cpu_run_frame(plain, C8_CPU_FRAME_CYCLES);
+        }
+        frame += n;
+        skipped += n;
+
+        if (!c8_idle_test_same(plain, skipping)) {
+            fprintf(stderr, "states differ after frame %u\n", frame);
+            skipped = -1;
+            break;
+        }
+    }
+
+    c8_cpu_free(plain);
+    c8_cpu_free(skipping);
+    return skipped;
+}
+
+static const C8CpuEngine c8_idle_test_engines[] = {
+    C8_CPU_ENGINE_SWITCH,
+    C8_CPU_ENGINE_THREADED,
+    C8_CPU_ENGINE_JIT,
+};
+#define C8_IDLE_TEST_ENGINES \
+    (sizeof(c8_idle_test_engines) / sizeof(c8_idle_test_engines[0]))
+
+static const uint32_t c8_idle_test_periods[] = {0, 7, 13, 40};
+#define C8_IDLE_TEST_PERIODS \
+    (sizeof(c8_idle_test_periods) / sizeof(c8_idle_test_periods[0]))
+
+/*
+ * Runs `rom` in every configuration, adding the frames skipped to `total`.
+ * Returns the configurations that failed.
+ */
+static int c8_idle_test_configurations(const C8IdleTestRom *rom,
+                                       uint32_t frames, long *total)
+{
+    int failures = 0;
+
+    for (size_t e = 0; e < C8_IDLE_TEST_ENGINES; e++) {
+        for (size_t p = 0; p < C8_IDLE_TEST_PERIODS; p++) {
+            C8CpuEngine engine = c8_idle_test_engines[e];
+            uint32_t period = c8_idle_test_periods[p];
+            long skipped = c8_idle_test_run(rom, engine, period, frames);
+
+            if (skipped < 0) {
+                fprintf(stderr, "%s: engine %d, input every %u: FAIL\n",
+                        rom->name, engine, period);
+                failures++;
+            } else {
+                *total += skipped;
+            }
+        }
+    }
+
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+
+    for (size_t r = 0; r < sizeof(c8_idle_test_roms) /
+                               sizeof(c8_idle_test_roms[0]);
+         r++) {
+        const C8IdleTestRom *rom = &c8_idle_test_roms[r];
+        long total = 0;
+
+        failures +=
+            c8_idle_test_configurations(rom, C8_IDLE_TEST_FRAMES, &total);
+
+        /* Each of them waits long enough to skip something */
+        if (total == 0) {
+            fprintf(stderr, "%s: nothing was skipped\n", rom->name);
+            failures++;
+        }
+        printf("%s: %ld frames skipped\n", rom->name, total);
+    }
+
+    uint8_t program[2 * C8_IDLE_TEST_LENGTH];
+    long total = 0;
+    int skipping = 0;
+
+    for (uint64_t seed = 1; seed <= C8_IDLE_TEST_PROGRAMS; seed++) {
+        uint64_t rng = seed * 0x9e3779b97f4a7c15;
+        char name[32];
+        long skipped = 0;
+
+        c8_idle_test_program(&rng, program);
+        snprintf(name, sizeof(name), "program %llu",
+                 (unsigned long long)seed);
+
+        C8IdleTestRom rom = {name, program, sizeof(program)};
+        failures += c8_idle_test_configurations(
+            &rom, C8_IDLE_TEST_PROGRAM_FRAMES, &skipped);
+        skipping += skipped > 0;
+        total += skipped;
+    }
+
+    /* A corpus where nothing waits would prove nothing */
+    if (skipping == 0) {
+        fprintf(stderr, "random programs: nothing was skipped\n");
+        failures++;
+    }
+    printf("%d random programs: %ld frames skipped in %d of them\n",
+           C8_IDLE_TEST_PROGRAMS, total, skipping);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,188 @@
+/*
+ * Attaches every combination of debugger, profile, trace and coverage map
+ * to a CPU and checks that each of them sees every instruction, and that
+ * watching doesn't change what the program does.
+ */
+#include "c8/coverage.h"
+#include "c8/cpu.h"
+#include "c8/debugger.h"
+#include "c8/keyboard.h"
+#include "c8/memory.h"
+#include "c8/profile.h"
+#include "c8/state.h"
+#include "c8/trace.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Few enough that no coverage counter wraps */
+#define C8_OBSERVER_TEST_INSTRUCTIONS 200
+#define C8_OBSERVER_TEST_CYCLES 25
+
+#define C8_OBSERVER_PROFILE 1
+#define C8_OBSERVER_TRACE 2
+#define C8_OBSERVER_COVERAGE 4
+#define C8_OBSERVER_DEBUGGER 8
+
+/* LD VA, 60; loop: ADD V1, 1; LD I, 0x300; LD B, V1; JP loop */
+static const uint8_t c8_observer_test_program[] = {
+    0x6a, 0x3c, 0x71, 0x01, 0xa3, 0x00, 0xf1, 0x33, 0x12, 0x02,
+};
+/* The debugger breaks on JP loop, every fourth instruction after LD VA */
+#define C8_OBSERVER_TEST_BREAKPOINT 0x208
+#define C8_OBSERVER_TEST_BREAKS ((C8_OBSERVER_TEST_INSTRUCTIONS - 1) / 4)
+
+static C8Cpu *c8_observer_test_cpu(void)
+{
+    C8Memory *memory = c8_memory_new(c8_observer_test_program,
+                                     sizeof(c8_observer_test_program));
+    C8Keyboard *keyboard = c8_keyboard_new();
+
+    if (memory == NULL || keyboard == NULL) {
+        c8_memory_free(memory);
+        free(keyboard);
+        return NULL;
+    }
+
+    C8Cpu *cpu = c8_cpu_new(memory, keyboard);
+    if (cpu == NULL) {
+        c8_memory_free(memory);
+        free(keyboard);
+    }
+
+    return cpu;
+}
+
+/* Runs in slices, continuing past breakpoints. Returns the breaks. */
+static uint32_t c8_observer_test_run(C8Cpu *cpu, C8Debugger *debugger)
+{
+    uint32_t breaks = 0;
+
+    while (c8_cpu_cycles(cpu) < C8_OBSERVER_TEST_INSTRUCTIONS) {
+        uint64_t left = C8_OBSERVER_TEST_INSTRUCTIONS - c8_cpu_cycles(cpu);
+        uint32_t slice =
+            left < C8_OBSERVER_TEST_CYCLES ? left : C8_OBSERVER_TEST_CYCLES;
+
+        if (c8_cpu_run(cpu, slice) == C8_CPU_STOP_BREAK) {
+            breaks++;
+            c8_debugger_continue(debugger);
+        }
+    }
+
+    return breaks;
+}
+
+static bool c8_observer_test_same(C8Cpu *a, C8Cpu *b)
+{
+    static uint8_t x[8192];
+    static uint8_t y[8192];
+
+    long size = c8_state_save(a, x, sizeof(x));
+    return size > 0 && c8_state_save(b, y, sizeof(y)) == size &&
+           memcmp(x, y, size) == 0;
+}
+
+/* Returns how many of the attached observers missed instructions */
+static int c8_observer_test(C8Cpu *reference, unsigned observers)
+{
+    static uint8_t map[C8_COVERAGE_SIZE];
+    C8Cpu *cpu = c8_observer_test_cpu();
+    C8Profile *profile = c8_profile_new();
+    C8Trace *trace = c8_trace_new(1024);
+    C8Debugger *debugger = c8_debugger_new();
+    int failures = 0;
+
+    if (cpu == NULL || profile == NULL || trace == NULL || debugger == NULL) {
+        c8_cpu_free(cpu);
+        c8_profile_free(profile);
+        c8_trace_free(trace);
+        c8_debugger_free(debugger);
+        return 1;
+    }
+
+    memset(map, 0, sizeof(map));
+    if (observers & C8_OBSERVER_PROFILE) {
+        c8_cpu_set_profile(cpu, profile);
+    }
+    if (observers & C8_OBSERVER_TRACE) {
+        c8_cpu_set_trace(cpu, trace);
+    }
+    if (observers & C8_OBSERVER_COVERAGE) {
+        c8_cpu_set_coverage(cpu, map);
+    }
+    if (observers & C8_OBSERVER_DEBUGGER) {
+        c8_debugger_set_breakpoint(debugger, C8_OBSERVER_TEST_BREAKPOINT,
+                                   true);
+        c8_cpu_set_debugger(cpu, debugger);
+    }
+
+    uint32_t breaks = c8_observer_test_run(cpu, debugger);
+
+    uint64_t cycles = c8_cpu_cycles(cpu);
+    uint64_t edges = 0;
+    for (size_t k = 0; k < sizeof(map); k++) {
+        edges += map[k];
+    }
+
+    if (cycles != c8_cpu_cycles(reference) ||
+        !c8_observer_test_same(reference, cpu)) {
+        fprintf(stderr, "observers %u: the program ran differently\n",
+                observers);
+        failures++;
+    }
+    if ((observers & C8_OBSERVER_PROFILE) &&
+        c8_profile_instructions(profile) != cycles) {
+        fprintf(stderr, "observers %u: profile counted %llu of %llu\n",
+                observers,
+                (unsigned long long)c8_profile_instructions(profile),
+                (unsigned long long)cycles);
+        failures++;
+    }
+    if ((observers & C8_OBSERVER_TRACE) && c8_trace_records(trace) != cycles) {
+        fprintf(stderr, "observers %u: trace recorded %llu of %llu\n",
+                observers, (unsigned long long)c8_trace_records(trace),
+                (unsigned long long)cycles);
+        failures++;
+    }
+    if ((observers & C8_OBSERVER_COVERAGE) && edges != cycles) {
+        fprintf(stderr, "observers %u: coverage counted %llu of %llu\n",
+                observers, (unsigned long long)edges,
+                (unsigned long long)cycles);
+        failures++;
+    }
+    if ((observers & C8_OBSERVER_DEBUGGER) &&
+        breaks != C8_OBSERVER_TEST_BREAKS) {
+        fprintf(stderr, "observers %u: debugger broke %u times of %d\n",
+                observers, breaks, C8_OBSERVER_TEST_BREAKS);
+        failures++;
+    }
+
+    c8_cpu_free(cpu);
+    c8_profile_free(profile);
+    c8_trace_free(trace);
+    c8_debugger_free(debugger);
+    return failures;
+}
+
+int main(void)
+{
+    C8Cpu *reference = c8_observer_test_cpu();
+    int failures = 0;
+
+    if (reference == NULL) {
+        return EXIT_FAILURE;
+    }
+    c8_observer_test_run(reference, NULL);
+
+    for (unsigned observers = 1; observers < 16; observers++) {
+        failures += c8_observer_test(reference, observers);
+    }
+
+    c8_cpu_free(reference);
+    printf("%d instructions, %d observers missed some\n",
+           C8_OBSERVER_TEST_INSTRUCTIONS, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}